@@ -5,6 +5,7 @@
 #include "bench.h"
 
 #include "crypto/sha256.h"
+#include "hash.h"
 #include "key.h"
 #include "random.h"
 #include "util.h"
@@ -12,6 +13,7 @@
 
 int main(int argc, char **argv) {
     SHA256AutoDetect();
+    SipHashAutoDetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
@@ -64,6 +64,21 @@ static void SipHash_32b(benchmark::State &state) {
     }
 }
 
+static void SipHash_32b_Batch(benchmark::State &state) {
+    std::vector<uint256> vals(1000);
+    std::vector<const uint256 *> ptrs;
+    for (uint256 &val : vals) {
+        val = GetRandHash();
+        ptrs.push_back(&val);
+    }
+    std::vector<uint64_t> out(vals.size());
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            SipHashUint256Batch(0, i, ptrs.data(), ptrs.size(), out.data());
+        }
+    }
+}
+
 static void FastRandom_32bit(benchmark::State &state) {
     FastRandomContext rng(true);
     uint32_t x;
@@ -91,5 +106,6 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+BENCHMARK(SipHash_32b_Batch);
 BENCHMARK(FastRandom_32bit);
 BENCHMARK(FastRandom_1bit);
@@ -0,0 +1,64 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+
+#include <cassert>
+#include <vector>
+
+/**
+ * Verify signatures of a few keys, as when the same keys spend many outputs
+ * in a block, with up to nCacheEntries parsed keys cached.
+ */
+static void VerifyRepeatedKeys(benchmark::State &state, bool fCompressed,
+                               size_t nCacheEntries) {
+    ECCVerifyHandle verifyHandle;
+    InitPubKeyCache(nCacheEntries, GetRandHash());
+
+    uint256 hash = GetRandHash();
+    std::vector<CPubKey> pubkeys;
+    std::vector<std::vector<uint8_t>> sigs;
+    for (int i = 0; i < 4; i++) {
+        CKey key;
+        key.MakeNewKey(fCompressed);
+        std::vector<uint8_t> vchSig;
+        bool fSigned = key.Sign(hash, vchSig);
+        assert(fSigned);
+        pubkeys.push_back(key.GetPubKey());
+        sigs.push_back(vchSig);
+    }
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        bool fValid = pubkeys[i].Verify(hash, sigs[i]);
+        assert(fValid);
+        i = (i + 1) % pubkeys.size();
+    }
+
+    InitPubKeyCache(DEFAULT_PUBKEY_CACHE_ENTRIES, GetRandHash());
+}
+
+static void VerifyCompressedUncached(benchmark::State &state) {
+    VerifyRepeatedKeys(state, true, 0);
+}
+
+static void VerifyCompressedCached(benchmark::State &state) {
+    VerifyRepeatedKeys(state, true, DEFAULT_PUBKEY_CACHE_ENTRIES);
+}
+
+static void VerifyUncompressedUncached(benchmark::State &state) {
+    VerifyRepeatedKeys(state, false, 0);
+}
+
+static void VerifyUncompressedCached(benchmark::State &state) {
+    VerifyRepeatedKeys(state, false, DEFAULT_PUBKEY_CACHE_ENTRIES);
+}
+
+BENCHMARK(VerifyCompressedUncached);
+BENCHMARK(VerifyCompressedCached);
+BENCHMARK(VerifyUncompressedUncached);
+BENCHMARK(VerifyUncompressedCached);
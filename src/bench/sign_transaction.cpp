@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "keystore.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "util.h"
+
+#include <cassert>
+#include <vector>
+
+static const size_t SIGN_INPUTS = 200;
+
+/** A transaction spending SIGN_INPUTS P2PKH outputs of keys in keystore. */
+static CMutableTransaction
+MakeUnsignedTransaction(CBasicKeyStore &keystore, std::vector<CTxOut> &vSpent) {
+    CMutableTransaction mtx;
+    for (size_t i = 0; i < SIGN_INPUTS; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        vSpent.push_back(CTxOut(
+            Amount(1000), GetScriptForDestination(key.GetPubKey().GetID())));
+        mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    }
+    mtx.vout.push_back(CTxOut(Amount(1000), CScript() << OP_TRUE));
+    return mtx;
+}
+
+/** Sign one input at a time, as signrawtransaction used to. */
+static void SignTransactionSequential(benchmark::State &state) {
+    ECCVerifyHandle verifyHandle;
+    CBasicKeyStore keystore;
+    std::vector<CTxOut> vSpent;
+    const CMutableTransaction mtx = MakeUnsignedTransaction(keystore, vSpent);
+    SigHashType sigHashType = SigHashType().withForkId(true);
+
+    while (state.KeepRunning()) {
+        CMutableTransaction txSigned(mtx);
+        for (size_t i = 0; i < txSigned.vin.size(); i++) {
+            SignatureData sigdata;
+            bool fSolved = ProduceSignature(
+                MutableTransactionSignatureCreator(&keystore, &txSigned, i,
+                                                   vSpent[i].nValue,
+                                                   sigHashType),
+                vSpent[i].scriptPubKey, sigdata);
+            assert(fSolved);
+            UpdateTransaction(txSigned, i, sigdata);
+        }
+    }
+}
+
+static void RunProduceSignatures(benchmark::State &state,
+                                 unsigned int nThreads) {
+    ECCVerifyHandle verifyHandle;
+    CBasicKeyStore keystore;
+    std::vector<CTxOut> vSpent;
+    const CTransaction tx(MakeUnsignedTransaction(keystore, vSpent));
+    SigHashType sigHashType = SigHashType().withForkId(true);
+    std::vector<unsigned int> vInputs;
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        vInputs.push_back(i);
+    }
+
+    while (state.KeepRunning()) {
+        std::vector<SignatureData> vSigData;
+        bool fSolved = ProduceSignatures(keystore, tx, vInputs, vSpent,
+                                         sigHashType, nThreads, vSigData);
+        assert(fSolved);
+    }
+}
+
+static void SignTransactionShared(benchmark::State &state) {
+    RunProduceSignatures(state, 1);
+}
+
+static void SignTransactionThreaded(benchmark::State &state) {
+    RunProduceSignatures(state, GetNumCores());
+}
+
+BENCHMARK(SignTransactionSequential);
+BENCHMARK(SignTransactionShared);
+BENCHMARK(SignTransactionThreaded);
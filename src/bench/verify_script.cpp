@@ -0,0 +1,96 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "key.h"
+#include "policy/policy.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+
+#include <cassert>
+#include <vector>
+
+/** Sign the only input of txSpend with each of keys. */
+static std::vector<std::vector<uint8_t>>
+SignInput(const CMutableTransaction &txSpend, const CScript &scriptCode,
+          const Amount amount, const std::vector<CKey> &keys) {
+    SigHashType sigHashType = SigHashType().withForkId(true);
+    uint256 hash = SignatureHash(scriptCode, CTransaction(txSpend), 0,
+                                 sigHashType, amount);
+    std::vector<std::vector<uint8_t>> vchSigs;
+    for (const CKey &key : keys) {
+        std::vector<uint8_t> vchSig;
+        bool fSigned = key.Sign(hash, vchSig);
+        assert(fSigned);
+        vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+        vchSigs.push_back(vchSig);
+    }
+    return vchSigs;
+}
+
+static CMutableTransaction SpendingTransaction() {
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = Amount(1000);
+    return txSpend;
+}
+
+static void RunVerifyScript(benchmark::State &state,
+                            const CMutableTransaction &txSpend,
+                            const CScript &scriptPubKey, const Amount amount) {
+    ECCVerifyHandle verifyHandle;
+    CTransaction tx(txSpend);
+    PrecomputedTransactionData txdata(tx);
+    TransactionSignatureChecker checker(&tx, 0, amount, txdata);
+    while (state.KeepRunning()) {
+        ScriptError err;
+        bool fSuccess =
+            VerifyScript(tx.vin[0].scriptSig, scriptPubKey,
+                         STANDARD_SCRIPT_VERIFY_FLAGS, checker, &err);
+        assert(fSuccess && err == SCRIPT_ERR_OK);
+    }
+}
+
+static void VerifyScriptP2PKH(benchmark::State &state) {
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CScript scriptPubKey = GetScriptForDestination(pubkey.GetID());
+    Amount amount(1000);
+
+    CMutableTransaction txSpend = SpendingTransaction();
+    std::vector<std::vector<uint8_t>> vchSigs =
+        SignInput(txSpend, scriptPubKey, amount, {key});
+    txSpend.vin[0].scriptSig << vchSigs[0] << ToByteVector(pubkey);
+
+    RunVerifyScript(state, txSpend, scriptPubKey, amount);
+}
+
+static void VerifyScriptP2SHMultiSig(benchmark::State &state) {
+    std::vector<CKey> keys(3);
+    std::vector<CPubKey> pubkeys;
+    for (CKey &key : keys) {
+        key.MakeNewKey(true);
+        pubkeys.push_back(key.GetPubKey());
+    }
+    CScript redeemScript = GetScriptForMultisig(2, pubkeys);
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    Amount amount(1000);
+
+    CMutableTransaction txSpend = SpendingTransaction();
+    std::vector<std::vector<uint8_t>> vchSigs =
+        SignInput(txSpend, redeemScript, amount, {keys[0], keys[2]});
+    txSpend.vin[0].scriptSig << OP_0 << vchSigs[0] << vchSigs[1]
+                             << ToByteVector(redeemScript);
+
+    RunVerifyScript(state, txSpend, scriptPubKey, amount);
+}
+
+BENCHMARK(VerifyScriptP2PKH);
+BENCHMARK(VerifyScriptP2SHMultiSig);
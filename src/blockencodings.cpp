@@ -14,8 +14,12 @@
 #include "util.h"
 #include "validation.h"
 
+#include <algorithm>
 #include <unordered_map>
 
+/** Number of mempool short ids computed together in InitData */
+static const size_t SHORTTXIDS_BATCH_SIZE = 64;
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock &block)
     : nonce(GetRand(std::numeric_limits<uint64_t>::max())),
       shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -46,6 +50,17 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256 &txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDs(const uint256 *const *txhashes,
+                                            size_t count,
+                                            uint64_t *shortids) const {
+    static_assert(SHORTTXIDS_LENGTH == 6,
+                  "shorttxids calculation assumes 6-byte shorttxids");
+    SipHashUint256Batch(shorttxidk0, shorttxidk1, txhashes, count, shortids);
+    for (size_t i = 0; i < count; i++) {
+        shortids[i] &= 0xffffffffffffL;
+    }
+}
+
 ReadStatus PartiallyDownloadedBlock::InitData(
     const CBlockHeaderAndShortTxIDs &cmpctblock,
     const std::vector<std::pair<uint256, CTransactionRef>> &extra_txn) {
@@ -113,36 +128,66 @@ ReadStatus PartiallyDownloadedBlock::InitData(
         return READ_STATUS_FAILED;
     }
 
+    // Most mempool txn are not in the block. Rule them out with a bitmap over
+    // the low bits of the short ids before looking them up.
+    size_t nShortIDMask = 63;
+    while (nShortIDMask < 8 * shorttxids.size()) {
+        nShortIDMask = (nShortIDMask << 1) | 1;
+    }
+    std::vector<bool> vShortIDBits(nShortIDMask + 1);
+    for (uint64_t shortid : cmpctblock.shorttxids) {
+        vShortIDBits[shortid & nShortIDMask] = true;
+    }
+
     std::vector<bool> have_txn(txn_available.size());
     {
         LOCK(pool->cs);
         const std::vector<std::pair<uint256, CTxMemPool::txiter>> &vTxHashes =
             pool->vTxHashes;
-        for (size_t i = 0; i < vTxHashes.size(); i++) {
-            uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-            std::unordered_map<uint64_t, uint16_t>::iterator idit =
-                shorttxids.find(shortid);
-            if (idit != shorttxids.end()) {
-                if (!have_txn[idit->second]) {
-                    txn_available[idit->second] =
-                        vTxHashes[i].second->GetSharedTx();
-                    have_txn[idit->second] = true;
-                    mempool_count++;
-                } else {
-                    // If we find two mempool txn that match the short id, just
-                    // request it. This should be rare enough that the extra
-                    // bandwidth doesn't matter, but eating a round-trip due to
-                    // FillBlock failure would be annoying.
-                    if (txn_available[idit->second]) {
-                        txn_available[idit->second].reset();
-                        mempool_count--;
+        // The short ids are computed in batches, which is much faster than
+        // one at a time.
+        const uint256 *batch_hashes[SHORTTXIDS_BATCH_SIZE];
+        uint64_t batch_shortids[SHORTTXIDS_BATCH_SIZE];
+        for (size_t batch_start = 0; batch_start < vTxHashes.size() &&
+                                     mempool_count < shorttxids.size();
+             batch_start += SHORTTXIDS_BATCH_SIZE) {
+            size_t batch_size = std::min(SHORTTXIDS_BATCH_SIZE,
+                                         vTxHashes.size() - batch_start);
+            for (size_t j = 0; j < batch_size; j++) {
+                batch_hashes[j] = &vTxHashes[batch_start + j].first;
+            }
+            cmpctblock.GetShortIDs(batch_hashes, batch_size, batch_shortids);
+
+            for (size_t j = 0; j < batch_size; j++) {
+                uint64_t shortid = batch_shortids[j];
+                if (!vShortIDBits[shortid & nShortIDMask]) {
+                    continue;
+                }
+                std::unordered_map<uint64_t, uint16_t>::iterator idit =
+                    shorttxids.find(shortid);
+                if (idit != shorttxids.end()) {
+                    if (!have_txn[idit->second]) {
+                        txn_available[idit->second] =
+                            vTxHashes[batch_start + j].second->GetSharedTx();
+                        have_txn[idit->second] = true;
+                        mempool_count++;
+                    } else {
+                        // If we find two mempool txn that match the short id,
+                        // just request it. This should be rare enough that the
+                        // extra bandwidth doesn't matter, but eating a
+                        // round-trip due to FillBlock failure would be
+                        // annoying.
+                        if (txn_available[idit->second]) {
+                            txn_available[idit->second].reset();
+                            mempool_count--;
+                        }
                     }
                 }
+                // Though ideally we'd continue scanning for the
+                // two-txn-match-shortid case, the performance win of an early
+                // exit here is too good to pass up and worth the extra risk.
+                if (mempool_count == shorttxids.size()) break;
             }
-            // Though ideally we'd continue scanning for the
-            // two-txn-match-shortid case, the performance win of an early exit
-            // here is too good to pass up and worth the extra risk.
-            if (mempool_count == shorttxids.size()) break;
         }
     }
 
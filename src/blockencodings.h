@@ -162,6 +162,9 @@ public:
     CBlockHeaderAndShortTxIDs(const CBlock &block);
 
     uint64_t GetShortID(const uint256 &txhash) const;
+    /** GetShortID of count hashes at once, see SipHashUint256Batch. */
+    void GetShortIDs(const uint256 *const *txhashes, size_t count,
+                     uint64_t *shortids) const;
 
     size_t BlockTxCount() const {
         return shorttxids.size() + prefilledtxn.size();
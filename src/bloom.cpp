@@ -118,6 +118,15 @@ bool CBloomFilter::IsWithinSizeConstraints() const {
            nHashFuncs <= MAX_HASH_FUNCS;
 }
 
+double CBloomFilter::GetFalsePositiveRate(unsigned int nElements) const {
+    if (isFull || vData.empty()) {
+        return 1.0;
+    }
+    double nBits = vData.size() * 8;
+    return std::pow(1 - std::exp(-double(nHashFuncs) * nElements / nBits),
+                    nHashFuncs);
+}
+
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction &tx) {
     bool fFound = false;
     // Match if the filter contains the hash of tx for finding tx when they
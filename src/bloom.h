@@ -100,6 +100,11 @@ public:
     //! deserialized which was too big)
     bool IsWithinSizeConstraints() const;
 
+    //! Expected false positive rate once nElements have been inserted. It
+    //! can be higher than the rate asked for in the constructor, since the
+    //! size is capped at MAX_BLOOM_FILTER_SIZE.
+    double GetFalsePositiveRate(unsigned int nElements) const;
+
     //! Also adds any outputs which match the filter to the filter (to match
     //! their spending txes)
     bool IsRelevantAndUpdate(const CTransaction &tx);
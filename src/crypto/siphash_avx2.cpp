@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SipHash-2-4 of four 32-byte values at once, one per 64-bit lane of the AVX2
+// registers. This file is only compiled with AVX2 enabled, callers must check
+// for runtime support before using it.
+
+#include <stdint.h>
+
+#include <immintrin.h>
+
+namespace siphash_avx2 {
+namespace {
+    inline __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+    inline __m256i Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+    template <int b> inline __m256i Rotl(__m256i x) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, b),
+                               _mm256_srli_epi64(x, 64 - b));
+    }
+    /** Rotating by 32 bits only swaps the halves of each lane. */
+    inline __m256i Rotl32(__m256i x) {
+        return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+
+    inline void SipRound(__m256i &v0, __m256i &v1, __m256i &v2, __m256i &v3) {
+        v0 = Add(v0, v1);
+        v1 = Rotl<13>(v1);
+        v1 = Xor(v1, v0);
+        v0 = Rotl32(v0);
+        v2 = Add(v2, v3);
+        v3 = Rotl<16>(v3);
+        v3 = Xor(v3, v2);
+        v0 = Add(v0, v3);
+        v3 = Rotl<21>(v3);
+        v3 = Xor(v3, v0);
+        v2 = Add(v2, v1);
+        v1 = Rotl<17>(v1);
+        v1 = Xor(v1, v2);
+        v2 = Rotl32(v2);
+    }
+
+    inline void Compress(__m256i &v0, __m256i &v1, __m256i &v2, __m256i &v3,
+                         __m256i d) {
+        v3 = Xor(v3, d);
+        SipRound(v0, v1, v2, v3);
+        SipRound(v0, v1, v2, v3);
+        v0 = Xor(v0, d);
+    }
+} // namespace
+
+void SipHashUint256x4(uint64_t k0, uint64_t k1,
+                      const unsigned char *const *vals, uint64_t *out) {
+    // Transpose the values, so that register i holds their i-th words. x86 is
+    // little endian, so words can be loaded as is.
+    __m256i r0 = _mm256_loadu_si256((const __m256i *)vals[0]);
+    __m256i r1 = _mm256_loadu_si256((const __m256i *)vals[1]);
+    __m256i r2 = _mm256_loadu_si256((const __m256i *)vals[2]);
+    __m256i r3 = _mm256_loadu_si256((const __m256i *)vals[3]);
+    __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+
+    __m256i key0 = _mm256_set1_epi64x(k0);
+    __m256i key1 = _mm256_set1_epi64x(k1);
+    __m256i v0 = Xor(key0, _mm256_set1_epi64x(0x736f6d6570736575ULL));
+    __m256i v1 = Xor(key1, _mm256_set1_epi64x(0x646f72616e646f6dULL));
+    __m256i v2 = Xor(key0, _mm256_set1_epi64x(0x6c7967656e657261ULL));
+    __m256i v3 = Xor(key1, _mm256_set1_epi64x(0x7465646279746573ULL));
+
+    Compress(v0, v1, v2, v3, _mm256_permute2x128_si256(t0, t2, 0x20));
+    Compress(v0, v1, v2, v3, _mm256_permute2x128_si256(t1, t3, 0x20));
+    Compress(v0, v1, v2, v3, _mm256_permute2x128_si256(t0, t2, 0x31));
+    Compress(v0, v1, v2, v3, _mm256_permute2x128_si256(t1, t3, 0x31));
+    Compress(v0, v1, v2, v3, _mm256_set1_epi64x(uint64_t(4) << 59));
+
+    v2 = Xor(v2, _mm256_set1_epi64x(0xFF));
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    _mm256_storeu_si256((__m256i *)out, Xor(Xor(v0, v1), Xor(v2, v3)));
+}
+} // namespace siphash_avx2
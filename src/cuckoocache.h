@@ -111,6 +111,27 @@ public:
     }
 };
 
+/**
+ * cache_stats describes the occupancy of a cache and counts what happened to
+ * its elements, to help choose its size.
+ */
+struct cache_stats {
+    /** slots in the table */
+    uint32_t size;
+    /** slots holding an element that has not been erased */
+    uint32_t occupied;
+    /** occupied slots whose element was inserted in the current generation */
+    uint32_t recent;
+    /** calls to insert */
+    uint64_t inserts;
+    /** elements moved to another slot to make room for an insert */
+    uint64_t displacements;
+    /** elements dropped because insert ran out of depth */
+    uint64_t evictions;
+    /** generations started, by the epoch heuristic or new_generation */
+    uint64_t generations;
+};
+
 /**
  * cache implements a cache with properties similar to a cuckoo-set
  *
@@ -118,6 +139,8 @@ public:
  *
  *  Read Operations:
  *      - contains(*, false)
+ *      - get_entries()
+ *      - get_stats()
  *
  *  Read+Erase Operations:
  *      - contains(*, true)
@@ -130,6 +153,7 @@ public:
  *      - setup_bytes()
  *      - insert()
  *      - please_keep()
+ *      - new_generation()
  *
  *  Synchronization Free Operations:
  *      - invalid()
@@ -206,6 +230,12 @@ private:
      */
     uint8_t depth_limit;
 
+    /** counters reported by get_stats */
+    uint64_t insert_count;
+    uint64_t displacement_count;
+    uint64_t eviction_count;
+    uint64_t generation_count;
+
     /**
      * hash_function is a const instance of the hash function. It cannot be
      * static or initialized at call time as it may have internal state (such as
@@ -249,6 +279,20 @@ private:
      */
     inline void please_keep(uint32_t n) const { collection_flags.bit_unset(n); }
 
+    /**
+     * age_epochs starts a new epoch: elements of the old epoch are allow_erased
+     * and elements of the current epoch become the old epoch.
+     */
+    void age_epochs() {
+        for (uint32_t i = 0; i < size; ++i)
+            if (epoch_flags[i])
+                epoch_flags[i] = false;
+            else
+                allow_erase(i);
+        epoch_heuristic_counter = epoch_size;
+        ++generation_count;
+    }
+
     /**
      * epoch_check handles the changing of epochs for elements stored in the
      * cache. epoch_check should be run before every insert.
@@ -275,12 +319,7 @@ private:
         // false) and move all elements in the current epoch to the old epoch
         // but do not call allow_erase on their indices.
         if (epoch_unused_count >= epoch_size) {
-            for (uint32_t i = 0; i < size; ++i)
-                if (epoch_flags[i])
-                    epoch_flags[i] = false;
-                else
-                    allow_erase(i);
-            epoch_heuristic_counter = epoch_size;
+            age_epochs();
         } else {
             // reset the epoch_heuristic_counter to next do a scan when worst
             // case behavior (no intermittent erases) would exceed epoch size,
@@ -301,7 +340,8 @@ public:
     cache()
         : table(), size(), collection_flags(0), epoch_flags(),
           epoch_heuristic_counter(), epoch_size(), depth_limit(0),
-          hash_function() {}
+          insert_count(0), displacement_count(0), eviction_count(0),
+          generation_count(0), hash_function() {}
 
     /**
      * setup initializes the container to store no more than new_size elements.
@@ -366,6 +406,7 @@ public:
      * table, the entry attempted to be inserted is evicted.
      */
     inline void insert(Element e) {
+        ++insert_count;
         epoch_check();
         uint32_t last_loc = invalid();
         bool last_epoch = true;
@@ -407,6 +448,7 @@ public:
                            locs.begin())) &
                      7];
             std::swap(table[last_loc], e);
+            ++displacement_count;
             // Can't std::swap a std::vector<bool>::reference and a bool&.
             bool epoch = last_epoch;
             last_epoch = epoch_flags[last_loc];
@@ -415,8 +457,17 @@ public:
             // Recompute the locs -- unfortunately happens one too many times!
             locs = compute_hashes(e);
         }
+        ++eviction_count;
     }
 
+    /**
+     * new_generation ages the elements by one generation without waiting for
+     * the current epoch to fill up: elements inserted before the previous call
+     * are allow_erased, unless they were inserted again since. Calling it
+     * periodically bounds how long unused elements stay in the cache.
+     */
+    void new_generation() { age_epochs(); }
+
     /**
      * contains iterates through the hash locations for a given element  and
      * checks to see if it is present.
@@ -455,6 +506,39 @@ public:
         }
         return false;
     }
+
+    /**
+     * get_entries appends every element that has not been erased to entries,
+     * so that the cache can be saved. It has the same requirements as a Read.
+     *
+     * @param entries the vector to append the elements to
+     */
+    void get_entries(std::vector<Element> &entries) const {
+        for (uint32_t i = 0; i < size; ++i)
+            if (!collection_flags.bit_is_set(i)) entries.push_back(table[i]);
+    }
+
+    /**
+     * get_stats scans the table to count occupied slots, and returns them with
+     * the counters. It has the same requirements as a Read.
+     * @returns the statistics of the cache
+     */
+    cache_stats get_stats() const {
+        cache_stats stats;
+        stats.size = size;
+        stats.occupied = 0;
+        stats.recent = 0;
+        for (uint32_t i = 0; i < size; ++i) {
+            if (collection_flags.bit_is_set(i)) continue;
+            ++stats.occupied;
+            stats.recent += epoch_flags[i];
+        }
+        stats.inserts = insert_count;
+        stats.displacements = displacement_count;
+        stats.evictions = eviction_count;
+        stats.generations = generation_count;
+        return stats;
+    }
 };
 } // namespace CuckooCache
 
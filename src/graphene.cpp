@@ -0,0 +1,293 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "graphene.h"
+
+#include "config.h"
+#include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "hash.h"
+#include "net.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <unordered_map>
+
+/** Serialized size of an IBLT cell in bytes */
+static const double GRAPHENE_IBLT_CELL_SIZE = 16;
+/** Cells per entry of the IBLT, see CIblt::OptimalCellCount */
+static const double GRAPHENE_IBLT_OVERHEAD = 2;
+/** Highest false positive rate for which the Bloom filter is still built */
+static const double GRAPHENE_MAX_FPRATE = 0.999;
+
+CGrapheneBlock::CGrapheneBlock(const CBlock &block, uint64_t nReceiverPoolTxs)
+    : fIbltCapped(false), header(block), coinbase(block.vtx[0]) {
+    // The short txids must all be distinct for the receiver to order the
+    // block. Collisions are rare enough to just pick another nonce.
+    std::vector<uint64_t> vShortIDs(block.vtx.size() - 1);
+    for (;;) {
+        nonce = GetRand(std::numeric_limits<uint64_t>::max());
+        FillShortTxIDSelector();
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            vShortIDs[i - 1] = GetShortID(block.vtx[i]->GetId());
+        }
+        std::vector<uint64_t> vSorted(vShortIDs);
+        std::sort(vSorted.begin(), vSorted.end());
+        if (std::adjacent_find(vSorted.begin(), vSorted.end()) ==
+            vSorted.end()) {
+            vOrder.resize(vShortIDs.size());
+            for (size_t i = 0; i < vShortIDs.size(); i++) {
+                vOrder[i] = std::lower_bound(vSorted.begin(), vSorted.end(),
+                                             vShortIDs[i]) -
+                            vSorted.begin();
+            }
+            break;
+        }
+    }
+
+    // Every transaction of the receiver's mempool which is not in the block
+    // passes the filter with probability fpRate, and then costs
+    // GRAPHENE_IBLT_OVERHEAD cells in the IBLT. The filter costs
+    // -n * ln(fpRate) / ln(2)^2 bits. Minimizing the sum over the expected
+    // number of false positives a = fpRate * (m - n) gives
+    // a = n / (8 * ln(2)^2 * cell size * overhead).
+    const double LN2SQUARED = 0.480453013918201424667102526326664971730;
+    size_t nBlockTxs = vShortIDs.size();
+    double nExpectedFalsePositives =
+        nBlockTxs /
+        (8 * LN2SQUARED * GRAPHENE_IBLT_CELL_SIZE * GRAPHENE_IBLT_OVERHEAD);
+    // The mempool size comes from the peer.
+    nReceiverPoolTxs =
+        std::min(nReceiverPoolTxs, GRAPHENE_MAX_RECEIVER_POOL_TXS);
+    double nExcessTxs =
+        nReceiverPoolTxs > nBlockTxs ? nReceiverPoolTxs - nBlockTxs : 0;
+    double fpRate = GRAPHENE_MAX_FPRATE;
+    if (nExcessTxs > 0 && nExpectedFalsePositives < nExcessTxs) {
+        fpRate = std::max(nExpectedFalsePositives / nExcessTxs, 1e-9);
+    }
+
+    filter = CBloomFilter(std::max<size_t>(nBlockTxs, 1), fpRate,
+                          GetRand(std::numeric_limits<uint32_t>::max()),
+                          BLOOM_UPDATE_NONE);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        filter.insert(block.vtx[i]->GetId());
+    }
+
+    // The filter is capped at MAX_BLOOM_FILTER_SIZE, so for large blocks it
+    // lets through many more transactions than fpRate. The IBLT has to be
+    // sized for the rate the filter actually has.
+    nExpectedFalsePositives =
+        filter.GetFalsePositiveRate(nBlockTxs) * nExcessTxs;
+
+    // The number of false positives is binomially distributed, leave room
+    // for three standard deviations above the expected count. The count is
+    // capped while still a double, as it may not fit in a size_t.
+    double nEntries = std::ceil(nExpectedFalsePositives +
+                                3 * std::sqrt(nExpectedFalsePositives));
+    size_t nMaxEntries =
+        GetMaxIbltCells(nBlockTxs) / GRAPHENE_IBLT_OVERHEAD;
+    if (nEntries > nMaxEntries) {
+        fIbltCapped = true;
+        nEntries = nMaxEntries;
+    }
+    iblt = CIblt(CIblt::OptimalCellCount(nEntries), nonce & 0xffffffff);
+    for (uint64_t shortid : vShortIDs) {
+        iblt.Insert(shortid);
+    }
+}
+
+size_t CGrapheneBlock::GetMaxIbltCells(size_t nBlockTxs) {
+    // A compact block takes 6 bytes per short txid. Whatever the block size,
+    // the IBLT also has to leave room for the filter in a message.
+    size_t nMaxCells = nBlockTxs * 6 / GRAPHENE_IBLT_CELL_SIZE;
+    nMaxCells = std::max(nMaxCells, GRAPHENE_MIN_MAX_IBLT_CELLS);
+    return std::min<size_t>(nMaxCells, MAX_PROTOCOL_MESSAGE_LENGTH / 2 /
+                                           GRAPHENE_IBLT_CELL_SIZE);
+}
+
+void CGrapheneBlock::FillShortTxIDSelector() const {
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << header << nonce;
+    CSHA256 hasher;
+    hasher.Write((uint8_t *)&(*stream.begin()), stream.end() - stream.begin());
+    uint256 shorttxidhash;
+    hasher.Finalize(shorttxidhash.begin());
+    shorttxidk0 = shorttxidhash.GetUint64(0);
+    shorttxidk1 = shorttxidhash.GetUint64(1);
+}
+
+uint64_t CGrapheneBlock::GetShortID(const uint256 &txhash) const {
+    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
+}
+
+/** Number of bits needed to store the ranks 0 to nOrderSize - 1 */
+static unsigned int GetRankBits(uint64_t nOrderSize) {
+    unsigned int nBits = 0;
+    while (nBits < 32 && (uint64_t(1) << nBits) < nOrderSize) {
+        nBits++;
+    }
+    return nBits;
+}
+
+std::vector<uint8_t> CGrapheneBlock::PackOrder() const {
+    unsigned int nBits = GetRankBits(vOrder.size());
+    std::vector<uint8_t> vPacked((vOrder.size() * nBits + 7) / 8);
+    uint64_t nBitPos = 0;
+    for (uint32_t nRank : vOrder) {
+        for (unsigned int i = 0; i < nBits; i++, nBitPos++) {
+            if ((nRank >> i) & 1) {
+                vPacked[nBitPos >> 3] |= 1 << (nBitPos & 7);
+            }
+        }
+    }
+    return vPacked;
+}
+
+bool CGrapheneBlock::UnpackOrder(uint64_t nOrderSize,
+                                 const std::vector<uint8_t> &vPacked) {
+    unsigned int nBits = GetRankBits(nOrderSize);
+    // Check the size first, so that a bogus nOrderSize cannot make us
+    // allocate anything.
+    if (nOrderSize > std::numeric_limits<uint32_t>::max() ||
+        vPacked.size() != (nOrderSize * nBits + 7) / 8) {
+        return false;
+    }
+
+    vOrder.assign(nOrderSize, 0);
+    uint64_t nBitPos = 0;
+    for (uint32_t &nRank : vOrder) {
+        for (unsigned int i = 0; i < nBits; i++, nBitPos++) {
+            if ((vPacked[nBitPos >> 3] >> (nBitPos & 7)) & 1) {
+                nRank |= uint32_t(1) << i;
+            }
+        }
+    }
+    return true;
+}
+
+ReadStatus CGrapheneBlock::FillBlock(
+    const Config &config, CTxMemPool &pool,
+    const std::vector<std::pair<uint256, CTransactionRef>> &extra_txn,
+    CBlock &block) const {
+    if (header.IsNull() || !coinbase || coinbase->IsNull()) {
+        return READ_STATUS_INVALID;
+    }
+    if (BlockTxCount() > config.GetMaxBlockSize() / MIN_TRANSACTION_SIZE) {
+        return READ_STATUS_INVALID;
+    }
+    if (!iblt.IsValid() || !filter.IsWithinSizeConstraints()) {
+        return READ_STATUS_INVALID;
+    }
+
+    // The ranks must be a permutation of the block positions.
+    std::vector<bool> vRankSeen(vOrder.size());
+    for (uint32_t nRank : vOrder) {
+        if (nRank >= vOrder.size() || vRankSeen[nRank]) {
+            return READ_STATUS_INVALID;
+        }
+        vRankSeen[nRank] = true;
+    }
+
+    // A deserialized filter matches everything until its flags are updated.
+    CBloomFilter txFilter(filter);
+    txFilter.UpdateEmptyFull();
+
+    std::unordered_map<uint64_t, CTransactionRef> mapCandidates;
+    bool fCollision = false;
+    auto addCandidate = [&](const uint256 &txid, const CTransactionRef &tx) {
+        if (!txFilter.contains(txid)) {
+            return;
+        }
+        auto ret = mapCandidates.emplace(GetShortID(txid), tx);
+        if (!ret.second && ret.first->second->GetId() != txid) {
+            fCollision = true;
+        }
+    };
+
+    {
+        LOCK(pool.cs);
+        for (const auto &entry : pool.vTxHashes) {
+            addCandidate(entry.first, entry.second->GetSharedTx());
+        }
+    }
+    for (const auto &entry : extra_txn) {
+        if (entry.second) {
+            addCandidate(entry.first, entry.second);
+        }
+    }
+
+    uint256 hash = header.GetHash();
+    if (fCollision) {
+        LogPrint(BCLog::CMPCTBLOCK,
+                 "Short txid collision in graphene block %s\n",
+                 hash.ToString());
+        return READ_STATUS_FAILED;
+    }
+
+    CIblt candidates(iblt.GetCellCount(), iblt.GetSalt(), iblt.GetHashFuncs());
+    for (const auto &entry : mapCandidates) {
+        candidates.Insert(entry.first);
+    }
+
+    CIblt difference(iblt);
+    std::set<uint64_t> setMissing, setFalsePositives;
+    if (!difference.Subtract(candidates) ||
+        !difference.ListEntries(setMissing, setFalsePositives)) {
+        LogPrint(BCLog::CMPCTBLOCK,
+                 "Failed to decode the IBLT of graphene block %s with %lu "
+                 "candidates\n",
+                 hash.ToString(), mapCandidates.size());
+        return READ_STATUS_FAILED;
+    }
+    if (!setMissing.empty()) {
+        LogPrint(BCLog::CMPCTBLOCK,
+                 "Missing %lu txn of graphene block %s\n", setMissing.size(),
+                 hash.ToString());
+        return READ_STATUS_FAILED;
+    }
+
+    for (uint64_t shortid : setFalsePositives) {
+        if (!mapCandidates.erase(shortid)) {
+            return READ_STATUS_FAILED;
+        }
+    }
+    if (mapCandidates.size() != vOrder.size()) {
+        return READ_STATUS_FAILED;
+    }
+
+    std::vector<uint64_t> vSorted;
+    vSorted.reserve(mapCandidates.size());
+    for (const auto &entry : mapCandidates) {
+        vSorted.push_back(entry.first);
+    }
+    std::sort(vSorted.begin(), vSorted.end());
+
+    block = header;
+    block.vtx.resize(BlockTxCount());
+    block.vtx[0] = coinbase;
+    for (size_t i = 0; i < vOrder.size(); i++) {
+        block.vtx[i + 1] = mapCandidates[vSorted[vOrder[i]]];
+    }
+
+    CValidationState state;
+    if (!CheckBlock(config, block, state)) {
+        if (state.CorruptionPossible()) {
+            // Undetected short txid collision or IBLT decoding error.
+            return READ_STATUS_FAILED;
+        }
+        return READ_STATUS_CHECKBLOCK_FAILED;
+    }
+
+    LogPrint(BCLog::CMPCTBLOCK,
+             "Successfully reconstructed graphene block %s with %lu txn, "
+             "dropping %lu false positives\n",
+             hash.ToString(), block.vtx.size(), setFalsePositives.size());
+    return READ_STATUS_OK;
+}
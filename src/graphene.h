@@ -0,0 +1,152 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_GRAPHENE_H
+#define BITCOIN_GRAPHENE_H
+
+#include "blockencodings.h"
+#include "bloom.h"
+#include "iblt.h"
+#include "primitives/block.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class Config;
+class CTxMemPool;
+
+/** Default for -usegraphene */
+static const bool DEFAULT_USE_GRAPHENE = false;
+/** Version of graphene blocks announced in "sendgrph" messages */
+static const uint64_t GRAPHENE_VERSION = 1;
+/**
+ * Mempool size of a requester above which graphene blocks are sized as if it
+ * had this many transactions, far more than fit in a default sized mempool.
+ */
+static const uint64_t GRAPHENE_MAX_RECEIVER_POOL_TXS = 10000000;
+/** Number of IBLT cells a graphene block may always have, however small */
+static const size_t GRAPHENE_MIN_MAX_IBLT_CELLS = 1024;
+
+/** Request for a graphene block, sized for the mempool of the requester. */
+class CGrapheneBlockRequest {
+public:
+    uint256 blockhash;
+    //! Number of transactions in the mempool of the requesting node.
+    uint64_t nReceiverPoolTxs;
+
+    CGrapheneBlockRequest() : nReceiverPoolTxs(0) {}
+    CGrapheneBlockRequest(const uint256 &blockhashIn,
+                          uint64_t nReceiverPoolTxsIn)
+        : blockhash(blockhashIn), nReceiverPoolTxs(nReceiverPoolTxsIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(blockhash);
+        READWRITE(nReceiverPoolTxs);
+    }
+};
+
+/**
+ * A block encoded for a peer which already has most of its transactions in
+ * its mempool (Ozisik et al., "Graphene: Efficient Interactive Set
+ * Reconciliation Applied to Blockchain Propagation", 2019).
+ *
+ * The Bloom filter over the txids lets the receiver select the candidate
+ * transactions from its mempool, and the IBLT over the short txids of the
+ * block lets it drop the false positives of the filter. The filter and the
+ * IBLT are sized together from the mempool size of the receiver, so that the
+ * encoding is much smaller than a compact block for large blocks.
+ *
+ * As transactions are ordered topologically rather than canonically, the
+ * position of each short txid in the sorted set is sent as well.
+ *
+ * The receiver cannot ask for the transactions it is missing. If it fails to
+ * reconstruct the block, it falls back to requesting a compact block.
+ */
+class CGrapheneBlock {
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    //! Block position (minus the coinbase) -> rank of its short txid.
+    std::vector<uint32_t> vOrder;
+
+    //! Not serialized: whether the IBLT is too small to be decoded.
+    bool fIbltCapped;
+
+    void FillShortTxIDSelector() const;
+
+    //! The ranks are sent with just as many bits as needed.
+    std::vector<uint8_t> PackOrder() const;
+    bool UnpackOrder(uint64_t nOrderSize, const std::vector<uint8_t> &vPacked);
+
+public:
+    CBlockHeader header;
+    CTransactionRef coinbase;
+    CBloomFilter filter;
+    CIblt iblt;
+
+    // Dummy for deserialization
+    CGrapheneBlock() : fIbltCapped(false) {}
+
+    CGrapheneBlock(const CBlock &block, uint64_t nReceiverPoolTxs);
+
+    /**
+     * Number of cells, up to the rounding of CIblt::OptimalCellCount, the
+     * IBLT of a block with nBlockTxs transactions besides the coinbase is
+     * capped at. Beyond that, the IBLT alone is larger than the short txids
+     * of a compact block.
+     */
+    static size_t GetMaxIbltCells(size_t nBlockTxs);
+
+    /**
+     * Whether the IBLT had to be capped at GetMaxIbltCells, in which case the
+     * receiver will likely fail to reconstruct the block and a compact block
+     * should be sent instead.
+     */
+    bool IsIbltCapped() const { return fIbltCapped; }
+
+    uint64_t GetShortID(const uint256 &txhash) const;
+
+    size_t BlockTxCount() const { return vOrder.size() + 1; }
+
+    /**
+     * Rebuild the block from the transactions in pool and extra_txn.
+     * READ_STATUS_FAILED means the block could not be reconstructed and
+     * should be requested in another way.
+     */
+    ReadStatus FillBlock(
+        const Config &config, CTxMemPool &pool,
+        const std::vector<std::pair<uint256, CTransactionRef>> &extra_txn,
+        CBlock &block) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(header);
+        READWRITE(nonce);
+        READWRITE(coinbase);
+        READWRITE(filter);
+        READWRITE(iblt);
+
+        uint64_t nOrderSize = (uint64_t)vOrder.size();
+        READWRITE(COMPACTSIZE(nOrderSize));
+        std::vector<uint8_t> vPacked;
+        if (!ser_action.ForRead()) {
+            vPacked = PackOrder();
+        }
+        READWRITE(vPacked);
+        if (ser_action.ForRead() && !UnpackOrder(nOrderSize, vPacked)) {
+            throw std::ios_base::failure("invalid graphene block order");
+        }
+
+        if (ser_action.ForRead()) FillShortTxIDSelector();
+    }
+};
+
+#endif // BITCOIN_GRAPHENE_H
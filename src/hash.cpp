@@ -7,6 +7,19 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#include <cassert>
+
+// libbitcoinconsensus is built from the sources directly and doesn't include
+// the objects compiled with extra instruction sets.
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+#define USE_SIPHASH_AVX2
+#include <cpuid.h>
+namespace siphash_avx2 {
+void SipHashUint256x4(uint64_t k0, uint64_t k1,
+                      const unsigned char *const *vals, uint64_t *out);
+}
+#endif
+
 inline uint32_t ROTL32(uint32_t x, int8_t r) {
     return (x << r) | (x >> (32 - r));
 }
@@ -217,6 +230,145 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256 &val) {
     return v0 ^ v1 ^ v2 ^ v3;
 }
 
+/** Number of values hashed together by SipHashUint256Batch */
+static const size_t SIPHASH_BATCH_LANES = 4;
+
+/**
+ * The rounds of SIPHASH_BATCH_LANES independent hashes are interleaved, so
+ * that the CPU can execute them in parallel instead of waiting on the
+ * dependency chain of a single hash.
+ */
+#define SIPROUND_LANES                                                         \
+    do {                                                                       \
+        for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {                     \
+            uint64_t v0 = a0[j], v1 = a1[j], v2 = a2[j], v3 = a3[j];           \
+            SIPROUND;                                                          \
+            SIPROUND;                                                          \
+            a0[j] = v0;                                                        \
+            a1[j] = v1;                                                        \
+            a2[j] = v2;                                                        \
+            a3[j] = v3;                                                        \
+        }                                                                      \
+    } while (0)
+
+static void SipHashUint256Lanes(uint64_t k0, uint64_t k1,
+                                const uint256 *const *vals, uint64_t *out) {
+    uint64_t a0[SIPHASH_BATCH_LANES], a1[SIPHASH_BATCH_LANES],
+        a2[SIPHASH_BATCH_LANES], a3[SIPHASH_BATCH_LANES],
+        d[SIPHASH_BATCH_LANES];
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        a0[j] = 0x736f6d6570736575ULL ^ k0;
+        a1[j] = 0x646f72616e646f6dULL ^ k1;
+        a2[j] = 0x6c7967656e657261ULL ^ k0;
+        a3[j] = 0x7465646279746573ULL ^ k1;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+            d[j] = vals[j]->GetUint64(i);
+            a3[j] ^= d[j];
+        }
+        SIPROUND_LANES;
+        for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+            a0[j] ^= d[j];
+        }
+    }
+
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        a3[j] ^= uint64_t(4) << 59;
+    }
+    SIPROUND_LANES;
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        a0[j] ^= uint64_t(4) << 59;
+        a2[j] ^= 0xFF;
+    }
+    SIPROUND_LANES;
+    SIPROUND_LANES;
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        out[j] = a0[j] ^ a1[j] ^ a2[j] ^ a3[j];
+    }
+}
+
+#if defined(USE_SIPHASH_AVX2)
+static void SipHashUint256LanesAVX2(uint64_t k0, uint64_t k1,
+                                    const uint256 *const *vals, uint64_t *out) {
+    static_assert(SIPHASH_BATCH_LANES == 4,
+                  "the AVX2 implementation hashes 4 values at once");
+    const unsigned char *data[SIPHASH_BATCH_LANES];
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        data[j] = vals[j]->begin();
+    }
+    siphash_avx2::SipHashUint256x4(k0, k1, data, out);
+}
+
+/** Whether both the CPU and the OS support AVX2. */
+static bool AVX2Enabled() {
+    uint32_t eax, ebx, ecx, edx;
+    // The OS must save the upper halves of the YMM registers (OSXSAVE and the
+    // SSE and AVX bits of XCR0).
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !((ecx >> 27) & 1)) {
+        return false;
+    }
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6 || __get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx >> 5) & 1;
+}
+#endif
+
+typedef void (*SipHashLanesType)(uint64_t k0, uint64_t k1,
+                                 const uint256 *const *vals, uint64_t *out);
+static SipHashLanesType SipHashLanes = SipHashUint256Lanes;
+
+/** Check lanes against SipHashUint256. */
+static bool SipHashSelfTest(SipHashLanesType lanes) {
+    uint256 vals[SIPHASH_BATCH_LANES];
+    const uint256 *ptrs[SIPHASH_BATCH_LANES];
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        for (size_t b = 0; b < vals[j].size(); b++) {
+            vals[j].begin()[b] = uint8_t(b * 7 + j * 61);
+        }
+        ptrs[j] = &vals[j];
+    }
+    uint64_t out[SIPHASH_BATCH_LANES];
+    lanes(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, ptrs, out);
+    for (size_t j = 0; j < SIPHASH_BATCH_LANES; j++) {
+        if (out[j] != SipHashUint256(0x0706050403020100ULL,
+                                     0x0F0E0D0C0B0A0908ULL, vals[j])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string SipHashAutoDetect() {
+#if defined(USE_SIPHASH_AVX2)
+    if (AVX2Enabled()) {
+        SipHashLanes = SipHashUint256LanesAVX2;
+        assert(SipHashSelfTest(SipHashLanes));
+        return "avx2";
+    }
+#endif
+
+    SipHashLanes = SipHashUint256Lanes;
+    assert(SipHashSelfTest(SipHashLanes));
+    return "standard";
+}
+
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256 *const *vals,
+                         size_t count, uint64_t *out) {
+    size_t i = 0;
+    for (; i + SIPHASH_BATCH_LANES <= count; i += SIPHASH_BATCH_LANES) {
+        SipHashLanes(k0, k1, vals + i, out + i);
+    }
+    for (; i < count; i++) {
+        out[i] = SipHashUint256(k0, k1, *vals[i]);
+    }
+}
+
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256 &val,
                              uint32_t extra) {
     /* Specialized implementation for efficiency */
@@ -13,6 +13,7 @@
 #include "uint256.h"
 #include "version.h"
 
+#include <string>
 #include <vector>
 
 typedef uint256 ChainCode;
@@ -251,4 +252,18 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256 &val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256 &val,
                              uint32_t extra);
 
+/**
+ * SipHashUint256 of count values with the same key: out[i] is the hash of
+ * *vals[i]. Several values are hashed at once, which is significantly faster
+ * than hashing them one after the other.
+ */
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256 *const *vals,
+                         size_t count, uint64_t *out);
+
+/**
+ * Autodetect the best available SipHashUint256Batch implementation.
+ * Returns the name of the implementation.
+ */
+std::string SipHashAutoDetect();
+
 #endif // BITCOIN_HASH_H
@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "iblt.h"
+
+#include "hash.h"
+
+#include <cassert>
+#include <limits>
+
+CIblt::CIblt(size_t nCells, uint32_t nSaltIn, uint8_t nHashFuncsIn)
+    : nHashFuncs(nHashFuncsIn), nSalt(nSaltIn), vCells(nCells) {
+    assert(nHashFuncs > 0 && nCells > 0 && nCells % nHashFuncs == 0);
+}
+
+size_t CIblt::OptimalCellCount(size_t nEntries, uint8_t nHashFuncs) {
+    // Asymptotically, peeling succeeds once there are about 1.3 cells per
+    // entry. Tables of a few hundred entries mostly fail because two keys
+    // share all their cells, which takes a lot more headroom to make rare:
+    // with 4 hash functions this sizing fails about once in a thousand.
+    size_t nCells = nEntries * 2 + 10 * nHashFuncs;
+    return (nCells + nHashFuncs - 1) / nHashFuncs * nHashFuncs;
+}
+
+uint32_t CIblt::KeyCheck(uint64_t key) const {
+    // Hash number IBLT_MAX_HASH_FUNCS is never used to pick a cell.
+    return CSipHasher(nSalt, IBLT_MAX_HASH_FUNCS).Write(key).Finalize();
+}
+
+size_t CIblt::CellIndex(uint64_t key, uint8_t nHashNum) const {
+    size_t nSubtableSize = vCells.size() / nHashFuncs;
+    uint64_t nHash = CSipHasher(nSalt, nHashNum).Write(key).Finalize();
+    return nHashNum * nSubtableSize + nHash % nSubtableSize;
+}
+
+bool CIblt::IsPure(const Cell &cell) const {
+    return (cell.nCount == 1 || cell.nCount == -1) &&
+           cell.nKeyCheck == KeyCheck(cell.nKeySum);
+}
+
+void CIblt::Update(uint64_t key, int32_t nDelta) {
+    uint32_t nKeyCheck = KeyCheck(key);
+    for (uint8_t i = 0; i < nHashFuncs; i++) {
+        Cell &cell = vCells[CellIndex(key, i)];
+        cell.nCount += nDelta;
+        cell.nKeySum ^= key;
+        cell.nKeyCheck ^= nKeyCheck;
+    }
+}
+
+bool CIblt::Subtract(const CIblt &other) {
+    if (nHashFuncs != other.nHashFuncs || nSalt != other.nSalt ||
+        vCells.size() != other.vCells.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < vCells.size(); i++) {
+        int64_t nCount = int64_t(vCells[i].nCount) - other.vCells[i].nCount;
+        if (nCount < std::numeric_limits<int32_t>::min() ||
+            nCount > std::numeric_limits<int32_t>::max()) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        vCells[i].nKeySum ^= other.vCells[i].nKeySum;
+        vCells[i].nKeyCheck ^= other.vCells[i].nKeyCheck;
+    }
+    return true;
+}
+
+bool CIblt::ListEntries(std::set<uint64_t> &setPositive,
+                        std::set<uint64_t> &setNegative) const {
+    CIblt peeled(*this);
+
+    std::vector<size_t> vPure;
+    for (size_t i = 0; i < peeled.vCells.size(); i++) {
+        if (peeled.IsPure(peeled.vCells[i])) {
+            vPure.push_back(i);
+        }
+    }
+
+    // Every key takes one cell in each subtable, so a table which lists more
+    // keys than it has cells is bogus. Bounding the work also guards against
+    // tables crafted to never finish peeling.
+    size_t nPeeled = 0;
+    while (!vPure.empty()) {
+        const Cell &cell = peeled.vCells[vPure.back()];
+        vPure.pop_back();
+        if (!peeled.IsPure(cell)) {
+            continue;
+        }
+
+        if (++nPeeled > peeled.vCells.size()) {
+            return false;
+        }
+
+        uint64_t key = cell.nKeySum;
+        int32_t nCount = cell.nCount;
+        std::set<uint64_t> &setEntries =
+            nCount > 0 ? setPositive : setNegative;
+        if (!setEntries.insert(key).second) {
+            return false;
+        }
+
+        peeled.Update(key, -nCount);
+        for (uint8_t i = 0; i < nHashFuncs; i++) {
+            size_t nIndex = peeled.CellIndex(key, i);
+            if (peeled.IsPure(peeled.vCells[nIndex])) {
+                vPure.push_back(nIndex);
+            }
+        }
+    }
+
+    for (const Cell &cell : peeled.vCells) {
+        if (!cell.IsEmpty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CIblt::IsValid() const {
+    if (nHashFuncs == 0 || nHashFuncs > IBLT_MAX_HASH_FUNCS ||
+        vCells.empty() || vCells.size() % nHashFuncs != 0) {
+        return false;
+    }
+
+    // Bounding the counts keeps them far from overflowing when tables are
+    // subtracted and peeled.
+    for (const Cell &cell : vCells) {
+        if (cell.nCount < -IBLT_MAX_CELL_COUNT ||
+            cell.nCount > IBLT_MAX_CELL_COUNT) {
+            return false;
+        }
+    }
+    return true;
+}
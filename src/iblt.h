@@ -0,0 +1,120 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_IBLT_H
+#define BITCOIN_IBLT_H
+
+#include "serialize.h"
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+/** Default number of hash functions, and of subtables, of an IBLT */
+static const uint8_t IBLT_DEFAULT_HASH_FUNCS = 4;
+/** Maximum number of hash functions accepted from a peer */
+static const uint8_t IBLT_MAX_HASH_FUNCS = 8;
+/**
+ * Maximum absolute cell count accepted from a peer. A cell counts the keys
+ * hashed to it, and this is far above the number of transactions of any
+ * block.
+ */
+static const int32_t IBLT_MAX_CELL_COUNT = 1 << 24;
+
+/**
+ * Invertible Bloom lookup table over 64-bit keys.
+ *
+ * Every key is added to one cell in each of nHashFuncs equally sized
+ * subtables. Subtracting the table of one set from the table of another
+ * leaves only the keys that are in one set but not in the other, and those
+ * can be listed as long as there are not too many of them for the number of
+ * cells, whatever the size of the sets themselves.
+ *
+ * See Goodrich and Mitzenmacher, "Invertible Bloom Lookup Tables" (2011).
+ */
+class CIblt {
+public:
+    struct Cell {
+        int32_t nCount;
+        uint64_t nKeySum;
+        uint32_t nKeyCheck;
+
+        Cell() : nCount(0), nKeySum(0), nKeyCheck(0) {}
+
+        bool IsEmpty() const {
+            return nCount == 0 && nKeySum == 0 && nKeyCheck == 0;
+        }
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream &s, Operation ser_action) {
+            READWRITE(nCount);
+            READWRITE(nKeySum);
+            READWRITE(nKeyCheck);
+        }
+    };
+
+private:
+    uint8_t nHashFuncs;
+    uint32_t nSalt;
+    std::vector<Cell> vCells;
+
+    uint32_t KeyCheck(uint64_t key) const;
+    size_t CellIndex(uint64_t key, uint8_t nHashNum) const;
+    bool IsPure(const Cell &cell) const;
+    void Update(uint64_t key, int32_t nDelta);
+
+public:
+    CIblt() : nHashFuncs(0), nSalt(0) {}
+    /** nCells must be a multiple of nHashFuncsIn. */
+    CIblt(size_t nCells, uint32_t nSaltIn,
+          uint8_t nHashFuncsIn = IBLT_DEFAULT_HASH_FUNCS);
+
+    /**
+     * Number of cells needed to list about nEntries differences with high
+     * probability, rounded up to a multiple of nHashFuncs.
+     */
+    static size_t OptimalCellCount(size_t nEntries,
+                                   uint8_t nHashFuncs = IBLT_DEFAULT_HASH_FUNCS);
+
+    void Insert(uint64_t key) { Update(key, 1); }
+    void Erase(uint64_t key) { Update(key, -1); }
+
+    /**
+     * Subtract the table of another set from this one. Fails, leaving this
+     * table unchanged, if the two tables do not have the same parameters or
+     * if a cell count would overflow.
+     */
+    bool Subtract(const CIblt &other);
+
+    /**
+     * List the keys left in the table: the ones inserted more often than
+     * erased in setPositive, the others in setNegative. Returns false if the
+     * table could not be fully decoded, in which case both sets are partial.
+     */
+    bool ListEntries(std::set<uint64_t> &setPositive,
+                     std::set<uint64_t> &setNegative) const;
+
+    /**
+     * Whether the parameters and cell counts are sane, for tables received
+     * from a peer.
+     */
+    bool IsValid() const;
+
+    size_t GetCellCount() const { return vCells.size(); }
+    uint8_t GetHashFuncs() const { return nHashFuncs; }
+    uint32_t GetSalt() const { return nSalt; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(nHashFuncs);
+        READWRITE(nSalt);
+        READWRITE(vCells);
+    }
+};
+
+#endif // BITCOIN_IBLT_H
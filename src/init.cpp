@@ -18,6 +18,8 @@
 #include "config.h"
 #include "consensus/validation.h"
 #include "fs.h"
+#include "graphene.h"
+#include "hash.h"
 #include "httprpc.h"
 #include "httpserver.h"
 #include "key.h"
@@ -209,6 +211,9 @@ void Shutdown() {
         gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
     }
+    if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpValidationCaches();
+    }
 
     if (fFeeEstimatesInitialized) {
         fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -379,6 +384,16 @@ std::string HelpMessage(HelpMessageMode mode) {
         "-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable "
                                         "transactions in memory (default: %u)"),
                                       DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt(
+        "-maxorphanpoolsize=<n>",
+        strprintf(_("Keep unconnectable transactions below <n> megabytes "
+                    "(default: %u)"),
+                  DEFAULT_MAX_ORPHAN_POOL_SIZE));
+    strUsage += HelpMessageOpt(
+        "-maxorphanpeersize=<n>",
+        strprintf(_("Keep at most <n> megabytes of unconnectable transactions "
+                    "from each peer (default: %u)"),
+                  DEFAULT_MAX_ORPHAN_PEER_SIZE));
     strUsage += HelpMessageOpt("-maxmempool=<n>",
                                strprintf(_("Keep the transaction memory pool "
                                            "below <n> megabytes (default: %u)"),
@@ -390,8 +405,9 @@ std::string HelpMessage(HelpMessageMode mode) {
                                  DEFAULT_MEMPOOL_EXPIRY));
     strUsage +=
         HelpMessageOpt("-persistmempool",
-                       strprintf(_("Whether to save the mempool on shutdown "
-                                   "and load on restart (default: %u)"),
+                       strprintf(_("Whether to save the mempool and the "
+                                   "signature and script caches on shutdown "
+                                   "and load them on restart (default: %u)"),
                                  DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt(
         "-blockreconstructionextratxn=<n>",
@@ -459,6 +475,11 @@ std::string HelpMessage(HelpMessageMode mode) {
     strUsage += HelpMessageOpt("-bind=<addr>",
                                _("Bind to given address and always listen on "
                                  "it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt(
+        "-compressmessages",
+        strprintf(_("Compress block and transaction messages exchanged with "
+                    "peers which enable this option as well (default: %d)"),
+                  DEFAULT_COMPRESS_MESSAGES));
     strUsage +=
         HelpMessageOpt("-connect=<ip>",
                        _("Connect only to the specified node(s); -noconnect or "
@@ -475,6 +496,12 @@ std::string HelpMessage(HelpMessageMode mode) {
                       "addresses (default: 1 unless -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>",
                                _("Specify your own public address"));
+    strUsage += HelpMessageOpt(
+        "-fastblockrelay",
+        strprintf(_("Announce new blocks to high-bandwidth compact block peers "
+                    "as soon as their header and merkle root are checked, "
+                    "before they are fully validated (default: %d)"),
+                  DEFAULT_FAST_BLOCK_RELAY));
     strUsage += HelpMessageOpt(
         "-forcednsseed",
         strprintf(
@@ -491,6 +518,11 @@ std::string HelpMessage(HelpMessageMode mode) {
         "-maxconnections=<n>",
         strprintf(_("Maintain at most <n> connections to peers (default: %u)"),
                   DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt(
+        "-maxdownloadrate=<n>",
+        strprintf(_("Maximum download rate from all peers together, in KB/s, "
+                    "0 = no limit (default: %u)"),
+                  DEFAULT_MAX_DOWNLOAD_RATE));
     strUsage +=
         HelpMessageOpt("-maxreceivebuffer=<n>",
                        strprintf(_("Maximum per-connection receive buffer, "
@@ -518,6 +550,11 @@ std::string HelpMessage(HelpMessageMode mode) {
         HelpMessageOpt("-permitbaremultisig",
                        strprintf(_("Relay non-P2SH multisig (default: %d)"),
                                  DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt(
+        "-peerbandwidthshare=<n>",
+        strprintf(_("Percentage of -maxuploadrate and -maxdownloadrate a "
+                    "single peer may use, between 1 and 100 (default: %u)"),
+                  DEFAULT_PEER_BANDWIDTH_SHARE));
     strUsage += HelpMessageOpt(
         "-peerbloomfilters",
         strprintf(_("Support filtering of blocks and transaction with bloom "
@@ -560,6 +597,11 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(_("Use UPnP to map the listening port (default: %u)"), 0));
 #endif
 #endif
+    strUsage += HelpMessageOpt(
+        "-usegraphene",
+        strprintf(_("Request and offer new blocks as graphene blocks, falling "
+                    "back to compact blocks (default: %d)"),
+                  DEFAULT_USE_GRAPHENE));
     strUsage +=
         HelpMessageOpt("-whitebind=<addr>",
                        _("Bind to given address and whitelist peers connecting "
@@ -582,6 +624,12 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(_("Force relay of transactions from whitelisted peers even "
                     "if they violate local relay policy (default: %d)"),
                   DEFAULT_WHITELISTFORCERELAY));
+    strUsage += HelpMessageOpt(
+        "-maxuploadrate=<n>",
+        strprintf(_("Maximum upload rate to all peers together, in KB/s, 0 = "
+                    "no limit. Transactions, addresses and historical blocks "
+                    "wait for it, new blocks don't (default: %u)"),
+                  DEFAULT_MAX_UPLOAD_RATE));
     strUsage += HelpMessageOpt(
         "-maxuploadtarget=<n>",
         strprintf(_("Tries to keep outbound traffic under the given target (in "
@@ -680,6 +728,17 @@ std::string HelpMessage(HelpMessageMode mode) {
                       "more than <n> kilobytes of in-mempool descendants "
                       "(default: %u).",
                       DEFAULT_DESCENDANT_SIZE_LIMIT));
+        strUsage += HelpMessageOpt(
+            "-limitclustercount=<n>",
+            strprintf("Do not accept transactions if they would join <n> or "
+                      "more connected in-mempool transactions (default: %u)",
+                      DEFAULT_CLUSTER_LIMIT));
+        strUsage += HelpMessageOpt(
+            "-limitclustersize=<n>",
+            strprintf("Do not accept transactions if they would join more "
+                      "than <n> kilobytes of connected in-mempool "
+                      "transactions (default: %u)",
+                      DEFAULT_CLUSTER_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end",
                                    "Use given start/end times for specified "
                                    "BIP9 deployment (regtest-only)");
@@ -1664,6 +1723,8 @@ bool AppInitSanityChecks() {
     // Initialize elliptic curve code
     std::string sha256_algo = SHA256AutoDetect();
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string siphash_algo = SipHashAutoDetect();
+    LogPrintf("Using the '%s' SipHash implementation\n", siphash_algo);
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1721,12 +1782,16 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
     InitSignatureCache();
     InitScriptExecutionCache();
+    if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadValidationCaches();
+    }
 
     LogPrintf("Using %u threads for script verification\n",
               nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadHeaderCheck);
         }
     }
 
@@ -1736,6 +1801,20 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>,
                                           "scheduler", serviceLoop));
 
+    // Age the validation caches once per mempool expiry, so that entries of
+    // transactions that left the mempool without being mined are dropped
+    // after one or two expiry periods.
+    int64_t nCacheAgeMilliSeconds =
+        std::max<int64_t>(
+            1, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY)) *
+        60 * 60 * 1000;
+    scheduler.scheduleEvery(
+        [] {
+            AgeSignatureCache();
+            AgeScriptExecutionCache();
+        },
+        nCacheAgeMilliSeconds);
+
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
      * that the server is there and will be ready later).  Warmup mode will
@@ -1928,6 +2007,13 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
             1024;
     }
 
+    int64_t nPeerBandwidthShare =
+        gArgs.GetArg("-peerbandwidthshare", DEFAULT_PEER_BANDWIDTH_SHARE);
+    if (nPeerBandwidthShare < 1 || nPeerBandwidthShare > 100) {
+        return InitError(
+            _("-peerbandwidthshare must be between 1 and 100 percent"));
+    }
+
     // Step 7: load block chain
 
     fReindex = gArgs.GetBoolArg("-reindex", false);
@@ -2238,6 +2324,11 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.nMaxUploadRate =
+        1000 * gArgs.GetArg("-maxuploadrate", DEFAULT_MAX_UPLOAD_RATE);
+    connOptions.nMaxDownloadRate =
+        1000 * gArgs.GetArg("-maxdownloadrate", DEFAULT_MAX_DOWNLOAD_RATE);
+    connOptions.nPeerBandwidthShare = nPeerBandwidthShare;
 
     if (!connman.Start(scheduler, strNodeError, connOptions)) {
         return InitError(strNodeError);
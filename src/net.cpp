@@ -49,6 +49,11 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// MSG_MORE is Linux-specific.
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
 // Fix for ancient MinGW versions, that don't have defined these in ws2tcpip.h.
 // Todo: Can be removed when our pull-tester is upgraded to a modern MinGW
 // version.
@@ -393,6 +398,7 @@ CNode *CConnman::ConnectNode(CAddress addrConnect, const char *pszDest,
                       pszDest ? pszDest : "", false);
         pnode->nServicesExpected =
             ServiceFlags(addrConnect.nServices & nRelevantServices);
+        SetPeerRateLimits(pnode);
         pnode->AddRef();
 
         return pnode;
@@ -665,6 +671,7 @@ void CNode::copyStats(CNodeStats &stats) {
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
         X(nSendBytes);
+        X(nThrottledSends);
     }
     {
         LOCK(cs_vRecv);
@@ -838,14 +845,30 @@ const uint256 &CNetMessage::GetMessageHash() const {
     return data_hash;
 }
 
+CSharedNetMsg::CSharedNetMsg(std::string commandIn,
+                             std::vector<uint8_t> &&data)
+    : command(std::move(commandIn)) {
+    assert(data.size() >= CMessageHeader::HEADER_SIZE);
+    size_t nMessageSize = data.size() - CMessageHeader::HEADER_SIZE;
+    uint256 hash = Hash(data.data() + CMessageHeader::HEADER_SIZE,
+                        data.data() + data.size());
+    CMessageHeader hdr(Params().NetMagic(), command.c_str(), nMessageSize);
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, data, 0, hdr};
+    message = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+}
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const {
     AssertLockHeld(pnode->cs_vSend);
     size_t nSentSize = 0;
     size_t nMsgCount = 0;
 
-    for (const auto &data : pnode->vSendMsg) {
-        assert(data.size() > pnode->nSendOffset);
+    while (nMsgCount < pnode->vSendMsg.size()) {
+        // Write as many of the queued buffers as possible with one call.
+        size_t nBuffers = std::min(pnode->vSendMsg.size() - nMsgCount,
+                                   MAX_SEND_BUFFERS_PER_WRITE);
+        size_t nBatchSize = 0;
         int nBytes = 0;
 
         {
@@ -854,11 +877,44 @@ size_t CConnman::SocketSendData(CNode *pnode) const {
                 break;
             }
 
-            nBytes = send(pnode->hSocket,
-                          reinterpret_cast<const char *>(data.data()) +
-                              pnode->nSendOffset,
-                          data.size() - pnode->nSendOffset,
-                          MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            WSABUF vBuffers[MAX_SEND_BUFFERS_PER_WRITE];
+#else
+            struct iovec vBuffers[MAX_SEND_BUFFERS_PER_WRITE];
+#endif
+            for (size_t i = 0; i < nBuffers; i++) {
+                const CSendBuffer &data = pnode->vSendMsg[nMsgCount + i];
+                size_t nOffset = i == 0 ? pnode->nSendOffset : 0;
+                assert(data.size() > nOffset);
+#ifdef WIN32
+                vBuffers[i].buf = reinterpret_cast<char *>(
+                    const_cast<uint8_t *>(data.begin()) + nOffset);
+                vBuffers[i].len = data.size() - nOffset;
+#else
+                vBuffers[i].iov_base =
+                    const_cast<uint8_t *>(data.begin()) + nOffset;
+                vBuffers[i].iov_len = data.size() - nOffset;
+#endif
+                nBatchSize += data.size() - nOffset;
+            }
+
+#ifdef WIN32
+            DWORD nSent = 0;
+            nBytes = WSASend(pnode->hSocket, vBuffers, nBuffers, &nSent, 0,
+                             nullptr, nullptr) == SOCKET_ERROR
+                         ? -1
+                         : int(nSent);
+#else
+            struct msghdr msg = {};
+            msg.msg_iov = vBuffers;
+            msg.msg_iovlen = nBuffers;
+            int nFlags = MSG_NOSIGNAL | MSG_DONTWAIT;
+            if (nMsgCount + nBuffers < pnode->vSendMsg.size()) {
+                // Let the kernel fill the last segment with the rest.
+                nFlags |= MSG_MORE;
+            }
+            nBytes = sendmsg(pnode->hSocket, &msg, nFlags);
+#endif
         }
 
         if (nBytes == 0) {
@@ -881,17 +937,28 @@ size_t CConnman::SocketSendData(CNode *pnode) const {
         assert(nBytes > 0);
         pnode->nLastSend = GetSystemTimeInSeconds();
         pnode->nSendBytes += nBytes;
-        pnode->nSendOffset += nBytes;
         nSentSize += nBytes;
-        if (pnode->nSendOffset != data.size()) {
-            // could not send full message; stop sending more
-            break;
-        }
 
-        pnode->nSendOffset = 0;
-        pnode->nSendSize -= data.size();
+        // Drop the buffers which were fully written.
+        size_t nRemaining = nBytes;
+        while (nRemaining > 0) {
+            const CSendBuffer &data = pnode->vSendMsg[nMsgCount];
+            size_t nLeft = data.size() - pnode->nSendOffset;
+            if (nRemaining < nLeft) {
+                pnode->nSendOffset += nRemaining;
+                break;
+            }
+            nRemaining -= nLeft;
+            pnode->nSendOffset = 0;
+            pnode->nSendSize -= data.size();
+            nMsgCount++;
+        }
         pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-        nMsgCount++;
+
+        if (size_t(nBytes) != nBatchSize) {
+            // could not send everything; stop sending more
+            break;
+        }
     }
 
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(),
@@ -1192,6 +1259,7 @@ void CConnman::AcceptConnection(const ListenSocket &hListenSocket) {
                              CalculateKeyedNetGroup(addr), nonce, "", true);
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
+    SetPeerRateLimits(pnode);
 
     GetNodeSignals().InitializeNode(*config, pnode, *this);
 
@@ -1304,7 +1372,8 @@ void CConnman::ThreadSocketHandler() {
                 // * Hand off all complete messages to the processor, to be
                 // handled without blocking here.
 
-                bool select_recv = !pnode->fPauseRecv;
+                bool select_recv =
+                    !pnode->fPauseRecv && HasRecvAllowance(pnode);
                 bool select_send;
                 {
                     LOCK(pnode->cs_vSend);
@@ -1411,6 +1480,7 @@ void CConnman::ThreadSocketHandler() {
                         pnode->CloseSocketDisconnect();
                     }
                     RecordBytesRecv(nBytes);
+                    RecordTrafficRecv(pnode, nBytes);
                     if (notify) {
                         size_t nSizeAdded = 0;
                         auto it(pnode->vRecvMsg.begin());
@@ -1418,8 +1488,12 @@ void CConnman::ThreadSocketHandler() {
                             if (!it->complete()) {
                                 break;
                             }
-                            nSizeAdded +=
+                            size_t nSize =
                                 it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                            nSizeAdded += nSize;
+                            LOCK(cs_trafficShaper);
+                            nRecvBytesPerClass[GetTrafficClass(
+                                it->hdr.GetCommand())] += nSize;
                         }
                         {
                             LOCK(pnode->cs_vProcessMsg);
@@ -2106,8 +2180,10 @@ void CConnman::ThreadMessageHandler() {
             // Send messages
             {
                 LOCK(pnode->cs_sendProcessing);
+                CorkSend(pnode);
                 GetNodeSignals().SendMessages(*config, pnode, *this,
                                               flagInterruptMsgProc);
+                UncorkSend(pnode);
             }
             if (flagInterruptMsgProc) {
                 return;
@@ -2335,6 +2411,14 @@ CConnman::CConnman(const Config &configIn, uint64_t nSeed0In, uint64_t nSeed1In)
     nBestHeight = 0;
     clientInterface = nullptr;
     flagInterruptMsgProc = false;
+    nMaxUploadRate = 0;
+    nMaxDownloadRate = 0;
+    nPeerBandwidthShare = 100;
+    nThrottledSends = 0;
+    for (int i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+        nSendBytesPerClass[i] = 0;
+        nRecvBytesPerClass[i] = 0;
+    }
 }
 
 NodeId CConnman::GetNewNodeId() {
@@ -2361,6 +2445,9 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
+    SetRateLimits(connOptions.nMaxUploadRate, connOptions.nMaxDownloadRate,
+                  connOptions.nPeerBandwidthShare);
+
     SetBestHeight(connOptions.nBestHeight);
 
     clientInterface = connOptions.uiInterface;
@@ -2764,6 +2851,137 @@ uint64_t CConnman::GetOutboundTargetBytesLeft() {
                : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
 }
 
+TrafficClass GetTrafficClass(const std::string &command) {
+    if (command == NetMsgType::BLOCK || command == NetMsgType::CMPCTBLOCK ||
+        command == NetMsgType::BLOCKTXN || command == NetMsgType::GETBLOCKTXN ||
+        command == NetMsgType::GRAPHENEBLOCK ||
+        command == NetMsgType::MERKLEBLOCK || command == NetMsgType::HEADERS) {
+        return TRAFFIC_BLOCK;
+    }
+    if (command == NetMsgType::TX || command == NetMsgType::INV ||
+        command == NetMsgType::GETDATA || command == NetMsgType::NOTFOUND) {
+        return TRAFFIC_TX;
+    }
+    if (command == NetMsgType::ADDR || command == NetMsgType::GETADDR) {
+        return TRAFFIC_ADDR;
+    }
+    return TRAFFIC_OTHER;
+}
+
+const char *GetTrafficClassName(TrafficClass trafficClass) {
+    switch (trafficClass) {
+        case TRAFFIC_BLOCK:
+            return "block";
+        case TRAFFIC_TX:
+            return "tx";
+        case TRAFFIC_ADDR:
+            return "addr";
+        default:
+            return "other";
+    }
+}
+
+void CConnman::SetRateLimits(uint64_t nMaxUploadRateIn,
+                             uint64_t nMaxDownloadRateIn,
+                             unsigned int nPeerBandwidthShareIn) {
+    LOCK(cs_trafficShaper);
+    int64_t nNow = GetTimeMicros();
+    nMaxUploadRate = nMaxUploadRateIn;
+    nMaxDownloadRate = nMaxDownloadRateIn;
+    nPeerBandwidthShare =
+        std::max(1U, std::min(nPeerBandwidthShareIn, 100U));
+    sendBucket.SetRate(nMaxUploadRate, nNow);
+    for (int i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+        sendClassBuckets[i].SetRate(
+            nMaxUploadRate * TRAFFIC_CLASS_UPLOAD_SHARE[i] / 100.0, nNow);
+    }
+    recvBucket.SetRate(nMaxDownloadRate, nNow);
+}
+
+void CConnman::SetPeerRateLimits(CNode *pnode) {
+    // Whitelisted peers are set after the node is created, so they get rate
+    // limits as well, which HasSendAllowance ignores.
+    int64_t nNow = GetTimeMicros();
+    double dSendRate, dRecvRate;
+    {
+        LOCK(cs_trafficShaper);
+        dSendRate = nMaxUploadRate * nPeerBandwidthShare / 100.0;
+        dRecvRate = nMaxDownloadRate * nPeerBandwidthShare / 100.0;
+    }
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->sendBucket.SetRate(dSendRate, nNow);
+    }
+    pnode->recvBucket.SetRate(dRecvRate, nNow);
+}
+
+bool CConnman::HasSendAllowance(CNode *pnode, TrafficClass trafficClass) {
+    if (pnode->fWhitelisted) {
+        return true;
+    }
+
+    int64_t nNow = GetTimeMicros();
+    LOCK(pnode->cs_vSend);
+    if (!pnode->sendBucket.HasTokens(nNow)) {
+        return false;
+    }
+    LOCK(cs_trafficShaper);
+    return sendBucket.HasTokens(nNow) &&
+           sendClassBuckets[trafficClass].HasTokens(nNow);
+}
+
+void CConnman::RecordThrottledSend(CNode *pnode) {
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->nThrottledSends++;
+    }
+    LOCK(cs_trafficShaper);
+    nThrottledSends++;
+}
+
+// Requires pnode->cs_vSend.
+void CConnman::RecordTrafficSent(CNode *pnode, TrafficClass trafficClass,
+                                 size_t nBytes) {
+    int64_t nNow = GetTimeMicros();
+    pnode->sendBucket.Consume(nBytes, nNow);
+    LOCK(cs_trafficShaper);
+    sendBucket.Consume(nBytes, nNow);
+    sendClassBuckets[trafficClass].Consume(nBytes, nNow);
+    nSendBytesPerClass[trafficClass] += nBytes;
+}
+
+bool CConnman::HasRecvAllowance(CNode *pnode) {
+    if (pnode->fWhitelisted) {
+        return true;
+    }
+
+    int64_t nNow = GetTimeMicros();
+    if (!pnode->recvBucket.HasTokens(nNow)) {
+        return false;
+    }
+    LOCK(cs_trafficShaper);
+    return recvBucket.HasTokens(nNow);
+}
+
+void CConnman::RecordTrafficRecv(CNode *pnode, size_t nBytes) {
+    int64_t nNow = GetTimeMicros();
+    pnode->recvBucket.Consume(nBytes, nNow);
+    LOCK(cs_trafficShaper);
+    recvBucket.Consume(nBytes, nNow);
+}
+
+void CConnman::GetTrafficStats(CTrafficStats &stats) {
+    LOCK(cs_trafficShaper);
+    stats.nMaxUploadRate = nMaxUploadRate;
+    stats.nMaxDownloadRate = nMaxDownloadRate;
+    stats.nPeerBandwidthShare = nPeerBandwidthShare;
+    stats.nThrottledSends = nThrottledSends;
+    for (int i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+        stats.nSendBytesPerClass[i] = nSendBytesPerClass[i];
+        stats.nRecvBytesPerClass[i] = nRecvBytesPerClass[i];
+    }
+}
+
 uint64_t CConnman::GetTotalBytesRecv() {
     LOCK(cs_totalBytesRecv);
     return nTotalBytesRecv;
@@ -2825,6 +3043,10 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn,
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fSendCorked = false;
+    fCompressSend = false;
+    fCompressRecv = false;
+    nThrottledSends = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2918,35 +3140,73 @@ bool CConnman::NodeFullyConnected(const CNode *pnode) {
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
+/**
+ * Get an owned buffer at the end of a send queue with room for nSize more
+ * bytes. Appending to it is fine even if it is partially sent, as long as it is
+ * not reallocated.
+ */
+static std::vector<uint8_t> &GetSendBuffer(std::deque<CSendBuffer> &vSendMsg,
+                                           size_t nSize) {
+    if (vSendMsg.empty() || vSendMsg.back().SpareCapacity() < nSize) {
+        vSendMsg.emplace_back();
+        vSendMsg.back().GetOwned().reserve(std::max(nSize, SEND_BUFFER_SIZE));
+    }
+    return vSendMsg.back().GetOwned();
+}
+
 void CConnman::PushMessage(CNode *pnode, CSerializedNetMsg &&msg) {
+    TrafficClass trafficClass = GetTrafficClass(msg.command);
+    if (!pnode->fCompressSend) {
+        QueueMessage(pnode, std::move(msg), trafficClass);
+        return;
+    }
+
+    LOCK(pnode->cs_sendCompressor);
+    std::vector<uint8_t> vCompressed;
+    if (pnode->sendCompressor.Compress(msg.command, msg.data, vCompressed)) {
+        msg.command = NetMsgType::COMPRESSED;
+        msg.data.swap(vCompressed);
+    }
+    QueueMessage(pnode, std::move(msg), trafficClass);
+}
+
+void CConnman::QueueMessage(CNode *pnode, CSerializedNetMsg &&msg,
+                            TrafficClass trafficClass) {
     size_t nMessageSize = msg.data.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",
              SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
 
-    std::vector<uint8_t> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
     uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().NetMagic(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    bool fCoalescePayload = nMessageSize <= MAX_COALESCED_PAYLOAD_SIZE;
+    size_t nCopySize =
+        CMessageHeader::HEADER_SIZE + (fCoalescePayload ? nMessageSize : 0);
 
     size_t nBytesSent = 0;
     {
         LOCK(pnode->cs_vSend);
-        bool optimisticSend(pnode->vSendMsg.empty());
+        bool optimisticSend(pnode->vSendMsg.empty() && !pnode->fSendCorked);
 
         // log total amount of bytes per command
         pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        RecordTrafficSent(pnode, trafficClass, nTotalSize);
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize) {
             pnode->fPauseSend = true;
         }
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize) {
-            pnode->vSendMsg.push_back(std::move(msg.data));
+
+        std::vector<uint8_t> &buffer =
+            GetSendBuffer(pnode->vSendMsg, nCopySize);
+        CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, buffer, buffer.size(),
+                      hdr};
+        if (fCoalescePayload) {
+            buffer.insert(buffer.end(), msg.data.begin(), msg.data.end());
+        } else {
+            pnode->vSendMsg.emplace_back(std::move(msg.data));
         }
 
         // If write queue empty, attempt "optimistic write"
@@ -2959,6 +3219,78 @@ void CConnman::PushMessage(CNode *pnode, CSerializedNetMsg &&msg) {
     }
 }
 
+void CConnman::PushMessage(CNode *pnode, const CSharedNetMsg &msg) {
+    size_t nTotalSize = msg.size();
+    if (pnode->fCompressSend &&
+        CNetMsgCompressor::IsWorthCompressing(
+            msg.command, nTotalSize - CMessageHeader::HEADER_SIZE)) {
+        // The compressed payload is specific to this peer.
+        CSerializedNetMsg copy;
+        copy.command = msg.command;
+        copy.data.assign(msg.message->begin() + CMessageHeader::HEADER_SIZE,
+                         msg.message->end());
+        PushMessage(pnode, std::move(copy));
+        return;
+    }
+
+    LogPrint(BCLog::NET, "sending %s (%d bytes, shared) peer=%d\n",
+             SanitizeString(msg.command.c_str()),
+             nTotalSize - CMessageHeader::HEADER_SIZE, pnode->id);
+
+    size_t nBytesSent = 0;
+    {
+        LOCK(pnode->cs_vSend);
+        bool optimisticSend(pnode->vSendMsg.empty() && !pnode->fSendCorked);
+
+        // log total amount of bytes per command
+        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        RecordTrafficSent(pnode, GetTrafficClass(msg.command), nTotalSize);
+        pnode->nSendSize += nTotalSize;
+
+        if (pnode->nSendSize > nSendBufferMaxSize) {
+            pnode->fPauseSend = true;
+        }
+
+        // Small messages are cheaper to copy than to queue on their own.
+        if (nTotalSize <=
+            CMessageHeader::HEADER_SIZE + MAX_COALESCED_PAYLOAD_SIZE) {
+            std::vector<uint8_t> &buffer =
+                GetSendBuffer(pnode->vSendMsg, nTotalSize);
+            buffer.insert(buffer.end(), msg.message->begin(),
+                          msg.message->end());
+        } else {
+            pnode->vSendMsg.emplace_back(msg.message);
+        }
+
+        // If write queue empty, attempt "optimistic write"
+        if (optimisticSend == true) {
+            nBytesSent = SocketSendData(pnode);
+        }
+    }
+    if (nBytesSent) {
+        RecordBytesSent(nBytesSent);
+    }
+}
+
+void CConnman::CorkSend(CNode *pnode) {
+    LOCK(pnode->cs_vSend);
+    pnode->fSendCorked = true;
+}
+
+void CConnman::UncorkSend(CNode *pnode) {
+    size_t nBytesSent = 0;
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->fSendCorked = false;
+        if (!pnode->vSendMsg.empty()) {
+            nBytesSent = SocketSendData(pnode);
+        }
+    }
+    if (nBytesSent) {
+        RecordBytesSent(nBytesSent);
+    }
+}
+
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode *pnode)> func) {
     CNode *found = nullptr;
     LOCK(cs_vNodes);
@@ -17,6 +17,7 @@
 #include "hash.h"
 #include "limitedmap.h"
 #include "netaddress.h"
+#include "netcompression.h"
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
@@ -85,6 +86,11 @@ static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** The default timeframe for -maxuploadtarget. 1 day. */
 static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
+/** The default for -maxuploadrate and -maxdownloadrate. 0 = Unlimited */
+static const uint64_t DEFAULT_MAX_UPLOAD_RATE = 0;
+static const uint64_t DEFAULT_MAX_DOWNLOAD_RATE = 0;
+/** The default for -peerbandwidthshare, in percent */
+static const unsigned int DEFAULT_PEER_BANDWIDTH_SHARE = 50;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
 
@@ -94,6 +100,14 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = true;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER = 1 * 1000;
+/** Size of the buffers in which message headers and small payloads are queued
+ * for sending */
+static const size_t SEND_BUFFER_SIZE = 16 * 1024;
+/** Payloads up to this size are copied into a send buffer, larger ones are
+ * queued as they are */
+static const size_t MAX_COALESCED_PAYLOAD_SIZE = 4 * 1024;
+/** Maximum number of queued buffers written with a single system call */
+static const size_t MAX_SEND_BUFFERS_PER_WRITE = 64;
 
 static const ServiceFlags REQUIRED_SERVICES = ServiceFlags(NODE_NETWORK);
 
@@ -103,6 +117,81 @@ static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;
 
 typedef int64_t NodeId;
 
+/** Classes of traffic the rate limiter accounts for separately. */
+enum TrafficClass {
+    TRAFFIC_BLOCK,
+    TRAFFIC_TX,
+    TRAFFIC_ADDR,
+    TRAFFIC_OTHER,
+    TRAFFIC_CLASS_COUNT,
+};
+
+/** Percentage of the upload rate each class of traffic may use. */
+static const unsigned int TRAFFIC_CLASS_UPLOAD_SHARE[TRAFFIC_CLASS_COUNT] = {
+    100, 50, 10, 100,
+};
+
+/** The class of traffic of messages with the given command. */
+TrafficClass GetTrafficClass(const std::string &command);
+const char *GetTrafficClassName(TrafficClass trafficClass);
+
+/**
+ * Token bucket refilled at a fixed rate (in bytes per second) up to one
+ * second worth of tokens. Traffic is allowed while the bucket holds tokens and
+ * may overdraw it, so that a large message delays the ones after it rather
+ * than being held back forever. A rate of 0 means no limit.
+ */
+class CTokenBucket {
+private:
+    double dRate;
+    double dTokens;
+    int64_t nLastRefill;
+
+    void Refill(int64_t nNowMicros) {
+        if (nNowMicros > nLastRefill) {
+            double dRefill = dRate * (nNowMicros - nLastRefill) / 1e6;
+            dTokens = std::min(dRate, dTokens + dRefill);
+            nLastRefill = nNowMicros;
+        }
+    }
+
+public:
+    CTokenBucket() : dRate(0), dTokens(0), nLastRefill(0) {}
+
+    void SetRate(double dRateIn, int64_t nNowMicros) {
+        dRate = dRateIn;
+        dTokens = dRate;
+        nLastRefill = nNowMicros;
+    }
+    double GetRate() const { return dRate; }
+
+    bool HasTokens(int64_t nNowMicros) {
+        if (dRate == 0) {
+            return true;
+        }
+        Refill(nNowMicros);
+        return dTokens > 0;
+    }
+
+    void Consume(size_t nBytes, int64_t nNowMicros) {
+        if (dRate == 0) {
+            return;
+        }
+        Refill(nNowMicros);
+        dTokens -= nBytes;
+    }
+};
+
+/** Rate limits and per class traffic totals of a CConnman. */
+struct CTrafficStats {
+    uint64_t nMaxUploadRate;
+    uint64_t nMaxDownloadRate;
+    unsigned int nPeerBandwidthShare;
+    uint64_t nThrottledSends;
+    uint64_t nSendBytesPerClass[TRAFFIC_CLASS_COUNT];
+    uint64_t nRecvBytesPerClass[TRAFFIC_CLASS_COUNT];
+};
+
 struct AddedNodeInfo {
     std::string strAddedNode;
     CService resolvedAddress;
@@ -126,6 +215,63 @@ struct CSerializedNetMsg {
     std::string command;
 };
 
+/**
+ * A message which is serialized once and can be pushed to any number of peers.
+ * Its header and payload are kept in one immutable, reference counted buffer,
+ * which is queued for each peer without copying.
+ */
+class CSharedNetMsg {
+public:
+    CSharedNetMsg() {}
+    /**
+     * Complete a message whose payload was serialized after
+     * CMessageHeader::HEADER_SIZE bytes left free at the start of data.
+     */
+    CSharedNetMsg(std::string commandIn, std::vector<uint8_t> &&data);
+
+    bool IsNull() const { return !message; }
+    const std::string &GetCommand() const { return command; }
+    //! Size of the header and payload.
+    size_t size() const { return message->size(); }
+
+private:
+    friend class CConnman;
+
+    std::string command;
+    std::shared_ptr<const std::vector<uint8_t>> message;
+};
+
+/**
+ * Data queued for sending to a peer: either a buffer owned by the queue, which
+ * can be appended to, or an immutable one shared with other peers' queues.
+ */
+class CSendBuffer {
+public:
+    CSendBuffer() {}
+    explicit CSendBuffer(std::vector<uint8_t> &&dataIn)
+        : data(std::move(dataIn)) {}
+    explicit CSendBuffer(std::shared_ptr<const std::vector<uint8_t>> sharedIn)
+        : shared(std::move(sharedIn)) {}
+
+    const uint8_t *begin() const {
+        return shared ? shared->data() : data.data();
+    }
+    size_t size() const { return shared ? shared->size() : data.size(); }
+    //! Bytes which can be appended without reallocating, 0 if shared.
+    size_t SpareCapacity() const {
+        return shared ? 0 : data.capacity() - data.size();
+    }
+    //! The owned buffer, to append to it.
+    std::vector<uint8_t> &GetOwned() {
+        assert(!shared);
+        return data;
+    }
+
+private:
+    std::vector<uint8_t> data;
+    std::shared_ptr<const std::vector<uint8_t>> shared;
+};
+
 class CConnman {
 public:
     enum NumConnections {
@@ -148,6 +294,9 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        uint64_t nMaxUploadRate = 0;
+        uint64_t nMaxDownloadRate = 0;
+        unsigned int nPeerBandwidthShare = 100;
     };
     CConnman(const Config &configIn, uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -169,6 +318,14 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode *pnode)> func);
 
     void PushMessage(CNode *pnode, CSerializedNetMsg &&msg);
+    void PushMessage(CNode *pnode, const CSharedNetMsg &msg);
+    /**
+     * Only queue the messages pushed to a peer until UncorkSend, so that they
+     * are written together instead of in one small segment each.
+     */
+    void CorkSend(CNode *pnode);
+    /** Write the messages queued for a peer since CorkSend. */
+    void UncorkSend(CNode *pnode);
 
     template <typename Callable> void ForEachNode(Callable &&func) {
         LOCK(cs_vNodes);
@@ -274,6 +431,22 @@ public:
     // in case of no limit, it will always response 0
     uint64_t GetMaxOutboundTimeLeftInCycle();
 
+    /**
+     * Whether traffic of the given class may be sent to a peer now, within
+     * -maxuploadrate and -peerbandwidthshare. Everything sent counts against
+     * the limits, but only traffic which can be deferred, like transactions
+     * and historical blocks, waits for them, so that new blocks go first.
+     */
+    bool HasSendAllowance(CNode *pnode, TrafficClass trafficClass);
+    //! Count a send held back because HasSendAllowance denied it, once per
+    // send however often it is retried.
+    void RecordThrottledSend(CNode *pnode);
+    //! set the rate limits in bytes per second, 0 = no limit. Only applies to
+    // peers connected afterwards.
+    void SetRateLimits(uint64_t nMaxUploadRateIn, uint64_t nMaxDownloadRateIn,
+                       unsigned int nPeerBandwidthShareIn);
+    void GetTrafficStats(CTrafficStats &stats);
+
     uint64_t GetTotalBytesRecv();
     uint64_t GetTotalBytesSent();
 
@@ -321,6 +494,13 @@ private:
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    void QueueMessage(CNode *pnode, CSerializedNetMsg &&msg,
+                      TrafficClass trafficClass);
+    void SetPeerRateLimits(CNode *pnode);
+    void RecordTrafficSent(CNode *pnode, TrafficClass trafficClass,
+                           size_t nBytes);
+    bool HasRecvAllowance(CNode *pnode);
+    void RecordTrafficRecv(CNode *pnode, size_t nBytes);
     //! check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //! set the "dirty" flag for the banlist
@@ -352,6 +532,18 @@ private:
     uint64_t nMaxOutboundLimit;
     uint64_t nMaxOutboundTimeframe;
 
+    // Rate limits & per class stats, see CTokenBucket.
+    CCriticalSection cs_trafficShaper;
+    CTokenBucket sendBucket;
+    CTokenBucket sendClassBuckets[TRAFFIC_CLASS_COUNT];
+    CTokenBucket recvBucket;
+    uint64_t nMaxUploadRate;
+    uint64_t nMaxDownloadRate;
+    unsigned int nPeerBandwidthShare;
+    uint64_t nThrottledSends;
+    uint64_t nSendBytesPerClass[TRAFFIC_CLASS_COUNT];
+    uint64_t nRecvBytesPerClass[TRAFFIC_CLASS_COUNT];
+
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
     std::vector<CSubNet> vWhitelistedRange;
@@ -512,6 +704,7 @@ public:
     int nStartingHeight;
     uint64_t nSendBytes;
     mapMsgCmdSize mapSendBytesPerMsgCmd;
+    uint64_t nThrottledSends;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
     bool fWhitelisted;
@@ -589,8 +782,30 @@ public:
     // Offset inside the first vSendMsg already sent.
     size_t nSendOffset;
     uint64_t nSendBytes;
-    std::deque<std::vector<uint8_t>> vSendMsg;
+    // Message headers and small payloads are appended to the last entry while
+    // it has spare capacity, larger payloads get their own, possibly shared,
+    // entry.
+    std::deque<CSendBuffer> vSendMsg;
+    // While set, PushMessage only queues messages, see CConnman::CorkSend.
+    bool fSendCorked;
     CCriticalSection cs_vSend;
+    // Set once the peer told us it can decode "compressed" messages. Messages
+    // are compressed and queued under cs_sendCompressor, so that the peer
+    // decompresses them in the order they were compressed.
+    std::atomic_bool fCompressSend;
+    CCriticalSection cs_sendCompressor;
+    CNetMsgCompressor sendCompressor;
+    // Share of the upload rate limit for this peer and how often it held back
+    // traffic, protected by cs_vSend.
+    CTokenBucket sendBucket;
+    uint64_t nThrottledSends;
+    // Share of the download rate limit for this peer, only used by the socket
+    // handler thread.
+    CTokenBucket recvBucket;
+    // Set once we told the peer it may send us "compressed" messages. The
+    // messages received are only decompressed by the message handler thread.
+    std::atomic_bool fCompressRecv;
+    CNetMsgCompressor recvCompressor;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
 
@@ -601,6 +816,9 @@ public:
     CCriticalSection cs_sendProcessing;
 
     std::deque<CInv> vRecvGetData;
+    // getdata requests held back by the rate limiter, answered before
+    // vRecvGetData once it allows.
+    std::deque<CInv> vThrottledGetData;
     uint64_t nRecvBytes;
     std::atomic<int> nRecvVersion;
 
@@ -11,11 +11,13 @@
 #include "chainparams.h"
 #include "config.h"
 #include "consensus/validation.h"
+#include "graphene.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "netbase.h"
+#include "netcompression.h"
 #include "netmessagemaker.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
@@ -31,6 +33,10 @@
 #include "validation.h"
 #include "validationinterface.h"
 
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
 #include <boost/range/adaptor/reversed.hpp>
 #include <boost/thread.hpp>
 
@@ -41,23 +47,7 @@
 // Used only to inform the wallet of when we last received a block.
 std::atomic<int64_t> nTimeBestReceived(0);
 
-struct IteratorComparator {
-    template <typename I> bool operator()(const I &a, const I &b) {
-        return &(*a) < &(*b);
-    }
-};
-
-struct COrphanTx {
-    // When modifying, adapt the copy of this definition in tests/DoS_tests.
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-std::map<COutPoint,
-         std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>>
-    mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+CTxOrphanPool orphanpool;
 
 static size_t vExtraTxnForCompactIt = 0;
 static std::vector<std::pair<uint256, CTransactionRef>>
@@ -110,6 +100,8 @@ struct QueuedBlock {
     bool fValidatedHeaders;
     //!< Optional, used for CMPCTBLOCK downloads
     std::unique_ptr<PartiallyDownloadedBlock> partialBlock;
+    //!< When the block was requested (in microseconds).
+    int64_t nTimeRequested;
 };
 std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator>>
     mapBlocksInFlight;
@@ -123,8 +115,17 @@ int nPreferredDownload = 0;
 /** Number of peers from which we're downloading blocks. */
 int nPeersWithValidatedDownloads = 0;
 
+/**
+ * A transaction in the relay map. It is serialized on the first request for
+ * it, and the message is then reused for every peer asking for it.
+ */
+struct RelayTx {
+    CTransactionRef tx;
+    CSharedNetMsg msg;
+};
+
 /** Relay map, protected by cs_main. */
-typedef std::map<uint256, CTransactionRef> MapRelay;
+typedef std::map<uint256, RelayTx> MapRelay;
 MapRelay mapRelay;
 /** Expiration-time ordered list of (expire time, relay map entry) pairs,
  * protected by cs_main). */
@@ -186,6 +187,16 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! How many blocks we are willing to have in flight from this peer.
+    int nBlocksInTransitLimit;
+    //! Estimated rate (in bytes per second) at which this peer delivers the
+    //! blocks we request from it, or 0 if unknown.
+    double dBlockDownloadRate;
+    //! Average size (in bytes) of the blocks this peer delivered to us.
+    double dAvgBlockSize;
+    //! When we last received a requested block from this peer (in
+    //! microseconds), or 0.
+    int64_t nLastBlockReceived;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block
@@ -207,6 +218,8 @@ struct CNodeState {
      * non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether this peer will send us graphene blocks if we request them.
+    bool fSupportsGraphene;
 
     CNodeState(CAddress addrIn, std::string addrNameIn)
         : address(addrIn), name(addrNameIn) {
@@ -223,11 +236,16 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksInTransitLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        dBlockDownloadRate = 0;
+        dAvgBlockSize = 0;
+        nLastBlockReceived = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
         fProvidesHeaderAndIDs = false;
         fSupportsDesiredCmpctVersion = false;
+        fSupportsGraphene = false;
     }
 };
 
@@ -336,7 +354,7 @@ void FinalizeNode(NodeId nodeid, bool &fUpdateConnectionTime) {
         }
     }
 
-    EraseOrphansFor(nodeid);
+    orphanpool.EraseForPeer(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -384,6 +402,81 @@ bool MarkBlockAsReceived(const uint256 &hash) {
     return false;
 }
 
+// Requires cs_main.
+// Update the download rate estimate of the peer the block is in flight from,
+// if that is the peer which delivered it. Must be called before
+// MarkBlockAsReceived.
+static void UpdateBlockDownloadRate(NodeId nodeid, const uint256 &hash,
+                                    size_t nSize) {
+    std::map<uint256,
+             std::pair<NodeId, std::list<QueuedBlock>::iterator>>::iterator
+        itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() ||
+        itInFlight->second.first != nodeid) {
+        return;
+    }
+
+    CNodeState *state = State(nodeid);
+    int64_t nNow = GetTimeMicros();
+    // Blocks are delivered one after the other, so the time spent on this one
+    // started when the previous one arrived, unless the peer was idle.
+    int64_t nElapsed =
+        nNow - std::max(itInFlight->second.second->nTimeRequested,
+                        state->nLastBlockReceived);
+    state->nLastBlockReceived = nNow;
+    double dRate = 1e6 * nSize / std::max<int64_t>(nElapsed, 1000);
+    if (state->dBlockDownloadRate == 0) {
+        state->dBlockDownloadRate = dRate;
+        state->dAvgBlockSize = nSize;
+    } else {
+        state->dBlockDownloadRate += (dRate - state->dBlockDownloadRate) / 8;
+        state->dAvgBlockSize += (nSize - state->dAvgBlockSize) / 8;
+    }
+}
+
+// The size to account for a block delivered as a compact or graphene block.
+// Download rates are in block bytes, so that the blocks in flight from a peer
+// are sized alike however it delivers them.
+static size_t GetBlockDownloadSize(const CBlock &block) {
+    return ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+}
+
+// Number of blocks to keep in flight from a peer so it stays busy for
+// BLOCK_DOWNLOAD_TARGET_TIME plus its round trip time at its measured download
+// rate.
+static int GetBlocksInTransitLimit(const CNodeState &state, int64_t nRTT) {
+    if (state.dBlockDownloadRate == 0 || state.dAvgBlockSize == 0) {
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    }
+    double dBlocks = state.dBlockDownloadRate *
+                     (BLOCK_DOWNLOAD_TARGET_TIME + nRTT) / 1e6 /
+                     state.dAvgBlockSize;
+    if (dBlocks >= MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER) {
+        return MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER;
+    }
+    return std::max<int>(std::ceil(dBlocks), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+// Requires cs_main.
+// Whether the block at the base of the download window, in flight from
+// nodeStaller, should be requested from nodeid instead because the latter is
+// expected to deliver it much sooner.
+static bool ShouldReassignBlock(NodeId nodeid, NodeId nodeStaller,
+                                const uint256 &hash) {
+    const CNodeState *state = State(nodeid);
+    const CNodeState *stateStaller = State(nodeStaller);
+    if (state->dBlockDownloadRate == 0 ||
+        state->dBlockDownloadRate <= stateStaller->dBlockDownloadRate) {
+        return false;
+    }
+
+    const QueuedBlock &queuedBlock = *mapBlocksInFlight[hash].second;
+    int64_t nExpected = 1e6 * state->dAvgBlockSize / state->dBlockDownloadRate;
+    int64_t nInFlight = GetTimeMicros() - queuedBlock.nTimeRequested;
+    return nInFlight > BLOCK_REASSIGN_MIN_TIME &&
+           nInFlight > BLOCK_REASSIGN_FACTOR * nExpected;
+}
+
 // Requires cs_main.
 // returns false, still setting pit, if the block was already in flight from the
 // same peer pit will only be valid as long as the same cs_main lock is being
@@ -413,7 +506,8 @@ MarkBlockAsInFlight(const Config &config, NodeId nodeid, const uint256 &hash,
         state->vBlocksInFlight.end(),
         {hash, pindex, pindex != nullptr,
          std::unique_ptr<PartiallyDownloadedBlock>(
-             pit ? new PartiallyDownloadedBlock(config, &mempool) : nullptr)});
+             pit ? new PartiallyDownloadedBlock(config, &mempool) : nullptr),
+         GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -595,6 +689,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count,
     int nMaxHeight =
         std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex *pindexWaiting = nullptr;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed)
         // successors of pindexWalk (towards pindexBestKnownBlock) into
@@ -633,6 +728,20 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count,
                         // We aren't able to fetch anything, but we would be if
                         // the download window was one larger.
                         nodeStaller = waitingfor;
+                        if (waitingfor != -1 &&
+                            ShouldReassignBlock(
+                                nodeid, waitingfor,
+                                pindexWaiting->GetBlockHash())) {
+                            // Ask this peer for the block holding back the
+                            // window instead.
+                            LogPrint(BCLog::NET,
+                                     "Reassigning block %s (%d) from peer=%d "
+                                     "to peer=%d\n",
+                                     pindexWaiting->GetBlockHash().ToString(),
+                                     pindexWaiting->nHeight, waitingfor,
+                                     nodeid);
+                            vBlocks.push_back(pindexWaiting);
+                        }
                     }
                     return;
                 }
@@ -643,6 +752,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count,
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaiting = pindex;
             }
         }
     }
@@ -667,6 +777,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
         }
     }
+    stats.nBlocksInTransitLimit = state->nBlocksInTransitLimit;
+    stats.dBlockDownloadRate = state->dBlockDownloadRate;
     return true;
 }
 
@@ -686,7 +798,7 @@ void UnregisterNodeSignals(CNodeSignals &nodeSignals) {
 
 //////////////////////////////////////////////////////////////////////////////
 //
-// mapOrphanTransactions
+// vExtraTxnForCompact
 //
 
 void AddToCompactExtraTransactions(const CTransactionRef &tx) {
@@ -705,121 +817,6 @@ void AddToCompactExtraTransactions(const CTransactionRef &tx) {
     vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
 }
 
-bool AddOrphanTx(const CTransactionRef &tx, NodeId peer)
-    EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
-    const uint256 &txid = tx->GetId();
-    if (mapOrphanTransactions.count(txid)) {
-        return false;
-    }
-
-    // Ignore big transactions, to avoid a send-big-orphans memory exhaustion
-    // attack. If a peer has a legitimate large transaction with a missing
-    // parent then we assume it will rebroadcast it later, after the parent
-    // transaction(s) have been mined or received.
-    // 100 orphans, each of which is at most 99,999 bytes big is at most 10
-    // megabytes of orphans and somewhat more byprev index (in the worst case):
-    unsigned int sz = GetTransactionSize(*tx);
-    if (sz >= MAX_STANDARD_TX_SIZE) {
-        LogPrint(BCLog::MEMPOOL,
-                 "ignoring large orphan tx (size: %u, hash: %s)\n", sz,
-                 txid.ToString());
-        return false;
-    }
-
-    auto ret = mapOrphanTransactions.emplace(
-        txid, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
-    assert(ret.second);
-    for (const CTxIn &txin : tx->vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
-    }
-
-    AddToCompactExtraTransactions(tx);
-
-    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u)\n",
-             txid.ToString(), mapOrphanTransactions.size(),
-             mapOrphanTransactionsByPrev.size());
-    return true;
-}
-
-static int EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
-    std::map<uint256, COrphanTx>::iterator it =
-        mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end()) {
-        return 0;
-    }
-    for (const CTxIn &txin : it->second.tx->vin) {
-        auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
-        if (itPrev == mapOrphanTransactionsByPrev.end()) {
-            continue;
-        }
-        itPrev->second.erase(it);
-        if (itPrev->second.empty()) {
-            mapOrphanTransactionsByPrev.erase(itPrev);
-        }
-    }
-    mapOrphanTransactions.erase(it);
-    return 1;
-}
-
-void EraseOrphansFor(NodeId peer) {
-    int nErased = 0;
-    std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end()) {
-        // Increment to avoid iterator becoming invalid.
-        std::map<uint256, COrphanTx>::iterator maybeErase = iter++;
-        if (maybeErase->second.fromPeer == peer) {
-            nErased += EraseOrphanTx(maybeErase->second.tx->GetId());
-        }
-    }
-    if (nErased > 0) {
-        LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx from peer=%d\n", nErased,
-                 peer);
-    }
-}
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
-    EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
-    unsigned int nEvicted = 0;
-    static int64_t nNextSweep;
-    int64_t nNow = GetTime();
-    if (nNextSweep <= nNow) {
-        // Sweep out expired orphan pool entries:
-        int nErased = 0;
-        int64_t nMinExpTime =
-            nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        std::map<uint256, COrphanTx>::iterator iter =
-            mapOrphanTransactions.begin();
-        while (iter != mapOrphanTransactions.end()) {
-            std::map<uint256, COrphanTx>::iterator maybeErase = iter++;
-            if (maybeErase->second.nTimeExpire <= nNow) {
-                nErased += EraseOrphanTx(maybeErase->second.tx->GetId());
-            } else {
-                nMinExpTime =
-                    std::min(maybeErase->second.nTimeExpire, nMinExpTime);
-            }
-        }
-        // Sweep again 5 minutes after the next entry that expires in order to
-        // batch the linear scan.
-        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
-        if (nErased > 0) {
-            LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx due to expiration\n",
-                     nErased);
-        }
-    }
-    while (mapOrphanTransactions.size() > nMaxOrphans) {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        std::map<uint256, COrphanTx>::iterator it =
-            mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end()) {
-            it = mapOrphanTransactions.begin();
-        }
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
-}
-
 // Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch, const std::string &reason) {
     if (howmuch == 0) {
@@ -866,54 +863,24 @@ PeerLogicValidation::PeerLogicValidation(CConnman *connmanIn)
 void PeerLogicValidation::BlockConnected(
     const std::shared_ptr<const CBlock> &pblock, const CBlockIndex *pindex,
     const std::vector<CTransactionRef> &vtxConflicted) {
-    LOCK(cs_main);
-
-    std::vector<uint256> vOrphanErase;
-
-    for (const CTransactionRef &ptx : pblock->vtx) {
-        const CTransaction &tx = *ptx;
-
-        // Which orphan pool entries must we evict?
-        for (size_t j = 0; j < tx.vin.size(); j++) {
-            auto itByPrev = mapOrphanTransactionsByPrev.find(tx.vin[j].prevout);
-            if (itByPrev == mapOrphanTransactionsByPrev.end()) {
-                continue;
-            }
-
-            for (auto mi = itByPrev->second.begin();
-                 mi != itByPrev->second.end(); ++mi) {
-                const CTransaction &orphanTx = *(*mi)->second.tx;
-                const uint256 &orphanHash = orphanTx.GetHash();
-                vOrphanErase.push_back(orphanHash);
-            }
-        }
-    }
-
-    // Erase orphan transactions include or precluded by this block
-    if (vOrphanErase.size()) {
-        int nErased = 0;
-        for (uint256 &orphanId : vOrphanErase) {
-            nErased += EraseOrphanTx(orphanId);
-        }
-        LogPrint(BCLog::MEMPOOL,
-                 "Erased %d orphan tx included or conflicted by block\n",
-                 nErased);
-    }
+    orphanpool.EraseForBlock(*pblock);
 }
 
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
-static std::shared_ptr<const CBlockHeaderAndShortTxIDs>
-    most_recent_compact_block;
+static CSharedNetMsg most_recent_compact_block;
 static uint256 most_recent_block_hash;
 
-void PeerLogicValidation::NewPoWValidBlock(
-    const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock) {
-    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock =
-        std::make_shared<const CBlockHeaderAndShortTxIDs>(*pblock);
-    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
-
-    LOCK(cs_main);
+/**
+ * Announce a block with a compact block to the peers which requested
+ * high-bandwidth mode, unless a block at the same height was already announced
+ * that way. Requires cs_main.
+ */
+static void RelayHeaderAndIDs(const CBlockIndex *pindex,
+                              const std::shared_ptr<const CBlock> &pblock,
+                              const CSharedNetMsg &cmpctblock,
+                              CConnman &connman) {
+    AssertLockHeld(cs_main);
 
     static int nHighestFastAnnounce = 0;
     if (pindex->nHeight <= nHighestFastAnnounce) {
@@ -927,12 +894,11 @@ void PeerLogicValidation::NewPoWValidBlock(
         LOCK(cs_most_recent_block);
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
-        most_recent_compact_block = pcmpctblock;
+        most_recent_compact_block = cmpctblock;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker,
-                          &hashBlock](CNode *pnode) {
-        // TODO: Avoid the repeated-serialization here
+    connman.ForEachNode([&connman, &cmpctblock, pindex,
+                         &hashBlock](CNode *pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect) {
             return;
         }
@@ -944,15 +910,63 @@ void PeerLogicValidation::NewPoWValidBlock(
             PeerHasHeader(&state, pindex->pprev)) {
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n",
-                     "PeerLogicValidation::NewPoWValidBlock",
-                     hashBlock.ToString(), pnode->id);
-            connman->PushMessage(
-                pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                     __func__, hashBlock.ToString(), pnode->id);
+            connman.PushMessage(pnode, cmpctblock);
             state.pindexBestHeaderSent = pindex;
         }
     });
 }
 
+void PeerLogicValidation::NewPoWValidBlock(
+    const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock) {
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CSharedNetMsg cmpctblock = msgMaker.MakeShared(
+        NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(*pblock));
+
+    LOCK(cs_main);
+    RelayHeaderAndIDs(pindex, pblock, cmpctblock, *connman);
+}
+
+/**
+ * In -fastblockrelay mode, announce a block received from a peer to our
+ * high-bandwidth compact block peers as soon as its header was accepted and it
+ * passed CheckBlock, rather than from AcceptBlock. The caller still hands the
+ * block to ProcessNewBlock for full validation. Peers announced to this way
+ * don't punish us if the block turns out to be invalid, see
+ * INVALID_CB_NO_BAN_VERSION.
+ */
+static void FastRelayBlock(const Config &config,
+                           const std::shared_ptr<const CBlock> &pblock,
+                           CConnman &connman) {
+    if (!gArgs.GetBoolArg("-fastblockrelay", DEFAULT_FAST_BLOCK_RELAY)) {
+        return;
+    }
+
+    // Blocks rebuilt from a compact or graphene block were checked by
+    // FillBlock already, in which case this is a no-op.
+    CValidationState state;
+    if (!CheckBlock(config, *pblock, state)) {
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CSharedNetMsg cmpctblock = msgMaker.MakeShared(
+        NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(*pblock));
+
+    LOCK(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(pblock->GetHash());
+    if (mi == mapBlockIndex.end()) {
+        // The header was not accepted (yet), leave it to AcceptBlock.
+        return;
+    }
+    const CBlockIndex *pindex = mi->second;
+    if ((pindex->nStatus & BLOCK_FAILED_MASK) || IsInitialBlockDownload() ||
+        chainActive.Tip() != pindex->pprev) {
+        return;
+    }
+    RelayHeaderAndIDs(pindex, pblock, cmpctblock, connman);
+}
+
 void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew,
                                           const CBlockIndex *pindexFork,
                                           bool fInitialDownload) {
@@ -1058,7 +1072,7 @@ static bool AlreadyHave(const CInv &inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
             // diminishing returns with 2 onward.
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
+                   orphanpool.HaveTx(inv.hash) ||
                    pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
                    pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
@@ -1116,21 +1130,74 @@ static void RelayAddress(const CAddress &addr, bool fReachable,
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+// Requires cs_main.
+// Whether the answer to a getdata for inv has to wait for the rate limiter.
+// Only transactions and historical blocks do, so that new blocks go first.
+static bool IsGetDataThrottled(CConnman &connman, CNode *pfrom,
+                               const CInv &inv) {
+    TrafficClass trafficClass;
+    if (inv.type == MSG_TX) {
+        trafficClass = TRAFFIC_TX;
+    } else if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
+               inv.type == MSG_CMPCT_BLOCK) {
+        // assume > 1 week = historical, as for -maxuploadtarget
+        static const int nOneWeek = 7 * 24 * 60 * 60;
+        BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+        if (mi == mapBlockIndex.end() || pindexBestHeader == nullptr ||
+            pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() <=
+                nOneWeek) {
+            return false;
+        }
+        trafficClass = TRAFFIC_BLOCK;
+    } else {
+        return false;
+    }
+    return !connman.HasSendAllowance(pfrom, trafficClass);
+}
+
 static void ProcessGetData(const Config &config, CNode *pfrom,
                            const Consensus::Params &consensusParams,
                            CConnman &connman,
                            const std::atomic<bool> &interruptMsgProc) {
-    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     LOCK(cs_main);
 
+    // Requests held back by the rate limiter were received first, so they are
+    // answered first once it allows.
+    size_t nRetries = 0;
+    if (!pfrom->vThrottledGetData.empty() &&
+        !IsGetDataThrottled(connman, pfrom,
+                            pfrom->vThrottledGetData.front())) {
+        nRetries = pfrom->vThrottledGetData.size();
+        pfrom->vRecvGetData.insert(pfrom->vRecvGetData.begin(),
+                                   pfrom->vThrottledGetData.begin(),
+                                   pfrom->vThrottledGetData.end());
+        pfrom->vThrottledGetData.clear();
+    }
+
+    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway.
         if (pfrom->fPauseSend) {
             break;
         }
 
+        bool fRetry = nRetries > 0;
+        if (fRetry) {
+            nRetries--;
+        }
+        if (IsGetDataThrottled(connman, pfrom, *it)) {
+            // Answer the other requests meanwhile, rather than holding up
+            // everything else the peer sent.
+            if (!fRetry) {
+                connman.RecordThrottledSend(pfrom);
+            }
+            pfrom->vThrottledGetData.push_back(*it);
+            it++;
+            continue;
+        }
+
         const CInv &inv = *it;
         {
             if (interruptMsgProc) {
@@ -1267,12 +1334,19 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
                         if (CanDirectFetch(consensusParams) &&
                             mi->second->nHeight >=
                                 chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block);
-                            connman.PushMessage(
-                                pfrom,
-                                msgMaker.Make(nSendFlags,
-                                              NetMsgType::CMPCTBLOCK,
-                                              cmpctblock));
+                            CSharedNetMsg cmpctblock;
+                            {
+                                LOCK(cs_most_recent_block);
+                                if (most_recent_block_hash == inv.hash) {
+                                    cmpctblock = most_recent_compact_block;
+                                }
+                            }
+                            if (cmpctblock.IsNull()) {
+                                cmpctblock = msgMaker.MakeShared(
+                                    nSendFlags, NetMsgType::CMPCTBLOCK,
+                                    CBlockHeaderAndShortTxIDs(block));
+                            }
+                            connman.PushMessage(pfrom, cmpctblock);
                         } else {
                             connman.PushMessage(pfrom,
                                                 msgMaker.Make(nSendFlags,
@@ -1301,9 +1375,12 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
                 auto mi = mapRelay.find(inv.hash);
                 int nSendFlags = 0;
                 if (mi != mapRelay.end()) {
-                    connman.PushMessage(
-                        pfrom,
-                        msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                    RelayTx &relayTx = mi->second;
+                    if (relayTx.msg.IsNull()) {
+                        relayTx.msg = msgMaker.MakeShared(
+                            nSendFlags, NetMsgType::TX, *relayTx.tx);
+                    }
+                    connman.PushMessage(pfrom, relayTx.msg);
                     push = true;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
@@ -1334,7 +1411,11 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
         }
     }
 
-    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+    // Retried requests not looked at again stay held back, ahead of the ones
+    // held back since.
+    pfrom->vThrottledGetData.insert(pfrom->vThrottledGetData.begin(), it,
+                                    it + nRetries);
+    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it + nRetries);
 
     if (!vNotFound.empty()) {
         // Let the peer know that we didn't find what it asked for, so it
@@ -1659,6 +1740,20 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                                 msgMaker.Make(NetMsgType::SENDCMPCT,
                                               fAnnounceUsingCMPCTBLOCK,
                                               nCMPCTBLOCKVersion));
+            // Graphene blocks fall back to compact blocks, so only offer them
+            // alongside.
+            if (gArgs.GetBoolArg("-usegraphene", DEFAULT_USE_GRAPHENE)) {
+                connman.PushMessage(pfrom,
+                                    msgMaker.Make(NetMsgType::SENDGRAPHENE,
+                                                  GRAPHENE_VERSION));
+            }
+        }
+        if (gArgs.GetBoolArg("-compressmessages", DEFAULT_COMPRESS_MESSAGES)) {
+            // Be ready for compressed messages before asking for them.
+            pfrom->fCompressRecv = true;
+            connman.PushMessage(pfrom,
+                                msgMaker.Make(NetMsgType::SENDCOMPRESSION,
+                                              COMPRESSION_VERSION));
         }
         pfrom->fSuccessfullyConnected = true;
     }
@@ -1747,6 +1842,25 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
     }
 
+    else if (strCommand == NetMsgType::SENDGRAPHENE) {
+        uint64_t nGrapheneVersion = 0;
+        vRecv >> nGrapheneVersion;
+        if (nGrapheneVersion == GRAPHENE_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fSupportsGraphene = true;
+        }
+    }
+
+    else if (strCommand == NetMsgType::SENDCOMPRESSION) {
+        uint64_t nCompressionVersion = 0;
+        vRecv >> nCompressionVersion;
+        // Compressing costs us CPU, so only do it if we opted in as well.
+        if (nCompressionVersion == COMPRESSION_VERSION &&
+            gArgs.GetBoolArg("-compressmessages", DEFAULT_COMPRESS_MESSAGES)) {
+            pfrom->fCompressSend = true;
+        }
+    }
+
     else if (strCommand == NetMsgType::INV) {
         std::vector<CInv> vInv;
         vRecv >> vInv;
@@ -1976,6 +2090,80 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         SendBlockTransactions(block, req, pfrom, connman);
     }
 
+    else if (strCommand == NetMsgType::GETGRAPHENE) {
+        // We only serve graphene blocks if we opted in to them.
+        if (!gArgs.GetBoolArg("-usegraphene", DEFAULT_USE_GRAPHENE)) {
+            LogPrint(BCLog::NET,
+                     "Peer %d sent us a getgraphene with graphene disabled\n",
+                     pfrom->id);
+            return true;
+        }
+
+        CGrapheneBlockRequest req;
+        vRecv >> req;
+
+        std::shared_ptr<const CBlock> recent_block;
+        {
+            LOCK(cs_most_recent_block);
+            if (most_recent_block_hash == req.blockhash) {
+                recent_block = most_recent_block;
+            }
+            // Unlock cs_most_recent_block to avoid cs_main lock inversion
+        }
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+            if (it == mapBlockIndex.end() ||
+                !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint(BCLog::NET,
+                         "Peer %d sent us a getgrblk for a block we don't "
+                         "have\n",
+                         pfrom->id);
+                return true;
+            }
+
+            if (!CanDirectFetch(chainparams.GetConsensus()) ||
+                it->second->nHeight <
+                    chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                // As for compact blocks, the peer is unlikely to have the
+                // transactions of old blocks, so send the full block.
+                CInv inv;
+                inv.type = MSG_BLOCK;
+                inv.hash = req.blockhash;
+                pfrom->vRecvGetData.push_back(inv);
+                ProcessGetData(config, pfrom, chainparams.GetConsensus(),
+                               connman, interruptMsgProc);
+                return true;
+            }
+
+            if (!recent_block) {
+                bool ret = ReadBlockFromDisk(block, it->second, config);
+                assert(ret);
+            }
+        }
+
+        CGrapheneBlock grapheneBlock(recent_block ? *recent_block : block,
+                                     req.nReceiverPoolTxs);
+        if (grapheneBlock.IsIbltCapped()) {
+            // The mempool of the peer is too far from the block for graphene
+            // to beat a compact block.
+            LogPrint(BCLog::NET,
+                     "Peer %d sent us a getgraphene for a mempool of %u "
+                     "transactions, sending a compact block instead\n",
+                     pfrom->id, req.nReceiverPoolTxs);
+            pfrom->vRecvGetData.push_back(
+                CInv(MSG_CMPCT_BLOCK, req.blockhash));
+            ProcessGetData(config, pfrom, chainparams.GetConsensus(), connman,
+                           interruptMsgProc);
+            return true;
+        }
+        connman.PushMessage(
+            pfrom, msgMaker.Make(NetMsgType::GRAPHENEBLOCK, grapheneBlock));
+    }
+
     else if (strCommand == NetMsgType::GETHEADERS) {
         CBlockLocator locator;
         uint256 hashStop;
@@ -2049,7 +2237,6 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
         std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
@@ -2073,9 +2260,6 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                                &fMissingInputs, &lRemovedTxn)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx, connman);
-            for (size_t i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
 
             pfrom->nLastTXTime = GetTime();
 
@@ -2084,73 +2268,59 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                      pfrom->id, tx.GetId().ToString(), mempool.size(),
                      mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this
-            // one
+            // Process all orphan transactions that depended on this one,
+            // parents before children.
             std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev =
-                    mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end()) {
+            for (const auto &orphan : orphanpool.GetUnblockedBy(tx)) {
+                const CTransactionRef &porphanTx = orphan.first;
+                const CTransaction &orphanTx = *porphanTx;
+                const uint256 &orphanId = orphanTx.GetId();
+                NodeId fromPeer = orphan.second;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to
+                // counter-DoS based on orphan resolution (that is, feeding
+                // people an invalid transaction based on LegitTxX in order to
+                // get anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+                if (setMisbehaving.count(fromPeer)) {
                     continue;
                 }
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end(); ++mi) {
-                    const CTransactionRef &porphanTx = (*mi)->second.tx;
-                    const CTransaction &orphanTx = *porphanTx;
-                    const uint256 &orphanId = orphanTx.GetId();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes
-                    // to counter-DoS based on orphan resolution (that is,
-                    // feeding people an invalid transaction based on LegitTxX
-                    // in order to get anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-                    if (setMisbehaving.count(fromPeer)) {
-                        continue;
-                    }
-                    if (AcceptToMemoryPool(config, mempool, stateDummy,
-                                           porphanTx, true, &fMissingInputs2,
-                                           &lRemovedTxn)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n",
+                if (AcceptToMemoryPool(config, mempool, stateDummy, porphanTx,
+                                       true, &fMissingInputs2, &lRemovedTxn)) {
+                    LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n",
+                             orphanId.ToString());
+                    RelayTransaction(orphanTx, connman);
+                    vEraseQueue.push_back(orphanId);
+                } else if (!fMissingInputs2) {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0) {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos, "invalid-orphan-tx");
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n",
                                  orphanId.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (size_t i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanId, i);
-                        }
-                        vEraseQueue.push_back(orphanId);
-                    } else if (!fMissingInputs2) {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0) {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos, "invalid-orphan-tx");
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL,
-                                     "   invalid orphan tx %s\n",
-                                     orphanId.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n",
-                                 orphanId.ToString());
-                        vEraseQueue.push_back(orphanId);
-                        if (!stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness
-                            // transactions or witness-stripped transactions, as
-                            // they can have been malleated. See
-                            // https://github.com/bitcoin/bitcoin/issues/8279
-                            // for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanId);
-                        }
                     }
-                    mempool.check(pcoinsTip);
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n",
+                             orphanId.ToString());
+                    vEraseQueue.push_back(orphanId);
+                    if (!stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness transactions
+                        // or witness-stripped transactions, as they can have
+                        // been malleated. See
+                        // https://github.com/bitcoin/bitcoin/issues/8279 for
+                        // details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanId);
+                    }
                 }
+                mempool.check(pcoinsTip);
             }
 
-            for (uint256 hash : vEraseQueue) {
-                EraseOrphanTx(hash);
+            for (const uint256 &hash : vEraseQueue) {
+                orphanpool.EraseTx(hash);
             }
         } else if (fMissingInputs) {
             // It may be the case that the orphans parents have all been
@@ -2172,18 +2342,31 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                         pfrom->AskFor(_inv);
                     }
                 }
-                AddOrphanTx(ptx, pfrom->GetId());
+                size_t nMaxPeerUsage =
+                    std::max(int64_t(0),
+                             gArgs.GetArg("-maxorphanpeersize",
+                                          DEFAULT_MAX_ORPHAN_PEER_SIZE)) *
+                    1000000;
+                if (orphanpool.AddTx(ptx, pfrom->GetId(), nMaxPeerUsage)) {
+                    AddToCompactExtraTransactions(ptx);
+                }
 
-                // DoS prevention: do not allow mapOrphanTransactions to grow
+                // DoS prevention: do not allow the orphan pool to grow
                 // unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max(
                     int64_t(0),
                     gArgs.GetArg("-maxorphantx",
                                  DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+                size_t nMaxOrphanUsage =
+                    std::max(int64_t(0),
+                             gArgs.GetArg("-maxorphanpoolsize",
+                                          DEFAULT_MAX_ORPHAN_POOL_SIZE)) *
+                    1000000;
+                unsigned int nEvicted =
+                    orphanpool.LimitOrphans(nMaxOrphanTx, nMaxOrphanUsage);
                 if (nEvicted > 0) {
                     LogPrint(BCLog::MEMPOOL,
-                             "mapOrphan overflow, removed %u tx\n", nEvicted);
+                             "orphan pool overflow, removed %u tx\n", nEvicted);
                 }
             } else {
                 LogPrint(BCLog::MEMPOOL,
@@ -2493,6 +2676,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                 mapBlockSource.emplace(pblock->GetHash(),
                                        std::make_pair(pfrom->GetId(), false));
             }
+            FastRelayBlock(config, pblock, connman);
             bool fNewBlock = false;
             ProcessNewBlock(config, pblock, true, &fNewBlock);
             if (fNewBlock) {
@@ -2506,6 +2690,8 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                 // some other peer. We do this after calling. ProcessNewBlock so
                 // that a malleated cmpctblock announcement can't be used to
                 // interfere with block relay.
+                UpdateBlockDownloadRate(pfrom->GetId(), pblock->GetHash(),
+                                        GetBlockDownloadSize(*pblock));
                 MarkBlockAsReceived(pblock->GetHash());
             }
         }
@@ -2576,6 +2762,8 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                 // updated, reject messages go out, etc.
 
                 // it is now an empty pointer
+                UpdateBlockDownloadRate(pfrom->GetId(), resp.blockhash,
+                                        GetBlockDownloadSize(*pblock));
                 MarkBlockAsReceived(resp.blockhash);
                 fBlockRead = true;
                 // mapBlockSource is only used for sending reject messages and
@@ -2588,6 +2776,75 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             }
         } // Don't hold cs_main when we call into ProcessNewBlock
         if (fBlockRead) {
+            FastRelayBlock(config, pblock, connman);
+            bool fNewBlock = false;
+            // Since we requested this block (it was in mapBlocksInFlight),
+            // force it to be processed, even if it would not be a candidate for
+            // new tip (missing previous block, chain not long enough, etc)
+            ProcessNewBlock(config, pblock, true, &fNewBlock);
+            if (fNewBlock) {
+                pfrom->nLastBlockTime = GetTime();
+            }
+        }
+    }
+
+    else if (strCommand == NetMsgType::GRAPHENEBLOCK && !fImporting &&
+             !fReindex) // Ignore blocks received while importing
+    {
+        CGrapheneBlock grapheneBlock;
+        vRecv >> grapheneBlock;
+
+        const uint256 hash = grapheneBlock.header.GetHash();
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        bool fBlockRead = false;
+        {
+            LOCK(cs_main);
+
+            std::map<uint256,
+                     std::pair<NodeId, std::list<QueuedBlock>::iterator>>::
+                iterator it = mapBlocksInFlight.find(hash);
+            if (it == mapBlocksInFlight.end() ||
+                it->second.first != pfrom->GetId()) {
+                LogPrint(BCLog::NET,
+                         "Peer %d sent us a graphene block we weren't "
+                         "expecting\n",
+                         pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = grapheneBlock.FillBlock(
+                config, mempool, vExtraTxnForCompact, *pblock);
+            if (status == READ_STATUS_INVALID) {
+                // Reset in-flight state in case of whitelist.
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom, 100, "invalid-grblk");
+                LogPrintf("Peer %d sent us invalid graphene block\n",
+                          pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Not enough of the block in our mempool, or the IBLT was too
+                // small. The block stays in flight, get it as a compact block.
+                LogPrint(BCLog::NET,
+                         "Failed to reconstruct graphene block %s from peer "
+                         "%d, requesting a compact block\n",
+                         hash.ToString(), pfrom->id);
+                std::vector<CInv> invs;
+                invs.push_back(CInv(MSG_CMPCT_BLOCK, hash));
+                connman.PushMessage(pfrom,
+                                    msgMaker.Make(NetMsgType::GETDATA, invs));
+            } else {
+                // As for compact blocks, a block which fails CheckBlock is
+                // handled by ProcessNewBlock.
+                UpdateBlockDownloadRate(pfrom->GetId(), hash,
+                                        GetBlockDownloadSize(*pblock));
+                MarkBlockAsReceived(hash);
+                fBlockRead = true;
+                mapBlockSource.emplace(hash,
+                                       std::make_pair(pfrom->GetId(), false));
+            }
+        } // Don't hold cs_main when we call into ProcessNewBlock
+        if (fBlockRead) {
+            FastRelayBlock(config, pblock, connman);
             bool fNewBlock = false;
             // Since we requested this block (it was in mapBlocksInFlight),
             // force it to be processed, even if it would not be a candidate for
@@ -2708,18 +2965,21 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
             if (nCount == MAX_HEADERS_RESULTS) {
                 // Headers message had its maximum size; the peer may have more
-                // headers.
-                // TODO: optimize: if pindexLast is an ancestor of
-                // chainActive.Tip or pindexBestHeader, continue from there
-                // instead.
+                // headers. If another peer already sent us the headers after
+                // these, continue from the best one.
+                const CBlockIndex *pindexStart = pindexLast;
+                if (pindexBestHeader->GetAncestor(pindexLast->nHeight) ==
+                    pindexLast) {
+                    pindexStart = pindexBestHeader;
+                }
                 LogPrint(
                     BCLog::NET,
                     "more getheaders (%d) to end to peer=%d (startheight:%d)\n",
-                    pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
+                    pindexStart->nHeight, pfrom->id, pfrom->nStartingHeight);
                 connman.PushMessage(
                     pfrom,
                     msgMaker.Make(NetMsgType::GETHEADERS,
-                                  chainActive.GetLocator(pindexLast),
+                                  chainActive.GetLocator(pindexStart),
                                   uint256()));
             }
 
@@ -2783,14 +3043,31 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                             vGetData.size() == 1 &&
                             mapBlocksInFlight.size() == 1 &&
                             pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN)) {
-                            // In any case, we want to download using a compact
-                            // block, not a regular one.
-                            vGetData[0] =
-                                CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                            if (nodestate->fSupportsGraphene &&
+                                gArgs.GetBoolArg("-usegraphene",
+                                                 DEFAULT_USE_GRAPHENE)) {
+                                // Try a graphene block first, we will fall
+                                // back to a compact block if we cannot
+                                // reconstruct it.
+                                connman.PushMessage(
+                                    pfrom, msgMaker.Make(
+                                               NetMsgType::GETGRAPHENE,
+                                               CGrapheneBlockRequest(
+                                                   vGetData[0].hash,
+                                                   mempool.size())));
+                                vGetData.clear();
+                            } else {
+                                // In any case, we want to download using a
+                                // compact block, not a regular one.
+                                vGetData[0] =
+                                    CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                            }
+                        }
+                        if (!vGetData.empty()) {
+                            connman.PushMessage(
+                                pfrom,
+                                msgMaker.Make(NetMsgType::GETDATA, vGetData));
                         }
-                        connman.PushMessage(
-                            pfrom,
-                            msgMaker.Make(NetMsgType::GETDATA, vGetData));
                     }
                 }
             }
@@ -2801,6 +3078,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
              !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        const size_t nBlockSize = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n",
@@ -2816,12 +3094,14 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we
             // may need it even though it is not a candidate for a new best tip.
+            UpdateBlockDownloadRate(pfrom->GetId(), hash, nBlockSize);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS
             // scores, so the race between here and cs_main in ProcessNewBlock
             // is fine.
             mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
         }
+        FastRelayBlock(config, pblock, connman);
         bool fNewBlock = false;
         ProcessNewBlock(config, pblock, forceProcessing, &fNewBlock);
         if (fNewBlock) {
@@ -3088,7 +3368,7 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
     //
     bool fMoreWork = false;
 
-    if (!pfrom->vRecvGetData.empty()) {
+    if (!pfrom->vRecvGetData.empty() || !pfrom->vThrottledGetData.empty()) {
         ProcessGetData(config, pfrom, chainparams.GetConsensus(), connman,
                        interruptMsgProc);
     }
@@ -3102,6 +3382,13 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
         return true;
     }
 
+    // Stop reading requests from a peer which keeps asking faster than the
+    // rate limiter lets us answer. There is no point in retrying before it
+    // refills.
+    if (pfrom->vThrottledGetData.size() >= MAX_INV_SZ) {
+        return false;
+    }
+
     // Don't bother if send buffer is too full to respond anyway
     if (pfrom->fPauseSend) {
         return false;
@@ -3162,6 +3449,26 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
         return fMoreWork;
     }
 
+    // Compressed messages are processed as the message they wrap.
+    if (strCommand == NetMsgType::COMPRESSED) {
+        std::vector<uint8_t> vPayload;
+        if (!pfrom->fCompressRecv ||
+            !pfrom->recvCompressor.Decompress(
+                vRecv, MAX_PROTOCOL_MESSAGE_LENGTH, strCommand, vPayload)) {
+            // Later messages may depend on this one, we can't skip it.
+            LogPrintf("%s(%s, %u bytes): invalid compressed message, "
+                      "disconnecting peer=%d\n",
+                      __func__, SanitizeString(strCommand), nMessageSize,
+                      pfrom->id);
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        vRecv.clear();
+        vRecv.write(reinterpret_cast<const char *>(vPayload.data()),
+                    vPayload.size());
+        nMessageSize = vPayload.size();
+    }
+
     // Process message
     bool fRet = false;
     try {
@@ -3213,17 +3520,81 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
     return fMoreWork;
 }
 
-class CompareInvMempoolOrder {
-    CTxMemPool *mp;
+/**
+ * Order in which the transactions that recently entered the mempool are
+ * announced, the order of CTxMemPool::CompareDepthAndScore. It is computed once
+ * per RELAY_SCHEDULE_INTERVAL and shared by all peers, so that ordering a
+ * peer's inventory mostly compares integer ranks instead of locking the
+ * mempool for every comparison.
+ *
+ * At most RELAY_SCHEDULE_MAX_ENTRIES transactions are ranked, so that the
+ * sort done under cs_main every interval stays cheap however fast
+ * transactions arrive. The ancestor counts are kept along with the ranks,
+ * for merging with transactions that are not ranked. Entering or leaving the
+ * mempool doesn't change the ancestor counts of the other transactions except
+ * when a block is connected or disconnected, so the schedule is also
+ * recomputed when the tip changes.
+ */
+class CTxRelaySchedule {
+    int64_t nNextUpdate;
+    const CBlockIndex *pindexTip;
+    //! Ancestor count and rank of each ranked transaction.
+    std::unordered_map<uint256, std::pair<uint64_t, uint64_t>,
+                       SaltedTxidHasher>
+        mapRank;
 
 public:
-    CompareInvMempoolOrder(CTxMemPool *_mempool) { mp = _mempool; }
+    CTxRelaySchedule() : nNextUpdate(0), pindexTip(nullptr) {}
+
+    void Update(int64_t nNow) {
+        AssertLockHeld(cs_main);
+        if (nNow < nNextUpdate && chainActive.Tip() == pindexTip) {
+            return;
+        }
+        nNextUpdate = nNow + RELAY_SCHEDULE_INTERVAL;
+        pindexTip = chainActive.Tip();
+
+        std::vector<uint256> vtxid;
+        std::vector<uint64_t> vAncestors;
+        mempool.queryHashesSince(GetTime() - RELAY_SCHEDULE_WINDOW,
+                                 RELAY_SCHEDULE_MAX_ENTRIES, vtxid);
+        mempool.sortDepthAndScore(vtxid, vAncestors);
+        mapRank.clear();
+        mapRank.reserve(vtxid.size());
+        for (size_t i = 0; i < vtxid.size(); i++) {
+            mapRank.emplace(vtxid[i], std::make_pair(vAncestors[i], i));
+        }
+    }
+
+    /** Number of ranked transactions. */
+    size_t size() const { return mapRank.size(); }
+
+    /**
+     * Ancestor count and rank of txid. Transactions are announced by
+     * increasing ancestor count, then by increasing rank.
+     */
+    bool GetRank(const uint256 &txid,
+                 std::pair<uint64_t, uint64_t> &rank) const {
+        auto it = mapRank.find(txid);
+        if (it == mapRank.end()) {
+            return false;
+        }
+        rank = it->second;
+        return true;
+    }
+};
 
-    bool operator()(std::set<uint256>::iterator a,
-                    std::set<uint256>::iterator b) {
+static CTxRelaySchedule relaySchedule GUARDED_BY(cs_main);
+
+typedef std::pair<std::pair<uint64_t, uint64_t>, std::set<uint256>::iterator>
+    InvRank;
+
+class CompareInvRank {
+public:
+    bool operator()(const InvRank &a, const InvRank &b) {
         /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
+         * fewest ancestors/lowest rank to sort later. */
+        return a.first > b.first;
     }
 };
 
@@ -3293,6 +3664,15 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     //
     // Message: addr
     //
+    if (pto->nNextAddrSend < nNow &&
+        !connman.HasSendAllowance(pto, TRAFFIC_ADDR)) {
+        // Addresses over the rate limit wait for the next broadcast.
+        pto->nNextAddrSend =
+            PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+        if (!pto->vAddrToSend.empty()) {
+            connman.RecordThrottledSend(pto);
+        }
+    }
     if (pto->nNextAddrSend < nNow) {
         pto->nNextAddrSend =
             PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
@@ -3332,9 +3712,9 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                   (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot);
 
     if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex) {
-        // Only actively request headers from a single peer, unless we're close
-        // to today.
-        if ((nSyncStarted == 0 && fFetch) ||
+        // Only actively request headers from MAX_HEADERS_SYNC_PEERS peers,
+        // unless we're close to today.
+        if ((nSyncStarted < MAX_HEADERS_SYNC_PEERS && fFetch) ||
             pindexBestHeader->GetBlockTime() >
                 GetAdjustedTime() - 24 * 60 * 60) {
             state.fSyncStarted = true;
@@ -3454,12 +3834,7 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                 {
                     LOCK(cs_most_recent_block);
                     if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                        CBlockHeaderAndShortTxIDs cmpctblock(
-                            *most_recent_block);
-                        connman.PushMessage(
-                            pto,
-                            msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK,
-                                          cmpctblock));
+                        connman.PushMessage(pto, most_recent_compact_block);
                         fGotBlockFromCache = true;
                     }
                 }
@@ -3552,6 +3927,12 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
             // concern for them.
             pto->nNextInvSend = PoissonNextSend(
                 nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            // Transactions over the rate limit wait for the next trickle.
+            fSendTrickle = connman.HasSendAllowance(pto, TRAFFIC_TX);
+            if (!fSendTrickle && (!pto->setInventoryTxToSend.empty() ||
+                                  pto->fSendMempool)) {
+                connman.RecordThrottledSend(pto);
+            }
         }
 
         // Time to send but the peer has requested we not relay transactions.
@@ -3601,13 +3982,38 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
 
         // Determine transactions to relay
         if (fSendTrickle) {
-            // Produce a vector with all candidates for sending
-            std::vector<std::set<uint256>::iterator> vInvTx;
+            relaySchedule.Update(nNow);
+
+            // Produce a vector with all candidates for sending, keyed by
+            // ancestor count and rank. Those without a rank in the shared
+            // schedule either entered the mempool since it was computed or
+            // have been waiting for longer than it covers. They are ranked
+            // after the scheduled ones with one mempool lookup each, so that
+            // parents still go before their children.
+            std::vector<InvRank> vInvTx;
+            std::vector<uint256> vUnscheduled;
             vInvTx.reserve(pto->setInventoryTxToSend.size());
             for (std::set<uint256>::iterator it =
                      pto->setInventoryTxToSend.begin();
-                 it != pto->setInventoryTxToSend.end(); it++) {
-                vInvTx.push_back(it);
+                 it != pto->setInventoryTxToSend.end();) {
+                std::pair<uint64_t, uint64_t> rank;
+                if (relaySchedule.GetRank(*it, rank)) {
+                    vInvTx.emplace_back(rank, it++);
+                } else {
+                    // Put back below if still in the mempool.
+                    vUnscheduled.push_back(*it);
+                    it = pto->setInventoryTxToSend.erase(it);
+                }
+            }
+            if (!vUnscheduled.empty()) {
+                std::vector<uint64_t> vAncestors;
+                mempool.sortDepthAndScore(vUnscheduled, vAncestors);
+                for (size_t i = 0; i < vUnscheduled.size(); i++) {
+                    vInvTx.emplace_back(
+                        std::make_pair(vAncestors[i], relaySchedule.size() + i),
+                        pto->setInventoryTxToSend.insert(vUnscheduled[i])
+                            .first);
+                }
             }
             Amount filterrate(0);
             {
@@ -3617,9 +4023,8 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
             // Topologically and fee-rate sort the inventory we send for privacy
             // and priority reasons. A heap is used so that not all items need
             // sorting if only a few are being sent.
-            CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-            std::make_heap(vInvTx.begin(), vInvTx.end(),
-                           compareInvMempoolOrder);
+            CompareInvRank compareInvRank;
+            std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvRank);
             // No reason to drain out at many times the network's capacity,
             // especially since we have many peers and some will draw much
             // shorter delays.
@@ -3628,9 +4033,8 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
             while (!vInvTx.empty() &&
                    nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
                 // Fetch the top element from the heap
-                std::pop_heap(vInvTx.begin(), vInvTx.end(),
-                              compareInvMempoolOrder);
-                std::set<uint256>::iterator it = vInvTx.back();
+                std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvRank);
+                std::set<uint256>::iterator it = vInvTx.back().second;
                 vInvTx.pop_back();
                 uint256 hash = *it;
                 // Remove it from the to-be-sent set
@@ -3663,8 +4067,8 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                         vRelayExpiration.pop_front();
                     }
 
-                    auto ret = mapRelay.insert(
-                        std::make_pair(hash, std::move(txinfo.tx)));
+                    auto ret = mapRelay.insert(std::make_pair(
+                        hash, RelayTx{std::move(txinfo.tx), CSharedNetMsg()}));
                     if (ret.second) {
                         vRelayExpiration.push_back(std::make_pair(
                             nNow + 15 * 60 * 1000000, ret.first));
@@ -3725,12 +4129,16 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     // Message: getdata (blocks)
     //
     std::vector<CInv> vGetData;
+    int64_t nMinPing = pto->nMinPingUsecTime;
+    state.nBlocksInTransitLimit = GetBlocksInTransitLimit(
+        state,
+        nMinPing == std::numeric_limits<int64_t>::max() ? 0 : nMinPing);
     if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) &&
-        state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        state.nBlocksInFlight < state.nBlocksInTransitLimit) {
         std::vector<const CBlockIndex *> vToDownload;
         NodeId staller = -1;
         FindNextBlocksToDownload(pto->GetId(),
-                                 MAX_BLOCKS_IN_TRANSIT_PER_PEER -
+                                 state.nBlocksInTransitLimit -
                                      state.nBlocksInFlight,
                                  vToDownload, staller, consensusParams);
         for (const CBlockIndex *pindex : vToDownload) {
@@ -3832,7 +4240,6 @@ public:
     CNetProcessingCleanup() {}
     ~CNetProcessingCleanup() {
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanpool.Clear();
     }
 } instance_of_cnetprocessingcleanup;
@@ -7,20 +7,27 @@
 #define BITCOIN_NET_PROCESSING_H
 
 #include "net.h"
+#include "txorphanpool.h"
 #include "validationinterface.h"
 
 class Config;
 
-/** Default for -maxorphantx, maximum number of orphan transactions kept in
- * memory */
-static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
-/** Expiration time for orphan transactions in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
-/** Minimum time between orphan transactions expire time checks in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block
  * reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -fastblockrelay */
+static const bool DEFAULT_FAST_BLOCK_RELAY = false;
+/** Time between recomputations of the transaction announcement order shared by
+ * all peers, in microseconds */
+static const int64_t RELAY_SCHEDULE_INTERVAL = 1000000;
+/** Transactions that entered the mempool at most this many seconds ago are
+ * ranked in the shared announcement order */
+static const int64_t RELAY_SCHEDULE_WINDOW = 60;
+/** Maximum number of transactions ranked in the shared announcement order */
+static const size_t RELAY_SCHEDULE_MAX_ENTRIES = 10000;
+
+/** Transactions received from peers that are missing inputs */
+extern CTxOrphanPool orphanpool;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals &nodeSignals);
@@ -52,6 +59,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInTransitLimit;
+    double dBlockDownloadRate;
 };
 
 /** Get statistics from node state */
@@ -0,0 +1,285 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netcompression.h"
+
+#include "crypto/common.h"
+#include "protocol.h"
+#include "streams.h"
+#include "version.h"
+
+#include <algorithm>
+#include <ios>
+
+namespace {
+
+/** Shortest match worth encoding. */
+const size_t MIN_MATCH = 4;
+/** Matches can refer to this many bytes back at most. */
+const size_t MAX_OFFSET = 65535;
+/** Upper bound on the size of the match finder hash table, in bits. */
+const int MAX_HASH_LOG = 14;
+
+/** Message types worth compressing, and the size from which they are. */
+struct CompressionRule {
+    const char *command;
+    size_t nMinSize;
+    bool fDictionary;
+};
+
+const CompressionRule compressionRules[] = {
+    {NetMsgType::BLOCK, 1024, false},
+    {NetMsgType::CMPCTBLOCK, 1024, false},
+    {NetMsgType::BLOCKTXN, 1024, false},
+    {NetMsgType::GRAPHENEBLOCK, 1024, false},
+    {NetMsgType::HEADERS, 1024, false},
+    {NetMsgType::ADDR, 512, false},
+    {NetMsgType::TX, 128, true},
+    {NetMsgType::INV, 128, true},
+};
+
+const CompressionRule *GetCompressionRule(const std::string &command) {
+    for (const CompressionRule &rule : compressionRules) {
+        if (command == rule.command) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t HashSequence(uint32_t x, int nHashLog) {
+    return (x * 2654435761U) >> (32 - nHashLog);
+}
+
+void WriteLength(size_t nLength, std::vector<uint8_t> &out) {
+    while (nLength >= 255) {
+        out.push_back(255);
+        nLength -= 255;
+    }
+    out.push_back(nLength);
+}
+
+bool ReadLength(const uint8_t *&ip, const uint8_t *end, size_t &nLength) {
+    uint8_t b;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        b = *ip++;
+        nLength += b;
+    } while (b == 255);
+    return true;
+}
+
+void WriteSequence(const uint8_t *literals, size_t nLiterals, size_t nOffset,
+                   size_t nMatch, std::vector<uint8_t> &out) {
+    size_t nMatchCode = nMatch ? nMatch - MIN_MATCH : 0;
+    out.push_back((std::min<size_t>(nLiterals, 15) << 4) |
+                  std::min<size_t>(nMatchCode, 15));
+    if (nLiterals >= 15) {
+        WriteLength(nLiterals - 15, out);
+    }
+    out.insert(out.end(), literals, literals + nLiterals);
+    if (nMatch == 0) {
+        // Last sequence.
+        return;
+    }
+    out.push_back(nOffset & 0xff);
+    out.push_back(nOffset >> 8);
+    if (nMatchCode >= 15) {
+        WriteLength(nMatchCode - 15, out);
+    }
+}
+
+} // namespace
+
+void LZCompress(const uint8_t *src, size_t nSize, size_t nDictSize,
+                std::vector<uint8_t> &out) {
+    const uint8_t *base = src - nDictSize;
+    const size_t nEnd = nDictSize + nSize;
+
+    int nHashLog = 8;
+    while (nHashLog < MAX_HASH_LOG && (size_t(1) << nHashLog) < nEnd) {
+        nHashLog++;
+    }
+    // Position + 1 of the last sequence seen with each hash, 0 if none.
+    std::vector<uint32_t> vTable(size_t(1) << nHashLog, 0);
+
+    size_t nPos = nDictSize > MAX_OFFSET ? nDictSize - MAX_OFFSET : 0;
+    for (; nPos + MIN_MATCH <= nDictSize; nPos++) {
+        vTable[HashSequence(ReadLE32(base + nPos), nHashLog)] = nPos + 1;
+    }
+
+    size_t nAnchor = nDictSize;
+    nPos = nDictSize;
+    while (nPos + MIN_MATCH <= nEnd) {
+        uint32_t nSequence = ReadLE32(base + nPos);
+        uint32_t &nCandidate = vTable[HashSequence(nSequence, nHashLog)];
+        size_t nMatchPos = nCandidate - 1;
+        bool fMatch = nCandidate != 0 && nPos - nMatchPos <= MAX_OFFSET &&
+                      ReadLE32(base + nMatchPos) == nSequence;
+        nCandidate = nPos + 1;
+        if (!fMatch) {
+            // Skip faster over incompressible data.
+            nPos += 1 + ((nPos - nAnchor) >> 6);
+            continue;
+        }
+
+        size_t nMatch = MIN_MATCH;
+        while (nPos + nMatch < nEnd &&
+               base[nMatchPos + nMatch] == base[nPos + nMatch]) {
+            nMatch++;
+        }
+        WriteSequence(base + nAnchor, nPos - nAnchor, nPos - nMatchPos, nMatch,
+                      out);
+        nPos += nMatch;
+        nAnchor = nPos;
+    }
+    WriteSequence(base + nAnchor, nEnd - nAnchor, 0, 0, out);
+}
+
+bool LZDecompress(const uint8_t *src, size_t nSize, size_t nOutSize,
+                  const std::vector<uint8_t> &dictionary,
+                  std::vector<uint8_t> &out) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + nSize;
+    const size_t nStart = out.size();
+    const size_t nLimit = nStart + nOutSize;
+    out.reserve(nLimit);
+
+    for (;;) {
+        // Streams end with a sequence of literals only, so running out of
+        // input right after a match means it was truncated.
+        if (ip == end) {
+            return false;
+        }
+        uint8_t token = *ip++;
+
+        size_t nLiterals = token >> 4;
+        if (nLiterals == 15 && !ReadLength(ip, end, nLiterals)) {
+            return false;
+        }
+        if (nLiterals > size_t(end - ip) ||
+            nLiterals > nLimit - out.size()) {
+            return false;
+        }
+        out.insert(out.end(), ip, ip + nLiterals);
+        ip += nLiterals;
+        if (ip == end) {
+            // Last sequence.
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t nOffset = ReadLE16(ip);
+        ip += 2;
+        size_t nMatch = token & 15;
+        if (nMatch == 15 && !ReadLength(ip, end, nMatch)) {
+            return false;
+        }
+        nMatch += MIN_MATCH;
+
+        size_t nProduced = out.size() - nStart;
+        if (nOffset == 0 || nOffset > nProduced + dictionary.size() ||
+            nMatch > nLimit - out.size()) {
+            return false;
+        }
+        if (nOffset > nProduced) {
+            // The match starts in the dictionary.
+            size_t nDictPos = dictionary.size() - (nOffset - nProduced);
+            size_t nCopy = std::min(nMatch, dictionary.size() - nDictPos);
+            out.insert(out.end(), dictionary.begin() + nDictPos,
+                       dictionary.begin() + nDictPos + nCopy);
+            nMatch -= nCopy;
+        }
+        // Matches may overlap the bytes they produce.
+        size_t nMatchPos = out.size() - nOffset;
+        for (size_t i = 0; i < nMatch; i++) {
+            out.push_back(out[nMatchPos + i]);
+        }
+    }
+
+    return out.size() == nLimit;
+}
+
+void CNetMsgCompressor::AddToDictionary(const uint8_t *data, size_t nSize) {
+    dictionary.insert(dictionary.end(), data, data + nSize);
+    if (dictionary.size() > 2 * COMPRESSION_DICTIONARY_SIZE) {
+        dictionary.erase(dictionary.begin(),
+                         dictionary.end() - COMPRESSION_DICTIONARY_SIZE);
+    }
+}
+
+bool CNetMsgCompressor::IsWorthCompressing(const std::string &command,
+                                           size_t nSize) {
+    const CompressionRule *rule = GetCompressionRule(command);
+    return rule != nullptr && nSize >= rule->nMinSize;
+}
+
+bool CNetMsgCompressor::Compress(const std::string &command,
+                                 const std::vector<uint8_t> &payload,
+                                 std::vector<uint8_t> &wrapped) {
+    if (!IsWorthCompressing(command, payload.size())) {
+        return false;
+    }
+
+    const CompressionRule *rule = GetCompressionRule(command);
+    uint8_t nFlags = rule->fDictionary ? USES_DICTIONARY : 0;
+    uint64_t nSize = payload.size();
+    wrapped.clear();
+    CVectorWriter{SER_NETWORK, PROTOCOL_VERSION, wrapped, 0, command, nFlags,
+                  COMPACTSIZE(nSize)};
+    if (rule->fDictionary) {
+        size_t nDictSize =
+            std::min(dictionary.size(), COMPRESSION_DICTIONARY_SIZE);
+        std::vector<uint8_t> buffer(dictionary.end() - nDictSize,
+                                    dictionary.end());
+        buffer.insert(buffer.end(), payload.begin(), payload.end());
+        LZCompress(buffer.data() + nDictSize, payload.size(), nDictSize,
+                   wrapped);
+    } else {
+        LZCompress(payload.data(), payload.size(), 0, wrapped);
+    }
+
+    if (rule->fDictionary) {
+        // Sent even if it doesn't shrink, so that the next ones can refer to
+        // it.
+        AddToDictionary(payload.data(), payload.size());
+        return true;
+    }
+    // The wrapper must pay for itself.
+    return wrapped.size() < payload.size();
+}
+
+bool CNetMsgCompressor::Decompress(CDataStream &wrapped, size_t nMaxSize,
+                                   std::string &command,
+                                   std::vector<uint8_t> &payload) {
+    uint8_t nFlags;
+    uint64_t nSize;
+    try {
+        wrapped >> LIMITED_STRING(command, CMessageHeader::COMMAND_SIZE) >>
+            nFlags >> COMPACTSIZE(nSize);
+    } catch (const std::ios_base::failure &) {
+        return false;
+    }
+    if (nSize > nMaxSize || command == NetMsgType::COMPRESSED ||
+        (nFlags & ~USES_DICTIONARY)) {
+        return false;
+    }
+
+    static const std::vector<uint8_t> noDictionary;
+    bool fDictionary = nFlags & USES_DICTIONARY;
+    const std::vector<uint8_t> &dict = fDictionary ? dictionary : noDictionary;
+    payload.clear();
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(wrapped.data());
+    if (!LZDecompress(data, wrapped.size(), nSize, dict, payload)) {
+        return false;
+    }
+    if (fDictionary) {
+        AddToDictionary(payload.data(), payload.size());
+    }
+    return true;
+}
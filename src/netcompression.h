@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETCOMPRESSION_H
+#define BITCOIN_NETCOMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CDataStream;
+
+/** Default for -compressmessages */
+static const bool DEFAULT_COMPRESS_MESSAGES = false;
+/** Version of message compression announced in "sendcompr" messages */
+static const uint64_t COMPRESSION_VERSION = 1;
+/** Amount of recently compressed TX and INV payloads the next ones may refer
+ * to. Matches can't reach further back than 64 KiB anyway. */
+static const size_t COMPRESSION_DICTIONARY_SIZE = 64 * 1024;
+
+/**
+ * Compress src[0, nSize) as a sequence of LZ77 literal runs and matches, in the
+ * LZ4 block format, and append it to out. Matches may refer to the nDictSize
+ * bytes before src, which must be readable.
+ */
+void LZCompress(const uint8_t *src, size_t nSize, size_t nDictSize,
+                std::vector<uint8_t> &out);
+
+/**
+ * Decompress src[0, nSize) into exactly nOutSize bytes appended to out. Matches
+ * may refer to the dictionary. Returns false if the input is malformed.
+ */
+bool LZDecompress(const uint8_t *src, size_t nSize, size_t nOutSize,
+                  const std::vector<uint8_t> &dictionary,
+                  std::vector<uint8_t> &out);
+
+/**
+ * Compression state of one direction of a connection.
+ *
+ * Payloads of the message types worth it are sent wrapped in a "compressed"
+ * message holding the original command, flags, the size of the payload and the
+ * payload compressed with LZCompress. TX and INV payloads are compressed
+ * against the previous ones of the same connection, so both ends must handle
+ * them in the order they go over the wire.
+ */
+class CNetMsgCompressor {
+private:
+    enum Flags : uint8_t {
+        USES_DICTIONARY = 1,
+    };
+
+    std::vector<uint8_t> dictionary;
+
+    void AddToDictionary(const uint8_t *data, size_t nSize);
+
+public:
+    /** Whether Compress may compress a message of this type and size. */
+    static bool IsWorthCompressing(const std::string &command, size_t nSize);
+
+    /**
+     * Return the payload of a "compressed" message wrapping the given one in
+     * wrapped, or false if the message isn't worth compressing. Messages which
+     * feed the dictionary are always wrapped.
+     */
+    bool Compress(const std::string &command,
+                  const std::vector<uint8_t> &payload,
+                  std::vector<uint8_t> &wrapped);
+
+    /**
+     * Unwrap the payload of a "compressed" message. Returns false if it is
+     * malformed or its payload would exceed nMaxSize.
+     */
+    bool Decompress(CDataStream &wrapped, size_t nMaxSize,
+                    std::string &command, std::vector<uint8_t> &payload);
+};
+
+#endif // BITCOIN_NETCOMPRESSION_H
@@ -28,6 +28,25 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    /**
+     * Serialize a message once, to push it to several peers or to keep it for
+     * later requests.
+     */
+    template <typename... Args>
+    CSharedNetMsg MakeShared(int nFlags, std::string sCommand,
+                             Args &&... args) const {
+        std::vector<uint8_t> data;
+        CVectorWriter{SER_NETWORK, nFlags | nVersion, data,
+                      CMessageHeader::HEADER_SIZE,
+                      std::forward<Args>(args)...};
+        return CSharedNetMsg(std::move(sCommand), std::move(data));
+    }
+
+    template <typename... Args>
+    CSharedNetMsg MakeShared(std::string sCommand, Args &&... args) const {
+        return MakeShared(0, std::move(sCommand), std::forward<Args>(args)...);
+    }
+
 private:
     const int nVersion;
 };
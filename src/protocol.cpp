@@ -39,6 +39,11 @@ const char *SENDCMPCT = "sendcmpct";
 const char *CMPCTBLOCK = "cmpctblock";
 const char *GETBLOCKTXN = "getblocktxn";
 const char *BLOCKTXN = "blocktxn";
+const char *SENDGRAPHENE = "sendgrph";
+const char *GETGRAPHENE = "getgrblk";
+const char *GRAPHENEBLOCK = "grblk";
+const char *SENDCOMPRESSION = "sendcompr";
+const char *COMPRESSED = "compressed";
 }; // namespace NetMsgType
 
 /**
@@ -54,7 +59,9 @@ static const std::string allNetMessageTypes[] = {
     NetMsgType::NOTFOUND,    NetMsgType::FILTERLOAD, NetMsgType::FILTERADD,
     NetMsgType::FILTERCLEAR, NetMsgType::REJECT,     NetMsgType::SENDHEADERS,
     NetMsgType::FEEFILTER,   NetMsgType::SENDCMPCT,  NetMsgType::CMPCTBLOCK,
-    NetMsgType::GETBLOCKTXN, NetMsgType::BLOCKTXN,
+    NetMsgType::GETBLOCKTXN, NetMsgType::BLOCKTXN,   NetMsgType::SENDGRAPHENE,
+    NetMsgType::GETGRAPHENE, NetMsgType::GRAPHENEBLOCK,
+    NetMsgType::SENDCOMPRESSION, NetMsgType::COMPRESSED,
 };
 static const std::vector<std::string>
     allNetMessageTypesVec(allNetMessageTypes,
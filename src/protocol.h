@@ -242,6 +242,35 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Contains an 8-byte LE version number.
+ * Indicates that a node is willing to provide and receive blocks via "grblk"
+ * messages.
+ */
+extern const char *SENDGRAPHENE;
+/**
+ * Contains a CGrapheneBlockRequest.
+ * Peer should respond with a "grblk" message, or a "block" message for old
+ * blocks.
+ */
+extern const char *GETGRAPHENE;
+/**
+ * Contains a CGrapheneBlock - providing a header, a Bloom filter and an IBLT
+ * over the short txids of the block.
+ * Sent in response to a "getgrblk" message.
+ */
+extern const char *GRAPHENEBLOCK;
+/**
+ * Contains an 8-byte LE version number.
+ * Indicates that a node is able to decode "compressed" messages.
+ */
+extern const char *SENDCOMPRESSION;
+/**
+ * Contains the command of another message, flags, its payload size and its
+ * payload compressed, see CNetMsgCompressor.
+ * Only sent to peers which sent a "sendcompr" message.
+ */
+extern const char *COMPRESSED;
 }; // namespace NetMsgType
 
 /* Get a vector of all valid message types (see above) */
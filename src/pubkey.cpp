@@ -7,9 +7,80 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <mutex>
+#include <vector>
+
 namespace {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context *secp256k1_context_verify = nullptr;
+
+/**
+ * Parsed public keys for CPubKey::Verify. Each key has a single place, picked
+ * by a salted hash, in one of SHARDS tables with their own lock, so that
+ * concurrent verifications rarely wait for each other. A key replaces the one
+ * in its place.
+ */
+class PubKeyCache {
+    static const size_t SHARDS = 16;
+
+    struct Entry {
+        CPubKey key;
+        secp256k1_pubkey pubkey;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+    };
+
+    Shard shards[SHARDS];
+    uint64_t k0 = 0;
+    uint64_t k1 = 0;
+
+    uint64_t Hash(const CPubKey &key) const {
+        return CSipHasher(k0, k1).Write(key.begin(), key.size()).Finalize();
+    }
+
+public:
+    void Setup(size_t nEntries, const uint256 &salt) {
+        k0 = salt.GetUint64(0);
+        k1 = salt.GetUint64(1);
+        for (Shard &shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.entries.assign((nEntries + SHARDS - 1) / SHARDS, Entry());
+        }
+    }
+
+    bool Get(const CPubKey &key, secp256k1_pubkey &pubkey) {
+        uint64_t hash = Hash(key);
+        Shard &shard = shards[hash % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.entries.empty()) {
+            return false;
+        }
+        const Entry &entry =
+            shard.entries[(hash / SHARDS) % shard.entries.size()];
+        if (entry.key != key) {
+            return false;
+        }
+        pubkey = entry.pubkey;
+        return true;
+    }
+
+    void Put(const CPubKey &key, const secp256k1_pubkey &pubkey) {
+        uint64_t hash = Hash(key);
+        Shard &shard = shards[hash % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.entries.empty()) {
+            return;
+        }
+        Entry &entry = shard.entries[(hash / SHARDS) % shard.entries.size()];
+        entry.key = key;
+        entry.pubkey = pubkey;
+    }
+};
+
+PubKeyCache pubkey_cache;
 } // namespace
 
 /**
@@ -172,9 +243,12 @@ bool CPubKey::Verify(const uint256 &hash,
     if (!IsValid()) return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey,
-                                   &(*this)[0], size())) {
-        return false;
+    if (!pubkey_cache.Get(*this, pubkey)) {
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey,
+                                       &(*this)[0], size())) {
+            return false;
+        }
+        pubkey_cache.Put(*this, pubkey);
     }
     if (vchSig.size() == 0) {
         return false;
@@ -301,6 +375,10 @@ bool CExtPubKey::Derive(CExtPubKey &out, unsigned int _nChild) const {
                                                  nullptr, &sig));
 }
 
+void InitPubKeyCache(size_t nEntries, const uint256 &salt) {
+    pubkey_cache.Setup(nEntries, salt);
+}
+
 /* static */ int ECCVerifyHandle::refcount = 0;
 
 ECCVerifyHandle::ECCVerifyHandle() {
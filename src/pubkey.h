@@ -195,6 +195,17 @@ struct CExtPubKey {
     }
 };
 
+//! Parsed public keys kept for CPubKey::Verify by default.
+static const size_t DEFAULT_PUBKEY_CACHE_ENTRIES = 1 << 15;
+
+/**
+ * Keep up to nEntries parsed public keys for CPubKey::Verify, so that a key
+ * used by many signatures is parsed, and decompressed, only once. The salt
+ * randomizes where keys are stored. The cache is disabled until this is
+ * called, and must not be in use while it is.
+ */
+void InitPubKeyCache(size_t nEntries, const uint256 &salt);
+
 /**
  * Users of this module must hold an ECCVerifyHandle. The constructor and
  * destructor of these are not allowed to run in parallel, though.
@@ -10,6 +10,7 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "rpc/blockchain.h"
+#include "rpc/mining.h"
 #include "rpc/server.h"
 #include "rpc/tojson.h"
 #include "streams.h"
@@ -443,6 +444,64 @@ static bool rest_tx(Config &config, HTTPRequest *req,
     return true;
 }
 
+static bool rest_blocktemplate(Config &config, HTTPRequest *req,
+                               const std::string &strURIPart) {
+    if (!CheckWarmup(req)) {
+        return false;
+    }
+
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY && rf != RF_HEX) {
+        return RESTERR(req, HTTP_NOT_FOUND,
+                       "output format not found (available: .bin, .hex)");
+    }
+
+    // /rest/blocktemplate/<templateid> requests a delta against a previously
+    // served template.
+    uint256 baseTemplateId;
+    if (!param.empty()) {
+        std::string hashStr = param.substr(1);
+        if (param[0] != '/' || !ParseHashStr(hashStr, baseTemplateId)) {
+            return RESTERR(req, HTTP_BAD_REQUEST,
+                           "Invalid template id: " + hashStr);
+        }
+    }
+
+    CDataStream ssTemplate(SER_NETWORK, PROTOCOL_VERSION);
+    std::string strError;
+    if (!GetBinaryBlockTemplate(config, baseTemplateId, ssTemplate,
+                                strError)) {
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, strError);
+    }
+
+    switch (rf) {
+        case RF_BINARY: {
+            std::string binaryTemplate = ssTemplate.str();
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, binaryTemplate);
+            return true;
+        }
+
+        case RF_HEX: {
+            std::string strHex =
+                HexStr(ssTemplate.begin(), ssTemplate.end()) + "\n";
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, strHex);
+            return true;
+        }
+
+        default: {
+            return RESTERR(req, HTTP_NOT_FOUND,
+                           "output format not found (available: .bin, .hex)");
+        }
+    }
+
+    // not reached
+    // continue to process further HTTP reqs on this cxn
+    return true;
+}
+
 static bool rest_getutxos(Config &config, HTTPRequest *req,
                           const std::string &strURIPart) {
     if (!CheckWarmup(req)) {
@@ -678,6 +737,7 @@ static const struct {
     {"/rest/mempool/contents", rest_mempool_contents},
     {"/rest/headers/", rest_headers},
     {"/rest/getutxos", rest_getutxos},
+    {"/rest/blocktemplate", rest_blocktemplate},
 };
 
 bool StartREST() {
@@ -17,6 +17,8 @@
 #include "primitives/transaction.h"
 #include "rpc/server.h"
 #include "rpc/tojson.h"
+#include "script/scriptcache.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -389,6 +391,14 @@ std::string EntryDescriptionString() {
            "ancestor transactions (including this one)\n"
            "    \"ancestorsize\" : n,     (numeric) virtual transaction size "
            "of in-mempool ancestors (including this one)\n"
+           "    \"clustercount\" : n,     (numeric) number of in-mempool "
+           "transactions connected to this one (including this one)\n"
+           "    \"clustersize\" : n,      (numeric) virtual transaction size "
+           "of in-mempool transactions connected to this one (including this "
+           "one)\n"
+           "    \"clusterfees\" : n,      (numeric) modified fees (see above) "
+           "of in-mempool transactions connected to this one (including this "
+           "one)\n"
            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) "
            "of in-mempool ancestors (including this one)\n"
            "    \"depends\" : [           (array) unconfirmed transactions "
@@ -416,6 +426,12 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) {
     info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
     info.push_back(
         Pair("ancestorfees", e.GetModFeesWithAncestors().GetSatoshis()));
+    uint64_t nClusterCount, nClusterSize;
+    Amount nClusterFees;
+    mempool.GetClusterStats(e, nClusterCount, nClusterSize, nClusterFees);
+    info.push_back(Pair("clustercount", nClusterCount));
+    info.push_back(Pair("clustersize", nClusterSize));
+    info.push_back(Pair("clusterfees", nClusterFees.GetSatoshis()));
     const CTransaction &tx = e.GetTx();
     std::set<std::string> setDepends;
     for (const CTxIn &txin : tx.vin) {
@@ -1502,6 +1518,81 @@ UniValue getmempoolinfo(const Config &config, const JSONRPCRequest &request) {
     return mempoolInfoToJSON();
 }
 
+static UniValue CacheStatsToJSON(const CacheStats &stats) {
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("lookups", stats.nLookups));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nLookups - stats.nHits));
+    ret.push_back(Pair("lookupwaits", stats.nLookupWaits));
+    ret.push_back(Pair("inserts", stats.nInserts));
+    ret.push_back(Pair("merges", stats.nMerges));
+    ret.push_back(Pair("mergewaits", stats.nMergeWaits));
+    ret.push_back(Pair("mergesdeferred", stats.nMergesDeferred));
+    ret.push_back(Pair("pending", stats.nPending));
+    ret.push_back(Pair("size", stats.nSize));
+    ret.push_back(Pair("occupied", stats.nOccupied));
+    ret.push_back(Pair("recent", stats.nRecent));
+    ret.push_back(Pair("displacements", stats.nDisplacements));
+    ret.push_back(Pair("evictions", stats.nEvictions));
+    ret.push_back(Pair("generations", stats.nGenerations));
+    return ret;
+}
+
+UniValue getcacheinfo(const Config &config, const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 0) {
+        throw std::runtime_error(
+            "getcacheinfo\n"
+            "\nReturns statistics about the validation caches.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sigcache\": {              (json object) Signature cache\n"
+            "    \"lookups\": xxxxx,        (numeric) Number of lookups\n"
+            "    \"hits\": xxxxx,           (numeric) Lookups that found "
+            "the entry\n"
+            "    \"misses\": xxxxx,         (numeric) Lookups that did not "
+            "find the entry\n"
+            "    \"lookupwaits\": xxxxx,    (numeric) Lookups that waited "
+            "for inserts to be merged\n"
+            "    \"inserts\": xxxxx,        (numeric) Number of inserted "
+            "entries\n"
+            "    \"merges\": xxxxx,         (numeric) Batches of inserts "
+            "merged into the cache\n"
+            "    \"mergewaits\": xxxxx,     (numeric) Merges that waited for "
+            "lookups to finish\n"
+            "    \"mergesdeferred\": xxxxx, (numeric) Merges deferred "
+            "because of running lookups\n"
+            "    \"pending\": xxxxx,        (numeric) Inserted entries not "
+            "merged yet\n"
+            "    \"size\": xxxxx,           (numeric) Number of slots\n"
+            "    \"occupied\": xxxxx,       (numeric) Slots holding an "
+            "entry\n"
+            "    \"recent\": xxxxx,         (numeric) Slots holding an entry "
+            "of the current generation\n"
+            "    \"displacements\": xxxxx,  (numeric) Entries moved to make "
+            "room for an insert\n"
+            "    \"evictions\": xxxxx,      (numeric) Entries dropped because "
+            "no room was found\n"
+            "    \"generations\": xxxxx     (numeric) Generations started; "
+            "entries not inserted again are dropped after two\n"
+            "  },\n"
+            "  \"scriptcache\": {           (json object) Script execution "
+            "cache, with the same fields\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getcacheinfo", "") +
+            HelpExampleRpc("getcacheinfo", ""));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(
+        Pair("sigcache", CacheStatsToJSON(GetSignatureCacheStats())));
+    ret.push_back(
+        Pair("scriptcache", CacheStatsToJSON(GetScriptCacheStats())));
+    return ret;
+}
+
 UniValue preciousblock(const Config &config, const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() != 1) {
         throw std::runtime_error(
@@ -1727,6 +1818,7 @@ static const CRPCCommand commands[] = {
     //  category            name                      actor (function)        okSafe argNames
     //  ------------------- ------------------------  ----------------------  ------ ----------
     { "blockchain",         "getblockchaininfo",      getblockchaininfo,      true,  {} },
+    { "blockchain",         "getcacheinfo",           getcacheinfo,           true,  {} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,       true,  {"nblocks", "blockhash"} },
     { "blockchain",         "getbestblockhash",       getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          getblockcount,          true,  {} },
@@ -13,6 +13,7 @@
 #include "consensus/validation.h"
 #include "core_io.h"
 #include "dstencode.h"
+#include "hash.h"
 #include "init.h"
 #include "miner.h"
 #include "net.h"
@@ -20,6 +21,7 @@
 #include "pow.h"
 #include "rpc/blockchain.h"
 #include "rpc/server.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -29,6 +31,7 @@
 #include <univalue.h>
 
 #include <cstdint>
+#include <deque>
 #include <memory>
 
 /**
@@ -787,6 +790,142 @@ static UniValue getblocktemplate(const Config &config,
     return result;
 }
 
+/**
+ * A block template as served through the binary interface. Only the data
+ * needed to express later templates as a delta against this one is kept.
+ */
+struct BinaryBlockTemplate {
+    uint256 templateId;
+    std::vector<uint256> vTxIds;
+};
+
+/** Recently served binary templates, most recent last. Guarded by cs_main. */
+static std::deque<std::shared_ptr<const BinaryBlockTemplate>>
+    recentBinaryTemplates;
+
+static uint256
+ComputeBlockTemplateId(const uint256 &hashPrevBlock,
+                       const std::vector<uint256> &vTxIds) {
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << hashPrevBlock << vTxIds;
+    return ss.GetHash();
+}
+
+bool GetBinaryBlockTemplate(const Config &config,
+                            const uint256 &baseTemplateId, CDataStream &ss,
+                            std::string &strError) {
+    LOCK(cs_main);
+
+    if (!g_connman) {
+        strError = "Peer-to-peer functionality missing or disabled";
+        return false;
+    }
+
+    if (g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL) == 0) {
+        strError = "Bitcoin is not connected!";
+        return false;
+    }
+
+    if (IsInitialBlockDownload()) {
+        strError = "Bitcoin is downloading blocks...";
+        return false;
+    }
+
+    // Same refresh policy as getblocktemplate: rebuild when the tip changes,
+    // or when the mempool changed and the template is more than 5s old.
+    static CBlockIndex *pindexPrev;
+    static int64_t nStart;
+    static unsigned int nTransactionsUpdatedLast;
+    static std::unique_ptr<CBlockTemplate> pblocktemplate;
+    if (pindexPrev != chainActive.Tip() ||
+        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast &&
+         GetTime() - nStart > 5)) {
+        pindexPrev = nullptr;
+
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        CBlockIndex *pindexPrevNew = chainActive.Tip();
+        nStart = GetTime();
+
+        CScript scriptDummy = CScript() << OP_TRUE;
+        pblocktemplate = BlockAssembler(config).CreateNewBlock(scriptDummy);
+        if (!pblocktemplate) {
+            strError = "Out of memory";
+            return false;
+        }
+
+        pindexPrev = pindexPrevNew;
+
+        auto tmpl = std::make_shared<BinaryBlockTemplate>();
+        const CBlock &block = pblocktemplate->block;
+        tmpl->vTxIds.reserve(block.vtx.size());
+        for (const auto &tx : block.vtx) {
+            if (!tx->IsCoinBase()) {
+                tmpl->vTxIds.push_back(tx->GetId());
+            }
+        }
+        tmpl->templateId =
+            ComputeBlockTemplateId(block.hashPrevBlock, tmpl->vTxIds);
+
+        recentBinaryTemplates.push_back(std::move(tmpl));
+        while (recentBinaryTemplates.size() > MAX_BINARY_TEMPLATE_HISTORY) {
+            recentBinaryTemplates.pop_front();
+        }
+    }
+
+    CBlock *pblock = &pblocktemplate->block;
+    UpdateTime(pblock, config, pindexPrev);
+    pblock->nNonce = 0;
+
+    const BinaryBlockTemplate &current = *recentBinaryTemplates.back();
+
+    // Find the template the client already has, if it is still known.
+    std::shared_ptr<const BinaryBlockTemplate> base;
+    if (!baseTemplateId.IsNull()) {
+        for (const auto &tmpl : recentBinaryTemplates) {
+            if (tmpl->templateId == baseTemplateId) {
+                base = tmpl;
+                break;
+            }
+        }
+    }
+
+    std::map<uint256, uint64_t> mapBaseIndex;
+    if (base) {
+        for (size_t i = 0; i < base->vTxIds.size(); i++) {
+            mapBaseIndex.emplace(base->vTxIds[i], i);
+        }
+    }
+
+    const uint64_t nMaxBlockSize = config.GetMaxBlockSize();
+
+    ss << current.templateId << (base ? base->templateId : uint256());
+    ss << pblock->GetBlockHeader();
+    ss << int32_t(pindexPrev->nHeight + 1);
+    ss << pblock->vtx[0]->vout[0].nValue.GetSatoshis();
+    ss << int64_t(pindexPrev->GetMedianTimePast() + 1);
+    ss << nMaxBlockSize << GetMaxBlockSigOpsCount(nMaxBlockSize);
+
+    // Each entry is either a reference to the 1-based position of the same
+    // transaction in the base template, or 0 followed by the transaction, its
+    // fee and its sigop count.
+    WriteCompactSize(ss, current.vTxIds.size());
+    for (size_t i = 0; i < current.vTxIds.size(); i++) {
+        auto it = mapBaseIndex.find(current.vTxIds[i]);
+        if (it != mapBaseIndex.end()) {
+            ss << VARINT(it->second + 1);
+            continue;
+        }
+
+        // Entry 0 in the template is the coinbase.
+        ss << VARINT(uint64_t(0));
+        ss << pblock->vtx[i + 1];
+        ss << pblocktemplate->vTxFees[i + 1].GetSatoshis();
+        ss << pblocktemplate->vTxSigOpsCount[i + 1];
+    }
+
+    return true;
+}
+
 class submitblock_StateCatcher : public CValidationInterface {
 public:
     uint256 hash;
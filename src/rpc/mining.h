@@ -10,12 +10,27 @@
 #include <univalue.h>
 
 #include <memory>
+#include <string>
 
+class CDataStream;
 class Config;
+class uint256;
+
+/** Number of served binary templates kept around as delta bases. */
+static const size_t MAX_BINARY_TEMPLATE_HISTORY = 8;
 
 /** Generate blocks (mine) */
 UniValue generateBlocks(const Config &config,
                         std::shared_ptr<CReserveScript> coinbaseScript,
                         int nGenerate, uint64_t nMaxTries, bool keepScript);
 
+/**
+ * Serialize the current block template in the native binary format. If
+ * baseTemplateId names a recently served template, transactions the client
+ * already has are sent as references into it instead of in full.
+ */
+bool GetBinaryBlockTemplate(const Config &config,
+                            const uint256 &baseTemplateId, CDataStream &ss,
+                            std::string &strError);
+
 #endif
@@ -65,6 +65,24 @@ static UniValue ping(const Config &config, const JSONRPCRequest &request) {
     return NullUniValue;
 }
 
+static UniValue
+TrafficClassBytesToJSON(const uint64_t nBytesPerClass[TRAFFIC_CLASS_COUNT]) {
+    UniValue obj(UniValue::VOBJ);
+    for (int i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+        obj.push_back(Pair(GetTrafficClassName(TrafficClass(i)),
+                           nBytesPerClass[i]));
+    }
+    return obj;
+}
+
+static UniValue BytesPerTrafficClass(const mapMsgCmdSize &bytesPerMsgCmd) {
+    uint64_t nBytesPerClass[TRAFFIC_CLASS_COUNT] = {};
+    for (const mapMsgCmdSize::value_type &i : bytesPerMsgCmd) {
+        nBytesPerClass[GetTrafficClass(i.first)] += i.second;
+    }
+    return TrafficClassBytesToJSON(nBytesPerClass);
+}
+
 static UniValue getpeerinfo(const Config &config,
                             const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() != 0) {
@@ -120,6 +138,11 @@ static UniValue getpeerinfo(const Config &config,
             "we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflight_limit\": n,       (numeric) The number of blocks "
+            "we're willing to ask from this peer at once\n"
+            "    \"block_download_rate\": n,  (numeric) The measured rate in "
+            "bytes per second at which the peer sends us blocks, 0 if "
+            "unknown\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is "
             "whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
@@ -131,7 +154,19 @@ static UniValue getpeerinfo(const Config &config,
             "       \"addr\": n,              (numeric) The total bytes "
             "received aggregated by message type\n"
             "       ...\n"
-            "    }\n"
+            "    },\n"
+            "    \"bytessent_per_class\": {\n"
+            "       \"block\": n,             (numeric) The total bytes sent "
+            "aggregated by class of traffic (block, tx, addr or other)\n"
+            "       ...\n"
+            "    },\n"
+            "    \"bytesrecv_per_class\": {\n"
+            "       \"block\": n,             (numeric) The total bytes "
+            "received aggregated by class of traffic\n"
+            "       ...\n"
+            "    },\n"
+            "    \"throttled_sends\": n,     (numeric) How many times the rate "
+            "limiter held back traffic to the peer\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -194,6 +229,10 @@ static UniValue getpeerinfo(const Config &config,
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(
+                Pair("inflight_limit", statestats.nBlocksInTransitLimit));
+            obj.push_back(
+                Pair("block_download_rate", statestats.dBlockDownloadRate));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -213,6 +252,12 @@ static UniValue getpeerinfo(const Config &config,
         }
         obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
 
+        obj.push_back(Pair("bytessent_per_class",
+                           BytesPerTrafficClass(stats.mapSendBytesPerMsgCmd)));
+        obj.push_back(Pair("bytesrecv_per_class",
+                           BytesPerTrafficClass(stats.mapRecvBytesPerMsgCmd)));
+        obj.push_back(Pair("throttled_sends", stats.nThrottledSends));
+
         ret.push_back(obj);
     }
 
@@ -427,6 +472,27 @@ static UniValue getnettotals(const Config &config,
             "left in current time cycle\n"
             "    \"time_left_in_cycle\": t                 (numeric) Seconds "
             "left in current time cycle\n"
+            "  },\n"
+            "  \"ratelimit\":\n"
+            "  {\n"
+            "    \"maxuploadrate\": n,         (numeric) Upload rate limit in "
+            "bytes per second, 0 if unlimited\n"
+            "    \"maxdownloadrate\": n,       (numeric) Download rate limit "
+            "in bytes per second, 0 if unlimited\n"
+            "    \"peerbandwidthshare\": n,    (numeric) Percentage of the "
+            "limits a single peer may use\n"
+            "    \"throttled_sends\": n,       (numeric) How many times the "
+            "rate limiter held back traffic\n"
+            "    \"bytessent_per_class\": {    (json object) The total bytes "
+            "sent aggregated by class of traffic\n"
+            "      \"block\": n,\n"
+            "      ...\n"
+            "    },\n"
+            "    \"bytesrecv_per_class\": {    (json object) The total bytes "
+            "received aggregated by class of traffic\n"
+            "      \"block\": n,\n"
+            "      ...\n"
+            "    }\n"
             "  }\n"
             "}\n"
             "\nExamples:\n" +
@@ -455,6 +521,86 @@ static UniValue getnettotals(const Config &config,
     outboundLimit.push_back(
         Pair("time_left_in_cycle", g_connman->GetMaxOutboundTimeLeftInCycle()));
     obj.push_back(Pair("uploadtarget", outboundLimit));
+
+    CTrafficStats trafficStats;
+    g_connman->GetTrafficStats(trafficStats);
+    UniValue rateLimit(UniValue::VOBJ);
+    rateLimit.push_back(Pair("maxuploadrate", trafficStats.nMaxUploadRate));
+    rateLimit.push_back(Pair("maxdownloadrate", trafficStats.nMaxDownloadRate));
+    rateLimit.push_back(
+        Pair("peerbandwidthshare", uint64_t(trafficStats.nPeerBandwidthShare)));
+    rateLimit.push_back(Pair("throttled_sends", trafficStats.nThrottledSends));
+    rateLimit.push_back(
+        Pair("bytessent_per_class",
+             TrafficClassBytesToJSON(trafficStats.nSendBytesPerClass)));
+    rateLimit.push_back(
+        Pair("bytesrecv_per_class",
+             TrafficClassBytesToJSON(trafficStats.nRecvBytesPerClass)));
+    obj.push_back(Pair("ratelimit", rateLimit));
+    return obj;
+}
+
+static UniValue getorphanpoolinfo(const Config &config,
+                                  const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getorphanpoolinfo\n"
+            "\nReturns information about the transactions received from "
+            "peers whose inputs are not known yet.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": n,          (numeric) Current number of orphan "
+            "transactions\n"
+            "  \"bytes\": n,         (numeric) Memory used by orphan "
+            "transactions\n"
+            "  \"maxsize\": n,       (numeric) Maximum number of orphan "
+            "transactions\n"
+            "  \"maxbytes\": n,      (numeric) Maximum memory for orphan "
+            "transactions\n"
+            "  \"maxpeerbytes\": n,  (numeric) Maximum memory for the orphan "
+            "transactions of a single peer\n"
+            "  \"peers\": [          (array) Peers with orphan transactions\n"
+            "    {\n"
+            "      \"id\": n,        (numeric) Peer index\n"
+            "      \"size\": n,      (numeric) Number of orphan transactions "
+            "from this peer\n"
+            "      \"bytes\": n      (numeric) Memory used by them\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getorphanpoolinfo", "") +
+            HelpExampleRpc("getorphanpoolinfo", ""));
+
+    UniValue peers(UniValue::VARR);
+    for (const auto &entry : orphanpool.GetPeerStats()) {
+        UniValue peer(UniValue::VOBJ);
+        peer.push_back(Pair("id", entry.first));
+        peer.push_back(Pair("size", uint64_t(entry.second.nCount)));
+        peer.push_back(Pair("bytes", uint64_t(entry.second.nUsage)));
+        peers.push_back(peer);
+    }
+
+    int64_t nMaxOrphanTx = std::max(
+        int64_t(0),
+        gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    int64_t nMaxOrphanUsage =
+        std::max(int64_t(0), gArgs.GetArg("-maxorphanpoolsize",
+                                          DEFAULT_MAX_ORPHAN_POOL_SIZE)) *
+        1000000;
+    int64_t nMaxPeerUsage =
+        std::max(int64_t(0), gArgs.GetArg("-maxorphanpeersize",
+                                          DEFAULT_MAX_ORPHAN_PEER_SIZE)) *
+        1000000;
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("size", uint64_t(orphanpool.Size())));
+    obj.push_back(Pair("bytes", uint64_t(orphanpool.GetUsage())));
+    obj.push_back(Pair("maxsize", nMaxOrphanTx));
+    obj.push_back(Pair("maxbytes", nMaxOrphanUsage));
+    obj.push_back(Pair("maxpeerbytes", nMaxPeerUsage));
+    obj.push_back(Pair("peers", peers));
     return obj;
 }
 
@@ -756,6 +902,7 @@ static const CRPCCommand commands[] = {
     { "network",            "getaddednodeinfo",       getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         getnetworkinfo,         true,  {} },
+    { "network",            "getorphanpoolinfo",      getorphanpoolinfo,      true,  {} },
     { "network",            "setban",                 setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             listbanned,             true,  {} },
     { "network",            "clearbanned",            clearbanned,            true,  {} },
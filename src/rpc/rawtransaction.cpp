@@ -24,6 +24,7 @@
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
+#include "util.h"
 #include "utilstrencodings.h"
 #include "validation.h"
 #ifdef ENABLE_WALLET
@@ -1027,7 +1028,26 @@ static UniValue signrawtransaction(const Config &config,
     // Use CTransaction for the constant parts of the transaction to avoid
     // rehashing.
     const CTransaction txConst(mergedTx);
-    // Sign what we can:
+
+    // Sign what we can, on all cores. Signatures don't commit to the
+    // signatures of other inputs, so inputs can be signed independently.
+    std::vector<unsigned int> vToSign;
+    std::vector<CTxOut> vSpent;
+    for (size_t i = 0; i < mergedTx.vin.size(); i++) {
+        const Coin &coin = view.AccessCoin(mergedTx.vin[i].prevout);
+        // Only sign SIGHASH_SINGLE if there's a corresponding output:
+        if (!coin.IsSpent() &&
+            ((sigHashType.getBaseSigHashType() != BaseSigHashType::SINGLE) ||
+             (i < mergedTx.vout.size()))) {
+            vToSign.push_back(i);
+            vSpent.push_back(coin.GetTxOut());
+        }
+    }
+    std::vector<SignatureData> vSigData;
+    ProduceSignatures(keystore, txConst, vToSign, vSpent, sigHashType,
+                      GetNumCores(), vSigData);
+
+    size_t nSigned = 0;
     for (size_t i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn &txin = mergedTx.vin[i];
         const Coin &coin = view.AccessCoin(txin.prevout);
@@ -1040,12 +1060,8 @@ static UniValue signrawtransaction(const Config &config,
         const Amount amount = coin.GetTxOut().nValue;
 
         SignatureData sigdata;
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if ((sigHashType.getBaseSigHashType() != BaseSigHashType::SINGLE) ||
-            (i < mergedTx.vout.size())) {
-            ProduceSignature(MutableTransactionSignatureCreator(
-                                 &keystore, &mergedTx, i, amount, sigHashType),
-                             prevPubKey, sigdata);
+        if (nSigned < vToSign.size() && vToSign[nSigned] == i) {
+            sigdata = vSigData[nSigned++];
         }
 
         // ... and merge in other signatures:
@@ -10,6 +10,13 @@
 #include "script/interpreter.h"
 #include "version.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -125,6 +132,147 @@ int bitcoinconsensus_verify_script(const uint8_t *scriptPubKey,
                            nIn, flags, err);
 }
 
+namespace {
+
+/** A transaction of a batch, with the data shared by all its inputs. */
+struct BatchTransaction {
+    std::unique_ptr<CTransaction> tx;
+    std::unique_ptr<PrecomputedTransactionData> txdata;
+    //! Position of the first input in the arrays of the batch.
+    size_t nFirstInput;
+};
+
+/** An input to verify, as a transaction and an input index. */
+typedef std::pair<size_t, unsigned int> BatchInput;
+
+} // namespace
+
+/**
+ * Check that all specified flags are part of the libconsensus interface. Batch
+ * verification always has the amounts, so it also accepts SIGHASH_FORKID.
+ */
+static bool verify_batch_flags(unsigned int flags) {
+    return (flags & ~(bitcoinconsensus_SCRIPT_FLAGS_VERIFY_ALL |
+                      bitcoinconsensus_SCRIPT_ENABLE_SIGHASH_FORKID)) == 0;
+}
+
+static bitcoinconsensus_error
+prepare_batch_tx(BatchTransaction &btx, const uint8_t *txTo,
+                 unsigned int txToLen, unsigned int nInputs) {
+    try {
+        TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
+        btx.tx.reset(new CTransaction(deserialize, stream));
+        if (nInputs != btx.tx->vin.size()) {
+            return bitcoinconsensus_ERR_TX_INPUT_COUNT;
+        }
+        if (GetSerializeSize(*btx.tx, SER_NETWORK, PROTOCOL_VERSION) !=
+            txToLen) {
+            return bitcoinconsensus_ERR_TX_SIZE_MISMATCH;
+        }
+        btx.txdata.reset(new PrecomputedTransactionData(*btx.tx));
+        return bitcoinconsensus_ERR_OK;
+    } catch (const std::exception &) {
+        // Error deserializing
+        return bitcoinconsensus_ERR_TX_DESERIALIZE;
+    }
+}
+
+static int verify_txs(const uint8_t *const *txTos,
+                      const unsigned int *txToLens,
+                      const unsigned int *txInputCounts, unsigned int nTxs,
+                      const uint8_t *const *scriptPubKeys,
+                      const unsigned int *scriptPubKeyLens,
+                      const int64_t *amounts, unsigned int flags,
+                      unsigned int nThreads, int *results,
+                      bitcoinconsensus_error *errs) {
+    bool fValid = true;
+    std::vector<BatchTransaction> vTxs(nTxs);
+    std::vector<BatchInput> vInputs;
+    size_t nFirstInput = 0;
+    for (unsigned int t = 0; t < nTxs; t++) {
+        BatchTransaction &btx = vTxs[t];
+        btx.nFirstInput = nFirstInput;
+        nFirstInput += txInputCounts[t];
+        std::fill(results + btx.nFirstInput, results + nFirstInput, 0);
+
+        bitcoinconsensus_error err =
+            verify_batch_flags(flags)
+                ? prepare_batch_tx(btx, txTos[t], txToLens[t], txInputCounts[t])
+                : bitcoinconsensus_ERR_INVALID_FLAGS;
+        if (errs) {
+            errs[t] = err;
+        }
+        if (err != bitcoinconsensus_ERR_OK) {
+            fValid = false;
+            continue;
+        }
+        for (unsigned int i = 0; i < txInputCounts[t]; i++) {
+            vInputs.emplace_back(t, i);
+        }
+    }
+
+    // Each thread takes the next input until none are left. Nothing is shared
+    // between calls, so concurrent calls don't interfere.
+    std::atomic<size_t> nNext{0};
+    std::atomic<bool> fAllValid{true};
+    auto worker = [&]() {
+        for (size_t n = nNext++; n < vInputs.size(); n = nNext++) {
+            const BatchTransaction &btx = vTxs[vInputs[n].first];
+            const unsigned int nIn = vInputs[n].second;
+            const size_t pos = btx.nFirstInput + nIn;
+            const uint8_t *scriptPubKey = scriptPubKeys[pos];
+            bool fSuccess = VerifyScript(
+                btx.tx->vin[nIn].scriptSig,
+                CScript(scriptPubKey, scriptPubKey + scriptPubKeyLens[pos]),
+                flags,
+                TransactionSignatureChecker(btx.tx.get(), nIn,
+                                            Amount(amounts[pos]), *btx.txdata),
+                nullptr);
+            results[pos] = fSuccess;
+            if (!fSuccess) {
+                fAllValid = false;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t nWorkers = std::min<size_t>(nThreads, vInputs.size());
+    for (size_t i = 1; i < nWorkers; i++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error &) {
+            // Carry on with the threads we already have.
+            break;
+        }
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return fValid && fAllValid;
+}
+
+int bitcoinconsensus_verify_tx_inputs(
+    const uint8_t *txTo, unsigned int txToLen,
+    const uint8_t *const *scriptPubKeys, const unsigned int *scriptPubKeyLens,
+    const int64_t *amounts, unsigned int nInputs, unsigned int flags,
+    unsigned int nThreads, int *results, bitcoinconsensus_error *err) {
+    return ::verify_txs(&txTo, &txToLen, &nInputs, 1, scriptPubKeys,
+                        scriptPubKeyLens, amounts, flags, nThreads, results,
+                        err);
+}
+
+int bitcoinconsensus_verify_txs(
+    const uint8_t *const *txTos, const unsigned int *txToLens,
+    const unsigned int *txInputCounts, unsigned int nTxs,
+    const uint8_t *const *scriptPubKeys, const unsigned int *scriptPubKeyLens,
+    const int64_t *amounts, unsigned int flags, unsigned int nThreads,
+    int *results, bitcoinconsensus_error *errs) {
+    return ::verify_txs(txTos, txToLens, txInputCounts, nTxs, scriptPubKeys,
+                        scriptPubKeyLens, amounts, flags, nThreads, results,
+                        errs);
+}
+
 unsigned int bitcoinconsensus_version() {
     // Just use the API version for now
     return BITCOINCONSENSUS_API_VER;
@@ -33,7 +33,7 @@
 extern "C" {
 #endif
 
-#define BITCOINCONSENSUS_API_VER 1
+#define BITCOINCONSENSUS_API_VER 2
 
 typedef enum bitcoinconsensus_error_t {
     bitcoinconsensus_ERR_OK = 0,
@@ -42,6 +42,7 @@ typedef enum bitcoinconsensus_error_t {
     bitcoinconsensus_ERR_TX_DESERIALIZE,
     bitcoinconsensus_ERR_AMOUNT_REQUIRED,
     bitcoinconsensus_ERR_INVALID_FLAGS,
+    bitcoinconsensus_ERR_TX_INPUT_COUNT,
 } bitcoinconsensus_error;
 
 /** Script verification flags */
@@ -83,6 +84,38 @@ EXPORT_SYMBOL int bitcoinconsensus_verify_script_with_amount(
     const uint8_t *txTo, unsigned int txToLen, unsigned int nIn,
     unsigned int flags, bitcoinconsensus_error *err);
 
+/// Verifies all nInputs inputs of the serialized transaction pointed to by
+/// txTo. scriptPubKeys, scriptPubKeyLens and amounts describe the outputs
+/// spent by the inputs, in order. results[i] is set to 1 if input i correctly
+/// spends its output, and to 0 otherwise.
+/// The transaction is deserialized and its signature hash data precomputed
+/// once for all inputs. If nThreads is greater than 1, up to nThreads threads
+/// verify the inputs in parallel.
+/// Returns 1 if all inputs are valid. If not nullptr, err will contain an
+/// error/success code for the operation; unless it is bitcoinconsensus_ERR_OK,
+/// all results are 0.
+/// Available since API version 2.
+EXPORT_SYMBOL int bitcoinconsensus_verify_tx_inputs(
+    const uint8_t *txTo, unsigned int txToLen,
+    const uint8_t *const *scriptPubKeys, const unsigned int *scriptPubKeyLens,
+    const int64_t *amounts, unsigned int nInputs, unsigned int flags,
+    unsigned int nThreads, int *results, bitcoinconsensus_error *err);
+
+/// Verifies the inputs of the nTxs serialized transactions pointed to by txTos
+/// as bitcoinconsensus_verify_tx_inputs does, sharing the threads between
+/// them. txInputCounts[t] is the number of inputs of transaction t. The spent
+/// outputs and the results of all transactions follow each other in
+/// scriptPubKeys, scriptPubKeyLens, amounts and results.
+/// Returns 1 if all inputs of all transactions are valid. If not nullptr,
+/// errs[t] will contain the error/success code of transaction t.
+/// Available since API version 2.
+EXPORT_SYMBOL int bitcoinconsensus_verify_txs(
+    const uint8_t *const *txTos, const unsigned int *txToLens,
+    const unsigned int *txInputCounts, unsigned int nTxs,
+    const uint8_t *const *scriptPubKeys, const unsigned int *scriptPubKeyLens,
+    const int64_t *amounts, unsigned int flags, unsigned int nThreads,
+    int *results, bitcoinconsensus_error *errs);
+
 EXPORT_SYMBOL unsigned int bitcoinconsensus_version();
 
 #ifdef __cplusplus
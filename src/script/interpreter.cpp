@@ -11,6 +11,7 @@
 #include "primitives/transaction.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "script/scriptstack.h"
 #include "uint256.h"
 
 typedef std::vector<uint8_t> valtype;
@@ -33,7 +34,7 @@ inline bool set_error(ScriptError *ret, const ScriptError serror) {
 
 } // namespace
 
-bool CastToBool(const valtype &vch) {
+bool CastToBool(const ScriptStackElement &vch) {
     for (size_t i = 0; i < vch.size(); i++) {
         if (vch[i] != 0) {
             // Can be negative zero
@@ -52,7 +53,7 @@ bool CastToBool(const valtype &vch) {
  */
 #define stacktop(i) (stack.at(stack.size() + (i)))
 #define altstacktop(i) (altstack.at(altstack.size() + (i)))
-static inline void popstack(std::vector<valtype> &stack) {
+static inline void popstack(ScriptStack &stack) {
     if (stack.empty()) {
         throw std::runtime_error("popstack(): stack empty");
     }
@@ -185,7 +186,7 @@ static bool IsLowDERSignature(const valtype &vchSig, ScriptError *serror) {
     return true;
 }
 
-static SigHashType GetHashType(const valtype &vchSig) {
+template <typename Bytes> static SigHashType GetHashType(const Bytes &vchSig) {
     if (vchSig.size() == 0) {
         return SigHashType(0);
     }
@@ -194,12 +195,12 @@ static SigHashType GetHashType(const valtype &vchSig) {
 }
 
 static void CleanupScriptCode(CScript &scriptCode,
-                              const std::vector<uint8_t> &vchSig,
+                              const ScriptStackElement &vchSig,
                               uint32_t flags) {
     // Drop the signature in scripts when SIGHASH_FORKID is not used.
     SigHashType sigHashType = GetHashType(vchSig);
     if (!(flags & SCRIPT_ENABLE_SIGHASH_FORKID) || !sigHashType.hasForkId()) {
-        scriptCode.FindAndDelete(CScript(vchSig));
+        scriptCode.FindAndDelete(CScript(vchSig.ToVector()));
     }
 }
 
@@ -262,7 +263,8 @@ static bool CheckPubKeyEncoding(const valtype &vchPubKey, uint32_t flags,
     return true;
 }
 
-static bool CheckMinimalPush(const valtype &data, opcodetype opcode) {
+static bool CheckMinimalPush(const ScriptStackElement &data,
+                             opcodetype opcode) {
     if (data.size() == 0) {
         // Could have used OP_0.
         return opcode == OP_0;
@@ -291,24 +293,163 @@ static bool CheckMinimalPush(const valtype &data, opcodetype opcode) {
     return true;
 }
 
-bool EvalScript(std::vector<valtype> &stack, const CScript &script,
-                uint32_t flags, const BaseSignatureChecker &checker,
-                ScriptError *serror) {
+/**
+ * Check the signature of OP_CHECKSIG(VERIFY) against the public key, and set
+ * fSuccess to the result. Returns false with serror set if the script must
+ * fail.
+ */
+static bool EvalCheckSig(const ScriptStackElement &sig,
+                         const ScriptStackElement &pubkey, CScript &scriptCode,
+                         uint32_t flags, const BaseSignatureChecker &checker,
+                         bool &fSuccess, ScriptError *serror) {
+    valtype vchSig = sig.ToVector();
+    valtype vchPubKey = pubkey.ToVector();
+
+    if (!CheckSignatureEncoding(vchSig, flags, serror) ||
+        !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
+        // serror is set
+        return false;
+    }
+
+    CleanupScriptCode(scriptCode, sig, flags);
+
+    fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode, flags);
+
+    if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size()) {
+        return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+    }
+    return true;
+}
+
+/**
+ * Pop the arguments of OP_CHECKMULTISIG(VERIFY) off the stack, check them and
+ * set fSuccess to the result. Returns false with serror set if the script must
+ * fail.
+ */
+static bool EvalCheckMultiSig(ScriptStack &stack, CScript &scriptCode,
+                              uint32_t flags,
+                              const BaseSignatureChecker &checker,
+                              int &nOpCount, bool &fSuccess,
+                              ScriptError *serror) {
+    bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+
+    int i = 1;
+    if ((int)stack.size() < i) {
+        return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+    }
+
+    int nKeysCount = CScriptNum(stacktop(-i), fRequireMinimal).getint();
+    if (nKeysCount < 0 || nKeysCount > MAX_PUBKEYS_PER_MULTISIG) {
+        return set_error(serror, SCRIPT_ERR_PUBKEY_COUNT);
+    }
+    nOpCount += nKeysCount;
+    if (nOpCount > MAX_OPS_PER_SCRIPT) {
+        return set_error(serror, SCRIPT_ERR_OP_COUNT);
+    }
+    int ikey = ++i;
+    // ikey2 is the position of last non-signature item in the stack. Top stack
+    // item = 1. With SCRIPT_VERIFY_NULLFAIL, this is used for cleanup if
+    // operation fails.
+    int ikey2 = nKeysCount + 2;
+    i += nKeysCount;
+    if ((int)stack.size() < i) {
+        return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+    }
+
+    int nSigsCount = CScriptNum(stacktop(-i), fRequireMinimal).getint();
+    if (nSigsCount < 0 || nSigsCount > nKeysCount) {
+        return set_error(serror, SCRIPT_ERR_SIG_COUNT);
+    }
+    int isig = ++i;
+    i += nSigsCount;
+    if ((int)stack.size() < i) {
+        return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+    }
+
+    // Drop the signature in pre-segwit scripts but not segwit scripts
+    for (int k = 0; k < nSigsCount; k++) {
+        CleanupScriptCode(scriptCode, stacktop(-isig - k), flags);
+    }
+
+    fSuccess = true;
+    while (fSuccess && nSigsCount > 0) {
+        valtype vchSig = stacktop(-isig).ToVector();
+        valtype vchPubKey = stacktop(-ikey).ToVector();
+
+        // Note how this makes the exact order of pubkey/signature evaluation
+        // distinguishable by CHECKMULTISIG NOT if the STRICTENC flag is set.
+        // See the script_(in)valid tests for details.
+        if (!CheckSignatureEncoding(vchSig, flags, serror) ||
+            !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
+            // serror is set
+            return false;
+        }
+
+        // Check signature
+        bool fOk = checker.CheckSig(vchSig, vchPubKey, scriptCode, flags);
+
+        if (fOk) {
+            isig++;
+            nSigsCount--;
+        }
+        ikey++;
+        nKeysCount--;
+
+        // If there are more signatures left than keys left, then too many
+        // signatures have failed. Exit early, without checking any further
+        // signatures.
+        if (nSigsCount > nKeysCount) {
+            fSuccess = false;
+        }
+    }
+
+    // Clean up stack of actual arguments
+    while (i-- > 1) {
+        // If the operation failed, we require that all signatures must be
+        // empty vector
+        if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && !ikey2 &&
+            stacktop(-1).size()) {
+            return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+        }
+        if (ikey2 > 0) {
+            ikey2--;
+        }
+        popstack(stack);
+    }
+
+    // A bug causes CHECKMULTISIG to consume one extra argument whose contents
+    // were not checked in any way.
+    //
+    // Unfortunately this is a potential source of mutability, so optionally
+    // verify it is exactly equal to zero prior to removing it from the stack.
+    if (stack.size() < 1) {
+        return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
+    }
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && stacktop(-1).size()) {
+        return set_error(serror, SCRIPT_ERR_SIG_NULLDUMMY);
+    }
+    popstack(stack);
+    return true;
+}
+
+static bool EvalScript(ScriptStack &stack, const CScript &script,
+                       uint32_t flags, const BaseSignatureChecker &checker,
+                       ScriptError *serror) {
     static const CScriptNum bnZero(0);
     static const CScriptNum bnOne(1);
     static const CScriptNum bnFalse(0);
     static const CScriptNum bnTrue(1);
-    static const valtype vchFalse(0);
-    static const valtype vchZero(0);
-    static const valtype vchTrue(1, 1);
+    static const ScriptStackElement vchFalse(bnFalse);
+    static const ScriptStackElement vchTrue(bnTrue);
 
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
+    const uint8_t *pPushValue;
+    size_t nPushSize;
     std::vector<bool> vfExec;
-    std::vector<valtype> altstack;
+    ScriptStack altstack;
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
     if (script.size() > MAX_SCRIPT_SIZE) {
         return set_error(serror, SCRIPT_ERR_SCRIPT_SIZE);
@@ -323,10 +464,10 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
             //
             // Read instruction
             //
-            if (!script.GetOp(pc, opcode, vchPushValue)) {
+            if (!script.GetOp(pc, opcode, pPushValue, nPushSize)) {
                 return set_error(serror, SCRIPT_ERR_BAD_OPCODE);
             }
-            if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE) {
+            if (nPushSize > MAX_SCRIPT_ELEMENT_SIZE) {
                 return set_error(serror, SCRIPT_ERR_PUSH_SIZE);
             }
 
@@ -346,6 +487,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
             }
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4) {
+                ScriptStackElement vchPushValue(pPushValue, nPushSize);
                 if (fRequireMinimal &&
                     !CheckMinimalPush(vchPushValue, opcode)) {
                     return set_error(serror, SCRIPT_ERR_MINIMALDATA);
@@ -375,7 +517,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                     case OP_16: {
                         // ( -- value)
                         CScriptNum bn((int)opcode - (int)(OP_1 - 1));
-                        stack.push_back(bn.getvch());
+                        stack.push_back(ScriptStackElement(bn));
                         // The result of these opcodes should always be the
                         // minimal way to push the data they push, so no need
                         // for a CheckMinimalPush here.
@@ -512,7 +654,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                                 return set_error(
                                     serror, SCRIPT_ERR_UNBALANCED_CONDITIONAL);
                             }
-                            valtype &vch = stacktop(-1);
+                            ScriptStackElement &vch = stacktop(-1);
                             if (flags & SCRIPT_VERIFY_MINIMALIF) {
                                 if (vch.size() > 1) {
                                     return set_error(serror,
@@ -604,8 +746,8 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch1 = stacktop(-2);
-                        valtype vch2 = stacktop(-1);
+                        ScriptStackElement vch1 = stacktop(-2);
+                        ScriptStackElement vch2 = stacktop(-1);
                         stack.push_back(vch1);
                         stack.push_back(vch2);
                     } break;
@@ -616,9 +758,9 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch1 = stacktop(-3);
-                        valtype vch2 = stacktop(-2);
-                        valtype vch3 = stacktop(-1);
+                        ScriptStackElement vch1 = stacktop(-3);
+                        ScriptStackElement vch2 = stacktop(-2);
+                        ScriptStackElement vch3 = stacktop(-1);
                         stack.push_back(vch1);
                         stack.push_back(vch2);
                         stack.push_back(vch3);
@@ -630,8 +772,8 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch1 = stacktop(-4);
-                        valtype vch2 = stacktop(-3);
+                        ScriptStackElement vch1 = stacktop(-4);
+                        ScriptStackElement vch2 = stacktop(-3);
                         stack.push_back(vch1);
                         stack.push_back(vch2);
                     } break;
@@ -642,8 +784,8 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch1 = stacktop(-6);
-                        valtype vch2 = stacktop(-5);
+                        ScriptStackElement vch1 = stacktop(-6);
+                        ScriptStackElement vch2 = stacktop(-5);
                         stack.erase(stack.end() - 6, stack.end() - 4);
                         stack.push_back(vch1);
                         stack.push_back(vch2);
@@ -655,8 +797,8 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        swap(stacktop(-4), stacktop(-2));
-                        swap(stacktop(-3), stacktop(-1));
+                        std::swap(stacktop(-4), stacktop(-2));
+                        std::swap(stacktop(-3), stacktop(-1));
                     } break;
 
                     case OP_IFDUP: {
@@ -665,7 +807,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch = stacktop(-1);
+                        ScriptStackElement vch = stacktop(-1);
                         if (CastToBool(vch)) {
                             stack.push_back(vch);
                         }
@@ -674,7 +816,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                     case OP_DEPTH: {
                         // -- stacksize
                         CScriptNum bn(stack.size());
-                        stack.push_back(bn.getvch());
+                        stack.push_back(ScriptStackElement(bn));
                     } break;
 
                     case OP_DROP: {
@@ -692,7 +834,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch = stacktop(-1);
+                        ScriptStackElement vch = stacktop(-1);
                         stack.push_back(vch);
                     } break;
 
@@ -711,7 +853,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch = stacktop(-2);
+                        ScriptStackElement vch = stacktop(-2);
                         stack.push_back(vch);
                     } break;
 
@@ -730,7 +872,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch = stacktop(-n - 1);
+                        ScriptStackElement vch = stacktop(-n - 1);
                         if (opcode == OP_ROLL) {
                             stack.erase(stack.end() - n - 1);
                         }
@@ -745,8 +887,8 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        swap(stacktop(-3), stacktop(-2));
-                        swap(stacktop(-2), stacktop(-1));
+                        std::swap(stacktop(-3), stacktop(-2));
+                        std::swap(stacktop(-2), stacktop(-1));
                     } break;
 
                     case OP_SWAP: {
@@ -755,7 +897,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        swap(stacktop(-2), stacktop(-1));
+                        std::swap(stacktop(-2), stacktop(-1));
                     } break;
 
                     case OP_TUCK: {
@@ -764,7 +906,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype vch = stacktop(-1);
+                        ScriptStackElement vch = stacktop(-1);
                         stack.insert(stack.end() - 2, vch);
                     } break;
 
@@ -775,7 +917,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
                         CScriptNum bn(stacktop(-1).size());
-                        stack.push_back(bn.getvch());
+                        stack.push_back(ScriptStackElement(bn));
                     } break;
 
                     //
@@ -790,8 +932,8 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                                 return set_error(
                                     serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                             }
-                            valtype &vch1 = stacktop(-2);
-                            valtype &vch2 = stacktop(-1);
+                            ScriptStackElement &vch1 = stacktop(-2);
+                            ScriptStackElement &vch2 = stacktop(-1);
                             bool fEqual = (vch1 == vch2);
                             // OP_NOTEQUAL is disabled because it would be too
                             // easy to say something like n != 1 and have some
@@ -854,7 +996,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                                 break;
                         }
                         popstack(stack);
-                        stack.push_back(bn.getvch());
+                        stack.push_back(ScriptStackElement(bn));
                     } break;
 
                     case OP_ADD:
@@ -926,7 +1068,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                         }
                         popstack(stack);
                         popstack(stack);
-                        stack.push_back(bn.getvch());
+                        stack.push_back(ScriptStackElement(bn));
 
                         if (opcode == OP_NUMEQUALVERIFY) {
                             if (CastToBool(stacktop(-1))) {
@@ -967,35 +1109,36 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype &vch = stacktop(-1);
-                        valtype vchHash((opcode == OP_RIPEMD160 ||
-                                         opcode == OP_SHA1 ||
-                                         opcode == OP_HASH160)
-                                            ? 20
-                                            : 32);
+                        ScriptStackElement &vch = stacktop(-1);
+                        uint8_t vchHash[CSHA256::OUTPUT_SIZE];
+                        size_t nHashSize = (opcode == OP_RIPEMD160 ||
+                                            opcode == OP_SHA1 ||
+                                            opcode == OP_HASH160)
+                                               ? 20
+                                               : 32;
                         if (opcode == OP_RIPEMD160) {
                             CRIPEMD160()
                                 .Write(vch.data(), vch.size())
-                                .Finalize(vchHash.data());
+                                .Finalize(vchHash);
                         } else if (opcode == OP_SHA1) {
                             CSHA1()
                                 .Write(vch.data(), vch.size())
-                                .Finalize(vchHash.data());
+                                .Finalize(vchHash);
                         } else if (opcode == OP_SHA256) {
                             CSHA256()
                                 .Write(vch.data(), vch.size())
-                                .Finalize(vchHash.data());
+                                .Finalize(vchHash);
                         } else if (opcode == OP_HASH160) {
                             CHash160()
                                 .Write(vch.data(), vch.size())
-                                .Finalize(vchHash.data());
+                                .Finalize(vchHash);
                         } else if (opcode == OP_HASH256) {
                             CHash256()
                                 .Write(vch.data(), vch.size())
-                                .Finalize(vchHash.data());
+                                .Finalize(vchHash);
                         }
                         popstack(stack);
-                        stack.push_back(vchHash);
+                        stack.push_back(ScriptStackElement(vchHash, nHashSize));
                     } break;
 
                     case OP_CODESEPARATOR: {
@@ -1010,26 +1153,16 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                             return set_error(
                                 serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                         }
-                        valtype &vchSig = stacktop(-2);
-                        valtype &vchPubKey = stacktop(-1);
-
-                        if (!CheckSignatureEncoding(vchSig, flags, serror) ||
-                            !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
-                            // serror is set
-                            return false;
-                        }
 
                         // Subset of script starting at the most recent
                         // codeseparator
                         CScript scriptCode(pbegincodehash, pend);
-                        CleanupScriptCode(scriptCode, vchSig, flags);
-
-                        bool fSuccess = checker.CheckSig(vchSig, vchPubKey,
-                                                         scriptCode, flags);
-
-                        if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) &&
-                            vchSig.size()) {
-                            return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+                        bool fSuccess;
+                        if (!EvalCheckSig(stacktop(-2), stacktop(-1),
+                                          scriptCode, flags, checker, fSuccess,
+                                          serror)) {
+                            // serror is set
+                            return false;
                         }
 
                         popstack(stack);
@@ -1050,123 +1183,16 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
                         // ([sig ...] num_of_signatures [pubkey ...]
                         // num_of_pubkeys -- bool)
 
-                        int i = 1;
-                        if ((int)stack.size() < i) {
-                            return set_error(
-                                serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                        }
-
-                        int nKeysCount =
-                            CScriptNum(stacktop(-i), fRequireMinimal).getint();
-                        if (nKeysCount < 0 ||
-                            nKeysCount > MAX_PUBKEYS_PER_MULTISIG) {
-                            return set_error(serror, SCRIPT_ERR_PUBKEY_COUNT);
-                        }
-                        nOpCount += nKeysCount;
-                        if (nOpCount > MAX_OPS_PER_SCRIPT) {
-                            return set_error(serror, SCRIPT_ERR_OP_COUNT);
-                        }
-                        int ikey = ++i;
-                        // ikey2 is the position of last non-signature item in
-                        // the stack. Top stack item = 1. With
-                        // SCRIPT_VERIFY_NULLFAIL, this is used for cleanup if
-                        // operation fails.
-                        int ikey2 = nKeysCount + 2;
-                        i += nKeysCount;
-                        if ((int)stack.size() < i) {
-                            return set_error(
-                                serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                        }
-
-                        int nSigsCount =
-                            CScriptNum(stacktop(-i), fRequireMinimal).getint();
-                        if (nSigsCount < 0 || nSigsCount > nKeysCount) {
-                            return set_error(serror, SCRIPT_ERR_SIG_COUNT);
-                        }
-                        int isig = ++i;
-                        i += nSigsCount;
-                        if ((int)stack.size() < i) {
-                            return set_error(
-                                serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                        }
-
                         // Subset of script starting at the most recent
                         // codeseparator
                         CScript scriptCode(pbegincodehash, pend);
-
-                        // Drop the signature in pre-segwit scripts but not
-                        // segwit scripts
-                        for (int k = 0; k < nSigsCount; k++) {
-                            valtype &vchSig = stacktop(-isig - k);
-                            CleanupScriptCode(scriptCode, vchSig, flags);
-                        }
-
-                        bool fSuccess = true;
-                        while (fSuccess && nSigsCount > 0) {
-                            valtype &vchSig = stacktop(-isig);
-                            valtype &vchPubKey = stacktop(-ikey);
-
-                            // Note how this makes the exact order of
-                            // pubkey/signature evaluation distinguishable by
-                            // CHECKMULTISIG NOT if the STRICTENC flag is set.
-                            // See the script_(in)valid tests for details.
-                            if (!CheckSignatureEncoding(vchSig, flags,
-                                                        serror) ||
-                                !CheckPubKeyEncoding(vchPubKey, flags,
-                                                     serror)) {
-                                // serror is set
-                                return false;
-                            }
-
-                            // Check signature
-                            bool fOk = checker.CheckSig(vchSig, vchPubKey,
-                                                        scriptCode, flags);
-
-                            if (fOk) {
-                                isig++;
-                                nSigsCount--;
-                            }
-                            ikey++;
-                            nKeysCount--;
-
-                            // If there are more signatures left than keys left,
-                            // then too many signatures have failed. Exit early,
-                            // without checking any further signatures.
-                            if (nSigsCount > nKeysCount) {
-                                fSuccess = false;
-                            }
-                        }
-
-                        // Clean up stack of actual arguments
-                        while (i-- > 1) {
-                            // If the operation failed, we require that all
-                            // signatures must be empty vector
-                            if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) &&
-                                !ikey2 && stacktop(-1).size()) {
-                                return set_error(serror,
-                                                 SCRIPT_ERR_SIG_NULLFAIL);
-                            }
-                            if (ikey2 > 0) {
-                                ikey2--;
-                            }
-                            popstack(stack);
-                        }
-
-                        // A bug causes CHECKMULTISIG to consume one extra
-                        // argument whose contents were not checked in any way.
-                        //
-                        // Unfortunately this is a potential source of
-                        // mutability, so optionally verify it is exactly equal
-                        // to zero prior to removing it from the stack.
-                        if (stack.size() < 1) {
-                            return set_error(
-                                serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                        }
-                        if ((flags & SCRIPT_VERIFY_NULLDUMMY) &&
-                            stacktop(-1).size()) {
-                            return set_error(serror, SCRIPT_ERR_SIG_NULLDUMMY);
+                        bool fSuccess;
+                        if (!EvalCheckMultiSig(stack, scriptCode, flags,
+                                               checker, nOpCount, fSuccess,
+                                               serror)) {
+                            // serror is set
+                            return false;
                         }
-                        popstack(stack);
 
                         stack.push_back(fSuccess ? vchTrue : vchFalse);
 
@@ -1200,6 +1226,15 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script,
     return set_success(serror);
 }
 
+bool EvalScript(std::vector<valtype> &stack, const CScript &script,
+                uint32_t flags, const BaseSignatureChecker &checker,
+                ScriptError *serror) {
+    ScriptStack scriptStack(stack);
+    bool fSuccess = EvalScript(scriptStack, script, flags, checker, serror);
+    stack = scriptStack.ToVector();
+    return fSuccess;
+}
+
 namespace {
 
 /**
@@ -1545,6 +1580,165 @@ bool TransactionSignatureChecker::CheckSequence(
     return true;
 }
 
+/**
+ * Push the data pushed by script onto the stack, as EvalScript would. Returns
+ * false if the script does anything else, if EvalScript would fail, or if it
+ * pushes more than nMaxPushes elements.
+ */
+static bool EvalDataPushes(ScriptStack &stack, const CScript &script,
+                           uint32_t flags, size_t nMaxPushes) {
+    if (script.size() > MAX_SCRIPT_SIZE) {
+        return false;
+    }
+    bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+    opcodetype opcode;
+    const uint8_t *pPushValue;
+    size_t nPushSize;
+    for (CScript::const_iterator pc = script.begin(); pc < script.end();) {
+        if (nMaxPushes-- == 0 ||
+            !script.GetOp(pc, opcode, pPushValue, nPushSize) ||
+            opcode > OP_PUSHDATA4 || nPushSize > MAX_SCRIPT_ELEMENT_SIZE) {
+            return false;
+        }
+        ScriptStackElement vchPushValue(pPushValue, nPushSize);
+        if (fRequireMinimal && !CheckMinimalPush(vchPushValue, opcode)) {
+            return false;
+        }
+        stack.push_back(vchPushValue);
+    }
+    return true;
+}
+
+/**
+ * Verify a P2PKH output spent by a signature and a public key without running
+ * EvalScript, with the same result and error. Returns false if the scripts are
+ * not of that form, and sets fValid to the result of VerifyScript otherwise.
+ */
+static bool VerifyPayToPubKeyHash(const CScript &scriptSig,
+                                  const CScript &scriptPubKey, uint32_t flags,
+                                  const BaseSignatureChecker &checker,
+                                  bool &fValid, ScriptError *serror) {
+    ScriptStack stack;
+    // VerifyScript asserts that CLEANSTACK is only used with P2SH.
+    if (((flags & SCRIPT_VERIFY_CLEANSTACK) &&
+         !(flags & SCRIPT_VERIFY_P2SH)) ||
+        !scriptPubKey.IsPayToPubKeyHash() ||
+        !EvalDataPushes(stack, scriptSig, flags, 2) || stack.size() != 2) {
+        return false;
+    }
+
+    // OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY
+    const ScriptStackElement &vchSig = stack.at(0);
+    const ScriptStackElement &vchPubKey = stack.at(1);
+    uint160 hash;
+    CHash160().Write(vchPubKey.data(), vchPubKey.size()).Finalize(hash.begin());
+    if (memcmp(hash.begin(), &scriptPubKey[3], hash.size()) != 0) {
+        fValid = set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+        return true;
+    }
+
+    // OP_CHECKSIG
+    CScript scriptCode(scriptPubKey);
+    bool fSuccess;
+    if (!EvalCheckSig(vchSig, vchPubKey, scriptCode, flags, checker, fSuccess,
+                      serror)) {
+        fValid = false;
+        return true;
+    }
+    if (!fSuccess) {
+        fValid = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        return true;
+    }
+
+    // The stack is clean.
+    fValid = set_success(serror);
+    return true;
+}
+
+/**
+ * Verify a P2SH output with a bare multisig redeem script, spent by the dummy
+ * element and exactly as many signatures as required, without running
+ * EvalScript, with the same result and error. Returns false if the scripts are
+ * not of that form, and sets fValid to the result of VerifyScript otherwise.
+ */
+static bool VerifyPayToScriptHashMultiSig(const CScript &scriptSig,
+                                          const CScript &scriptPubKey,
+                                          uint32_t flags,
+                                          const BaseSignatureChecker &checker,
+                                          bool &fValid, ScriptError *serror) {
+    ScriptStack stack;
+    if (!(flags & SCRIPT_VERIFY_P2SH) || !scriptPubKey.IsPayToScriptHash() ||
+        !EvalDataPushes(stack, scriptSig, flags,
+                        MAX_PUBKEYS_PER_MULTISIG + 2) ||
+        stack.empty()) {
+        return false;
+    }
+
+    // OP_HASH160 <hash> OP_EQUAL
+    const ScriptStackElement &vchRedeemScript = stack.back();
+    uint160 hash;
+    CHash160()
+        .Write(vchRedeemScript.data(), vchRedeemScript.size())
+        .Finalize(hash.begin());
+    if (memcmp(hash.begin(), &scriptPubKey[2], hash.size()) != 0) {
+        fValid = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        return true;
+    }
+
+    // <m> <pubkey>... <n> OP_CHECKMULTISIG, with pubkeys pushed directly.
+    CScript redeemScript(vchRedeemScript.begin(), vchRedeemScript.end());
+    stack.pop_back();
+    CScript::const_iterator pc = redeemScript.begin();
+    opcodetype opcode;
+    const uint8_t *pPushValue;
+    size_t nPushSize;
+    if (!redeemScript.GetOp(pc, opcode, pPushValue, nPushSize) ||
+        opcode < OP_1 || opcode > OP_16) {
+        return false;
+    }
+    int nSigsCount = CScript::DecodeOP_N(opcode);
+    if (stack.size() != size_t(nSigsCount) + 1) {
+        return false;
+    }
+    stack.push_back(ScriptStackElement(CScriptNum(nSigsCount)));
+    int nKeysCount = 0;
+    while (redeemScript.GetOp(pc, opcode, pPushValue, nPushSize) &&
+           (nPushSize == 33 || nPushSize == 65) &&
+           size_t(opcode) == nPushSize) {
+        stack.push_back(ScriptStackElement(pPushValue, nPushSize));
+        nKeysCount++;
+    }
+    if (opcode < OP_1 || opcode > OP_16 ||
+        CScript::DecodeOP_N(opcode) != nKeysCount ||
+        nKeysCount < nSigsCount ||
+        !redeemScript.GetOp(pc, opcode) || opcode != OP_CHECKMULTISIG ||
+        pc != redeemScript.end()) {
+        return false;
+    }
+    stack.push_back(ScriptStackElement(CScriptNum(nKeysCount)));
+
+    int nOpCount = 1;
+    bool fSuccess;
+    try {
+        if (!EvalCheckMultiSig(stack, redeemScript, flags, checker, nOpCount,
+                               fSuccess, serror)) {
+            fValid = false;
+            return true;
+        }
+    } catch (...) {
+        fValid = set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
+        return true;
+    }
+    if (!fSuccess) {
+        fValid = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        return true;
+    }
+
+    // The stack is clean.
+    fValid = set_success(serror);
+    return true;
+}
+
 bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey,
                   uint32_t flags, const BaseSignatureChecker &checker,
                   ScriptError *serror) {
@@ -1559,7 +1753,17 @@ bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey,
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
 
-    std::vector<valtype> stack, stackCopy;
+    // Nearly all inputs spend one of these, which can be verified without
+    // interpreting the scripts opcode by opcode.
+    bool fValid;
+    if (VerifyPayToPubKeyHash(scriptSig, scriptPubKey, flags, checker, fValid,
+                              serror) ||
+        VerifyPayToScriptHashMultiSig(scriptSig, scriptPubKey, flags, checker,
+                                      fValid, serror)) {
+        return fValid;
+    }
+
+    ScriptStack stack, stackCopy;
     if (!EvalScript(stack, scriptSig, flags, checker, serror)) {
         // serror is set
         return false;
@@ -1586,14 +1790,14 @@ bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey,
         }
 
         // Restore stack.
-        swap(stack, stackCopy);
+        stack.swap(stackCopy);
 
         // stack cannot be empty here, because if it was the P2SH  HASH <> EQUAL
         // scriptPubKey would be evaluated with an empty stack and the
         // EvalScript above would return false.
         assert(!stack.empty());
 
-        const valtype &pubKeySerialized = stack.back();
+        const ScriptStackElement &pubKeySerialized = stack.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stack);
 
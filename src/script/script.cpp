@@ -302,6 +302,13 @@ unsigned int CScript::GetSigOpCount(const CScript &scriptSig) const {
     return subscript.GetSigOpCount(true);
 }
 
+bool CScript::IsPayToPubKeyHash() const {
+    // Extra-fast test for pay-to-pubkey-hash CScripts:
+    return (this->size() == 25 && (*this)[0] == OP_DUP &&
+            (*this)[1] == OP_HASH160 && (*this)[2] == 0x14 &&
+            (*this)[23] == OP_EQUALVERIFY && (*this)[24] == OP_CHECKSIG);
+}
+
 bool CScript::IsPayToScriptHash() const {
     // Extra-fast test for pay-to-script-hash CScripts:
     return (this->size() == 23 && (*this)[0] == OP_HASH160 &&
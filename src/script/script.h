@@ -207,7 +207,12 @@ public:
 
     static const size_t nDefaultMaxNumSize = 4;
 
-    explicit CScriptNum(const std::vector<uint8_t> &vch, bool fRequireMinimal,
+    /**
+     * Decode a number from a byte container with size(), back() and
+     * operator[], such as a std::vector or an interpreter stack element.
+     */
+    template <typename Bytes>
+    explicit CScriptNum(const Bytes &vch, bool fRequireMinimal,
                         const size_t nMaxNumSize = nDefaultMaxNumSize) {
         if (vch.size() > nMaxNumSize) {
             throw scriptnum_error("script number overflow");
@@ -332,17 +337,31 @@ public:
         return m_value;
     }
 
+    int64_t getint64() const { return m_value; }
+
     std::vector<uint8_t> getvch() const { return serialize(m_value); }
 
+    /** Upper bound on the size of a serialized number. */
+    static const size_t MAX_SERIALIZED_SIZE = 9;
+
     static std::vector<uint8_t> serialize(const int64_t &value) {
-        if (value == 0) return std::vector<uint8_t>();
+        uint8_t buf[MAX_SERIALIZED_SIZE];
+        return std::vector<uint8_t>(buf, buf + serialize(value, buf));
+    }
 
-        std::vector<uint8_t> result;
+    /**
+     * Serialize value into out, which must hold MAX_SERIALIZED_SIZE bytes, and
+     * return the size of the serialization.
+     */
+    static size_t serialize(const int64_t &value, uint8_t *out) {
+        if (value == 0) return 0;
+
+        size_t nSize = 0;
         const bool neg = value < 0;
         uint64_t absvalue = neg ? -value : value;
 
         while (absvalue) {
-            result.push_back(absvalue & 0xff);
+            out[nSize++] = absvalue & 0xff;
             absvalue >>= 8;
         }
 
@@ -354,17 +373,17 @@ public:
         // - If the most significant byte is < 0x80 and the value is negative,
         // add 0x80 to it, since it will be subtracted and interpreted as a
         // negative when converting to an integral.
-        if (result.back() & 0x80) {
-            result.push_back(neg ? 0x80 : 0);
+        if (out[nSize - 1] & 0x80) {
+            out[nSize++] = neg ? 0x80 : 0;
         } else if (neg) {
-            result.back() |= 0x80;
+            out[nSize - 1] |= 0x80;
         }
 
-        return result;
+        return nSize;
     }
 
 private:
-    static int64_t set_vch(const std::vector<uint8_t> &vch) {
+    template <typename Bytes> static int64_t set_vch(const Bytes &vch) {
         if (vch.empty()) return 0;
 
         int64_t result = 0;
@@ -501,6 +520,30 @@ public:
         return GetOp2(pc, opcodeRet, nullptr);
     }
 
+    /**
+     * Like GetOp, but point to the data pushed by the instruction rather than
+     * copying it. The pointer is valid as long as the script is not modified.
+     */
+    bool GetOp(const_iterator &pc, opcodetype &opcodeRet,
+               const uint8_t *&pPushRet, size_t &nPushSizeRet) const {
+        nPushSizeRet = 0;
+        const_iterator pcStart = pc;
+        if (!GetOp2(pc, opcodeRet, nullptr)) {
+            return false;
+        }
+        pPushRet = data() + (pc - begin());
+        if (opcodeRet <= OP_PUSHDATA4) {
+            size_t nHeaderSize = opcodeRet < OP_PUSHDATA1
+                                     ? 1
+                                     : opcodeRet == OP_PUSHDATA1
+                                           ? 2
+                                           : opcodeRet == OP_PUSHDATA2 ? 3 : 5;
+            nPushSizeRet = pc - pcStart - nHeaderSize;
+            pPushRet -= nPushSizeRet;
+        }
+        return true;
+    }
+
     bool GetOp2(const_iterator &pc, opcodetype &opcodeRet,
                 std::vector<uint8_t> *pvchRet) const {
         opcodeRet = OP_INVALIDOPCODE;
@@ -595,6 +638,7 @@ public:
      */
     unsigned int GetSigOpCount(const CScript &scriptSig) const;
 
+    bool IsPayToPubKeyHash() const;
     bool IsPayToScriptHash() const;
     bool IsCommitment(const std::vector<uint8_t> &data) const;
     bool IsWitnessProgram(int &version, std::vector<uint8_t> &program) const;
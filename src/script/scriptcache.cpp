@@ -5,15 +5,13 @@
 #include "scriptcache.h"
 
 #include "crypto/sha256.h"
-#include "cuckoocache.h"
+#include "hash.h"
 #include "primitives/transaction.h"
 #include "random.h"
 #include "script/sigcache.h"
-#include "sync.h"
 #include "util.h"
-#include "validation.h"
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static CConcurrentCache scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
@@ -25,7 +23,7 @@ void InitScriptExecutionCache() {
                                        DEFAULT_MAX_SCRIPT_CACHE_SIZE)),
                  MAX_MAX_SCRIPT_CACHE_SIZE) *
         (size_t(1) << 20);
-    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    size_t nElems = scriptExecutionCache.Setup(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu requested for script execution cache, "
               "able to store %zu elements\n",
               (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
@@ -47,15 +45,31 @@ uint256 GetScriptCacheKey(const CTransaction &tx, uint32_t flags) {
 }
 
 bool IsKeyInScriptCache(uint256 key, bool erase) {
-    // TODO: Remove this requirement by making CuckooCache not require external
-    // locks
-    AssertLockHeld(cs_main);
-    return scriptExecutionCache.contains(key, erase);
+    return scriptExecutionCache.Contains(key, erase);
 }
 
 void AddKeyInScriptCache(uint256 key) {
-    // TODO: Remove this requirement by making CuckooCache not require external
-    // locks
-    AssertLockHeld(cs_main);
-    scriptExecutionCache.insert(key);
+    scriptExecutionCache.Insert(key);
+}
+
+CacheStats GetScriptCacheStats() {
+    return scriptExecutionCache.GetStats();
+}
+
+void AgeScriptExecutionCache() {
+    scriptExecutionCache.NewGeneration();
+}
+
+void SetScriptCacheSalt(const uint256 &salt) {
+    scriptExecutionCacheNonce =
+        (CHashWriter(SER_GETHASH, 0) << salt << std::string("scriptcache"))
+            .GetHash();
+}
+
+std::vector<uint256> GetScriptCacheEntries() {
+    return scriptExecutionCache.GetEntries();
+}
+
+void AddScriptCacheEntries(const std::vector<uint256> &entries) {
+    scriptExecutionCache.Insert(entries);
 }
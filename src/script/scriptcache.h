@@ -8,8 +8,10 @@
 #include "uint256.h"
 
 #include <cstdint>
+#include <vector>
 
 class CTransaction;
+struct CacheStats;
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
 // systems). Due to how we count cache size, actual memory usage is slightly
@@ -24,10 +26,31 @@ void InitScriptExecutionCache();
 /** Compute the cache key for a given transaction and flags. */
 uint256 GetScriptCacheKey(const CTransaction &tx, uint32_t flags);
 
-/** Check if a given key is in the cache. */
+/**
+ * Check if a given key is in the cache. The cache has its own locking, so this
+ * may be called from any thread without holding cs_main.
+ */
 bool IsKeyInScriptCache(uint256 key, bool erase);
 
-/** Add an entry in the cache. */
+/** Add an entry in the cache. May be called from any thread. */
 void AddKeyInScriptCache(uint256 key);
 
+/** Hit rate, lock and occupancy statistics of the cache. */
+CacheStats GetScriptCacheStats();
+
+/**
+ * Start a new generation of the cache: entries of transactions not validated
+ * again since the previous call are dropped when room is needed.
+ */
+void AgeScriptExecutionCache();
+
+/**
+ * Derive the nonce hashed into cache keys from salt, so that keys saved with
+ * GetScriptCacheEntries stay valid in a later run with the same salt. Must be
+ * called before the cache is used.
+ */
+void SetScriptCacheSalt(const uint256 &salt);
+std::vector<uint256> GetScriptCacheEntries();
+void AddScriptCacheEntries(const std::vector<uint256> &entries);
+
 #endif // BITCOIN_SCRIPT_SCRIPTCACHE_H
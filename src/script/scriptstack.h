@@ -0,0 +1,152 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SCRIPT_SCRIPTSTACK_H
+#define BITCOIN_SCRIPT_SCRIPTSTACK_H
+
+#include "prevector.h"
+#include "script/script.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * Element of the script interpreter stack, which never allocates memory.
+ *
+ * Elements of up to INLINE_SIZE bytes, which covers signatures, public keys,
+ * hashes and numbers, hold a copy of their data. No opcode produces larger
+ * elements, so those are always pushed by a script or part of the initial
+ * stack, and refer to that data instead. It must outlive the element.
+ */
+class ScriptStackElement {
+public:
+    static const size_t INLINE_SIZE = 80;
+
+private:
+    uint32_t nSize;
+    union {
+        const uint8_t *pExternal;
+        uint8_t vchInline[INLINE_SIZE];
+    };
+
+public:
+    ScriptStackElement() : nSize(0) {}
+
+    ScriptStackElement(const uint8_t *pch, size_t nSizeIn) : nSize(nSizeIn) {
+        if (IsInline()) {
+            std::copy(pch, pch + nSize, vchInline);
+        } else {
+            pExternal = pch;
+        }
+    }
+
+    explicit ScriptStackElement(const std::vector<uint8_t> &vch)
+        : ScriptStackElement(vch.data(), vch.size()) {}
+
+    explicit ScriptStackElement(const CScriptNum &bn) {
+        static_assert(CScriptNum::MAX_SERIALIZED_SIZE <= INLINE_SIZE,
+                      "numbers must fit inline");
+        nSize = CScriptNum::serialize(bn.getint64(), vchInline);
+    }
+
+    bool IsInline() const { return nSize <= INLINE_SIZE; }
+
+    const uint8_t *data() const { return IsInline() ? vchInline : pExternal; }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    const uint8_t *begin() const { return data(); }
+    const uint8_t *end() const { return data() + nSize; }
+    uint8_t operator[](size_t pos) const { return data()[pos]; }
+    uint8_t back() const { return data()[nSize - 1]; }
+
+    std::vector<uint8_t> ToVector() const {
+        return std::vector<uint8_t>(begin(), end());
+    }
+
+    bool operator==(const ScriptStackElement &other) const {
+        return nSize == other.nSize && memcmp(data(), other.data(), nSize) == 0;
+    }
+    bool operator!=(const ScriptStackElement &other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * The main or alt stack of the script interpreter. The first elements are
+ * stored inline, so that evaluating common scripts doesn't allocate memory.
+ */
+class ScriptStack {
+public:
+    static const unsigned int INLINE_ELEMENTS = 16;
+
+private:
+    typedef prevector<INLINE_ELEMENTS, ScriptStackElement> vector_type;
+    vector_type elements;
+
+public:
+    typedef vector_type::iterator iterator;
+    typedef vector_type::const_iterator const_iterator;
+
+    ScriptStack() {}
+
+    /** Refers to elements of vStack larger than INLINE_SIZE. */
+    explicit ScriptStack(const std::vector<std::vector<uint8_t>> &vStack) {
+        elements.reserve(vStack.size());
+        for (const std::vector<uint8_t> &vch : vStack) {
+            elements.push_back(ScriptStackElement(vch));
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> ToVector() const {
+        std::vector<std::vector<uint8_t>> vStack;
+        vStack.reserve(size());
+        for (const ScriptStackElement &element : elements) {
+            vStack.push_back(element.ToVector());
+        }
+        return vStack;
+    }
+
+    size_t size() const { return elements.size(); }
+    bool empty() const { return elements.empty(); }
+
+    iterator begin() { return elements.begin(); }
+    iterator end() { return elements.end(); }
+    const_iterator begin() const { return elements.begin(); }
+    const_iterator end() const { return elements.end(); }
+
+    ScriptStackElement &at(size_t pos) {
+        if (pos >= size()) {
+            throw std::out_of_range("ScriptStack::at(): out of range");
+        }
+        return elements[pos];
+    }
+    const ScriptStackElement &at(size_t pos) const {
+        if (pos >= size()) {
+            throw std::out_of_range("ScriptStack::at(): out of range");
+        }
+        return elements[pos];
+    }
+
+    ScriptStackElement &back() { return elements.back(); }
+    const ScriptStackElement &back() const { return elements.back(); }
+
+    // Unlike std::vector, prevector doesn't support inserting one of its own
+    // elements, so copy it first.
+    void push_back(ScriptStackElement element) { elements.push_back(element); }
+    void insert(iterator pos, ScriptStackElement element) {
+        elements.insert(pos, element);
+    }
+
+    void pop_back() { elements.pop_back(); }
+    void erase(iterator pos) { elements.erase(pos); }
+    void erase(iterator first, iterator last) { elements.erase(first, last); }
+
+    void swap(ScriptStack &other) { elements.swap(other.elements); }
+};
+
+#endif // BITCOIN_SCRIPT_SCRIPTSTACK_H
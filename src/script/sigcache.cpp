@@ -5,14 +5,203 @@
 
 #include "sigcache.h"
 
-#include "cuckoocache.h"
+#include "hash.h"
 #include "memusage.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
+#include <algorithm>
+
+CConcurrentCache::LockSlot &CConcurrentCache::GetSlot() {
+    // Spread threads over the slots in the order they first use a cache.
+    static std::atomic<size_t> nNextSlot{0};
+    static thread_local size_t nSlot = nNextSlot++ % LOCK_SLOTS;
+    return slots[nSlot];
+}
+
+bool CConcurrentCache::LockAll(bool fWait) {
+    // Slots are always locked in the same order, so merges can't deadlock.
+    bool fWaited = false;
+    for (size_t i = 0; i < LOCK_SLOTS; i++) {
+        if (slots[i].mutex.try_lock()) {
+            continue;
+        }
+        if (!fWait) {
+            while (i > 0) {
+                slots[--i].mutex.unlock();
+            }
+            return false;
+        }
+        slots[i].mutex.lock();
+        fWaited = true;
+    }
+    if (fWaited) {
+        nMergeWaits++;
+    }
+    return true;
+}
+
+void CConcurrentCache::UnlockAll() {
+    for (LockSlot &slot : slots) {
+        slot.mutex.unlock();
+    }
+}
+
+void CConcurrentCache::MergePending(bool fWait) {
+    if (!LockAll(fWait)) {
+        nMergesDeferred++;
+        return;
+    }
+    for (LockSlot &slot : slots) {
+        for (const uint256 &entry : slot.vPending) {
+            cache.insert(entry);
+        }
+    }
+    // Counted before any slot is seen empty, see Contains.
+    nMerges++;
+    for (LockSlot &slot : slots) {
+        slot.vPending.clear();
+        slot.nPending = 0;
+    }
+    UnlockAll();
+}
+
+bool CConcurrentCache::FindPending(LockSlot &slot, const uint256 &entry,
+                                   bool erase) {
+    auto it = std::find(slot.vPending.begin(), slot.vPending.end(), entry);
+    if (it == slot.vPending.end()) {
+        return false;
+    }
+    if (erase) {
+        slot.vPending.erase(it);
+        slot.nPending = slot.vPending.size();
+    }
+    return true;
+}
+
+uint32_t CConcurrentCache::Setup(size_t nBytes) {
+    LockAll(true);
+    uint32_t nElems = cache.setup_bytes(nBytes);
+    UnlockAll();
+    return nElems;
+}
+
+bool CConcurrentCache::Contains(const uint256 &entry, bool erase) {
+    LockSlot &slot = GetSlot();
+    std::unique_lock<std::mutex> lock(slot.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // Other lookups only lock one slot at a time, merges all of them.
+        slot.nLookupWaits.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    slot.nLookups.fetch_add(1, std::memory_order_relaxed);
+    uint64_t nMergesBefore = nMerges;
+    if (cache.contains(entry, erase) || FindPending(slot, entry, erase)) {
+        slot.nHits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    lock.unlock();
+
+    // The entry may be pending in the slot of another thread whose merge was
+    // deferred. Holding no other slot while locking one can't deadlock with a
+    // merge, which locks them all in order.
+    for (LockSlot &other : slots) {
+        if (&other == &slot || other.nPending == 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> otherLock(other.mutex);
+        if (FindPending(other, entry, erase)) {
+            slot.nHits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // A merge may have moved the entry from a slot not searched yet into the
+    // cache.
+    if (nMerges != nMergesBefore) {
+        lock.lock();
+        if (cache.contains(entry, erase)) {
+            slot.nHits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void CConcurrentCache::Insert(const uint256 &entry) {
+    LockSlot &slot = GetSlot();
+    bool fFull;
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        slot.vPending.push_back(entry);
+        slot.nPending = slot.vPending.size();
+        fFull = slot.vPending.size() >= MAX_PENDING_INSERTS;
+    }
+    nInserts++;
+    MergePending(fFull);
+}
+
+void CConcurrentCache::Insert(const std::vector<uint256> &entries) {
+    LockAll(true);
+    for (const uint256 &entry : entries) {
+        cache.insert(entry);
+    }
+    UnlockAll();
+    nInserts += entries.size();
+    nMerges++;
+}
+
+void CConcurrentCache::Flush() {
+    MergePending(true);
+}
+
+std::vector<uint256> CConcurrentCache::GetEntries() {
+    std::vector<uint256> entries;
+    LockAll(true);
+    cache.get_entries(entries);
+    for (const LockSlot &slot : slots) {
+        entries.insert(entries.end(), slot.vPending.begin(),
+                       slot.vPending.end());
+    }
+    UnlockAll();
+    return entries;
+}
+
+void CConcurrentCache::NewGeneration() {
+    LockAll(true);
+    cache.new_generation();
+    UnlockAll();
+}
+
+CacheStats CConcurrentCache::GetStats() {
+    CacheStats stats;
+    stats.nLookups = 0;
+    stats.nHits = 0;
+    stats.nLookupWaits = 0;
+    stats.nPending = 0;
+    LockAll(true);
+    for (LockSlot &slot : slots) {
+        stats.nLookups += slot.nLookups;
+        stats.nHits += slot.nHits;
+        stats.nLookupWaits += slot.nLookupWaits;
+        stats.nPending += slot.vPending.size();
+    }
+    CuckooCache::cache_stats cacheStats = cache.get_stats();
+    UnlockAll();
+    stats.nSize = cacheStats.size;
+    stats.nOccupied = cacheStats.occupied;
+    stats.nRecent = cacheStats.recent;
+    stats.nDisplacements = cacheStats.displacements;
+    stats.nEvictions = cacheStats.evictions;
+    stats.nGenerations = cacheStats.generations;
+    stats.nInserts = nInserts;
+    stats.nMerges = nMerges;
+    stats.nMergeWaits = nMergeWaits;
+    stats.nMergesDeferred = nMergesDeferred;
+    return stats;
+}
 
 namespace {
 
@@ -25,13 +214,13 @@ class CSignatureCache {
 private:
     //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+    CConcurrentCache setValid;
 
 public:
     CSignatureCache() { GetRandBytes(nonce.begin(), 32); }
 
+    void SetNonce(const uint256 &nonceIn) { nonce = nonceIn; }
+
     void ComputeEntry(uint256 &entry, const uint256 &hash,
                       const std::vector<uint8_t> &vchSig,
                       const CPubKey &pubkey) {
@@ -44,15 +233,17 @@ public:
     }
 
     bool Get(const uint256 &entry, const bool erase) {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        return setValid.Contains(entry, erase);
     }
 
-    void Set(uint256 &entry) {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+    void Set(uint256 &entry) { setValid.Insert(entry); }
+    uint32_t setup_bytes(size_t n) { return setValid.Setup(n); }
+    CacheStats GetStats() { return setValid.GetStats(); }
+    void NewGeneration() { setValid.NewGeneration(); }
+    std::vector<uint256> GetEntries() { return setValid.GetEntries(); }
+    void Insert(const std::vector<uint256> &entries) {
+        setValid.Insert(entries);
     }
-    uint32_t setup_bytes(size_t n) { return setValid.setup_bytes(n); }
 };
 
 /**
@@ -79,6 +270,30 @@ void InitSignatureCache() {
     LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to "
               "store %zu elements\n",
               (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+
+    InitPubKeyCache(DEFAULT_PUBKEY_CACHE_ENTRIES, GetRandHash());
+}
+
+CacheStats GetSignatureCacheStats() {
+    return signatureCache.GetStats();
+}
+
+void AgeSignatureCache() {
+    signatureCache.NewGeneration();
+}
+
+void SetSignatureCacheSalt(const uint256 &salt) {
+    signatureCache.SetNonce(
+        (CHashWriter(SER_GETHASH, 0) << salt << std::string("sigcache"))
+            .GetHash());
+}
+
+std::vector<uint256> GetSignatureCacheEntries() {
+    return signatureCache.GetEntries();
+}
+
+void AddSignatureCacheEntries(const std::vector<uint256> &entries) {
+    signatureCache.Insert(entries);
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(
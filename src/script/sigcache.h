@@ -6,8 +6,12 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "cuckoocache.h"
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
@@ -39,6 +43,98 @@ public:
     }
 };
 
+/**
+ * Statistics of a CConcurrentCache, to measure its hit rate, contention and
+ * occupancy.
+ */
+struct CacheStats {
+    //! Lookups, lookups that found the entry, and lookups that had to wait for
+    //! a merge to finish.
+    uint64_t nLookups;
+    uint64_t nHits;
+    uint64_t nLookupWaits;
+    //! Entries inserted, including those still pending.
+    uint64_t nInserts;
+    //! Batches of pending inserts merged into the cache, merges that had to
+    //! wait for lookups to finish, and merges deferred because of lookups.
+    uint64_t nMerges;
+    uint64_t nMergeWaits;
+    uint64_t nMergesDeferred;
+    //! Entries inserted but not merged yet.
+    uint64_t nPending;
+    //! Slots of the cache, slots holding an entry, and those holding an entry
+    //! inserted in the current generation.
+    uint64_t nSize;
+    uint64_t nOccupied;
+    uint64_t nRecent;
+    //! Entries moved to make room for an insert, entries dropped because no
+    //! room was found, and generations started.
+    uint64_t nDisplacements;
+    uint64_t nEvictions;
+    uint64_t nGenerations;
+};
+
+/**
+ * A CuckooCache of uint256 entries that many threads can use at once.
+ *
+ * Lookups lock one of LOCK_SLOTS mutexes, chosen per thread, so that concurrent
+ * lookups don't bounce a shared cache line between cores. CuckooCache lookups,
+ * including the atomic erase flags they set, may run in parallel but not
+ * during an insert, so inserts are buffered in the slot of the inserting thread
+ * and merged into the cache in batches while holding every slot. A merge is
+ * tried after each insert, but deferred while lookups are running until a slot
+ * has MAX_PENDING_INSERTS entries. Lookups see the pending entries of their own
+ * slot, and search those of the other slots, one at a time, on a miss.
+ */
+class CConcurrentCache {
+public:
+    static const size_t LOCK_SLOTS = 16;
+    static const size_t MAX_PENDING_INSERTS = 64;
+
+private:
+    struct alignas(64) LockSlot {
+        std::mutex mutex;
+        //! Inserted entries not merged into the cache yet, guarded by mutex.
+        std::vector<uint256> vPending;
+        //! Size of vPending, so lookups skip slots without pending entries.
+        std::atomic<size_t> nPending{0};
+        std::atomic<uint64_t> nLookups{0};
+        std::atomic<uint64_t> nHits{0};
+        std::atomic<uint64_t> nLookupWaits{0};
+    };
+
+    LockSlot slots[LOCK_SLOTS];
+    CuckooCache::cache<uint256, SignatureCacheHasher> cache;
+    std::atomic<uint64_t> nInserts{0};
+    std::atomic<uint64_t> nMerges{0};
+    std::atomic<uint64_t> nMergeWaits{0};
+    std::atomic<uint64_t> nMergesDeferred{0};
+
+    LockSlot &GetSlot();
+    //! Lock every slot, or none if fWait is false and one is already locked.
+    bool LockAll(bool fWait);
+    void UnlockAll();
+    void MergePending(bool fWait);
+    static bool FindPending(LockSlot &slot, const uint256 &entry, bool erase);
+
+public:
+    //! Size the cache to use about nBytes.
+    uint32_t Setup(size_t nBytes);
+    bool Contains(const uint256 &entry, bool erase);
+    void Insert(const uint256 &entry);
+    //! Insert many entries at once, for example when loading the cache.
+    void Insert(const std::vector<uint256> &entries);
+    //! Merge all pending inserts into the cache.
+    void Flush();
+    //! Entries that have not been erased, including pending ones.
+    std::vector<uint256> GetEntries();
+    //! Start a new generation, dropping entries not inserted again since the
+    //! previous one.
+    void NewGeneration();
+    //! Statistics, which takes a scan of the cache.
+    CacheStats GetStats();
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker {
 private:
     bool store;
@@ -58,4 +154,21 @@ public:
 
 void InitSignatureCache();
 
+CacheStats GetSignatureCacheStats();
+
+/**
+ * Start a new generation of the signature cache: entries of signatures not
+ * seen again since the previous call are dropped when room is needed.
+ */
+void AgeSignatureCache();
+
+/**
+ * Derive the nonce hashed into signature cache entries from salt, so that
+ * entries saved with GetSignatureCacheEntries stay valid in a later run with
+ * the same salt. Must be called before the cache is used.
+ */
+void SetSignatureCacheSalt(const uint256 &salt);
+std::vector<uint256> GetSignatureCacheEntries();
+void AddSignatureCacheEntries(const std::vector<uint256> &entries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
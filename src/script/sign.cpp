@@ -12,15 +12,28 @@
 #include "script/standard.h"
 #include "uint256.h"
 
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+
 typedef std::vector<uint8_t> valtype;
 
 TransactionSignatureCreator::TransactionSignatureCreator(
     const CKeyStore *keystoreIn, const CTransaction *txToIn, unsigned int nInIn,
     const Amount amountIn, SigHashType sigHashTypeIn)
     : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn),
-      amount(amountIn), sigHashType(sigHashTypeIn),
+      amount(amountIn), sigHashType(sigHashTypeIn), txdata(nullptr),
       checker(txTo, nIn, amountIn) {}
 
+TransactionSignatureCreator::TransactionSignatureCreator(
+    const CKeyStore *keystoreIn, const CTransaction *txToIn, unsigned int nInIn,
+    const Amount amountIn, SigHashType sigHashTypeIn,
+    const PrecomputedTransactionData &txdataIn)
+    : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn),
+      amount(amountIn), sigHashType(sigHashTypeIn), txdata(&txdataIn),
+      checker(txTo, nIn, amountIn, txdataIn) {}
+
 bool TransactionSignatureCreator::CreateSig(std::vector<uint8_t> &vchSig,
                                             const CKeyID &address,
                                             const CScript &scriptCode) const {
@@ -29,7 +42,8 @@ bool TransactionSignatureCreator::CreateSig(std::vector<uint8_t> &vchSig,
         return false;
     }
 
-    uint256 hash = SignatureHash(scriptCode, *txTo, nIn, sigHashType, amount);
+    uint256 hash =
+        SignatureHash(scriptCode, *txTo, nIn, sigHashType, amount, txdata);
     if (!key.Sign(hash, vchSig)) {
         return false;
     }
@@ -208,6 +222,48 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction &txFrom,
                          sigHashType);
 }
 
+bool ProduceSignatures(const CKeyStore &keystore, const CTransaction &txTo,
+                       const std::vector<unsigned int> &vInputs,
+                       const std::vector<CTxOut> &vSpent,
+                       SigHashType sigHashType, unsigned int nThreads,
+                       std::vector<SignatureData> &vSigData) {
+    assert(vInputs.size() == vSpent.size());
+    PrecomputedTransactionData txdata(txTo);
+    vSigData.assign(vInputs.size(), SignatureData());
+
+    // The signature of an input doesn't depend on the others, so each thread
+    // takes the next input until none are left.
+    std::atomic<size_t> nNext{0};
+    std::atomic<bool> fSolved{true};
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < vInputs.size(); i = nNext++) {
+            TransactionSignatureCreator creator(&keystore, &txTo, vInputs[i],
+                                                vSpent[i].nValue, sigHashType,
+                                                txdata);
+            if (!ProduceSignature(creator, vSpent[i].scriptPubKey,
+                                  vSigData[i])) {
+                fSolved = false;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t nWorkers = std::min<size_t>(nThreads, vInputs.size());
+    for (size_t i = 1; i < nWorkers; i++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error &) {
+            // Carry on with the threads we already have.
+            break;
+        }
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return fSolved;
+}
+
 static std::vector<valtype> CombineMultisig(
     const CScript &scriptPubKey, const BaseSignatureChecker &checker,
     const std::vector<valtype> &vSolutions, const std::vector<valtype> &sigs1,
@@ -14,6 +14,7 @@ class CKeyStore;
 class CMutableTransaction;
 class CScript;
 class CTransaction;
+class CTxOut;
 
 /** Virtual base class for signature creators. */
 class BaseSignatureCreator {
@@ -37,6 +38,7 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     unsigned int nIn;
     Amount amount;
     SigHashType sigHashType;
+    const PrecomputedTransactionData *txdata;
     const TransactionSignatureChecker checker;
 
 public:
@@ -44,6 +46,12 @@ public:
                                 const CTransaction *txToIn, unsigned int nInIn,
                                 const Amount amountIn,
                                 SigHashType sigHashTypeIn = SigHashType());
+    //! Use the signature hash data shared by all inputs of txToIn.
+    TransactionSignatureCreator(const CKeyStore *keystoreIn,
+                                const CTransaction *txToIn, unsigned int nInIn,
+                                const Amount amountIn,
+                                SigHashType sigHashTypeIn,
+                                const PrecomputedTransactionData &txdataIn);
     const BaseSignatureChecker &Checker() const override { return checker; }
     bool CreateSig(std::vector<uint8_t> &vchSig, const CKeyID &keyid,
                    const CScript &scriptCode) const override;
@@ -91,6 +99,18 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction &txFrom,
                    CMutableTransaction &txTo, unsigned int nIn,
                    SigHashType sigHashType);
 
+/**
+ * Produce script signatures for the inputs vInputs of txTo, which spend the
+ * outputs vSpent, on up to nThreads threads. The signature hash data of txTo
+ * is computed once for all inputs. vSigData gets the signature data of each
+ * input, in the same order. Returns whether all inputs were solved.
+ */
+bool ProduceSignatures(const CKeyStore &keystore, const CTransaction &txTo,
+                       const std::vector<unsigned int> &vInputs,
+                       const std::vector<CTxOut> &vSpent,
+                       SigHashType sigHashType, unsigned int nThreads,
+                       std::vector<SignatureData> &vSigData);
+
 /** Combine two script signatures using a generic signature checker,
  * intelligently, possibly with OP_0 placeholders. */
 SignatureData CombineSignatures(const CScript &scriptPubKey,
@@ -6,33 +6,25 @@
 
 #include "chainparams.h"
 #include "config.h"
+#include "core_memusage.h"
 #include "keystore.h"
 #include "net.h"
 #include "net_processing.h"
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
+#include "txorphanpool.h"
 #include "util.h"
 #include "validation.h"
 
 #include "test/test_bitcoin.h"
 
 #include <cstdint>
+#include <limits>
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/test/unit_test.hpp>
 
-// Tests these internal-to-net_processing.cpp methods:
-extern bool AddOrphanTx(const CTransactionRef &tx, NodeId peer);
-extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-
 CService ip(uint32_t i) {
     struct in_addr s;
     s.s_addr = i;
@@ -134,14 +126,26 @@ BOOST_AUTO_TEST_CASE(DoS_bantime) {
     BOOST_CHECK(!connman->IsBanned(addr));
 }
 
-CTransactionRef RandomOrphan() {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(InsecureRand256());
-    if (it == mapOrphanTransactions.end()) it = mapOrphanTransactions.begin();
-    return it->second.tx;
+static const size_t NO_QUOTA = std::numeric_limits<size_t>::max();
+
+static CMutableTransaction OrphanSpending(const uint256 &txid, uint32_t n) {
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txid, n);
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1 * CENT;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans) {
+    CTxOrphanPool pool;
+    std::vector<CTransactionRef> vOrphans;
+    auto RandomOrphan = [&vOrphans]() {
+        return vOrphans[InsecureRandRange(vOrphans.size())];
+    };
+
     CKey key;
     key.MakeNewKey(true);
     CBasicKeyStore keystore;
@@ -159,7 +163,8 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans) {
         tx.vout[0].scriptPubKey =
             GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        vOrphans.push_back(MakeTransactionRef(tx));
+        pool.AddTx(vOrphans.back(), i, NO_QUOTA);
     }
 
     // ... and 50 that depend on other orphans:
@@ -176,7 +181,8 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans) {
             GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, *txPrev, tx, 0, SigHashType());
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        vOrphans.push_back(MakeTransactionRef(tx));
+        pool.AddTx(vOrphans.back(), i, NO_QUOTA);
     }
 
     // This really-big orphan should be ignored:
@@ -199,23 +205,128 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans) {
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(MakeTransactionRef(tx), i));
+        BOOST_CHECK(!pool.AddTx(MakeTransactionRef(tx), i, NO_QUOTA));
     }
 
-    // Test EraseOrphansFor:
+    // Test EraseForPeer:
     for (NodeId i = 0; i < 3; i++) {
-        size_t sizeBefore = mapOrphanTransactions.size();
-        EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        size_t sizeBefore = pool.Size();
+        pool.EraseForPeer(i);
+        BOOST_CHECK(pool.Size() < sizeBefore);
+    }
+
+    // Test LimitOrphans() function:
+    pool.LimitOrphans(40, NO_QUOTA);
+    BOOST_CHECK(pool.Size() <= 40);
+    pool.LimitOrphans(10, NO_QUOTA);
+    BOOST_CHECK(pool.Size() <= 10);
+    pool.LimitOrphans(0, NO_QUOTA);
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+    BOOST_CHECK_EQUAL(pool.GetUsage(), 0);
+    BOOST_CHECK(pool.GetPeerStats().empty());
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanQuotas) {
+    CTxOrphanPool pool;
+
+    std::vector<CTransactionRef> vOrphans;
+    for (int i = 0; i < 20; i++) {
+        vOrphans.push_back(
+            MakeTransactionRef(OrphanSpending(InsecureRand256(), 0)));
     }
+    const size_t nUsage = RecursiveDynamicUsage(vOrphans[0]);
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
+    // Peer 0 may only use enough memory for 5 orphans.
+    for (int i = 0; i < 10; i++) {
+        BOOST_CHECK_EQUAL(pool.AddTx(vOrphans[i], 0, 5 * nUsage), i < 5);
+    }
+    // Other peers are not affected by peer 0's quota.
+    for (int i = 10; i < 20; i++) {
+        BOOST_CHECK(pool.AddTx(vOrphans[i], 1 + (i % 2), NO_QUOTA));
+    }
+    BOOST_CHECK_EQUAL(pool.Size(), 15);
+    BOOST_CHECK_EQUAL(pool.GetUsage(), 15 * nUsage);
+
+    std::map<NodeId, CTxOrphanPool::PeerStats> stats = pool.GetPeerStats();
+    BOOST_CHECK_EQUAL(stats.size(), 3);
+    BOOST_CHECK_EQUAL(stats[0].nCount, 5);
+    BOOST_CHECK_EQUAL(stats[1].nCount, 5);
+    BOOST_CHECK_EQUAL(stats[2].nCount, 5);
+
+    // Add more orphans for peer 2, making it the heaviest peer: it should be
+    // the one losing orphans, most recent first, when the pool is full.
+    CTransactionRef extra1 =
+        MakeTransactionRef(OrphanSpending(InsecureRand256(), 0));
+    CTransactionRef extra2 =
+        MakeTransactionRef(OrphanSpending(InsecureRand256(), 0));
+    BOOST_CHECK(pool.AddTx(extra1, 2, NO_QUOTA));
+    BOOST_CHECK(pool.AddTx(extra2, 2, NO_QUOTA));
+    BOOST_CHECK_EQUAL(pool.LimitOrphans(16, NO_QUOTA), 1);
+    BOOST_CHECK(pool.HaveTx(extra1->GetId()));
+    BOOST_CHECK(!pool.HaveTx(extra2->GetId()));
+
+    // Memory limits are enforced the same way.
+    BOOST_CHECK_EQUAL(pool.LimitOrphans(NO_QUOTA, 15 * nUsage), 1);
+    BOOST_CHECK(!pool.HaveTx(extra1->GetId()));
+    stats = pool.GetPeerStats();
+    BOOST_CHECK_EQUAL(stats[0].nCount, 5);
+    BOOST_CHECK_EQUAL(stats[1].nCount, 5);
+    BOOST_CHECK_EQUAL(stats[2].nCount, 5);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanResolution) {
+    CTxOrphanPool pool;
+
+    // A parent we have and a chain of orphans hanging off it:
+    //   parent -> a -> b -> d
+    //          \-> c ----/
+    // plus e, which also needs an unknown transaction.
+    CMutableTransaction parent = OrphanSpending(InsecureRand256(), 0);
+    parent.vout.resize(2, parent.vout[0]);
+    CMutableTransaction a = OrphanSpending(parent.GetId(), 0);
+    CMutableTransaction b = OrphanSpending(a.GetId(), 0);
+    CMutableTransaction c = OrphanSpending(parent.GetId(), 1);
+    CMutableTransaction d = OrphanSpending(b.GetId(), 0);
+    d.vin.push_back(CTxIn(COutPoint(c.GetId(), 0)));
+    CMutableTransaction e = OrphanSpending(d.GetId(), 0);
+    e.vin.push_back(CTxIn(COutPoint(InsecureRand256(), 0)));
+    CMutableTransaction unrelated = OrphanSpending(InsecureRand256(), 0);
+
+    // Insert them children first.
+    BOOST_CHECK(pool.AddTx(MakeTransactionRef(e), 0, NO_QUOTA));
+    BOOST_CHECK(pool.AddTx(MakeTransactionRef(d), 1, NO_QUOTA));
+    BOOST_CHECK(pool.AddTx(MakeTransactionRef(c), 0, NO_QUOTA));
+    BOOST_CHECK(pool.AddTx(MakeTransactionRef(b), 1, NO_QUOTA));
+    BOOST_CHECK(pool.AddTx(MakeTransactionRef(a), 0, NO_QUOTA));
+    BOOST_CHECK(pool.AddTx(MakeTransactionRef(unrelated), 0, NO_QUOTA));
+
+    std::vector<std::pair<CTransactionRef, NodeId>> vUnblocked =
+        pool.GetUnblockedBy(CTransaction(parent));
+    BOOST_CHECK_EQUAL(vUnblocked.size(), 5);
+
+    std::map<uint256, size_t> mapPosition;
+    for (size_t i = 0; i < vUnblocked.size(); i++) {
+        mapPosition[vUnblocked[i].first->GetId()] = i;
+    }
+    BOOST_CHECK(!mapPosition.count(unrelated.GetId()));
+    BOOST_CHECK(mapPosition.at(a.GetId()) < mapPosition.at(b.GetId()));
+    BOOST_CHECK(mapPosition.at(b.GetId()) < mapPosition.at(d.GetId()));
+    BOOST_CHECK(mapPosition.at(c.GetId()) < mapPosition.at(d.GetId()));
+    BOOST_CHECK(mapPosition.at(d.GetId()) < mapPosition.at(e.GetId()));
+    BOOST_CHECK_EQUAL(vUnblocked[mapPosition.at(d.GetId())].second, 1);
+
+    // A block spending the same outpoint as a removes a, but not its
+    // descendants, which are now orphans of a conflicted transaction.
+    CBlock block;
+    block.vtx.push_back(
+        MakeTransactionRef(OrphanSpending(parent.GetId(), 0)));
+    BOOST_CHECK_EQUAL(pool.EraseForBlock(block), 1);
+    BOOST_CHECK(!pool.HaveTx(a.GetId()));
+    BOOST_CHECK(pool.HaveTx(b.GetId()));
+
+    pool.Clear();
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+    BOOST_CHECK_EQUAL(pool.GetUsage(), 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,189 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/bitcoinconsensus.h"
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(bitcoinconsensus_tests, BasicTestingSetup)
+
+static const unsigned int FLAGS =
+    bitcoinconsensus_SCRIPT_FLAGS_VERIFY_ALL |
+    bitcoinconsensus_SCRIPT_ENABLE_SIGHASH_FORKID;
+
+/** A serialized transaction and the outputs spent by its inputs. */
+struct TestTransaction {
+    std::vector<uint8_t> vchTx;
+    std::vector<CScript> scriptPubKeys;
+    std::vector<int64_t> vAmounts;
+};
+
+/** Append the spent outputs of test to the arrays passed to the library. */
+static void AppendSpentOutputs(const TestTransaction &test,
+                               std::vector<const uint8_t *> &scriptPubKeys,
+                               std::vector<unsigned int> &scriptPubKeyLens,
+                               std::vector<int64_t> &amounts) {
+    for (const CScript &scriptPubKey : test.scriptPubKeys) {
+        scriptPubKeys.push_back(scriptPubKey.data());
+        scriptPubKeyLens.push_back(scriptPubKey.size());
+    }
+    amounts.insert(amounts.end(), test.vAmounts.begin(), test.vAmounts.end());
+}
+
+/** Spend nInputs P2PKH outputs, with a bad signature for input nBadInput. */
+static TestTransaction MakeTransaction(unsigned int nInputs,
+                                       unsigned int nBadInput) {
+    TestTransaction test;
+    CMutableTransaction mtx;
+    std::vector<CKey> keys(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        keys[i].MakeNewKey(i % 2 == 0);
+        mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), i)));
+        test.scriptPubKeys.push_back(
+            GetScriptForDestination(keys[i].GetPubKey().GetID()));
+        test.vAmounts.push_back(1000 * (i + 1));
+    }
+    mtx.vout.push_back(CTxOut(Amount(1000), CScript() << OP_TRUE));
+
+    SigHashType sigHashType = SigHashType().withForkId(true);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        uint256 hash =
+            SignatureHash(test.scriptPubKeys[i], CTransaction(mtx), i,
+                          sigHashType, Amount(test.vAmounts[i]));
+        std::vector<uint8_t> vchSig;
+        BOOST_CHECK(keys[i].Sign(hash, vchSig));
+        if (i == nBadInput) {
+            vchSig[vchSig.size() - 1] ^= 1;
+        }
+        vchSig.push_back(uint8_t(sigHashType.getRawSigHashType()));
+        mtx.vin[i].scriptSig << vchSig << ToByteVector(keys[i].GetPubKey());
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CTransaction(mtx);
+    test.vchTx.assign(stream.begin(), stream.end());
+    return test;
+}
+
+static int VerifyInputs(const TestTransaction &test, unsigned int nInputs,
+                        unsigned int flags, unsigned int nThreads,
+                        std::vector<int> &results,
+                        bitcoinconsensus_error &err) {
+    std::vector<const uint8_t *> scriptPubKeys;
+    std::vector<unsigned int> scriptPubKeyLens;
+    std::vector<int64_t> amounts;
+    AppendSpentOutputs(test, scriptPubKeys, scriptPubKeyLens, amounts);
+    results.assign(nInputs, -1);
+    return bitcoinconsensus_verify_tx_inputs(
+        test.vchTx.data(), test.vchTx.size(), scriptPubKeys.data(),
+        scriptPubKeyLens.data(), amounts.data(), nInputs, flags, nThreads,
+        results.data(), &err);
+}
+
+BOOST_AUTO_TEST_CASE(verify_tx_inputs) {
+    BOOST_CHECK_EQUAL(bitcoinconsensus_version(), 2U);
+
+    const unsigned int nInputs = 10;
+    TestTransaction valid = MakeTransaction(nInputs, nInputs);
+    TestTransaction invalid = MakeTransaction(nInputs, 3);
+    std::vector<int> results;
+    bitcoinconsensus_error err;
+
+    for (unsigned int nThreads : {0, 1, 4, 20}) {
+        BOOST_CHECK_EQUAL(
+            VerifyInputs(valid, nInputs, FLAGS, nThreads, results, err), 1);
+        BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+        BOOST_CHECK(results == std::vector<int>(nInputs, 1));
+
+        BOOST_CHECK_EQUAL(
+            VerifyInputs(invalid, nInputs, FLAGS, nThreads, results, err), 0);
+        BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+        for (unsigned int i = 0; i < nInputs; i++) {
+            BOOST_CHECK_EQUAL(results[i], i == 3 ? 0 : 1);
+        }
+    }
+
+    // Signatures commit to the amounts.
+    valid.vAmounts[5]++;
+    BOOST_CHECK_EQUAL(VerifyInputs(valid, nInputs, FLAGS, 2, results, err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_OK);
+    BOOST_CHECK_EQUAL(results[5], 0);
+    BOOST_CHECK_EQUAL(results[6], 1);
+    valid.vAmounts[5]--;
+
+    // Errors leave all results at 0.
+    BOOST_CHECK_EQUAL(
+        VerifyInputs(valid, nInputs - 1, FLAGS, 2, results, err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_TX_INPUT_COUNT);
+    BOOST_CHECK(results == std::vector<int>(nInputs - 1, 0));
+
+    BOOST_CHECK_EQUAL(
+        VerifyInputs(valid, nInputs, FLAGS | (1U << 30), 2, results, err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_INVALID_FLAGS);
+    BOOST_CHECK(results == std::vector<int>(nInputs, 0));
+
+    valid.vchTx.push_back(0);
+    BOOST_CHECK_EQUAL(VerifyInputs(valid, nInputs, FLAGS, 2, results, err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_TX_SIZE_MISMATCH);
+
+    valid.vchTx.resize(valid.vchTx.size() / 2);
+    BOOST_CHECK_EQUAL(VerifyInputs(valid, nInputs, FLAGS, 2, results, err), 0);
+    BOOST_CHECK_EQUAL(err, bitcoinconsensus_ERR_TX_DESERIALIZE);
+    BOOST_CHECK(results == std::vector<int>(nInputs, 0));
+}
+
+BOOST_AUTO_TEST_CASE(verify_txs) {
+    // One valid transaction, one with an invalid input and one that doesn't
+    // deserialize.
+    std::vector<TestTransaction> tests = {
+        MakeTransaction(3, 3), MakeTransaction(4, 0), MakeTransaction(2, 2)};
+    tests[2].vchTx.resize(10);
+
+    std::vector<const uint8_t *> txTos;
+    std::vector<unsigned int> txToLens, txInputCounts;
+    std::vector<const uint8_t *> scriptPubKeys;
+    std::vector<unsigned int> scriptPubKeyLens;
+    std::vector<int64_t> amounts;
+    for (const TestTransaction &test : tests) {
+        txTos.push_back(test.vchTx.data());
+        txToLens.push_back(test.vchTx.size());
+        txInputCounts.push_back(test.scriptPubKeys.size());
+        AppendSpentOutputs(test, scriptPubKeys, scriptPubKeyLens, amounts);
+    }
+
+    for (unsigned int nThreads : {1, 3}) {
+        std::vector<int> results(amounts.size(), -1);
+        std::vector<bitcoinconsensus_error> errs(tests.size());
+        BOOST_CHECK_EQUAL(
+            bitcoinconsensus_verify_txs(
+                txTos.data(), txToLens.data(), txInputCounts.data(),
+                tests.size(), scriptPubKeys.data(), scriptPubKeyLens.data(),
+                amounts.data(), FLAGS, nThreads, results.data(), errs.data()),
+            0);
+        BOOST_CHECK(results == std::vector<int>({1, 1, 1, 0, 1, 1, 1, 0, 0}));
+        BOOST_CHECK_EQUAL(errs[0], bitcoinconsensus_ERR_OK);
+        BOOST_CHECK_EQUAL(errs[1], bitcoinconsensus_ERR_OK);
+        BOOST_CHECK_EQUAL(errs[2], bitcoinconsensus_ERR_TX_DESERIALIZE);
+
+        // The first transaction alone is valid.
+        BOOST_CHECK_EQUAL(
+            bitcoinconsensus_verify_txs(
+                txTos.data(), txToLens.data(), txInputCounts.data(), 1,
+                scriptPubKeys.data(), scriptPubKeyLens.data(), amounts.data(),
+                FLAGS, nThreads, results.data(), nullptr),
+            1);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
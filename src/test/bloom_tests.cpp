@@ -1126,4 +1126,26 @@ BOOST_AUTO_TEST_CASE(rolling_bloom) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(bloom_false_positive_rate) {
+    // Filters below the size cap get about the rate asked for.
+    CBloomFilter filter(1000, 0.01, 0, BLOOM_UPDATE_NONE);
+    double fpRate = filter.GetFalsePositiveRate(1000);
+    BOOST_CHECK(fpRate > 0.005 && fpRate < 0.02);
+
+    // Capped filters get a much higher one, which matches what they do.
+    const unsigned int nElements = 100000;
+    CBloomFilter capped(nElements, 0.0001, 0, BLOOM_UPDATE_NONE);
+    BOOST_CHECK(capped.IsWithinSizeConstraints());
+    fpRate = capped.GetFalsePositiveRate(nElements);
+    BOOST_CHECK(fpRate > 0.1);
+    for (unsigned int i = 0; i < nElements; i++) {
+        capped.insert(GetRandHash());
+    }
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (capped.contains(GetRandHash())) ++nHits;
+    }
+    BOOST_CHECK(std::abs(nHits / 10000.0 - fpRate) < 0.05);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
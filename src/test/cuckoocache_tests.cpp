@@ -370,4 +370,63 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations) {
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+BOOST_AUTO_TEST_CASE(cuckoocache_new_generation_stats) {
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    cc.setup(1 << 12);
+
+    std::vector<uint256> old_hashes(1000), new_hashes(500);
+    for (uint256 &h : old_hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    CuckooCache::cache_stats stats = cc.get_stats();
+    BOOST_CHECK_EQUAL(stats.size, 1U << 12);
+    BOOST_CHECK_EQUAL(stats.occupied, 1000U);
+    BOOST_CHECK_EQUAL(stats.recent, 1000U);
+    BOOST_CHECK_EQUAL(stats.inserts, 1000U);
+    BOOST_CHECK_EQUAL(stats.evictions, 0U);
+    BOOST_CHECK_EQUAL(stats.generations, 0U);
+
+    // A new generation keeps the entries, but they are no longer recent.
+    cc.new_generation();
+    stats = cc.get_stats();
+    BOOST_CHECK_EQUAL(stats.occupied, 1000U);
+    BOOST_CHECK_EQUAL(stats.recent, 0U);
+    BOOST_CHECK_EQUAL(stats.generations, 1U);
+
+    // The next one drops those that were not inserted again.
+    for (uint256 &h : new_hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    for (size_t i = 0; i < 100; i++) {
+        cc.insert(old_hashes[i]);
+    }
+    cc.new_generation();
+    stats = cc.get_stats();
+    BOOST_CHECK_EQUAL(stats.occupied, 600U);
+    BOOST_CHECK_EQUAL(stats.recent, 0U);
+    BOOST_CHECK_EQUAL(stats.generations, 2U);
+    std::vector<uint256> entries;
+    cc.get_entries(entries);
+    BOOST_CHECK_EQUAL(entries.size(), 600U);
+    for (size_t i = 0; i < 100; i++) {
+        BOOST_CHECK(cc.contains(old_hashes[i], false));
+    }
+
+    // Overfilling the cache moves entries, and ages them so that there is
+    // still room for new ones.
+    uint256 h;
+    for (int i = 0; i < 20000; i++) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    stats = cc.get_stats();
+    BOOST_CHECK_EQUAL(stats.inserts, 21600U);
+    BOOST_CHECK(stats.occupied <= stats.size);
+    BOOST_CHECK(stats.displacements > 0);
+    BOOST_CHECK(stats.generations > 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
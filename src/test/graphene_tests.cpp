@@ -0,0 +1,278 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "graphene.h"
+#include "chainparams.h"
+#include "config.h"
+#include "consensus/merkle.h"
+#include "iblt.h"
+#include "net.h"
+#include "random.h"
+#include "txmempool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(graphene_tests, RegtestingSetup)
+
+static CMutableTransaction RandomTransaction() {
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = InsecureRand256();
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = Amount(42);
+    return tx;
+}
+
+static CBlock BuildBlockTestCase(size_t nTxs) {
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig.resize(10);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = Amount(42);
+
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (size_t i = 0; i < nTxs; i++) {
+        block.vtx.push_back(MakeTransactionRef(RandomTransaction()));
+    }
+    block.nVersion = 42;
+    block.hashPrevBlock = InsecureRand256();
+    block.nBits = 0x207fffff;
+
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, GetConfig())) {
+        ++block.nNonce;
+    }
+
+    return block;
+}
+
+static CGrapheneBlock RoundTrip(const CGrapheneBlock &grapheneBlock) {
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << grapheneBlock;
+
+    CGrapheneBlock grapheneBlock2;
+    stream >> grapheneBlock2;
+    BOOST_CHECK(stream.empty());
+    return grapheneBlock2;
+}
+
+BOOST_AUTO_TEST_CASE(iblt_difference) {
+    SeedInsecureRand(true);
+    CIblt ibltA(CIblt::OptimalCellCount(20), 42);
+    CIblt ibltB(CIblt::OptimalCellCount(20), 42);
+    BOOST_CHECK(ibltA.IsValid());
+
+    // 1000 shared keys, 10 only in A and 5 only in B.
+    std::set<uint64_t> setOnlyA, setOnlyB;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t key = InsecureRandBits(64);
+        ibltA.Insert(key);
+        ibltB.Insert(key);
+    }
+    for (int i = 0; i < 10; i++) {
+        uint64_t key = InsecureRandBits(64);
+        ibltA.Insert(key);
+        setOnlyA.insert(key);
+    }
+    for (int i = 0; i < 5; i++) {
+        uint64_t key = InsecureRandBits(64);
+        ibltB.Insert(key);
+        setOnlyB.insert(key);
+    }
+
+    // The shared keys cannot be listed from a single table.
+    std::set<uint64_t> setPositive, setNegative;
+    BOOST_CHECK(!ibltA.ListEntries(setPositive, setNegative));
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << ibltB;
+    CIblt ibltB2;
+    stream >> ibltB2;
+
+    CIblt difference(ibltA);
+    BOOST_CHECK(difference.Subtract(ibltB2));
+    setPositive.clear();
+    setNegative.clear();
+    BOOST_CHECK(difference.ListEntries(setPositive, setNegative));
+    BOOST_CHECK(setPositive == setOnlyA);
+    BOOST_CHECK(setNegative == setOnlyB);
+
+    // Erasing the differences leaves an empty table.
+    for (uint64_t key : setOnlyA) {
+        difference.Erase(key);
+    }
+    for (uint64_t key : setOnlyB) {
+        difference.Insert(key);
+    }
+    setPositive.clear();
+    setNegative.clear();
+    BOOST_CHECK(difference.ListEntries(setPositive, setNegative));
+    BOOST_CHECK(setPositive.empty() && setNegative.empty());
+
+    // Tables with different parameters cannot be compared.
+    CIblt ibltOtherSalt(ibltA.GetCellCount(), 43);
+    BOOST_CHECK(!difference.Subtract(ibltOtherSalt));
+    CIblt ibltOtherSize(ibltA.GetCellCount() + IBLT_DEFAULT_HASH_FUNCS, 42);
+    BOOST_CHECK(!difference.Subtract(ibltOtherSize));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_cell_counts) {
+    CIblt iblt(CIblt::OptimalCellCount(5), 42);
+    iblt.Insert(1);
+    BOOST_CHECK(iblt.IsValid());
+
+    // Tables from peers with out of range counts are rejected.
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << iblt.GetHashFuncs() << iblt.GetSalt()
+           << COMPACTSIZE(uint64_t(iblt.GetCellCount()));
+    for (size_t i = 0; i < iblt.GetCellCount(); i++) {
+        CIblt::Cell cell;
+        cell.nCount = i == 0 ? std::numeric_limits<int32_t>::min()
+                             : IBLT_MAX_CELL_COUNT;
+        stream << cell;
+    }
+    CIblt ibltBogus;
+    stream >> ibltBogus;
+    BOOST_CHECK(!ibltBogus.IsValid());
+
+    // Subtracting fails instead of overflowing, and leaves the table as is.
+    CIblt difference(iblt);
+    BOOST_CHECK(!difference.Subtract(ibltBogus));
+    std::set<uint64_t> setPositive, setNegative;
+    BOOST_CHECK(difference.ListEntries(setPositive, setNegative));
+    BOOST_CHECK(setPositive == std::set<uint64_t>({1}));
+    BOOST_CHECK(setNegative.empty());
+}
+
+BOOST_AUTO_TEST_CASE(iblt_overloaded) {
+    SeedInsecureRand(true);
+    CIblt ibltA(CIblt::OptimalCellCount(5), 42);
+    CIblt ibltB(CIblt::OptimalCellCount(5), 42);
+    for (int i = 0; i < 100; i++) {
+        ibltA.Insert(InsecureRandBits(64));
+    }
+
+    BOOST_CHECK(ibltA.Subtract(ibltB));
+    std::set<uint64_t> setPositive, setNegative;
+    BOOST_CHECK(!ibltA.ListEntries(setPositive, setNegative));
+}
+
+BOOST_AUTO_TEST_CASE(graphene_roundtrip) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase(1000));
+
+    // The mempool has the whole block, and many more transactions which have
+    // to be filtered out.
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        pool.addUnchecked(block.vtx[i]->GetId(), entry.FromTx(*block.vtx[i]));
+    }
+    for (int i = 0; i < 3000; i++) {
+        CTransaction tx(RandomTransaction());
+        pool.addUnchecked(tx.GetId(), entry.FromTx(tx));
+    }
+
+    CGrapheneBlock grapheneBlock2 =
+        RoundTrip(CGrapheneBlock(block, pool.size()));
+    BOOST_CHECK_EQUAL(grapheneBlock2.BlockTxCount(), block.vtx.size());
+
+    // Smaller than the compact block, which takes 6 bytes per short txid.
+    BOOST_CHECK_LT(
+        GetSerializeSize(grapheneBlock2, SER_NETWORK, PROTOCOL_VERSION),
+        GetSerializeSize(CBlockHeaderAndShortTxIDs(block), SER_NETWORK,
+                         PROTOCOL_VERSION));
+
+    std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+    CBlock block2;
+    BOOST_CHECK_EQUAL(
+        grapheneBlock2.FillBlock(GetConfig(), pool, extra_txn, block2),
+        READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), block2.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(block.vtx[i]->GetId() == block2.vtx[i]->GetId());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(graphene_missing_tx) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase(20));
+
+    for (size_t i = 2; i < block.vtx.size(); i++) {
+        pool.addUnchecked(block.vtx[i]->GetId(), entry.FromTx(*block.vtx[i]));
+    }
+
+    CGrapheneBlock grapheneBlock2 =
+        RoundTrip(CGrapheneBlock(block, pool.size() + 1));
+
+    // Without vtx[1] the block cannot be rebuilt.
+    std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+    CBlock block2;
+    BOOST_CHECK_EQUAL(
+        grapheneBlock2.FillBlock(GetConfig(), pool, extra_txn, block2),
+        READ_STATUS_FAILED);
+
+    // It can be found among the extra transactions.
+    extra_txn.emplace_back(block.vtx[1]->GetId(), block.vtx[1]);
+    BOOST_CHECK_EQUAL(
+        grapheneBlock2.FillBlock(GetConfig(), pool, extra_txn, block2),
+        READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    BOOST_CHECK(block.hashMerkleRoot == BlockMerkleRoot(block2));
+}
+
+BOOST_AUTO_TEST_CASE(graphene_huge_receiver_pool) {
+    // The mempool size comes from the peer, which must not be able to make
+    // us allocate an IBLT out of proportion with the block.
+    for (size_t nBlockTxs : {1000, 20000}) {
+        CBlock block(BuildBlockTestCase(nBlockTxs));
+        size_t nMaxCells = CIblt::OptimalCellCount(
+            CGrapheneBlock::GetMaxIbltCells(nBlockTxs) / 2);
+        for (uint64_t nReceiverPoolTxs :
+             {GRAPHENE_MAX_RECEIVER_POOL_TXS, uint64_t(1) << 40,
+              std::numeric_limits<uint64_t>::max()}) {
+            CGrapheneBlock grapheneBlock(block, nReceiverPoolTxs);
+            BOOST_CHECK_LE(grapheneBlock.iblt.GetCellCount(), nMaxCells);
+            // The filter of a large block is capped at MAX_BLOOM_FILTER_SIZE
+            // and lets through too many transactions of such a mempool.
+            BOOST_CHECK_EQUAL(grapheneBlock.IsIbltCapped(), nBlockTxs > 1000);
+        }
+    }
+
+    // Past that many transactions, the IBLT alone would be larger than the
+    // short txids of a compact block.
+    BOOST_CHECK_EQUAL(CGrapheneBlock::GetMaxIbltCells(20000), 20000 * 6 / 16);
+    BOOST_CHECK_LE(CGrapheneBlock::GetMaxIbltCells(1 << 30),
+                   MAX_PROTOCOL_MESSAGE_LENGTH / 2 / 16);
+}
+
+BOOST_AUTO_TEST_CASE(graphene_coinbase_only) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    CBlock block(BuildBlockTestCase(0));
+
+    CGrapheneBlock grapheneBlock2 = RoundTrip(CGrapheneBlock(block, 0));
+    BOOST_CHECK_EQUAL(grapheneBlock2.BlockTxCount(), 1);
+
+    std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+    CBlock block2;
+    BOOST_CHECK_EQUAL(
+        grapheneBlock2.FillBlock(GetConfig(), pool, extra_txn, block2),
+        READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 
 #include "base58.h"
 #include "dstencode.h"
+#include "random.h"
 #include "script/script.h"
 #include "test/test_bitcoin.h"
 #include "uint256.h"
@@ -203,4 +204,41 @@ BOOST_AUTO_TEST_CASE(key_test1) {
                          "8ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(pubkey_cache) {
+    // A tiny cache, so that keys keep replacing each other.
+    InitPubKeyCache(16, GetRandHash());
+
+    std::vector<CKey> keys(40);
+    std::vector<std::vector<uint8_t>> sigs;
+    uint256 hash = GetRandHash();
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i].MakeNewKey(i % 2 == 0);
+        std::vector<uint8_t> vchSig;
+        BOOST_CHECK(keys[i].Sign(hash, vchSig));
+        sigs.push_back(vchSig);
+    }
+
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            CPubKey pubkey = keys[i].GetPubKey();
+            BOOST_CHECK(pubkey.Verify(hash, sigs[i]));
+            BOOST_CHECK(!pubkey.Verify(hash, sigs[(i + 1) % keys.size()]));
+
+            // The other point with the same x coordinate is a different key.
+            std::vector<uint8_t> vchOther(pubkey.begin(), pubkey.end());
+            if (pubkey.IsCompressed()) {
+                vchOther[0] ^= 1;
+                BOOST_CHECK(!CPubKey(vchOther).Verify(hash, sigs[i]));
+            }
+        }
+    }
+
+    // Without the cache, results are the same.
+    InitPubKeyCache(0, uint256());
+    for (size_t i = 0; i < keys.size(); i++) {
+        BOOST_CHECK(keys[i].GetPubKey().Verify(hash, sigs[i]));
+    }
+    InitPubKeyCache(DEFAULT_PUBKEY_CACHE_ENTRIES, GetRandHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
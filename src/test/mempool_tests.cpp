@@ -479,6 +479,240 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest) {
     CheckSort<ancestor_score>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClusterTest) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+
+    // txA -> txB -> txC, and txD on its own.
+    CMutableTransaction txA, txB, txC, txD;
+    txA.vin.resize(1);
+    txA.vin[0].scriptSig = CScript() << OP_11;
+    txA.vout.resize(1);
+    txA.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA.vout[0].nValue = 10 * COIN;
+
+    txB.vin.resize(1);
+    txB.vin[0].prevout = COutPoint(txA.GetId(), 0);
+    txB.vin[0].scriptSig = CScript() << OP_11;
+    txB.vout.resize(1);
+    txB.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txB.vout[0].nValue = 9 * COIN;
+
+    txC.vin.resize(1);
+    txC.vin[0].prevout = COutPoint(txB.GetId(), 0);
+    txC.vin[0].scriptSig = CScript() << OP_11;
+    txC.vout.resize(1);
+    txC.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txC.vout[0].nValue = 8 * COIN;
+
+    txD.vin.resize(1);
+    txD.vin[0].scriptSig = CScript() << OP_12;
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txD.vout[0].nValue = 5 * COIN;
+
+    pool.addUnchecked(txA.GetId(), entry.Fee(Amount(1000LL)).FromTx(txA));
+    pool.addUnchecked(txB.GetId(), entry.Fee(Amount(2000LL)).FromTx(txB));
+    pool.addUnchecked(txC.GetId(), entry.Fee(Amount(3000LL)).FromTx(txC));
+    pool.addUnchecked(txD.GetId(), entry.Fee(Amount(4000LL)).FromTx(txD));
+
+    uint64_t sizeA = GetTransactionSize(txA);
+    uint64_t sizeB = GetTransactionSize(txB);
+    uint64_t sizeC = GetTransactionSize(txC);
+    uint64_t sizeD = GetTransactionSize(txD);
+
+    uint64_t nCount, nSize;
+    Amount nFees;
+    LOCK(pool.cs);
+    pool.GetClusterStats(*pool.mapTx.find(txA.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 3UL);
+    BOOST_CHECK_EQUAL(nSize, sizeA + sizeB + sizeC);
+    BOOST_CHECK_EQUAL(nFees, Amount(6000LL));
+    pool.GetClusterStats(*pool.mapTx.find(txD.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1UL);
+    BOOST_CHECK_EQUAL(nSize, sizeD);
+
+    // txE spends both txC and txD, merging their clusters.
+    CMutableTransaction txE;
+    txE.vin.resize(2);
+    txE.vin[0].prevout = COutPoint(txC.GetId(), 0);
+    txE.vin[0].scriptSig = CScript() << OP_11;
+    txE.vin[1].prevout = COutPoint(txD.GetId(), 0);
+    txE.vin[1].scriptSig = CScript() << OP_11;
+    txE.vout.resize(1);
+    txE.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txE.vout[0].nValue = 12 * COIN;
+    uint64_t sizeE = GetTransactionSize(txE);
+
+    std::string errString;
+    CTxMemPoolEntry entryE = entry.Fee(Amount(5000LL)).FromTx(txE);
+    BOOST_CHECK(!pool.CheckClusterLimits(entryE, 4, 1000000, errString));
+    BOOST_CHECK(!pool.CheckClusterLimits(
+        entryE, 5, sizeA + sizeB + sizeC + sizeD + sizeE - 1, errString));
+    BOOST_CHECK(pool.CheckClusterLimits(
+        entryE, 5, sizeA + sizeB + sizeC + sizeD + sizeE, errString));
+
+    pool.addUnchecked(txE.GetId(), entryE);
+    pool.GetClusterStats(*pool.mapTx.find(txD.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 5UL);
+    BOOST_CHECK_EQUAL(nSize, sizeA + sizeB + sizeC + sizeD + sizeE);
+    BOOST_CHECK_EQUAL(nFees, Amount(15000LL));
+
+    // Prioritisation is reflected in the cluster fees.
+    pool.PrioritiseTransaction(txB.GetId(), txB.GetId().ToString(), 0.0,
+                               Amount(500LL));
+    pool.GetClusterStats(*pool.mapTx.find(txA.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nFees, Amount(15500LL));
+
+    // Mining txB splits txA away from the rest of the cluster.
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txB));
+    pool.removeForBlock(vtx, 1);
+    pool.GetClusterStats(*pool.mapTx.find(txA.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1UL);
+    BOOST_CHECK_EQUAL(nSize, sizeA);
+    BOOST_CHECK_EQUAL(nFees, Amount(1000LL));
+    pool.GetClusterStats(*pool.mapTx.find(txE.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 3UL);
+    BOOST_CHECK_EQUAL(nSize, sizeC + sizeD + sizeE);
+    BOOST_CHECK_EQUAL(nFees, Amount(12000LL));
+
+    // Removing txE and its descendants leaves txC and txD apart.
+    pool.removeRecursive(txE);
+    pool.GetClusterStats(*pool.mapTx.find(txC.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1UL);
+    pool.GetClusterStats(*pool.mapTx.find(txD.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1UL);
+    BOOST_CHECK_EQUAL(nSize, sizeD);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterExpiryTest) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+
+    // txR1 -> txE, txR2 -> txF and txE -> txF.
+    CMutableTransaction txR1, txR2, txE, txF;
+    txR1.vin.resize(1);
+    txR1.vin[0].scriptSig = CScript() << OP_11;
+    txR1.vout.resize(1);
+    txR1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txR1.vout[0].nValue = 10 * COIN;
+
+    txR2.vin.resize(1);
+    txR2.vin[0].scriptSig = CScript() << OP_12;
+    txR2.vout.resize(1);
+    txR2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txR2.vout[0].nValue = 10 * COIN;
+
+    txE.vin.resize(1);
+    txE.vin[0].prevout = COutPoint(txR1.GetId(), 0);
+    txE.vin[0].scriptSig = CScript() << OP_11;
+    txE.vout.resize(1);
+    txE.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txE.vout[0].nValue = 9 * COIN;
+
+    txF.vin.resize(2);
+    txF.vin[0].prevout = COutPoint(txR2.GetId(), 0);
+    txF.vin[0].scriptSig = CScript() << OP_11;
+    txF.vin[1].prevout = COutPoint(txE.GetId(), 0);
+    txF.vin[1].scriptSig = CScript() << OP_11;
+    txF.vout.resize(1);
+    txF.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txF.vout[0].nValue = 18 * COIN;
+
+    pool.addUnchecked(txR1.GetId(), entry.Time(20).FromTx(txR1));
+    pool.addUnchecked(txR2.GetId(), entry.Time(20).FromTx(txR2));
+    pool.addUnchecked(txE.GetId(), entry.Time(10).FromTx(txE));
+    pool.addUnchecked(txF.GetId(), entry.Time(20).FromTx(txF));
+
+    uint64_t nCount, nSize;
+    Amount nFees;
+    {
+        LOCK(pool.cs);
+        pool.GetClusterStats(*pool.mapTx.find(txR1.GetId()), nCount, nSize,
+                             nFees);
+        BOOST_CHECK_EQUAL(nCount, 4UL);
+    }
+
+    // Expiring txE removes txF with it. Each of them is left linked to a
+    // single remaining transaction, but txR1 and txR2 are now apart.
+    BOOST_CHECK_EQUAL(pool.Expire(15), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 2UL);
+    LOCK(pool.cs);
+    pool.GetClusterStats(*pool.mapTx.find(txR1.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1UL);
+    BOOST_CHECK_EQUAL(nSize, GetTransactionSize(txR1));
+    pool.GetClusterStats(*pool.mapTx.find(txR2.GetId()), nCount, nSize, nFees);
+    BOOST_CHECK_EQUAL(nCount, 1UL);
+    BOOST_CHECK_EQUAL(nSize, GetTransactionSize(txR2));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolQueryHashesSinceTest) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+
+    // txA -> txB, and txC and txD on their own.
+    CMutableTransaction txA, txB, txC, txD;
+    txA.vin.resize(1);
+    txA.vin[0].scriptSig = CScript() << OP_11;
+    txA.vout.resize(1);
+    txA.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA.vout[0].nValue = 10 * COIN;
+
+    txB.vin.resize(1);
+    txB.vin[0].prevout = COutPoint(txA.GetId(), 0);
+    txB.vin[0].scriptSig = CScript() << OP_11;
+    txB.vout.resize(1);
+    txB.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txB.vout[0].nValue = 9 * COIN;
+
+    txC.vin.resize(1);
+    txC.vin[0].scriptSig = CScript() << OP_12;
+    txC.vout.resize(1);
+    txC.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txC.vout[0].nValue = 5 * COIN;
+
+    txD.vin.resize(1);
+    txD.vin[0].scriptSig = CScript() << OP_13;
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txD.vout[0].nValue = 5 * COIN;
+
+    pool.addUnchecked(txA.GetId(),
+                      entry.Fee(Amount(1000LL)).Time(10).FromTx(txA));
+    pool.addUnchecked(txB.GetId(),
+                      entry.Fee(Amount(50000LL)).Time(20).FromTx(txB));
+    pool.addUnchecked(txC.GetId(),
+                      entry.Fee(Amount(100LL)).Time(30).FromTx(txC));
+    pool.addUnchecked(txD.GetId(),
+                      entry.Fee(Amount(500LL)).Time(5).FromTx(txD));
+
+    // Newest first, up to the limit.
+    std::vector<uint256> vtxid;
+    pool.queryHashesSince(0, 10, vtxid);
+    BOOST_CHECK(vtxid == std::vector<uint256>({txC.GetId(), txB.GetId(),
+                                               txA.GetId(), txD.GetId()}));
+
+    pool.queryHashesSince(0, 2, vtxid);
+    BOOST_CHECK(vtxid == std::vector<uint256>({txC.GetId(), txB.GetId()}));
+
+    pool.queryHashesSince(25, 10, vtxid);
+    BOOST_CHECK(vtxid == std::vector<uint256>({txC.GetId()}));
+
+    pool.queryHashesSince(31, 10, vtxid);
+    BOOST_CHECK(vtxid.empty());
+
+    // Children come after their parents regardless of fee, otherwise higher
+    // fee rates come first. Transactions not in the mempool are dropped.
+    vtxid = {txB.GetId(), txC.GetId(), uint256S("01"), txA.GetId(),
+             txD.GetId()};
+    std::vector<uint64_t> vAncestors;
+    pool.sortDepthAndScore(vtxid, vAncestors);
+    BOOST_CHECK(vtxid == std::vector<uint256>({txA.GetId(), txD.GetId(),
+                                               txC.GetId(), txB.GetId()}));
+    BOOST_CHECK(vAncestors == std::vector<uint64_t>({1, 1, 1, 2}));
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest) {
     CTxMemPool pool(CFeeRate(Amount(1000)));
     TestMemPoolEntryHelper entry;
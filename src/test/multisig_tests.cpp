@@ -11,6 +11,7 @@
 #include "script/script_error.h"
 #include "script/sighashtype.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "uint256.h"
 
@@ -357,4 +358,72 @@ BOOST_AUTO_TEST_CASE(multisig_Sign) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(multisig_ProduceSignatures) {
+    CBasicKeyStore keystore;
+    CKey key[4];
+    for (int i = 0; i < 4; i++) {
+        key[i].MakeNewKey(true);
+        if (i < 3) {
+            keystore.AddKey(key[i]);
+        }
+    }
+
+    CScript escrow;
+    escrow << OP_2 << ToByteVector(key[0].GetPubKey())
+           << ToByteVector(key[1].GetPubKey())
+           << ToByteVector(key[2].GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    keystore.AddCScript(escrow);
+
+    // The last output has a key the keystore doesn't have.
+    std::vector<CScript> scripts = {
+        escrow, GetScriptForDestination(CScriptID(escrow)),
+        GetScriptForDestination(key[1].GetPubKey().GetID()),
+        GetScriptForDestination(key[3].GetPubKey().GetID())};
+
+    CMutableTransaction txFrom;
+    CMutableTransaction txTo;
+    for (size_t i = 0; i < 40; i++) {
+        txFrom.vout.push_back(
+            CTxOut(Amount(1000 + int64_t(i)), scripts[i % scripts.size()]));
+        txTo.vin.push_back(CTxIn(COutPoint(txFrom.GetId(), i)));
+    }
+    txTo.vout.push_back(CTxOut(Amount(1), CScript() << OP_TRUE));
+
+    // Sign input 3, whose key is unknown, then those with known keys.
+    std::vector<unsigned int> vInputs = {3};
+    std::vector<CTxOut> vSpent = {txFrom.vout[3]};
+    for (size_t i = 0; i < txTo.vin.size(); i++) {
+        if (i % scripts.size() != scripts.size() - 1) {
+            vInputs.push_back(i);
+            vSpent.push_back(txFrom.vout[i]);
+        }
+    }
+
+    SigHashType sigHashType = SigHashType().withForkId(true);
+    CTransaction txConst(txTo);
+    for (unsigned int nThreads : {1, 4}) {
+        // Only input 3 can't be signed.
+        std::vector<SignatureData> vSigData;
+        BOOST_CHECK(ProduceSignatures(
+            keystore, txConst,
+            std::vector<unsigned int>(vInputs.begin() + 1, vInputs.end()),
+            std::vector<CTxOut>(vSpent.begin() + 1, vSpent.end()), sigHashType,
+            nThreads, vSigData));
+        BOOST_CHECK(!ProduceSignatures(keystore, txConst, vInputs, vSpent,
+                                       sigHashType, nThreads, vSigData));
+        BOOST_CHECK_EQUAL(vSigData.size(), vInputs.size());
+
+        // Signatures are deterministic, so they match those made one input at
+        // a time.
+        for (size_t i = 0; i < vInputs.size(); i++) {
+            CMutableTransaction txExpected(txTo);
+            bool fSigned = SignSignature(keystore, CTransaction(txFrom),
+                                         txExpected, vInputs[i], sigHashType);
+            BOOST_CHECK_EQUAL(fSigned, vInputs[i] != 3);
+            BOOST_CHECK(vSigData[i].scriptSig ==
+                        txExpected.vin[vInputs[i]].scriptSig);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
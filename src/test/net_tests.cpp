@@ -7,6 +7,7 @@
 #include "hash.h"
 #include "net.h"
 #include "netbase.h"
+#include "netmessagemaker.h"
 #include "serialize.h"
 #include "streams.h"
 #include "test/test_bitcoin.h"
@@ -168,6 +169,276 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test) {
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(cnode_send_coalescing) {
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, "", false);
+
+    GlobalConfig config;
+    CConnman connman(config, 0x1337, 0x1337);
+    const CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+
+    // Small messages are queued in a shared buffer, large payloads on their
+    // own, and nothing is written while corked.
+    std::vector<uint8_t> vLarge(MAX_COALESCED_PAYLOAD_SIZE + 1, 0x42);
+    connman.CorkSend(&node);
+    connman.PushMessage(&node, msgMaker.Make(NetMsgType::PING, uint64_t(1)));
+    connman.PushMessage(&node, msgMaker.Make(NetMsgType::VERACK));
+    connman.PushMessage(&node, msgMaker.Make("large", vLarge));
+    connman.PushMessage(&node, msgMaker.Make(NetMsgType::PING, uint64_t(2)));
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK_EQUAL(node.vSendMsg.size(), 3UL);
+        BOOST_CHECK_EQUAL(node.nSendSize,
+                          4 * CMessageHeader::HEADER_SIZE + 8 + 8 +
+                              GetSerializeSize(vLarge, SER_NETWORK,
+                                               INIT_PROTO_VERSION));
+    }
+    BOOST_CHECK_EQUAL(node.nSendBytes, 0UL);
+
+    connman.UncorkSend(&node);
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK(node.vSendMsg.empty());
+        BOOST_CHECK_EQUAL(node.nSendSize, 0UL);
+    }
+
+    // The peer receives the messages in order.
+    std::vector<char> received(node.nSendBytes);
+    size_t nRead = 0;
+    while (nRead < received.size()) {
+        ssize_t n = read(fds[1], received.data() + nRead,
+                         received.size() - nRead);
+        BOOST_REQUIRE(n > 0);
+        nRead += n;
+    }
+    CDataStream ss(received, SER_NETWORK, INIT_PROTO_VERSION);
+    for (const std::string &command :
+         {std::string(NetMsgType::PING), std::string(NetMsgType::VERACK),
+          std::string("large"), std::string(NetMsgType::PING)}) {
+        CMessageHeader hdr(Params().NetMagic());
+        ss >> hdr;
+        BOOST_CHECK(hdr.IsValid(Params().NetMagic()));
+        BOOST_CHECK_EQUAL(hdr.GetCommand(), command);
+        ss.ignore(hdr.nMessageSize);
+    }
+    BOOST_CHECK(ss.empty());
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(cnode_send_shared) {
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    int fds1[2], fds2[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds1) == 0);
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds2) == 0);
+    CNode node1(0, NODE_NETWORK, 0, fds1[0], addr, 0, 0, "", false);
+    CNode node2(1, NODE_NETWORK, 0, fds2[0], addr, 0, 0, "", false);
+
+    GlobalConfig config;
+    CConnman connman(config, 0x1337, 0x1337);
+    const CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+
+    // A shared message has the same header and payload as a regular one.
+    std::vector<uint8_t> vLarge(MAX_COALESCED_PAYLOAD_SIZE + 1, 0x42);
+    CSharedNetMsg msg = msgMaker.MakeShared("large", vLarge);
+    BOOST_CHECK_EQUAL(msg.GetCommand(), "large");
+    CSerializedNetMsg expected = msgMaker.Make("large", vLarge);
+    BOOST_CHECK_EQUAL(msg.size(),
+                      CMessageHeader::HEADER_SIZE + expected.data.size());
+
+    // Large shared messages are queued without copying them.
+    connman.CorkSend(&node1);
+    connman.CorkSend(&node2);
+    connman.PushMessage(&node1, msg);
+    connman.PushMessage(&node2, msg);
+    {
+        LOCK2(node1.cs_vSend, node2.cs_vSend);
+        BOOST_CHECK_EQUAL(node1.vSendMsg.size(), 1UL);
+        BOOST_CHECK_EQUAL(node2.vSendMsg.size(), 1UL);
+        BOOST_CHECK(node1.vSendMsg.front().begin() ==
+                    node2.vSendMsg.front().begin());
+        BOOST_CHECK_EQUAL(node1.nSendSize, msg.size());
+    }
+
+    // While small ones are copied into the send buffer.
+    connman.PushMessage(&node1,
+                        msgMaker.MakeShared(NetMsgType::PING, uint64_t(1)));
+    {
+        LOCK(node1.cs_vSend);
+        BOOST_CHECK_EQUAL(node1.vSendMsg.size(), 2UL);
+    }
+    connman.UncorkSend(&node1);
+    connman.UncorkSend(&node2);
+
+    std::vector<char> received(node1.nSendBytes);
+    size_t nRead = 0;
+    while (nRead < received.size()) {
+        ssize_t n = read(fds1[1], received.data() + nRead,
+                         received.size() - nRead);
+        BOOST_REQUIRE(n > 0);
+        nRead += n;
+    }
+    CDataStream ss(received, SER_NETWORK, INIT_PROTO_VERSION);
+    CMessageHeader hdr(Params().NetMagic());
+    ss >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().NetMagic()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "large");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, expected.data.size());
+    uint256 hash = Hash(expected.data.begin(), expected.data.end());
+    BOOST_CHECK(memcmp(hdr.pchChecksum, hash.begin(),
+                       CMessageHeader::CHECKSUM_SIZE) == 0);
+    std::vector<uint8_t> payload(hdr.nMessageSize);
+    ss.read(reinterpret_cast<char *>(payload.data()), payload.size());
+    BOOST_CHECK(payload == expected.data);
+    ss >> hdr;
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), NetMsgType::PING);
+    ss.ignore(hdr.nMessageSize);
+    BOOST_CHECK(ss.empty());
+
+    close(fds1[1]);
+    close(fds2[1]);
+}
+
+BOOST_AUTO_TEST_CASE(cnode_send_compressed) {
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CNode node(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, "", false);
+    node.fCompressSend = true;
+
+    GlobalConfig config;
+    CConnman connman(config, 0x1337, 0x1337);
+    const CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+
+    // Shared messages are compressed for each peer, other message types are
+    // sent as is.
+    std::vector<uint8_t> vBlock(100000, 0x42);
+    connman.CorkSend(&node);
+    connman.PushMessage(&node, msgMaker.MakeShared(NetMsgType::BLOCK, vBlock));
+    connman.PushMessage(&node, msgMaker.Make(NetMsgType::PING, uint64_t(1)));
+    connman.UncorkSend(&node);
+    BOOST_CHECK(node.nSendBytes < 1000);
+
+    std::vector<char> received(node.nSendBytes);
+    size_t nRead = 0;
+    while (nRead < received.size()) {
+        ssize_t n =
+            read(fds[1], received.data() + nRead, received.size() - nRead);
+        BOOST_REQUIRE(n > 0);
+        nRead += n;
+    }
+    CDataStream ss(received, SER_NETWORK, INIT_PROTO_VERSION);
+    CMessageHeader hdr(Params().NetMagic());
+    ss >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().NetMagic()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), NetMsgType::COMPRESSED);
+    CDataStream wrapped(ss.begin(), ss.begin() + hdr.nMessageSize,
+                        SER_NETWORK, INIT_PROTO_VERSION);
+    ss.ignore(hdr.nMessageSize);
+    CNetMsgCompressor receiver;
+    std::string command;
+    std::vector<uint8_t> payload;
+    BOOST_CHECK(receiver.Decompress(wrapped, MAX_PROTOCOL_MESSAGE_LENGTH,
+                                    command, payload));
+    BOOST_CHECK_EQUAL(command, NetMsgType::BLOCK);
+    BOOST_CHECK(payload == msgMaker.Make(NetMsgType::BLOCK, vBlock).data);
+    ss >> hdr;
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), NetMsgType::PING);
+    ss.ignore(hdr.nMessageSize);
+    BOOST_CHECK(ss.empty());
+
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(token_bucket) {
+    CTokenBucket bucket;
+    // No limit by default.
+    BOOST_CHECK(bucket.HasTokens(0));
+    bucket.Consume(1000000, 0);
+    BOOST_CHECK(bucket.HasTokens(0));
+
+    // Starts full, may be overdrawn and refills at the given rate.
+    bucket.SetRate(1000, 0);
+    BOOST_CHECK(bucket.HasTokens(0));
+    bucket.Consume(2500, 0);
+    BOOST_CHECK(!bucket.HasTokens(0));
+    BOOST_CHECK(!bucket.HasTokens(1000000));
+    BOOST_CHECK(bucket.HasTokens(1500001));
+
+    // Holds at most one second worth of tokens.
+    BOOST_CHECK(bucket.HasTokens(100000000));
+    bucket.Consume(1000, 100000000);
+    BOOST_CHECK(!bucket.HasTokens(100000000));
+    BOOST_CHECK(bucket.HasTokens(100000001));
+}
+
+BOOST_AUTO_TEST_CASE(traffic_class) {
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::BLOCK), TRAFFIC_BLOCK);
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::CMPCTBLOCK), TRAFFIC_BLOCK);
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::HEADERS), TRAFFIC_BLOCK);
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::TX), TRAFFIC_TX);
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::INV), TRAFFIC_TX);
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::ADDR), TRAFFIC_ADDR);
+    BOOST_CHECK_EQUAL(GetTrafficClass(NetMsgType::PING), TRAFFIC_OTHER);
+    BOOST_CHECK_EQUAL(GetTrafficClassName(TRAFFIC_TX), "tx");
+}
+
+BOOST_AUTO_TEST_CASE(cnode_send_rate_limited) {
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CNode node(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, "", false);
+
+    GlobalConfig config;
+    CConnman connman(config, 0x1337, 0x1337);
+    const CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+
+    // Unlimited by default.
+    BOOST_CHECK(connman.HasSendAllowance(&node, TRAFFIC_TX));
+
+    // Sending more than a second worth of traffic holds back the next sends
+    // until the bucket refills, except to whitelisted peers.
+    connman.SetRateLimits(1000, 0, 50);
+    BOOST_CHECK(connman.HasSendAllowance(&node, TRAFFIC_TX));
+    connman.PushMessage(&node, msgMaker.Make(NetMsgType::BLOCK,
+                                             std::vector<uint8_t>(5000)));
+    BOOST_CHECK(!connman.HasSendAllowance(&node, TRAFFIC_TX));
+    BOOST_CHECK(!connman.HasSendAllowance(&node, TRAFFIC_BLOCK));
+    node.fWhitelisted = true;
+    BOOST_CHECK(connman.HasSendAllowance(&node, TRAFFIC_TX));
+
+    CTrafficStats stats;
+    connman.GetTrafficStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMaxUploadRate, 1000U);
+    BOOST_CHECK_EQUAL(stats.nPeerBandwidthShare, 50U);
+    // Only sends the caller held back count, not the checks.
+    BOOST_CHECK_EQUAL(stats.nThrottledSends, 0U);
+    connman.RecordThrottledSend(&node);
+    connman.GetTrafficStats(stats);
+    BOOST_CHECK_EQUAL(stats.nThrottledSends, 1U);
+    BOOST_CHECK_EQUAL(node.nThrottledSends, 1U);
+    BOOST_CHECK(stats.nSendBytesPerClass[TRAFFIC_BLOCK] > 5000);
+    BOOST_CHECK_EQUAL(stats.nSendBytesPerClass[TRAFFIC_TX], 0U);
+
+    close(fds[1]);
+}
+
 BOOST_AUTO_TEST_CASE(test_getSubVersionEB) {
     BOOST_CHECK_EQUAL(getSubVersionEB(13800000000), "13800.0");
     BOOST_CHECK_EQUAL(getSubVersionEB(3800000000), "3800.0");
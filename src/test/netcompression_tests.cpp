@@ -0,0 +1,174 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netcompression.h"
+#include "protocol.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(netcompression_tests, BasicTestingSetup)
+
+static std::vector<uint8_t> RandomBytes(size_t nSize) {
+    std::vector<uint8_t> data(nSize);
+    for (uint8_t &b : data) {
+        b = insecure_rand();
+    }
+    return data;
+}
+
+// Random runs of random bytes and of copies of earlier data.
+static std::vector<uint8_t> CompressibleBytes(size_t nSize) {
+    std::vector<uint8_t> data;
+    while (data.size() < nSize) {
+        size_t nRun = 1 + insecure_rand() % 300;
+        if (data.size() < 16 || insecure_rand() % 2) {
+            std::vector<uint8_t> random = RandomBytes(nRun);
+            data.insert(data.end(), random.begin(), random.end());
+        } else {
+            size_t nFrom = insecure_rand() % data.size();
+            for (size_t i = 0; i < nRun; i++) {
+                data.push_back(data[nFrom + i]);
+            }
+        }
+    }
+    data.resize(nSize);
+    return data;
+}
+
+static void CheckRoundTrip(const std::vector<uint8_t> &data,
+                           const std::vector<uint8_t> &dictionary) {
+    std::vector<uint8_t> buffer(dictionary);
+    buffer.insert(buffer.end(), data.begin(), data.end());
+    std::vector<uint8_t> compressed;
+    LZCompress(buffer.data() + dictionary.size(), data.size(),
+               dictionary.size(), compressed);
+
+    std::vector<uint8_t> decompressed;
+    BOOST_CHECK(LZDecompress(compressed.data(), compressed.size(), data.size(),
+                             dictionary, decompressed));
+    BOOST_CHECK(decompressed == data);
+}
+
+BOOST_AUTO_TEST_CASE(lz_round_trip) {
+    const std::vector<uint8_t> noDictionary;
+    for (size_t nSize : {0, 1, 3, 4, 15, 16, 300, 5000, 200000}) {
+        CheckRoundTrip(RandomBytes(nSize), noDictionary);
+        CheckRoundTrip(CompressibleBytes(nSize), noDictionary);
+        CheckRoundTrip(std::vector<uint8_t>(nSize, 0x42), noDictionary);
+    }
+
+    // Long runs compress well.
+    std::vector<uint8_t> zeros(100000, 0);
+    std::vector<uint8_t> compressed;
+    LZCompress(zeros.data(), zeros.size(), 0, compressed);
+    BOOST_CHECK(compressed.size() < 1000);
+
+    // Matches may start in the dictionary and run into the data.
+    std::vector<uint8_t> dictionary = CompressibleBytes(70000);
+    std::vector<uint8_t> data(dictionary.end() - 1000, dictionary.end());
+    std::vector<uint8_t> more = CompressibleBytes(2000);
+    data.insert(data.end(), more.begin(), more.end());
+    data.insert(data.end(), data.begin(), data.begin() + 1500);
+    CheckRoundTrip(data, dictionary);
+}
+
+BOOST_AUTO_TEST_CASE(lz_malformed) {
+    SeedInsecureRand(true);
+    const std::vector<uint8_t> noDictionary;
+    std::vector<uint8_t> data = CompressibleBytes(3000);
+    std::vector<uint8_t> compressed;
+    LZCompress(data.data(), data.size(), 0, compressed);
+
+    std::vector<uint8_t> out;
+    // Wrong size.
+    BOOST_CHECK(!LZDecompress(compressed.data(), compressed.size(),
+                              data.size() - 1, noDictionary, out));
+    out.clear();
+    BOOST_CHECK(!LZDecompress(compressed.data(), compressed.size(),
+                              data.size() + 1, noDictionary, out));
+    // Truncated.
+    out.clear();
+    BOOST_CHECK(!LZDecompress(compressed.data(), compressed.size() - 1,
+                              data.size(), noDictionary, out));
+    // Missing the final literal-only sequence after a match: 4 literals,
+    // then a match of 4 at offset 4.
+    const uint8_t unterminated[] = {0x40, 1, 2, 3, 4, 4, 0, 0x00};
+    out.clear();
+    BOOST_CHECK(!LZDecompress(unterminated, sizeof(unterminated) - 1, 8,
+                              noDictionary, out));
+    out.clear();
+    BOOST_CHECK(LZDecompress(unterminated, sizeof(unterminated), 8,
+                             noDictionary, out));
+    BOOST_CHECK(out == std::vector<uint8_t>({1, 2, 3, 4, 1, 2, 3, 4}));
+    // Nothing at all.
+    out.clear();
+    BOOST_CHECK(!LZDecompress(unterminated, 0, 0, noDictionary, out));
+    // Match before the start of the output: 4 literals, then offset 5.
+    const uint8_t backwards[] = {0x40, 1, 2, 3, 4, 5, 0, 0x00};
+    out.clear();
+    BOOST_CHECK(
+        !LZDecompress(backwards, sizeof(backwards), 8, noDictionary, out));
+    // Random input must never read or write out of bounds.
+    for (int i = 0; i < 1000; i++) {
+        std::vector<uint8_t> garbage = RandomBytes(1 + insecure_rand() % 100);
+        out.clear();
+        LZDecompress(garbage.data(), garbage.size(), insecure_rand() % 1000,
+                     noDictionary, out);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(msg_compressor) {
+    CNetMsgCompressor sender, receiver;
+    std::vector<uint8_t> wrapped;
+
+    // Message types not worth compressing are left alone.
+    BOOST_CHECK(!sender.Compress(NetMsgType::PING,
+                                 std::vector<uint8_t>(2000), wrapped));
+    BOOST_CHECK(!sender.Compress(NetMsgType::BLOCK, std::vector<uint8_t>(100),
+                                 wrapped));
+    // And so are incompressible payloads.
+    BOOST_CHECK(!sender.Compress(NetMsgType::BLOCK, RandomBytes(5000),
+                                 wrapped));
+
+    // Transactions sharing most of their bytes compress against each other,
+    // in order.
+    std::vector<uint8_t> tx = RandomBytes(400);
+    for (int i = 0; i < 10; i++) {
+        tx[insecure_rand() % tx.size()] = insecure_rand();
+        BOOST_CHECK(sender.Compress(NetMsgType::TX, tx, wrapped));
+        if (i > 0) {
+            BOOST_CHECK(wrapped.size() < tx.size() / 2);
+        }
+
+        CDataStream stream(wrapped, SER_NETWORK, PROTOCOL_VERSION);
+        std::string command;
+        std::vector<uint8_t> payload;
+        BOOST_CHECK(receiver.Decompress(stream, MAX_SIZE, command, payload));
+        BOOST_CHECK_EQUAL(command, NetMsgType::TX);
+        BOOST_CHECK(payload == tx);
+    }
+
+    std::vector<uint8_t> block = CompressibleBytes(100000);
+    BOOST_CHECK(sender.Compress(NetMsgType::BLOCK, block, wrapped));
+    std::string command;
+    std::vector<uint8_t> payload;
+    {
+        CDataStream stream(wrapped, SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_CHECK(
+            !receiver.Decompress(stream, block.size() - 1, command, payload));
+    }
+    {
+        CDataStream stream(wrapped, SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_CHECK(
+            receiver.Decompress(stream, block.size(), command, payload));
+        BOOST_CHECK_EQUAL(command, NetMsgType::BLOCK);
+        BOOST_CHECK(payload == block);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,265 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "key.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "script/script_error.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+typedef std::vector<uint8_t> valtype;
+
+BOOST_FIXTURE_TEST_SUITE(script_fastpath_tests, BasicTestingSetup)
+
+/**
+ * Accepts signatures depending on a hash of everything it is given, so that
+ * both paths must pass it the same signatures, keys and script code.
+ */
+class FakeSignatureChecker : public BaseSignatureChecker {
+public:
+    bool CheckSig(const valtype &vchSig, const valtype &vchPubKey,
+                  const CScript &scriptCode, uint32_t flags) const override {
+        uint8_t hash[CSHA256::OUTPUT_SIZE];
+        CSHA256()
+            .Write(vchSig.data(), vchSig.size())
+            .Write(vchPubKey.data(), vchPubKey.size())
+            .Write(scriptCode.data(), scriptCode.size())
+            .Finalize(hash);
+        return hash[0] % 8 != 0;
+    }
+};
+
+static bool CastToBool(const valtype &vch) {
+    for (size_t i = 0; i < vch.size(); i++) {
+        if (vch[i] != 0) {
+            // Can be negative zero
+            return i != vch.size() - 1 || vch[i] != 0x80;
+        }
+    }
+    return false;
+}
+
+/** VerifyScript as it was before the fast paths, on the generic EvalScript. */
+static bool ReferenceVerifyScript(const CScript &scriptSig,
+                                  const CScript &scriptPubKey, uint32_t flags,
+                                  const BaseSignatureChecker &checker,
+                                  ScriptError *serror) {
+    *serror = SCRIPT_ERR_UNKNOWN_ERROR;
+    if (flags & SCRIPT_ENABLE_SIGHASH_FORKID) {
+        flags |= SCRIPT_VERIFY_STRICTENC;
+    }
+    if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !scriptSig.IsPushOnly()) {
+        *serror = SCRIPT_ERR_SIG_PUSHONLY;
+        return false;
+    }
+
+    std::vector<valtype> stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, flags, checker, serror)) {
+        return false;
+    }
+    stackCopy = stack;
+    if (!EvalScript(stack, scriptPubKey, flags, checker, serror)) {
+        return false;
+    }
+    if (stack.empty() || !CastToBool(stack.back())) {
+        *serror = SCRIPT_ERR_EVAL_FALSE;
+        return false;
+    }
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash()) {
+        if (!scriptSig.IsPushOnly()) {
+            *serror = SCRIPT_ERR_SIG_PUSHONLY;
+            return false;
+        }
+        stack = stackCopy;
+        CScript redeemScript(stack.back().begin(), stack.back().end());
+        stack.pop_back();
+        if (!EvalScript(stack, redeemScript, flags, checker, serror)) {
+            return false;
+        }
+        if (stack.empty() || !CastToBool(stack.back())) {
+            *serror = SCRIPT_ERR_EVAL_FALSE;
+            return false;
+        }
+    }
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) && stack.size() != 1) {
+        *serror = SCRIPT_ERR_CLEANSTACK;
+        return false;
+    }
+    *serror = SCRIPT_ERR_OK;
+    return true;
+}
+
+static valtype RandomBytes(size_t nSize) {
+    valtype vch(nSize);
+    for (uint8_t &b : vch) {
+        b = insecure_rand();
+    }
+    return vch;
+}
+
+static const uint8_t hashTypes[] = {0x01, 0x41, 0x42, 0x43, 0xc1, 0x00, 0x04};
+
+/** A signature that is well encoded most of the time. */
+static valtype RandomSignature(const std::vector<CKey> &keys) {
+    switch (insecure_rand() % 8) {
+        case 0:
+            return valtype();
+        case 1:
+            return RandomBytes(insecure_rand() % 80);
+        default:
+            break;
+    }
+    valtype vchSig;
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(keys[insecure_rand() % keys.size()].Sign(hash, vchSig));
+    vchSig.push_back(hashTypes[insecure_rand() % sizeof(hashTypes)]);
+    if (insecure_rand() % 16 == 0) {
+        vchSig[insecure_rand() % vchSig.size()] ^= 1;
+    }
+    return vchSig;
+}
+
+/** A public key that is well encoded most of the time. */
+static valtype RandomPubKey(const std::vector<CKey> &keys) {
+    CPubKey pubkey = keys[insecure_rand() % keys.size()].GetPubKey();
+    valtype vchPubKey(pubkey.begin(), pubkey.end());
+    if (insecure_rand() % 16 == 0) {
+        vchPubKey[0] = insecure_rand() % 8;
+    }
+    return vchPubKey;
+}
+
+/** Push vch, sometimes non-minimally or followed by a harmless opcode. */
+static void PushData(CScript &script, const valtype &vch) {
+    switch (insecure_rand() % 32) {
+        case 0:
+            script.push_back(OP_PUSHDATA1);
+            script.push_back(vch.size());
+            script.insert(script.end(), vch.begin(), vch.end());
+            break;
+        case 1:
+            script << vch << OP_NOP;
+            break;
+        case 2:
+            script << vch << OP_1;
+            break;
+        default:
+            script << vch;
+            break;
+    }
+}
+
+static uint32_t RandomFlags() {
+    uint32_t flags = insecure_rand() % (1U << 18);
+    if (flags & SCRIPT_VERIFY_CLEANSTACK) {
+        flags |= SCRIPT_VERIFY_P2SH;
+    }
+    return flags;
+}
+
+static void CheckVerifyScript(const CScript &scriptSig,
+                              const CScript &scriptPubKey, int &nSuccesses) {
+    FakeSignatureChecker checker;
+    uint32_t flags = RandomFlags();
+    ScriptError err, errExpected;
+    bool fExpected = ReferenceVerifyScript(scriptSig, scriptPubKey, flags,
+                                           checker, &errExpected);
+    bool fSuccess = VerifyScript(scriptSig, scriptPubKey, flags, checker, &err);
+    BOOST_CHECK_EQUAL(fSuccess, fExpected);
+    BOOST_CHECK_EQUAL(err, errExpected);
+    nSuccesses += fSuccess;
+}
+
+static std::vector<CKey> MakeKeys() {
+    std::vector<CKey> keys(4);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i].MakeNewKey(i % 2 == 0);
+    }
+    return keys;
+}
+
+BOOST_AUTO_TEST_CASE(p2pkh_differential) {
+    std::vector<CKey> keys = MakeKeys();
+    int nSuccesses = 0;
+    for (int i = 0; i < 2000; i++) {
+        valtype vchPubKey = RandomPubKey(keys);
+        CScript scriptPubKey;
+        scriptPubKey << OP_DUP << OP_HASH160
+                     << ToByteVector(insecure_rand() % 8 == 0
+                                         ? uint160(RandomBytes(20))
+                                         : Hash160(vchPubKey))
+                     << OP_EQUALVERIFY << OP_CHECKSIG;
+        BOOST_CHECK(scriptPubKey.IsPayToPubKeyHash());
+
+        CScript scriptSig;
+        int nPushes = insecure_rand() % 8 == 0 ? insecure_rand() % 4 : 2;
+        for (int j = nPushes; j > 2; j--) {
+            PushData(scriptSig, RandomSignature(keys));
+        }
+        if (nPushes >= 2) {
+            PushData(scriptSig, RandomSignature(keys));
+        }
+        if (nPushes >= 1) {
+            PushData(scriptSig, vchPubKey);
+        }
+        CheckVerifyScript(scriptSig, scriptPubKey, nSuccesses);
+    }
+    BOOST_CHECK(nSuccesses > 0);
+}
+
+BOOST_AUTO_TEST_CASE(p2sh_multisig_differential) {
+    std::vector<CKey> keys = MakeKeys();
+    int nSuccesses = 0;
+    for (int i = 0; i < 2000; i++) {
+        int nKeys = 1 + insecure_rand() % 4;
+        int nSigs = 1 + insecure_rand() % nKeys;
+        if (insecure_rand() % 16 == 0) {
+            nSigs = 1 + insecure_rand() % 5;
+        }
+
+        CScript redeemScript;
+        redeemScript << CScript::EncodeOP_N(nSigs);
+        for (int j = 0; j < nKeys; j++) {
+            redeemScript << RandomPubKey(keys);
+        }
+        int nKeysOp = insecure_rand() % 16 == 0 ? insecure_rand() % 5 : nKeys;
+        redeemScript << CScript::EncodeOP_N(nKeysOp) << OP_CHECKMULTISIG;
+        if (insecure_rand() % 16 == 0) {
+            redeemScript << OP_NOP;
+        }
+
+        CScript scriptPubKey;
+        scriptPubKey << OP_HASH160
+                     << ToByteVector(insecure_rand() % 8 == 0
+                                         ? uint160(RandomBytes(20))
+                                         : Hash160(redeemScript))
+                     << OP_EQUAL;
+        BOOST_CHECK(scriptPubKey.IsPayToScriptHash());
+
+        CScript scriptSig;
+        // The dummy element is empty most of the time.
+        PushData(scriptSig, insecure_rand() % 8 == 0 ? RandomBytes(1)
+                                                     : valtype());
+        int nPushedSigs = nSigs;
+        if (insecure_rand() % 8 == 0) {
+            nPushedSigs = insecure_rand() % 5;
+        }
+        for (int j = 0; j < nPushedSigs; j++) {
+            PushData(scriptSig, RandomSignature(keys));
+        }
+        if (insecure_rand() % 32 != 0) {
+            PushData(scriptSig, valtype(redeemScript.begin(),
+                                        redeemScript.end()));
+        }
+        CheckVerifyScript(scriptSig, scriptPubKey, nSuccesses);
+    }
+    BOOST_CHECK(nSuccesses > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,278 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/sha256.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "script/scriptstack.h"
+
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+typedef std::vector<uint8_t> valtype;
+
+BOOST_FIXTURE_TEST_SUITE(scriptstack_tests, BasicTestingSetup)
+
+static valtype RandomElement() {
+    // Mostly around the inline size, sometimes up to the maximum size.
+    size_t nMaxSize = insecure_rand() % 4 == 0
+                          ? MAX_SCRIPT_ELEMENT_SIZE
+                          : 2 * ScriptStackElement::INLINE_SIZE;
+    valtype vch(insecure_rand() % (nMaxSize + 1));
+    for (uint8_t &b : vch) {
+        b = insecure_rand() % 4;
+    }
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(element_storage) {
+    valtype vchSmall(ScriptStackElement::INLINE_SIZE, 0x42);
+    valtype vchLarge(ScriptStackElement::INLINE_SIZE + 1, 0x42);
+    ScriptStackElement small(vchSmall);
+    ScriptStackElement large(vchLarge);
+    BOOST_CHECK(small.IsInline());
+    BOOST_CHECK(!large.IsInline());
+    BOOST_CHECK(small.ToVector() == vchSmall);
+    BOOST_CHECK(large.ToVector() == vchLarge);
+
+    // Small elements hold a copy, large ones refer to the data.
+    vchSmall[0] = vchLarge[0] = 0x43;
+    BOOST_CHECK_EQUAL(small[0], 0x42);
+    BOOST_CHECK_EQUAL(large[0], 0x43);
+
+    BOOST_CHECK(ScriptStackElement() == ScriptStackElement(valtype()));
+    BOOST_CHECK(ScriptStackElement(vchSmall) == ScriptStackElement(vchSmall));
+    BOOST_CHECK(ScriptStackElement(vchSmall) != small);
+    BOOST_CHECK(ScriptStackElement(vchLarge) == large);
+
+    for (int64_t n : {int64_t(0), int64_t(1), int64_t(-1), int64_t(127),
+                      int64_t(128), int64_t(-255), int64_t(0x7fffffff),
+                      std::numeric_limits<int64_t>::max(),
+                      std::numeric_limits<int64_t>::min() + 1}) {
+        CScriptNum bn(n);
+        BOOST_CHECK(ScriptStackElement(bn).ToVector() == bn.getvch());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stack_storage) {
+    std::vector<valtype> vStack;
+    for (int i = 0; i < 100; i++) {
+        vStack.push_back(RandomElement());
+    }
+    ScriptStack stack(vStack);
+    BOOST_CHECK_EQUAL(stack.size(), vStack.size());
+    BOOST_CHECK(stack.ToVector() == vStack);
+
+    // Elements may be pushed from the stack itself.
+    for (int i = 0; i < 100; i++) {
+        stack.push_back(stack.at(i));
+        stack.insert(stack.begin(), stack.back());
+    }
+    BOOST_CHECK_EQUAL(stack.size(), 300U);
+    BOOST_CHECK(stack.at(0) == stack.at(299));
+    BOOST_CHECK_THROW(stack.at(300), std::out_of_range);
+}
+
+/**
+ * Straightforward implementation of the stack manipulation opcodes on vectors,
+ * to check the interpreter against.
+ */
+static bool EvalStackOps(std::vector<valtype> &stack, const CScript &script) {
+    std::vector<valtype> altstack;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPush;
+    while (script.GetOp(pc, opcode, vchPush)) {
+        if (opcode <= OP_PUSHDATA4) {
+            stack.push_back(vchPush);
+            continue;
+        }
+        if (opcode >= OP_1 && opcode <= OP_16) {
+            stack.push_back(CScriptNum(opcode - (OP_1 - 1)).getvch());
+            continue;
+        }
+        size_t nArgs = 0;
+        switch (opcode) {
+            case OP_2ROT:
+                nArgs = 6;
+                break;
+            case OP_2OVER:
+            case OP_2SWAP:
+                nArgs = 4;
+                break;
+            case OP_3DUP:
+            case OP_ROT:
+                nArgs = 3;
+                break;
+            case OP_2DUP:
+            case OP_2DROP:
+            case OP_OVER:
+            case OP_SWAP:
+            case OP_NIP:
+            case OP_TUCK:
+            case OP_EQUAL:
+            case OP_PICK:
+            case OP_ROLL:
+                nArgs = 2;
+                break;
+            case OP_DEPTH:
+                nArgs = 0;
+                break;
+            default:
+                nArgs = opcode == OP_FROMALTSTACK ? 0 : 1;
+                break;
+        }
+        if (stack.size() < nArgs) {
+            return false;
+        }
+        auto top = [&](size_t i) -> valtype & {
+            return stack[stack.size() - i];
+        };
+        switch (opcode) {
+            case OP_TOALTSTACK:
+                altstack.push_back(top(1));
+                stack.pop_back();
+                break;
+            case OP_FROMALTSTACK:
+                if (altstack.empty()) {
+                    return false;
+                }
+                stack.push_back(altstack.back());
+                altstack.pop_back();
+                break;
+            case OP_2DROP:
+                stack.resize(stack.size() - 2);
+                break;
+            case OP_2DUP:
+            case OP_3DUP:
+            case OP_2OVER: {
+                size_t nFrom = stack.size() - nArgs;
+                for (size_t i = 0; i < (opcode == OP_3DUP ? 3U : 2U); i++) {
+                    stack.push_back(stack[nFrom + i]);
+                }
+            } break;
+            case OP_2ROT:
+            case OP_ROT: {
+                size_t nFrom = stack.size() - nArgs;
+                size_t nMove = opcode == OP_2ROT ? 2 : 1;
+                std::rotate(stack.begin() + nFrom,
+                            stack.begin() + nFrom + nMove, stack.end());
+            } break;
+            case OP_2SWAP:
+                std::swap(top(4), top(2));
+                std::swap(top(3), top(1));
+                break;
+            case OP_DEPTH:
+                stack.push_back(CScriptNum(stack.size()).getvch());
+                break;
+            case OP_DROP:
+                stack.pop_back();
+                break;
+            case OP_DUP:
+                stack.push_back(top(1));
+                break;
+            case OP_NIP:
+                stack.erase(stack.end() - 2);
+                break;
+            case OP_OVER:
+                stack.push_back(top(2));
+                break;
+            case OP_PICK:
+            case OP_ROLL: {
+                int64_t n = CScriptNum(top(1), false).getint();
+                stack.pop_back();
+                if (n < 0 || n >= int64_t(stack.size())) {
+                    return false;
+                }
+                valtype vch = top(n + 1);
+                if (opcode == OP_ROLL) {
+                    stack.erase(stack.end() - n - 1);
+                }
+                stack.push_back(vch);
+            } break;
+            case OP_SWAP:
+                std::swap(top(2), top(1));
+                break;
+            case OP_TUCK:
+                stack.insert(stack.end() - 2, top(1));
+                break;
+            case OP_SIZE:
+                stack.push_back(CScriptNum(top(1).size()).getvch());
+                break;
+            case OP_EQUAL: {
+                bool fEqual = top(2) == top(1);
+                stack.resize(stack.size() - 2);
+                stack.push_back(fEqual ? valtype(1, 1) : valtype());
+            } break;
+            case OP_SHA256: {
+                valtype vchHash(CSHA256::OUTPUT_SIZE);
+                CSHA256()
+                    .Write(top(1).data(), top(1).size())
+                    .Finalize(vchHash.data());
+                top(1) = vchHash;
+            } break;
+            default:
+                BOOST_FAIL("unexpected opcode");
+        }
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(stack_ops_differential) {
+    static const opcodetype ops[] = {
+        OP_TOALTSTACK, OP_FROMALTSTACK, OP_2DROP, OP_2DUP, OP_3DUP,
+        OP_2OVER,      OP_2ROT,         OP_2SWAP, OP_DEPTH, OP_DROP,
+        OP_DUP,        OP_NIP,          OP_OVER,  OP_ROT,   OP_SWAP,
+        OP_TUCK,       OP_SIZE,         OP_EQUAL, OP_SHA256,
+    };
+    const size_t nOps = sizeof(ops) / sizeof(ops[0]);
+
+    for (int i = 0; i < 2000; i++) {
+        std::vector<valtype> initial;
+        for (int j = insecure_rand() % 4; j > 0; j--) {
+            initial.push_back(RandomElement());
+        }
+
+        CScript script;
+        for (int j = insecure_rand() % 60; j > 0; j--) {
+            switch (insecure_rand() % 4) {
+                case 0:
+                    script << RandomElement();
+                    break;
+                case 1:
+                    script << CScript::EncodeOP_N(insecure_rand() % 5)
+                           << (insecure_rand() % 2 ? OP_PICK : OP_ROLL);
+                    break;
+                default:
+                    script << ops[insecure_rand() % nOps];
+                    break;
+            }
+        }
+
+        if (script.size() > MAX_SCRIPT_SIZE) {
+            continue;
+        }
+
+        std::vector<valtype> expected = initial;
+        bool fExpected = EvalStackOps(expected, script);
+
+        std::vector<valtype> stack = initial;
+        ScriptError err;
+        bool fSuccess = EvalScript(stack, script, SCRIPT_VERIFY_NONE,
+                                   BaseSignatureChecker(), &err);
+        BOOST_CHECK_EQUAL(fSuccess, fExpected);
+        if (fSuccess) {
+            BOOST_CHECK(stack == expected);
+        } else {
+            BOOST_CHECK(err == SCRIPT_ERR_INVALID_STACK_OPERATION ||
+                        err == SCRIPT_ERR_INVALID_ALTSTACK_OPERATION);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
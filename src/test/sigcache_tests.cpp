@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/sigcache.h"
+
+#include "random.h"
+#include "uint256.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(concurrent_cache_pending) {
+    CConcurrentCache cache;
+    cache.Setup(1 << 16);
+
+    std::vector<uint256> entries;
+    for (int i = 0; i < 10; i++) {
+        entries.push_back(GetRandHash());
+        cache.Insert(entries.back());
+    }
+
+    // Without concurrent lookups, inserts are merged right away.
+    CacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nInserts, 10U);
+    BOOST_CHECK_EQUAL(stats.nMerges, 10U);
+    BOOST_CHECK_EQUAL(stats.nMergesDeferred, 0U);
+    BOOST_CHECK_EQUAL(stats.nPending, 0U);
+
+    for (const uint256 &entry : entries) {
+        BOOST_CHECK(cache.Contains(entry, false));
+    }
+    BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+    BOOST_CHECK_EQUAL(cache.GetStats().nLookups, 11U);
+
+    // Erased entries stay until their space is needed.
+    BOOST_CHECK(cache.Contains(entries[0], true));
+    BOOST_CHECK(cache.Contains(entries[0], false));
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_cache_parallel) {
+    CConcurrentCache cache;
+    cache.Setup(1 << 20);
+
+    const int nThreads = 8;
+    const int nEntries = 1000;
+    std::vector<std::vector<uint256>> entries(nThreads);
+    for (std::vector<uint256> &threadEntries : entries) {
+        for (int i = 0; i < nEntries; i++) {
+            threadEntries.push_back(GetRandHash());
+        }
+    }
+
+    // Every thread inserts its entries while looking up those of the others,
+    // so some inserts are deferred. Each thread sees its own inserts.
+    std::atomic<int> nMissing{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < nEntries; i++) {
+                cache.Insert(entries[t][i]);
+                if (!cache.Contains(entries[t][i], false)) {
+                    nMissing++;
+                }
+                cache.Contains(entries[(t + 1) % nThreads][i], false);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(nMissing.load(), 0);
+
+    CacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nLookups, uint64_t(2 * nThreads * nEntries));
+    BOOST_CHECK_EQUAL(stats.nInserts, uint64_t(nThreads * nEntries));
+    BOOST_CHECK(stats.nPending <= CConcurrentCache::LOCK_SLOTS *
+                                      CConcurrentCache::MAX_PENDING_INSERTS);
+
+    // Any thread sees all entries, whether they are pending or not.
+    for (const std::vector<uint256> &threadEntries : entries) {
+        for (const uint256 &entry : threadEntries) {
+            BOOST_CHECK(cache.Contains(entry, false));
+        }
+    }
+
+    // A flush merges the pending entries.
+    cache.Flush();
+    BOOST_CHECK_EQUAL(cache.GetStats().nPending, 0U);
+    for (const std::vector<uint256> &threadEntries : entries) {
+        for (const uint256 &entry : threadEntries) {
+            BOOST_CHECK(cache.Contains(entry, false));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #include "consensus/validation.h"
 #include "crypto/sha256.h"
 #include "fs.h"
+#include "hash.h"
 #include "key.h"
 #include "miner.h"
 #include "net_processing.h"
@@ -43,6 +44,7 @@ extern void noui_connect();
 
 BasicTestingSetup::BasicTestingSetup(const std::string &chainName) {
     SHA256AutoDetect();
+    SipHashAutoDetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
@@ -94,6 +96,7 @@ TestingSetup::TestingSetup(const std::string &chainName)
     nScriptCheckThreads = 3;
     for (int i = 0; i < nScriptCheckThreads - 1; i++) {
         threadGroup.create_thread(&ThreadScriptCheck);
+        threadGroup.create_thread(&ThreadHeaderCheck);
     }
 
     // Deterministic randomness for tests.
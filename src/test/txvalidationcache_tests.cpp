@@ -4,21 +4,30 @@
 
 #include "config.h"
 #include "consensus/validation.h"
+#include "fs.h"
 #include "key.h"
 #include "keystore.h"
 #include "miner.h"
 #include "pubkey.h"
 #include "random.h"
 #include "script/scriptcache.h"
+#include "script/sigcache.h"
 #include "script/sighashtype.h"
 #include "script/sign.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "test/sigutil.h"
 #include "test/test_bitcoin.h"
 #include "txmempool.h"
+#include "util.h"
 #include "utiltime.h"
 #include "validation.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(txvalidationcache_tests)
@@ -386,4 +395,185 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup) {
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(mempool_persist_test, TestChain100Setup) {
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey())
+                                     << OP_CHECKSIG;
+
+    CKey wrongKey;
+    wrongKey.MakeNewKey(true);
+
+    // A parent spending a mature coinbase and two children. The second child
+    // is signed with the wrong key.
+    std::vector<CMutableTransaction> spends;
+    spends.resize(3);
+    spends[0].nVersion = 1;
+    spends[0].vin.resize(1);
+    spends[0].vin[0].prevout.hash = coinbaseTxns[0].GetId();
+    spends[0].vin[0].prevout.n = 0;
+    spends[0].vout.resize(2);
+    for (int i = 1; i < 3; i++) {
+        spends[0].vout[i - 1].nValue = 11 * CENT;
+        spends[0].vout[i - 1].scriptPubKey = scriptPubKey;
+
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout.n = i - 1;
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = 10 * CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (i > 0) {
+            spends[i].vin[0].prevout.hash = spends[0].GetId();
+        }
+        const Amount amount = i == 0 ? coinbaseTxns[0].vout[0].nValue
+                                     : spends[0].vout[i - 1].nValue;
+
+        std::vector<uint8_t> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0,
+                                     SigHashType().withForkId(true), amount);
+        BOOST_CHECK((i < 2 ? coinbaseKey : wrongKey).Sign(hash, vchSig));
+        vchSig.push_back(uint8_t(SIGHASH_ALL | SIGHASH_FORKID));
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+
+    // Round trip through mempool.dat.
+    BOOST_CHECK(ToMemPool(spends[0]));
+    BOOST_CHECK(ToMemPool(spends[1]));
+    BOOST_CHECK(!ToMemPool(spends[2]));
+    DumpMempool();
+    mempool.clear();
+    BOOST_CHECK(LoadMempool(GetConfig()));
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(mempool.exists(spends[0].GetId()));
+    BOOST_CHECK(mempool.exists(spends[1].GetId()));
+    mempool.clear();
+
+    // Scripts from mempool.dat are always verified again, so an invalid spend
+    // written to the file is rejected.
+    {
+        CAutoFile file(fsbridge::fopen(GetDataDir() / "mempool.dat", "wb"),
+                       SER_DISK, CLIENT_VERSION);
+        file << uint64_t(1) << uint64_t(3);
+        for (int i = 0; i < 3; i++) {
+            file << CTransaction(spends[i]) << GetTime() << int64_t(0);
+        }
+        file << std::map<uint256, Amount>();
+    }
+    BOOST_CHECK(LoadMempool(GetConfig()));
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(mempool.exists(spends[0].GetId()));
+    BOOST_CHECK(mempool.exists(spends[1].GetId()));
+    BOOST_CHECK(!mempool.exists(spends[2].GetId()));
+    mempool.clear();
+}
+
+static bool Contains(const std::vector<uint256> &entries,
+                     const uint256 &entry) {
+    return std::find(entries.begin(), entries.end(), entry) != entries.end();
+}
+
+BOOST_FIXTURE_TEST_CASE(validationcache_persist_test, TestingSetup) {
+    // Without a file, the caches get a fresh salt.
+    BOOST_CHECK(!LoadValidationCaches());
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(1);
+    mtx.nLockTime = insecure_rand();
+    CTransaction tx(mtx);
+    uint256 scriptKey = GetScriptCacheKey(tx, SCRIPT_VERIFY_P2SH);
+    AddKeyInScriptCache(scriptKey);
+    uint256 sigEntry = GetRandHash();
+    AddSignatureCacheEntries({sigEntry});
+    DumpValidationCaches();
+
+    // Erased entries are not saved.
+    BOOST_CHECK(IsKeyInScriptCache(scriptKey, true));
+    BOOST_CHECK(!Contains(GetScriptCacheEntries(), scriptKey));
+    BOOST_CHECK(Contains(GetSignatureCacheEntries(), sigEntry));
+
+    // After a restart, the salt and the entries are restored.
+    SetScriptCacheSalt(GetRandHash());
+    BOOST_CHECK(GetScriptCacheKey(tx, SCRIPT_VERIFY_P2SH) != scriptKey);
+    BOOST_CHECK(LoadValidationCaches());
+    BOOST_CHECK(GetScriptCacheKey(tx, SCRIPT_VERIFY_P2SH) == scriptKey);
+    BOOST_CHECK(Contains(GetScriptCacheEntries(), scriptKey));
+
+    // A corrupted file is ignored, and a fresh salt invalidates the entries.
+    {
+        FILE *file =
+            fsbridge::fopen(GetDataDir() / "validationcache.dat", "r+b");
+        BOOST_CHECK(file != nullptr);
+        // Flip a bit of the salt.
+        fseek(file, 20, SEEK_SET);
+        int c = fgetc(file);
+        fseek(file, 20, SEEK_SET);
+        fputc(c ^ 1, file);
+        fclose(file);
+    }
+    BOOST_CHECK(!LoadValidationCaches());
+    BOOST_CHECK(GetScriptCacheKey(tx, SCRIPT_VERIFY_P2SH) != scriptKey);
+
+    // So is a well formed file written by another client version, as its
+    // script execution cache entries may not hold for this one.
+    const uint256 salt = GetRandHash();
+    SetScriptCacheSalt(salt);
+    const uint256 otherScriptKey = GetScriptCacheKey(tx, SCRIPT_VERIFY_P2SH);
+    const uint256 otherSigEntry = GetRandHash();
+    {
+        const uint64_t version = 2;
+        const int nClientVersion = CLIENT_VERSION - 1;
+        const std::vector<uint256> vSigEntries{otherSigEntry};
+        const std::vector<uint256> vScriptEntries{otherScriptKey};
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        hasher << version << nClientVersion << salt << vSigEntries
+               << vScriptEntries;
+        CAutoFile file(
+            fsbridge::fopen(GetDataDir() / "validationcache.dat", "wb"),
+            SER_DISK, CLIENT_VERSION);
+        file << version << nClientVersion << salt << vSigEntries
+             << vScriptEntries << hasher.GetHash();
+    }
+    BOOST_CHECK(!LoadValidationCaches());
+    BOOST_CHECK(GetScriptCacheKey(tx, SCRIPT_VERIFY_P2SH) != otherScriptKey);
+    BOOST_CHECK(!Contains(GetScriptCacheEntries(), otherScriptKey));
+    BOOST_CHECK(!Contains(GetSignatureCacheEntries(), otherSigEntry));
+}
+
+BOOST_FIXTURE_TEST_CASE(scriptcache_threads, BasicTestingSetup) {
+    // The script cache is used from several threads without cs_main.
+    const int nThreads = 4;
+    const int nKeys = 1000;
+    CacheStats before = GetScriptCacheStats();
+    std::atomic<int> nWrong{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < nKeys; i++) {
+                uint256 key = GetRandHash();
+                if (IsKeyInScriptCache(key, false)) {
+                    nWrong++;
+                }
+                AddKeyInScriptCache(key);
+                if (!IsKeyInScriptCache(key, false)) {
+                    nWrong++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(nWrong.load(), 0);
+
+    CacheStats after = GetScriptCacheStats();
+    BOOST_CHECK_EQUAL(after.nLookups - before.nLookups,
+                      uint64_t(2 * nThreads * nKeys));
+    BOOST_CHECK_EQUAL(after.nHits - before.nHits, uint64_t(nThreads * nKeys));
+    BOOST_CHECK_EQUAL(after.nInserts - before.nInserts,
+                      uint64_t(nThreads * nKeys));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,8 @@
 #include "chainparams.h"
 #include "config.h"
 #include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "pow.h"
 #include "primitives/transaction.h"
 #include "test/test_bitcoin.h"
 #include "util.h"
@@ -76,4 +78,58 @@ BOOST_AUTO_TEST_CASE(validation_load_external_block_file) {
     BOOST_CHECK_NO_THROW({ LoadExternalBlockFile(config, fp, 0); });
 }
 
+/** Build a header on top of prev with either a valid or an invalid proof of
+ * work. */
+static CBlockHeader MakeHeader(const Config &config, const CBlockHeader &prev,
+                               bool fValidPOW) {
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = prev.GetHash();
+    header.nTime = prev.nTime + 1;
+    header.nBits = prev.nBits;
+    header.nNonce = 0;
+    while (CheckProofOfWork(header.GetHash(), header.nBits, config) !=
+           fValidPOW) {
+        header.nNonce++;
+    }
+    return header;
+}
+
+BOOST_FIXTURE_TEST_CASE(process_new_block_headers, TestChain100Setup) {
+    const Config &config = GetConfig();
+    const int nTipHeight = chainActive.Height();
+
+    // Enough headers for their proof of work to be checked on several threads.
+    const size_t nHeaders = 3 * MIN_HEADERS_PER_CHECK_THREAD;
+    std::vector<CBlockHeader> headers;
+    CBlockHeader prev = chainActive.Tip()->GetBlockHeader();
+    for (size_t i = 0; i < nHeaders; i++) {
+        headers.push_back(MakeHeader(config, prev, true));
+        prev = headers.back();
+    }
+
+    CValidationState state;
+    const CBlockIndex *pindexLast = nullptr;
+    BOOST_CHECK(ProcessNewBlockHeaders(config, headers, state, &pindexLast));
+    BOOST_CHECK(pindexLast->GetBlockHash() == headers.back().GetHash());
+    BOOST_CHECK_EQUAL(pindexLast->nHeight, nTipHeight + int(nHeaders));
+
+    // Headers are accepted up to the first one with an invalid proof of work.
+    const size_t nInvalid = 2 * MIN_HEADERS_PER_CHECK_THREAD + 10;
+    std::vector<CBlockHeader> invalid;
+    for (size_t i = 0; i < nHeaders; i++) {
+        invalid.push_back(MakeHeader(config, prev, i != nInvalid));
+        prev = invalid.back();
+    }
+
+    BOOST_CHECK(!ProcessNewBlockHeaders(config, invalid, state, &pindexLast));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    BOOST_CHECK_EQUAL(pindexLast->nHeight,
+                      nTipHeight + int(nHeaders + nInvalid));
+
+    LOCK(cs_main);
+    BOOST_CHECK(mapBlockIndex.count(invalid[nInvalid - 1].GetHash()));
+    BOOST_CHECK(!mapBlockIndex.count(invalid[nInvalid].GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -47,6 +47,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef &_tx, const Amount _nFee,
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCountWithAncestors = sigOpCount;
+
+    nClusterId = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry &other) {
@@ -169,6 +171,9 @@ void CTxMemPool::UpdateTransactionsFromBlock(
                 !setAlreadyIncluded.count(childHash)) {
                 UpdateChild(it, childIter, true);
                 UpdateParent(childIter, it, true);
+                if (childIter->nClusterId != it->nClusterId) {
+                    MergeClusters({it->nClusterId, childIter->nClusterId});
+                }
             }
         }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate,
@@ -176,6 +181,196 @@ void CTxMemPool::UpdateTransactionsFromBlock(
     }
 }
 
+void CTxMemPool::AddToCluster(uint64_t clusterId, txiter entry) {
+    TxCluster &cluster = mapClusters[clusterId];
+    setEntries s;
+    if (cluster.members.insert(entry).second) {
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
+        cluster.nSize += entry->GetTxSize();
+        cluster.nModFees += entry->GetModifiedFee();
+    }
+    entry->nClusterId = clusterId;
+}
+
+void CTxMemPool::RemoveFromCluster(txiter entry) {
+    clusterMap::iterator cit = mapClusters.find(entry->nClusterId);
+    assert(cit != mapClusters.end());
+    TxCluster &cluster = cit->second;
+
+    setEntries s;
+    if (cluster.members.erase(entry)) {
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    }
+    if (cluster.members.empty()) {
+        mapClusters.erase(cit);
+        return;
+    }
+
+    cluster.nSize -= entry->GetTxSize();
+    cluster.nModFees -= entry->GetModifiedFee();
+}
+
+void CTxMemPool::MarkSplitClusters(const setEntries &stage) {
+    // Removing transactions linked to a single remaining one cannot disconnect
+    // the rest of its cluster, which is the common case when a block confirms
+    // the head of a chain. This has to be decided while the links between the
+    // staged transactions and the remaining ones are still there.
+    std::map<uint64_t, txiter> mapLinked;
+    for (txiter it : stage) {
+        const TxLinks &links = mapLinks.find(it)->second;
+        for (const setEntries *relatives : {&links.parents, &links.children}) {
+            for (txiter relative : *relatives) {
+                if (stage.count(relative)) {
+                    continue;
+                }
+                std::pair<std::map<uint64_t, txiter>::iterator, bool> ret =
+                    mapLinked.emplace(relative->nClusterId, relative);
+                if (!ret.second && ret.first->second != relative) {
+                    mapClusters[relative->nClusterId].fDirty = true;
+                }
+            }
+        }
+    }
+}
+
+uint64_t CTxMemPool::MergeClusters(const std::set<uint64_t> &clusterIds) {
+    if (clusterIds.empty()) {
+        return ++nLastClusterId;
+    }
+
+    // Move the members of the smaller clusters into the largest one, so that
+    // each transaction is only moved O(log(n)) times.
+    uint64_t targetId = *clusterIds.begin();
+    for (uint64_t id : clusterIds) {
+        if (mapClusters[id].members.size() >
+            mapClusters[targetId].members.size()) {
+            targetId = id;
+        }
+    }
+
+    TxCluster &target = mapClusters[targetId];
+    for (uint64_t id : clusterIds) {
+        if (id == targetId) {
+            continue;
+        }
+
+        clusterMap::iterator cit = mapClusters.find(id);
+        assert(cit != mapClusters.end());
+        for (txiter member : cit->second.members) {
+            member->nClusterId = targetId;
+            target.members.insert(member);
+        }
+        target.nSize += cit->second.nSize;
+        target.nModFees += cit->second.nModFees;
+        target.fDirty |= cit->second.fDirty;
+        mapClusters.erase(cit);
+    }
+
+    return targetId;
+}
+
+const CTxMemPool::TxCluster &CTxMemPool::GetCluster(txiter entry) const {
+    clusterMap::iterator cit = mapClusters.find(entry->nClusterId);
+    assert(cit != mapClusters.end());
+    if (!cit->second.fDirty) {
+        return cit->second;
+    }
+
+    // Split the cluster into its connected components. Members are detached by
+    // resetting their cluster id, then reattached by walking the links from
+    // each member not reached yet. The number of members is unchanged, so is
+    // the memory accounted for in cachedInnerUsage.
+    setEntries members = std::move(cit->second.members);
+    mapClusters.erase(cit);
+    for (txiter member : members) {
+        member->nClusterId = 0;
+    }
+
+    std::vector<txiter> stage;
+    for (txiter root : members) {
+        if (root->nClusterId != 0) {
+            continue;
+        }
+
+        const uint64_t clusterId = ++nLastClusterId;
+        TxCluster &cluster = mapClusters[clusterId];
+        root->nClusterId = clusterId;
+        stage.push_back(root);
+        while (!stage.empty()) {
+            txiter it = stage.back();
+            stage.pop_back();
+            cluster.members.insert(it);
+            cluster.nSize += it->GetTxSize();
+            cluster.nModFees += it->GetModifiedFee();
+
+            const TxLinks &links = mapLinks.find(it)->second;
+            for (const setEntries *relatives :
+                 {&links.parents, &links.children}) {
+                for (txiter relative : *relatives) {
+                    if (relative->nClusterId == 0) {
+                        relative->nClusterId = clusterId;
+                        stage.push_back(relative);
+                    }
+                }
+            }
+        }
+    }
+
+    return mapClusters.find(entry->nClusterId)->second;
+}
+
+bool CTxMemPool::CheckClusterLimits(const CTxMemPoolEntry &entry,
+                                    uint64_t limitClusterCount,
+                                    uint64_t limitClusterSize,
+                                    std::string &errString) const {
+    LOCK(cs);
+
+    // The new transaction would join the clusters of all its in-mempool
+    // parents. Cleaning a parent's cluster never affects a cluster already
+    // accounted for, as clean clusters are left untouched.
+    std::set<uint64_t> setClusters;
+    uint64_t nCount = 1;
+    uint64_t nSize = entry.GetTxSize();
+    for (const CTxIn &in : entry.GetTx().vin) {
+        txiter piter = mapTx.find(in.prevout.hash);
+        if (piter == mapTx.end()) {
+            continue;
+        }
+
+        const TxCluster &cluster = GetCluster(piter);
+        if (!setClusters.insert(piter->nClusterId).second) {
+            continue;
+        }
+
+        nCount += cluster.members.size();
+        nSize += cluster.nSize;
+    }
+
+    if (nCount > limitClusterCount) {
+        errString = strprintf("too many transactions in cluster [limit: %u]",
+                              limitClusterCount);
+        return false;
+    }
+
+    if (nSize > limitClusterSize) {
+        errString = strprintf("exceeds cluster size limit [limit: %u]",
+                              limitClusterSize);
+        return false;
+    }
+
+    return true;
+}
+
+void CTxMemPool::GetClusterStats(const CTxMemPoolEntry &entry,
+                                 uint64_t &nCount, uint64_t &nSize,
+                                 Amount &nModFees) const {
+    LOCK(cs);
+    const TxCluster &cluster = GetCluster(mapTx.iterator_to(entry));
+    nCount = cluster.members.size();
+    nSize = cluster.nSize;
+    nModFees = cluster.nModFees;
+}
+
 bool CTxMemPool::CalculateMemPoolAncestors(
     const CTxMemPoolEntry &entry, setEntries &setAncestors,
     uint64_t limitAncestorCount, uint64_t limitAncestorSize,
@@ -380,7 +575,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, Amount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate &_minReasonableRelayFee)
-    : nTransactionsUpdated(0) {
+    : nTransactionsUpdated(0), nLastClusterId(0) {
     // lock free clear
     _clear();
 
@@ -460,6 +655,13 @@ bool CTxMemPool::addUnchecked(const uint256 &hash, const CTxMemPoolEntry &entry,
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
 
+    // The new transaction joins together the clusters of all its parents.
+    std::set<uint64_t> setParentClusters;
+    for (txiter pit : GetMemPoolParents(newit)) {
+        setParentClusters.insert(pit->nClusterId);
+    }
+    AddToCluster(MergeClusters(setParentClusters), newit);
+
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, validFeeEstimate);
@@ -488,6 +690,8 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason) {
         vTxHashes.clear();
     }
 
+    RemoveFromCluster(it);
+
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
     cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) +
@@ -666,6 +870,7 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef> &vtx,
 
 void CTxMemPool::_clear() {
     mapLinks.clear();
+    mapClusters.clear();
     mapTx.clear();
     mapNextTx.clear();
     vTxHashes.clear();
@@ -743,6 +948,16 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
             i++;
         }
         assert(setParentCheck == GetMemPoolParents(it));
+        // Check the entry shares its cluster with all its direct relatives.
+        clusterMap::const_iterator cit = mapClusters.find(it->nClusterId);
+        assert(cit != mapClusters.end());
+        assert(cit->second.members.count(it));
+        for (txiter relative : links.parents) {
+            assert(relative->nClusterId == it->nClusterId);
+        }
+        for (txiter relative : links.children) {
+            assert(relative->nClusterId == it->nClusterId);
+        }
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -825,6 +1040,23 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
         assert(&tx == it->second);
     }
 
+    // Verify the aggregate state of each cluster.
+    uint64_t nClusterMembers = 0;
+    for (const auto &cluster : mapClusters) {
+        uint64_t nSizeCheck = 0;
+        Amount nFeesCheck(0);
+        for (txiter member : cluster.second.members) {
+            assert(member->nClusterId == cluster.first);
+            nSizeCheck += member->GetTxSize();
+            nFeesCheck += member->GetModifiedFee();
+        }
+        assert(cluster.second.nSize == nSizeCheck);
+        assert(cluster.second.nModFees == nFeesCheck);
+        innerUsage += memusage::DynamicUsage(cluster.second.members);
+        nClusterMembers += cluster.second.members.size();
+    }
+    assert(nClusterMembers == mapTx.size());
+
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
 }
@@ -891,6 +1123,43 @@ void CTxMemPool::queryHashes(std::vector<uint256> &vtxid) {
     }
 }
 
+void CTxMemPool::queryHashesSince(int64_t nTime, size_t nMax,
+                                  std::vector<uint256> &vtxid) {
+    LOCK(cs);
+
+    vtxid.clear();
+    const auto &byTime = mapTx.get<entry_time>();
+    for (auto it = byTime.rbegin(); it != byTime.rend() &&
+                                    it->GetTime() >= nTime &&
+                                    vtxid.size() < nMax;
+         ++it) {
+        vtxid.push_back(it->GetTx().GetId());
+    }
+}
+
+void CTxMemPool::sortDepthAndScore(std::vector<uint256> &vtxid,
+                                   std::vector<uint64_t> &vAncestors) {
+    LOCK(cs);
+
+    std::vector<indexed_transaction_set::const_iterator> iters;
+    iters.reserve(vtxid.size());
+    for (const uint256 &txid : vtxid) {
+        indexed_transaction_set::const_iterator it = mapTx.find(txid);
+        if (it != mapTx.end()) {
+            iters.push_back(it);
+        }
+    }
+
+    std::sort(iters.begin(), iters.end(), DepthAndScoreComparator());
+
+    vtxid.clear();
+    vAncestors.clear();
+    for (auto it : iters) {
+        vtxid.push_back(it->GetTx().GetId());
+        vAncestors.push_back(it->GetCountWithAncestors());
+    }
+}
+
 static TxMempoolInfo
 GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
     return TxMempoolInfo{it->GetSharedTx(), it->GetTime(),
@@ -1000,6 +1269,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash,
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(deltas.second));
+            mapClusters[it->nClusterId].nModFees += nFeeDelta;
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -1089,12 +1359,14 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
            memusage::DynamicUsage(mapNextTx) +
            memusage::DynamicUsage(mapDeltas) +
            memusage::DynamicUsage(mapLinks) +
+           memusage::DynamicUsage(mapClusters) +
            memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants,
                               MemPoolRemovalReason reason) {
     AssertLockHeld(cs);
+    MarkSplitClusters(stage);
     UpdateForRemoveFromMempool(stage, updateDescendants);
     for (const txiter &it : stage) {
         removeUnchecked(it, reason);
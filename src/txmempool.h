@@ -177,6 +177,8 @@ public:
 
     //!< Index in mempool's vTxHashes
     mutable size_t vTxHashesIdx;
+    //!< Id of the mempool cluster this entry belongs to
+    mutable uint64_t nClusterId;
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -462,6 +464,15 @@ public:
  * CalculateMemPoolAncestors() takes configurable limits that are designed to
  * prevent these calculations from being too CPU intensive.
  *
+ * To make these limits cheap to enforce, the mempool also tracks clusters:
+ * sets of transactions connected through in-mempool parent/child links. Each
+ * cluster maintains the count, size and modified fees of its members
+ * incrementally, and adding a transaction only merges the clusters of its
+ * parents. Since every ancestor and descendant of a transaction is part of its
+ * cluster, bounding the cluster size bounds the work of any of the walks
+ * above. Removing a transaction may split its cluster; such clusters are
+ * marked dirty and only re-partitioned, at O(cluster) cost, when next needed.
+ *
  * Adding transactions from a disconnected block can be very time consuming,
  * because we don't have a way to limit the number of in-mempool descendants. To
  * bound CPU processing, we limit the amount of work we're willing to do to
@@ -549,6 +560,35 @@ private:
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
+    struct TxCluster {
+        setEntries members;
+        uint64_t nSize;
+        Amount nModFees;
+        //!< Set when a removal may have split this cluster in several
+        bool fDirty;
+
+        TxCluster() : nSize(0), nModFees(0), fDirty(false) {}
+    };
+
+    typedef std::map<uint64_t, TxCluster> clusterMap;
+    //!< Clusters are re-partitioned lazily, hence mutable.
+    mutable clusterMap mapClusters;
+    mutable uint64_t nLastClusterId;
+
+    void AddToCluster(uint64_t clusterId, txiter entry);
+    void RemoveFromCluster(txiter entry);
+    /**
+     * Mark dirty the clusters which removing stage may split, before the links
+     * of the staged entries are updated.
+     */
+    void MarkSplitClusters(const setEntries &stage);
+    uint64_t MergeClusters(const std::set<uint64_t> &clusterIds);
+    /**
+     * Return the cluster of entry, re-partitioning it first if removals may
+     * have split it.
+     */
+    const TxCluster &GetCluster(txiter entry) const;
+
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -598,6 +638,20 @@ public:
     void _clear();
     bool CompareDepthAndScore(const uint256 &hasha, const uint256 &hashb);
     void queryHashes(std::vector<uint256> &vtxid);
+    /**
+     * The txids of the at most nMax most recent transactions that entered
+     * the mempool at or after nTime, newest first.
+     */
+    void queryHashesSince(int64_t nTime, size_t nMax,
+                          std::vector<uint256> &vtxid);
+    /**
+     * Sort vtxid in the order of CompareDepthAndScore, dropping the
+     * transactions that are not in the mempool. vAncestors receives the
+     * number of in-mempool ancestors, including itself, of every remaining
+     * transaction.
+     */
+    void sortDepthAndScore(std::vector<uint256> &vtxid,
+                           std::vector<uint64_t> &vAncestors);
     bool isSpent(const COutPoint &outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -658,6 +712,24 @@ public:
         uint64_t limitDescendantCount, uint64_t limitDescendantSize,
         std::string &errString, bool fSearchForParents = true) const;
 
+    /**
+     * Check that adding entry would not create a cluster with more than
+     * limitClusterCount transactions or limitClusterSize bytes. The cost is
+     * proportional to the number of in-mempool parents of entry, plus the
+     * size of any cluster that needs re-partitioning after removals.
+     */
+    bool CheckClusterLimits(const CTxMemPoolEntry &entry,
+                            uint64_t limitClusterCount,
+                            uint64_t limitClusterSize,
+                            std::string &errString) const;
+
+    /**
+     * Get the number of transactions, total size and total modified fees of
+     * the cluster an in-mempool entry belongs to.
+     */
+    void GetClusterStats(const CTxMemPoolEntry &entry, uint64_t &nCount,
+                         uint64_t &nSize, Amount &nModFees) const;
+
     /**
      * Populate setDescendants with all in-mempool descendants of hash.
      * Assumes that setDescendants includes all in-mempool descendants of
@@ -0,0 +1,309 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txorphanpool.h"
+
+#include "core_memusage.h"
+#include "policy/policy.h"
+#include "primitives/block.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <deque>
+
+CTxOrphanPool::CTxOrphanPool()
+    : nTotalUsage(0), nLastSequence(0), nNextSweep(0) {}
+
+bool CTxOrphanPool::AddTx(const CTransactionRef &tx, NodeId peer,
+                          size_t nMaxPeerUsage) {
+    LOCK(cs);
+
+    const uint256 &txid = tx->GetId();
+    if (mapOrphans.count(txid)) {
+        return false;
+    }
+
+    // Ignore big transactions, to avoid a send-big-orphans memory exhaustion
+    // attack. If a peer has a legitimate large transaction with a missing
+    // parent then we assume it will rebroadcast it later, after the parent
+    // transaction(s) have been mined or received.
+    unsigned int sz = GetTransactionSize(*tx);
+    if (sz >= MAX_STANDARD_TX_SIZE) {
+        LogPrint(BCLog::MEMPOOL,
+                 "ignoring large orphan tx (size: %u, hash: %s)\n", sz,
+                 txid.ToString());
+        return false;
+    }
+
+    size_t nUsage = RecursiveDynamicUsage(tx);
+    PeerOrphans &peerOrphans = mapPeers[peer];
+    if (peerOrphans.nUsage + nUsage > nMaxPeerUsage) {
+        LogPrint(BCLog::MEMPOOL,
+                 "ignoring orphan tx %s, peer=%d is over its quota (%u "
+                 "bytes)\n",
+                 txid.ToString(), peer, peerOrphans.nUsage);
+        if (peerOrphans.mapBySequence.empty()) {
+            mapPeers.erase(peer);
+        }
+        return false;
+    }
+
+    uint64_t nSequence = ++nLastSequence;
+    auto ret = mapOrphans.emplace(
+        txid, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, nUsage,
+                        nSequence});
+    assert(ret.second);
+    for (const CTxIn &txin : tx->vin) {
+        mapOrphansByPrev[txin.prevout].insert(ret.first);
+    }
+
+    peerOrphans.nUsage += nUsage;
+    peerOrphans.mapBySequence.emplace(nSequence, txid);
+    nTotalUsage += nUsage;
+
+    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u)\n",
+             txid.ToString(), mapOrphans.size(), mapOrphansByPrev.size());
+    return true;
+}
+
+bool CTxOrphanPool::HaveTx(const uint256 &txid) const {
+    LOCK(cs);
+    return mapOrphans.count(txid);
+}
+
+bool CTxOrphanPool::_EraseTx(const uint256 &txid) {
+    OrphanMap::iterator it = mapOrphans.find(txid);
+    if (it == mapOrphans.end()) {
+        return false;
+    }
+
+    for (const CTxIn &txin : it->second.tx->vin) {
+        auto itPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itPrev == mapOrphansByPrev.end()) {
+            continue;
+        }
+        itPrev->second.erase(it);
+        if (itPrev->second.empty()) {
+            mapOrphansByPrev.erase(itPrev);
+        }
+    }
+
+    auto itPeer = mapPeers.find(it->second.fromPeer);
+    assert(itPeer != mapPeers.end());
+    itPeer->second.nUsage -= it->second.nUsage;
+    itPeer->second.mapBySequence.erase(it->second.nSequence);
+    if (itPeer->second.mapBySequence.empty()) {
+        assert(itPeer->second.nUsage == 0);
+        mapPeers.erase(itPeer);
+    }
+
+    nTotalUsage -= it->second.nUsage;
+    mapOrphans.erase(it);
+    return true;
+}
+
+bool CTxOrphanPool::EraseTx(const uint256 &txid) {
+    LOCK(cs);
+    return _EraseTx(txid);
+}
+
+int CTxOrphanPool::EraseForPeer(NodeId peer) {
+    LOCK(cs);
+
+    auto itPeer = mapPeers.find(peer);
+    if (itPeer == mapPeers.end()) {
+        return 0;
+    }
+
+    // Copy, as erasing the last orphan also erases the peer entry.
+    std::map<uint64_t, uint256> mapBySequence = itPeer->second.mapBySequence;
+    int nErased = 0;
+    for (const auto &entry : mapBySequence) {
+        nErased += _EraseTx(entry.second);
+    }
+
+    if (nErased > 0) {
+        LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx from peer=%d\n", nErased,
+                 peer);
+    }
+    return nErased;
+}
+
+int CTxOrphanPool::EraseForBlock(const CBlock &block) {
+    LOCK(cs);
+
+    std::vector<uint256> vOrphanErase;
+    for (const CTransactionRef &ptx : block.vtx) {
+        // Which orphan pool entries must we evict?
+        for (const CTxIn &txin : ptx->vin) {
+            auto itByPrev = mapOrphansByPrev.find(txin.prevout);
+            if (itByPrev == mapOrphansByPrev.end()) {
+                continue;
+            }
+
+            for (const auto &mi : itByPrev->second) {
+                vOrphanErase.push_back(mi->first);
+            }
+        }
+    }
+
+    int nErased = 0;
+    for (const uint256 &orphanId : vOrphanErase) {
+        nErased += _EraseTx(orphanId);
+    }
+
+    if (nErased > 0) {
+        LogPrint(BCLog::MEMPOOL,
+                 "Erased %d orphan tx included or conflicted by block\n",
+                 nErased);
+    }
+    return nErased;
+}
+
+unsigned int CTxOrphanPool::LimitOrphans(size_t nMaxOrphans,
+                                         size_t nMaxUsage) {
+    LOCK(cs);
+
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        // Sweep out expired orphan pool entries:
+        int nErased = 0;
+        int64_t nMinExpTime =
+            nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
+        OrphanMap::iterator iter = mapOrphans.begin();
+        while (iter != mapOrphans.end()) {
+            OrphanMap::iterator maybeErase = iter++;
+            if (maybeErase->second.nTimeExpire <= nNow) {
+                nErased += _EraseTx(maybeErase->first);
+            } else {
+                nMinExpTime =
+                    std::min(maybeErase->second.nTimeExpire, nMinExpTime);
+            }
+        }
+        // Sweep again 5 minutes after the next entry that expires in order to
+        // batch the linear scan.
+        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (nErased > 0) {
+            LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx due to expiration\n",
+                     nErased);
+        }
+    }
+
+    unsigned int nEvicted = 0;
+    while (mapOrphans.size() > nMaxOrphans || nTotalUsage > nMaxUsage) {
+        // Evict the most recent orphan of the peer using the most memory.
+        // Older orphans are more likely to be ancestors of the newer ones, so
+        // this keeps the chains we already have intact.
+        auto itHeaviest = mapPeers.begin();
+        for (auto it = mapPeers.begin(); it != mapPeers.end(); ++it) {
+            if (it->second.nUsage > itHeaviest->second.nUsage) {
+                itHeaviest = it;
+            }
+        }
+        assert(itHeaviest != mapPeers.end());
+        _EraseTx(itHeaviest->second.mapBySequence.rbegin()->second);
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+std::vector<std::pair<CTransactionRef, NodeId>>
+CTxOrphanPool::GetUnblockedBy(const CTransaction &tx) const {
+    LOCK(cs);
+
+    // Collect all descendants of tx in the pool.
+    std::vector<OrphanMap::const_iterator> vDescendants;
+    std::set<uint256> setDescendants;
+    std::deque<uint256> vWorkQueue;
+    vWorkQueue.push_back(tx.GetId());
+    while (!vWorkQueue.empty()) {
+        const uint256 txid = vWorkQueue.front();
+        vWorkQueue.pop_front();
+
+        // All outpoints of a transaction are adjacent in mapOrphansByPrev.
+        for (auto itByPrev = mapOrphansByPrev.lower_bound(COutPoint(txid, 0));
+             itByPrev != mapOrphansByPrev.end() &&
+             itByPrev->first.hash == txid;
+             ++itByPrev) {
+            for (const auto &mi : itByPrev->second) {
+                if (setDescendants.insert(mi->first).second) {
+                    vDescendants.push_back(mi);
+                    vWorkQueue.push_back(mi->first);
+                }
+            }
+        }
+    }
+
+    // Order them so that parents come before their children.
+    std::map<uint256, size_t> mapParentCount;
+    std::deque<OrphanMap::const_iterator> vReady;
+    for (const auto &it : vDescendants) {
+        std::set<uint256> setParents;
+        for (const CTxIn &txin : it->second.tx->vin) {
+            if (setDescendants.count(txin.prevout.hash)) {
+                setParents.insert(txin.prevout.hash);
+            }
+        }
+        mapParentCount[it->first] = setParents.size();
+        if (setParents.empty()) {
+            vReady.push_back(it);
+        }
+    }
+
+    std::vector<std::pair<CTransactionRef, NodeId>> vResult;
+    vResult.reserve(vDescendants.size());
+    while (!vReady.empty()) {
+        OrphanMap::const_iterator it = vReady.front();
+        vReady.pop_front();
+        vResult.emplace_back(it->second.tx, it->second.fromPeer);
+
+        const uint256 &txid = it->first;
+        std::set<uint256> setChildren;
+        for (auto itByPrev = mapOrphansByPrev.lower_bound(COutPoint(txid, 0));
+             itByPrev != mapOrphansByPrev.end() &&
+             itByPrev->first.hash == txid;
+             ++itByPrev) {
+            for (const auto &mi : itByPrev->second) {
+                if (setChildren.insert(mi->first).second &&
+                    --mapParentCount[mi->first] == 0) {
+                    vReady.push_back(mi);
+                }
+            }
+        }
+    }
+
+    return vResult;
+}
+
+void CTxOrphanPool::Clear() {
+    LOCK(cs);
+    mapOrphans.clear();
+    mapOrphansByPrev.clear();
+    mapPeers.clear();
+    nTotalUsage = 0;
+}
+
+size_t CTxOrphanPool::Size() const {
+    LOCK(cs);
+    return mapOrphans.size();
+}
+
+size_t CTxOrphanPool::GetUsage() const {
+    LOCK(cs);
+    return nTotalUsage;
+}
+
+std::map<NodeId, CTxOrphanPool::PeerStats>
+CTxOrphanPool::GetPeerStats() const {
+    LOCK(cs);
+
+    std::map<NodeId, PeerStats> mapStats;
+    for (const auto &entry : mapPeers) {
+        mapStats[entry.first] = PeerStats{entry.second.mapBySequence.size(),
+                                          entry.second.nUsage};
+    }
+    return mapStats;
+}
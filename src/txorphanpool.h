@@ -0,0 +1,131 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANPOOL_H
+#define BITCOIN_TXORPHANPOOL_H
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+class CBlock;
+
+/** Default for -maxorphantx, maximum number of orphan transactions kept in
+ * memory */
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 10000;
+/** Default for -maxorphanpoolsize, maximum memory used by orphan transactions
+ * in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_POOL_SIZE = 20;
+/** Default for -maxorphanpeersize, maximum memory used by the orphan
+ * transactions of a single peer in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_PEER_SIZE = 5;
+/** Expiration time for orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time between orphan transactions expire time checks in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+
+/**
+ * Transactions received from peers whose inputs are not all known yet.
+ *
+ * Orphans are indexed by the outpoints they spend, so that every orphan
+ * unblocked by a newly accepted transaction can be found in one call.
+ *
+ * Memory is accounted per peer. A peer cannot add orphans beyond its quota,
+ * and when the pool as a whole is over its limits the most recent orphans of
+ * the peer using the most memory are evicted first. This keeps a single peer
+ * from pushing everyone else's orphans out.
+ *
+ * The pool has its own lock and does not require cs_main. When both are
+ * needed, cs_main must be taken first.
+ */
+class CTxOrphanPool {
+public:
+    struct PeerStats {
+        size_t nCount;
+        size_t nUsage;
+    };
+
+private:
+    struct COrphanTx {
+        CTransactionRef tx;
+        NodeId fromPeer;
+        int64_t nTimeExpire;
+        size_t nUsage;
+        uint64_t nSequence;
+    };
+
+    typedef std::map<uint256, COrphanTx> OrphanMap;
+
+    struct IteratorComparator {
+        template <typename I> bool operator()(const I &a, const I &b) const {
+            return &(*a) < &(*b);
+        }
+    };
+
+    struct PeerOrphans {
+        size_t nUsage;
+        //! Orphans of this peer, oldest first.
+        std::map<uint64_t, uint256> mapBySequence;
+
+        PeerOrphans() : nUsage(0) {}
+    };
+
+    mutable CCriticalSection cs;
+    OrphanMap mapOrphans GUARDED_BY(cs);
+    std::map<COutPoint, std::set<OrphanMap::iterator, IteratorComparator>>
+        mapOrphansByPrev GUARDED_BY(cs);
+    std::map<NodeId, PeerOrphans> mapPeers GUARDED_BY(cs);
+    size_t nTotalUsage GUARDED_BY(cs);
+    uint64_t nLastSequence GUARDED_BY(cs);
+    int64_t nNextSweep GUARDED_BY(cs);
+
+    bool _EraseTx(const uint256 &txid) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+public:
+    CTxOrphanPool();
+
+    /**
+     * Add an orphan received from peer. Fails if it is already known, too
+     * large, or would take the peer over nMaxPeerUsage bytes.
+     */
+    bool AddTx(const CTransactionRef &tx, NodeId peer, size_t nMaxPeerUsage);
+    bool HaveTx(const uint256 &txid) const;
+    bool EraseTx(const uint256 &txid);
+    /** Erase all orphans received from peer. Returns the number erased. */
+    int EraseForPeer(NodeId peer);
+    /**
+     * Erase the orphans included in or conflicted by a block. Returns the
+     * number erased.
+     */
+    int EraseForBlock(const CBlock &block);
+    /**
+     * Expire old orphans, then evict until the pool holds at most nMaxOrphans
+     * transactions using at most nMaxUsage bytes. Returns the number evicted
+     * for being over the limits.
+     */
+    unsigned int LimitOrphans(size_t nMaxOrphans, size_t nMaxUsage);
+
+    /**
+     * All orphans that directly or indirectly spend outputs of tx, together
+     * with the peer they came from. Parents come before their children, so
+     * the result can be submitted to the mempool in order.
+     */
+    std::vector<std::pair<CTransactionRef, NodeId>>
+    GetUnblockedBy(const CTransaction &tx) const;
+
+    void Clear();
+    size_t Size() const;
+    size_t GetUsage() const;
+    std::map<NodeId, PeerStats> GetPeerStats() const;
+};
+
+#endif // BITCOIN_TXORPHANPOOL_H
@@ -196,6 +196,8 @@ static void FindFilesToPrune(std::set<int> &setFilesToPrune,
 static FILE *OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 static uint32_t GetBlockScriptFlags(const CBlockIndex *pindex,
                                     const Config &config);
+static void PrefillScriptCache(const std::vector<CTransactionRef> &vtx,
+                               uint32_t standardFlags, uint32_t blockFlags);
 
 static bool IsFinalTx(const CTransaction &tx, int nBlockHeight,
                       int64_t nBlockTime) {
@@ -598,6 +600,20 @@ bool IsDAAEnabled(const Config &config, const CBlockIndex *pindexPrev) {
     return IsDAAEnabled(config, pindexPrev->nHeight);
 }
 
+/**
+ * Script verification flags used to validate transactions entering the
+ * mempool.
+ */
+static uint32_t GetStandardScriptFlags(const Config &config) {
+    uint32_t flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!config.GetChainParams().RequireStandard()) {
+        flags = SCRIPT_ENABLE_SIGHASH_FORKID |
+                gArgs.GetArg("-promiscuousmempoolflags", flags);
+    }
+
+    return flags;
+}
+
 /**
  * Make mempool consistent after a reorg, by re-adding or recursively erasing
  * disconnected block transactions from the mempool, and also removing any other
@@ -622,6 +638,17 @@ void UpdateMempoolForReorg(const Config &config,
     // Iterate disconnectpool in reverse, so that we add transactions back to
     // the mempool starting with the earliest transaction that had been
     // previously seen in a block.
+    if (fAddToMempool) {
+        // This order is topological, so the scripts of the whole pool can be
+        // verified in parallel up front rather than one transaction at a time
+        // by AcceptToMemoryPool.
+        std::vector<CTransactionRef> vtx(
+            disconnectpool.queuedTx.get<insertion_order>().rbegin(),
+            disconnectpool.queuedTx.get<insertion_order>().rend());
+        PrefillScriptCache(vtx, GetStandardScriptFlags(config),
+                           GetBlockScriptFlags(chainActive.Tip(), config));
+    }
+
     auto it = disconnectpool.queuedTx.get<insertion_order>().rbegin();
     while (it != disconnectpool.queuedTx.get<insertion_order>().rend()) {
         // ignore validation errors in resurrected transactions
@@ -926,6 +953,20 @@ static bool AcceptToMemoryPoolWorker(
                                  strprintf("%d > %d", nFees, nAbsurdFee));
         }
 
+        // Check the cluster this transaction would join first: it contains all
+        // ancestors and their descendants, so it bounds the work below.
+        size_t nLimitClusterCount =
+            gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+        size_t nLimitClusterSize =
+            gArgs.GetArg("-limitclustersize", DEFAULT_CLUSTER_SIZE_LIMIT) *
+            1000;
+        std::string errString;
+        if (!pool.CheckClusterLimits(entry, nLimitClusterCount,
+                                     nLimitClusterSize, errString)) {
+            return state.DoS(0, false, REJECT_NONSTANDARD,
+                             "too-large-mempool-cluster", false, errString);
+        }
+
         // Calculate in-mempool ancestors, up to a limit.
         CTxMemPool::setEntries setAncestors;
         size_t nLimitAncestors =
@@ -939,7 +980,6 @@ static bool AcceptToMemoryPoolWorker(
             gArgs.GetArg("-limitdescendantsize",
                          DEFAULT_DESCENDANT_SIZE_LIMIT) *
             1000;
-        std::string errString;
         if (!pool.CalculateMemPoolAncestors(
                 entry, setAncestors, nLimitAncestors, nLimitAncestorSize,
                 nLimitDescendants, nLimitDescendantSize, errString)) {
@@ -947,12 +987,7 @@ static bool AcceptToMemoryPoolWorker(
                              "too-long-mempool-chain", false, errString);
         }
 
-        uint32_t scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!config.GetChainParams().RequireStandard()) {
-            scriptVerifyFlags =
-                SCRIPT_ENABLE_SIGHASH_FORKID |
-                gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
-        }
+        uint32_t scriptVerifyFlags = GetStandardScriptFlags(config);
 
         // Check against previous transactions. This is done last to help
         // prevent CPU exhaustion denial-of-service attacks.
@@ -1781,6 +1816,78 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Number of transactions whose script checks are queued together. */
+static const size_t PREFILL_SCRIPT_CACHE_BATCH_SIZE = 1000;
+
+/**
+ * Run the script checks for transactions that are about to be submitted to
+ * the mempool on the script check threads, and record the ones that pass in
+ * the script execution cache. The AcceptToMemoryPool calls that follow then
+ * only need to perform the cheap checks.
+ *
+ * vtx must be in topological order. Transactions whose inputs can't be found
+ * are left for AcceptToMemoryPool to reject, as are all transactions of a
+ * batch that contains an invalid script.
+ */
+static void PrefillScriptCache(const std::vector<CTransactionRef> &vtx,
+                               uint32_t standardFlags, uint32_t blockFlags) {
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads == 0) {
+        return;
+    }
+
+    LOCK(mempool.cs);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+    CCoinsViewCache view(&viewMemPool);
+
+    std::vector<uint256> vKeys;
+    std::vector<CScriptCheck> vChecks;
+    auto it = vtx.begin();
+    while (it != vtx.end()) {
+        vKeys.clear();
+
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        for (size_t n = 0;
+             it != vtx.end() && n < PREFILL_SCRIPT_CACHE_BATCH_SIZE;
+             ++it, ++n) {
+            const CTransaction &tx = **it;
+            if (tx.IsCoinBase()) {
+                continue;
+            }
+
+            PrecomputedTransactionData txdata(tx);
+            bool fOk = true;
+            for (uint32_t flags : {standardFlags, blockFlags}) {
+                CValidationState state;
+                vChecks.clear();
+                if (!CheckInputs(tx, state, view, true, flags, true, true,
+                                 txdata, &vChecks)) {
+                    fOk = false;
+                    break;
+                }
+
+                control.Add(vChecks);
+                vKeys.push_back(GetScriptCacheKey(tx, flags));
+            }
+
+            if (fOk) {
+                // Later transactions may spend these outputs.
+                AddCoins(view, tx, MEMPOOL_HEIGHT);
+            }
+        }
+
+        if (!control.Wait()) {
+            // Some script in the batch is invalid. AcceptToMemoryPool will find
+            // out which one.
+            continue;
+        }
+
+        for (const uint256 &key : vKeys) {
+            AddKeyInScriptCache(key);
+        }
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -3101,9 +3208,9 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-static CBlockIndex *AddToBlockIndex(const CBlockHeader &block) {
+static CBlockIndex *AddToBlockIndex(const CBlockHeader &block,
+                                   const uint256 &hash) {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end()) return it->second;
 
@@ -3141,6 +3248,10 @@ static CBlockIndex *AddToBlockIndex(const CBlockHeader &block) {
     return pindexNew;
 }
 
+static CBlockIndex *AddToBlockIndex(const CBlockHeader &block) {
+    return AddToBlockIndex(block, block.GetHash());
+}
+
 /**
  * Mark a block as having its data received and checked (up to
  * BLOCK_VALID_TRANSACTIONS).
@@ -3596,13 +3707,17 @@ static bool ContextualCheckBlock(const Config &config, const CBlock &block,
     return true;
 }
 
+/**
+ * Accept a header whose hash is known already. If fCheckedPOW is set, its proof
+ * of work was checked by the caller.
+ */
 static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
+                              const uint256 &hash, bool fCheckedPOW,
                               CValidationState &state, CBlockIndex **ppindex) {
     AssertLockHeld(cs_main);
     const CChainParams &chainparams = config.GetChainParams();
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3620,7 +3735,7 @@ static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
             return true;
         }
 
-        if (!CheckBlockHeader(config, block, state)) {
+        if (!CheckBlockHeader(config, block, state, !fCheckedPOW)) {
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__,
                          hash.ToString(), FormatStateMessage(state));
         }
@@ -3655,7 +3770,7 @@ static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
     }
 
     if (pindex == nullptr) {
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
     }
 
     if (ppindex) {
@@ -3667,17 +3782,119 @@ static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
     return true;
 }
 
+static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
+                              CValidationState &state, CBlockIndex **ppindex) {
+    return AcceptBlockHeader(config, block, block.GetHash(), false, state,
+                             ppindex);
+}
+
+/**
+ * Closure hashing a range of a batch of headers and checking their proof of
+ * work. The results are stored in the batch, so that the first header with an
+ * invalid proof of work can be found, and the check itself always succeeds.
+ */
+class CHeaderCheck {
+private:
+    const Config *config;
+    const std::vector<CBlockHeader> *headers;
+    std::vector<uint256> *hashes;
+    std::vector<char> *vValid;
+    size_t nBegin;
+    size_t nEnd;
+
+public:
+    CHeaderCheck()
+        : config(nullptr), headers(nullptr), hashes(nullptr), vValid(nullptr),
+          nBegin(0), nEnd(0) {}
+    CHeaderCheck(const Config &configIn,
+                 const std::vector<CBlockHeader> &headersIn,
+                 std::vector<uint256> &hashesIn, std::vector<char> &vValidIn,
+                 size_t nBeginIn, size_t nEndIn)
+        : config(&configIn), headers(&headersIn), hashes(&hashesIn),
+          vValid(&vValidIn), nBegin(nBeginIn), nEnd(nEndIn) {}
+
+    bool operator()() {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            (*hashes)[i] = (*headers)[i].GetHash();
+            (*vValid)[i] =
+                CheckProofOfWork((*hashes)[i], (*headers)[i].nBits, *config);
+        }
+        return true;
+    }
+
+    void swap(CHeaderCheck &check) {
+        std::swap(config, check.config);
+        std::swap(headers, check.headers);
+        std::swap(hashes, check.hashes);
+        std::swap(vValid, check.vValid);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+    }
+};
+
+/**
+ * Headers are checked without cs_main, so they can't share the script check
+ * queue, which ConnectBlock may be using meanwhile. Each check covers at least
+ * MIN_HEADERS_PER_CHECK_THREAD headers, so workers take them one at a time.
+ */
+static CCheckQueue<CHeaderCheck> headercheckqueue(1);
+//! Only one batch of headers can be checked on the queue at a time.
+static CCriticalSection cs_headercheckqueue;
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Compute the hashes of a batch of headers and check their proof of work,
+ * spread over as many threads as script verification uses. Returns the number
+ * of leading headers with valid proof of work.
+ */
+static size_t CheckHeadersProofOfWork(const Config &config,
+                                      const std::vector<CBlockHeader> &headers,
+                                      std::vector<uint256> &hashes) {
+    hashes.resize(headers.size());
+    // Not a vector<bool>, as it is written to concurrently.
+    std::vector<char> vValid(headers.size());
+
+    size_t nWorkers = std::min(std::max<size_t>(nScriptCheckThreads, 1),
+                               headers.size() / MIN_HEADERS_PER_CHECK_THREAD);
+    if (nWorkers <= 1) {
+        CHeaderCheck(config, headers, hashes, vValid, 0, headers.size())();
+    } else {
+        size_t nChunk = (headers.size() + nWorkers - 1) / nWorkers;
+        std::vector<CHeaderCheck> vChecks;
+        for (size_t nBegin = 0; nBegin < headers.size(); nBegin += nChunk) {
+            vChecks.emplace_back(config, headers, hashes, vValid, nBegin,
+                                 std::min(nBegin + nChunk, headers.size()));
+        }
+        LOCK(cs_headercheckqueue);
+        CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    return std::find(vValid.begin(), vValid.end(), false) - vValid.begin();
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const Config &config,
                             const std::vector<CBlockHeader> &headers,
                             CValidationState &state,
                             const CBlockIndex **ppindex) {
+    // Hash the headers and check their proof of work before taking cs_main.
+    // AcceptBlockHeader checks the first header which fails again, to report
+    // the failure.
+    std::vector<uint256> hashes;
+    size_t nCheckedPOW = CheckHeadersProofOfWork(config, headers, hashes);
     {
         LOCK(cs_main);
-        for (const CBlockHeader &header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
             // Use a temp pindex instead of ppindex to avoid a const_cast
             CBlockIndex *pindex = nullptr;
-            if (!AcceptBlockHeader(config, header, state, &pindex)) {
+            if (!AcceptBlockHeader(config, headers[i], hashes[i],
+                                   i < nCheckedPOW, state, &pindex)) {
                 return false;
             }
             if (ppindex) {
@@ -5169,6 +5386,16 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params &params,
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
 
+/** Number of snapshot entries whose scripts are verified together. */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 1000;
+
+namespace {
+struct MempoolSnapshotEntry {
+    CTransactionRef tx;
+    int64_t nTime;
+};
+} // namespace
+
 bool LoadMempool(const Config &config) {
     int64_t nExpiryTimeout =
         gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
@@ -5191,36 +5418,69 @@ bool LoadMempool(const Config &config) {
         if (version != MEMPOOL_DUMP_VERSION) {
             return false;
         }
+
+        uint32_t standardFlags, blockFlags;
+        {
+            LOCK(cs_main);
+            standardFlags = GetStandardScriptFlags(config);
+            blockFlags = GetBlockScriptFlags(chainActive.Tip(), config);
+        }
+
         uint64_t num;
         file >> num;
         double prioritydummy = 0;
+        std::vector<MempoolSnapshotEntry> vBatch;
+        vBatch.reserve(std::min<uint64_t>(num, MEMPOOL_LOAD_BATCH_SIZE));
         while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
+            MempoolSnapshotEntry entry;
             int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
+            file >> entry.tx;
+            file >> entry.nTime;
             file >> nFeeDelta;
 
             Amount amountdelta(nFeeDelta);
             if (amountdelta != Amount(0)) {
-                mempool.PrioritiseTransaction(tx->GetId(),
-                                              tx->GetId().ToString(),
+                mempool.PrioritiseTransaction(entry.tx->GetId(),
+                                              entry.tx->GetId().ToString(),
                                               prioritydummy, amountdelta);
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
+
+            if (entry.nTime + nExpiryTimeout > nNow) {
+                vBatch.push_back(std::move(entry));
+            } else {
+                ++skipped;
+            }
+
+            if (vBatch.size() < MEMPOOL_LOAD_BATCH_SIZE && num > 0) {
+                continue;
+            }
+
+            // The snapshot is not trusted: the scripts of every batch are
+            // executed on the script check threads before the entries go
+            // through AcceptToMemoryPool.
+            {
+                std::vector<CTransactionRef> vtx;
+                vtx.reserve(vBatch.size());
+                for (const MempoolSnapshotEntry &e : vBatch) {
+                    vtx.push_back(e.tx);
+                }
+                LOCK(cs_main);
+                PrefillScriptCache(vtx, standardFlags, blockFlags);
+            }
+
+            for (const MempoolSnapshotEntry &e : vBatch) {
+                CValidationState state;
                 LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(config, mempool, state, tx, true,
-                                           nullptr, nTime);
+                AcceptToMemoryPoolWithTime(config, mempool, state, e.tx, true,
+                                           nullptr, e.nTime);
                 if (state.IsValid()) {
                     ++count;
                 } else {
                     ++failed;
                 }
-            } else {
-                ++skipped;
             }
+            vBatch.clear();
+
             if (ShutdownRequested()) return false;
         }
         std::map<uint256, Amount> mapDeltas;
@@ -5291,6 +5551,130 @@ void DumpMempool(void) {
     }
 }
 
+/**
+ * The saved script execution cache entries vouch for the verdicts of this
+ * binary, so the file also records the client version which wrote it, and is
+ * discarded by any other one.
+ */
+static const uint64_t VALIDATION_CACHE_DUMP_VERSION = 2;
+
+/**
+ * Salt the nonces of the signature and script execution cache entries are
+ * derived from. It is kept with the saved entries, so they remain valid across
+ * restarts, and is null until LoadValidationCaches is called.
+ */
+static uint256 validationCacheSalt;
+
+static bool ReadValidationCaches(uint256 &salt,
+                                 std::vector<uint256> &vSigEntries,
+                                 std::vector<uint256> &vScriptEntries) {
+    FILE *filestr =
+        fsbridge::fopen(GetDataDir() / "validationcache.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open validation cache file from disk. Continuing "
+                  "anyway.\n");
+        return false;
+    }
+
+    try {
+        CHashVerifier<CAutoFile> verifier(&file);
+        uint64_t version;
+        verifier >> version;
+        if (version != VALIDATION_CACHE_DUMP_VERSION) {
+            return false;
+        }
+        int nClientVersion;
+        verifier >> nClientVersion;
+        if (nClientVersion != CLIENT_VERSION) {
+            LogPrintf("Validation cache file was written by client version "
+                      "%d. Continuing anyway.\n",
+                      nClientVersion);
+            return false;
+        }
+        verifier >> salt >> vSigEntries >> vScriptEntries;
+        uint256 hashChecksum;
+        file >> hashChecksum;
+        if (hashChecksum != verifier.GetHash()) {
+            LogPrintf("Checksum mismatch in validation cache file. Continuing "
+                      "anyway.\n");
+            return false;
+        }
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to deserialize validation cache data on disk: %s. "
+                  "Continuing anyway.\n",
+                  e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadValidationCaches() {
+    int64_t start = GetTimeMicros();
+    uint256 salt;
+    std::vector<uint256> vSigEntries, vScriptEntries;
+    bool fLoaded = ReadValidationCaches(salt, vSigEntries, vScriptEntries);
+    if (!fLoaded) {
+        // The entries of a fresh salt are unrelated to any previous run.
+        salt = GetRandHash();
+        vSigEntries.clear();
+        vScriptEntries.clear();
+    }
+
+    validationCacheSalt = salt;
+    SetSignatureCacheSalt(salt);
+    SetScriptCacheSalt(salt);
+    AddSignatureCacheEntries(vSigEntries);
+    AddScriptCacheEntries(vScriptEntries);
+    if (fLoaded) {
+        LogPrintf("Imported %u signature and %u script cache entries from "
+                  "disk: %gs\n",
+                  vSigEntries.size(), vScriptEntries.size(),
+                  (GetTimeMicros() - start) * 0.000001);
+    }
+    return fLoaded;
+}
+
+void DumpValidationCaches() {
+    if (validationCacheSalt.IsNull()) {
+        // The entries were not derived from a salt that could be saved.
+        return;
+    }
+
+    int64_t start = GetTimeMicros();
+    std::vector<uint256> vSigEntries = GetSignatureCacheEntries();
+    std::vector<uint256> vScriptEntries = GetScriptCacheEntries();
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE *filestr =
+            fsbridge::fopen(GetDataDir() / "validationcache.dat.new", "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        hasher << VALIDATION_CACHE_DUMP_VERSION << CLIENT_VERSION
+               << validationCacheSalt << vSigEntries << vScriptEntries;
+        file << VALIDATION_CACHE_DUMP_VERSION << CLIENT_VERSION
+             << validationCacheSalt << vSigEntries << vScriptEntries
+             << hasher.GetHash();
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "validationcache.dat.new",
+                   GetDataDir() / "validationcache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped %u signature and %u script cache entries: %gs to "
+                  "copy, %gs to dump\n",
+                  vSigEntries.size(), vScriptEntries.size(),
+                  (mid - start) * 0.000001, (last - mid) * 0.000001);
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to dump validation caches: %s. Continuing anyway.\n",
+                  e.what());
+    }
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData &data, CBlockIndex *pindex) {
     if (pindex == nullptr) return 0.0;
@@ -74,6 +74,12 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool
  * descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a cluster of
+ * connected in-mempool transactions */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 1000;
+/** Default for -limitclustersize, maximum kilobytes of a cluster of connected
+ * in-mempool transactions */
+static const unsigned int DEFAULT_CLUSTER_SIZE_LIMIT = 1010;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in
  * hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
@@ -91,9 +97,22 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer.
- */
+/** Number of blocks that can be requested at any given time from a single peer
+ * whose download rate we haven't measured yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks in flight from a single peer once its
+ * download rate is known. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** How long (in microseconds) the blocks in flight from a peer should keep it
+ * busy at its measured download rate, on top of its round trip time. */
+static const int64_t BLOCK_DOWNLOAD_TARGET_TIME = 4000000;
+/** A block holding back the download window is requested from a faster peer
+ * once it has been in flight this many times longer than that peer is expected
+ * to take to deliver it... */
+static const int BLOCK_REASSIGN_FACTOR = 4;
+/** ...but never earlier than this (in microseconds). */
+static const int64_t BLOCK_REASSIGN_MIN_TIME = 1000000;
 /** Timeout in seconds during which a peer must stall block download progress
  * before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
@@ -102,6 +121,17 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
  *  less than this number, we reached its tip. Changing this value is a protocol
  * upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Proof of work of a batch of headers is checked on several threads only if
+ * each thread gets at least this many headers. */
+static const size_t MIN_HEADERS_PER_CHECK_THREAD = 250;
+/** Maximum number of peers we download headers from at the same time while
+ * the best header we know is old. getheaders can only continue from a known
+ * hash, so the headers cannot be split into disjoint ranges across peers:
+ * each extra sync peer would send the same headers again, for as much more
+ * bandwidth and cs_main time, only to make header sync run at the pace of the
+ * fastest peer. Keep a single one until ranges can be split, e.g. from
+ * checkpoints or the assumed valid block. */
+static const int MAX_HEADERS_SYNC_PEERS = 1;
 /** Maximum depth of blocks we're willing to serve as compact blocks to peers
  *  when requested. For older blocks, a regular BLOCK response will be sent. */
 static const int MAX_CMPCTBLOCK_DEPTH = 5;
@@ -111,8 +141,9 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Size of the "block download window": how far ahead of our current height do
  * we fetch ? Larger windows tolerate larger download speed differences between
  * peer, but increase the potential degree of disordering of blocks on disk
- * (which make reindexing and in the future perhaps pruning harder). We'll
- * probably want to make this a per-peer adaptive value at some point. */
+ * (which make reindexing and in the future perhaps pruning harder). Slow peers
+ * holding back the window have their blocks requested again from faster ones,
+ * see BLOCK_REASSIGN_FACTOR. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
@@ -299,6 +330,8 @@ void LoadChainTip(const CChainParams &chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof of work checking thread */
+void ThreadHeaderCheck();
 /** Check whether we are doing an initial block download (synchronizing from
  * disk or network) */
 bool IsInitialBlockDownload();
@@ -650,4 +683,14 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool(const Config &config);
 
+/** Dump the signature and script execution caches to disk. */
+void DumpValidationCaches();
+
+/**
+ * Load the signature and script execution caches from disk, or pick a fresh
+ * salt for them if there is no usable file. Must be called before the caches
+ * are used.
+ */
+bool LoadValidationCaches();
+
 #endif // BITCOIN_VALIDATION_H
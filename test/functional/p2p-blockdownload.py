@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+""" BlockDownloadTest -- test parallel block download during IBD.
+
+A node in IBD is connected to two peers which both announce the headers of a
+chain longer than the block download window.
+
+1. The slow peer is asked for as many blocks as are allowed in flight from a
+   peer whose download rate isn't known yet, and never delivers them.
+
+2. The fast peer delivers every block it is asked for, until the blocks in
+   flight from the slow peer hold back the download window. Rather than
+   stalling, the node then asks the fast peer for those blocks as well, and
+   syncs the whole chain while the slow peer stays connected.
+"""
+
+from test_framework.blocktools import create_block, create_coinbase
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16
+MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2
+MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64
+BLOCK_DOWNLOAD_WINDOW = 1024
+
+
+class TestNode(NodeConnCB):
+    def __init__(self, blocks=None):
+        super().__init__()
+        # Blocks to deliver when asked, none for a slow peer.
+        self.blocks = blocks if blocks is not None else {}
+        self.requested = []
+
+    def on_getdata(self, conn, message):
+        for inv in message.inv:
+            if inv.type != 2:
+                continue
+            self.requested.append(inv.hash)
+            if inv.hash in self.blocks:
+                conn.send_message(msg_block(self.blocks[inv.hash]))
+
+    def send_headers(self, blocks):
+        headers = msg_headers()
+        headers.headers = [CBlockHeader(b) for b in blocks]
+        self.send_and_ping(headers)
+
+
+class BlockDownloadTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def get_peer_info(self, index):
+        # Peers are listed in connection order.
+        return self.nodes[0].getpeerinfo()[index]
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        # Build a chain longer than the window. Old timestamps keep
+        # the node in IBD.
+        tip = int(node.getbestblockhash(), 16)
+        block_time = node.getblock(node.getbestblockhash())['time'] + 1
+        blocks = []
+        for height in range(1, BLOCK_DOWNLOAD_WINDOW + 50):
+            block = create_block(tip, create_coinbase(height), block_time)
+            block.solve()
+            blocks.append(block)
+            tip = block.sha256
+            block_time += 1
+
+        slow = TestNode()
+        fast = TestNode({b.sha256: b for b in blocks})
+        connections = []
+        for peer in [slow, fast]:
+            connections.append(
+                NodeConn('127.0.0.1', p2p_port(0), node, peer))
+            peer.add_connection(connections[-1])
+
+        NetworkThread().start()  # Start up network handling in another thread
+
+        slow.wait_for_verack()
+        fast.wait_for_verack()
+
+        # 1. A peer with an unknown download rate gets the default limit.
+        slow.send_headers(blocks)
+        wait_until(lambda: len(slow.requested) ==
+                   MAX_BLOCKS_IN_TRANSIT_PER_PEER, timeout=30,
+                   lock=mininode_lock)
+        slow_info = self.get_peer_info(0)
+        assert_equal(slow_info['inflight_limit'],
+                     MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+        assert_equal(len(slow_info['inflight']),
+                     MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+        slow_requested = list(slow.requested)
+        assert_equal(slow_requested,
+                     [b.sha256 for b in blocks[:MAX_BLOCKS_IN_TRANSIT_PER_PEER]])
+        self.log.info("Slow peer was asked for %d blocks" %
+                      MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+
+        # 2. The blocks holding back the window are reassigned to the fast
+        # peer, and the whole chain is downloaded from it.
+        fast.send_headers(blocks)
+        wait_until(lambda: node.getblockcount() == len(blocks), timeout=60)
+        with mininode_lock:
+            for blockhash in slow_requested:
+                assert(blockhash in fast.requested)
+            assert_equal(slow.requested, slow_requested)
+        assert(slow.connected)
+
+        # The limit of the fast peer follows its measured download rate.
+        fast_info = self.get_peer_info(1)
+        assert(MIN_BLOCKS_IN_TRANSIT_PER_PEER <= fast_info['inflight_limit'] <=
+               MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER)
+        self.log.info("Blocks in flight from the slow peer were reassigned")
+
+
+if __name__ == '__main__':
+    BlockDownloadTest().main()
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+""" FastBlockRelayTest -- test -fastblockrelay announcements.
+
+Node0 runs with -fastblockrelay, node1 without it. Each node has a sender,
+which feeds it headers and blocks, and a listener, which asked for
+high-bandwidth compact block announcements.
+
+1. Leave IBD with one block on top of genesis on each node.
+
+2. Send the header, then the block, of a height 2 block whose parent is a fork
+   of the tip. No listener is sent a compact block for it, as its parent is
+   not the tip.
+
+3. Send the header, then the block, of a height 2 block on top of the tip
+   which passes CheckBlock but contains a non-final transaction. The listener
+   of node0 is sent a compact block for it before it is rejected by full
+   validation, the listener of node1 isn't.
+"""
+
+from test_framework.blocktools import create_block, create_coinbase
+from test_framework.mininode import *
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+# Announcing blocks which may turn out to be invalid is only done to peers
+# which won't ban us for it.
+INVALID_CB_NO_BAN_VERSION = 70015
+
+
+class TestNode(NodeConnCB):
+    def received_cmpctblock(self):
+        with mininode_lock:
+            return "cmpctblock" in self.last_message
+
+    def wait_for_cmpctblock(self, blockhash, timeout=60):
+        def test_function():
+            if "cmpctblock" not in self.last_message:
+                return False
+            header = self.last_message["cmpctblock"].header_and_shortids.header
+            header.calc_sha256()
+            return header.sha256 == blockhash
+        wait_until(test_function, timeout=timeout, lock=mininode_lock)
+
+
+class FastBlockRelayTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-fastblockrelay"], []]
+
+    def setup_network(self):
+        # The nodes must not relay blocks to each other.
+        self.setup_nodes()
+
+    def connect_listener(self, node_index, listener):
+        conn = NodeConn('127.0.0.1', p2p_port(node_index),
+                        self.nodes[node_index], listener, send_version=False)
+        version = msg_version()
+        version.nVersion = INVALID_CB_NO_BAN_VERSION
+        version.addrTo.ip = conn.dstaddr
+        version.addrTo.port = conn.dstport
+        version.addrFrom.ip = "0.0.0.0"
+        version.addrFrom.port = 0
+        conn.send_message(version, True)
+        listener.add_connection(conn)
+        return conn
+
+    def send_headers(self, conn, blocks):
+        headers = msg_headers()
+        headers.headers = [CBlockHeader(b) for b in blocks]
+        conn.send_and_ping(headers)
+
+    def send_header_and_block(self, sender, block):
+        self.send_headers(sender, [block])
+        sender.send_and_ping(msg_block(block))
+
+    def run_test(self):
+        senders = [NodeConnCB(), NodeConnCB()]
+        listeners = [TestNode(), TestNode()]
+        connections = []
+        for i in range(self.num_nodes):
+            connections.append(
+                NodeConn('127.0.0.1', p2p_port(i), self.nodes[i], senders[i]))
+            senders[i].add_connection(connections[-1])
+            connections.append(self.connect_listener(i, listeners[i]))
+
+        NetworkThread().start()  # Start up network handling in another thread
+
+        for x in senders + listeners:
+            x.wait_for_verack()
+
+        genesis = int(self.nodes[0].getbestblockhash(), 16)
+        block_time = int(time.time())
+
+        # 1. Leave IBD.
+        tip = create_block(genesis, create_coinbase(1), block_time)
+        tip.solve()
+        for i in range(self.num_nodes):
+            senders[i].send_and_ping(msg_block(tip))
+            assert_equal(self.nodes[i].getbestblockhash(), tip.hash)
+
+            # Let the node know the listener has the tip, and ask for
+            # high-bandwidth compact block announcements.
+            self.send_headers(listeners[i], [tip])
+            sendcmpct = msg_sendcmpct()
+            sendcmpct.announce = True
+            sendcmpct.version = 1
+            listeners[i].send_and_ping(sendcmpct)
+        self.log.info("Nodes left IBD")
+
+        # 2. A block whose parent is not the tip is not announced.
+        fork = create_block(genesis, create_coinbase(1), block_time + 1)
+        fork.solve()
+        fork_child = create_block(
+            fork.sha256, create_coinbase(2), block_time + 2)
+        fork_child.solve()
+        for i in range(self.num_nodes):
+            self.send_headers(senders[i], [fork, fork_child])
+            senders[i].send_and_ping(msg_block(fork_child))
+            listeners[i].sync_with_ping()
+            assert(not listeners[i].received_cmpctblock())
+            assert_equal(self.nodes[i].getbestblockhash(), tip.hash)
+        self.log.info("Block on a fork of the tip was not announced")
+
+        # 3. A block on the tip is announced by node0 before full validation.
+        nonfinal = CTransaction()
+        nonfinal.vin.append(CTxIn(COutPoint(tip.vtx[0].sha256, 0), b"", 0))
+        nonfinal.vout.append(CTxOut(1, CScript([OP_TRUE])))
+        nonfinal.nLockTime = 1000
+        nonfinal.rehash()
+        invalid = create_block(tip.sha256, create_coinbase(2), block_time + 3)
+        invalid.vtx.append(nonfinal)
+        invalid.hashMerkleRoot = invalid.calc_merkle_root()
+        invalid.solve()
+        for i in range(self.num_nodes):
+            self.send_header_and_block(senders[i], invalid)
+            assert_equal(self.nodes[i].getbestblockhash(), tip.hash)
+            invalid_tips = [x for x in self.nodes[i].getchaintips()
+                            if x['hash'] == invalid.hash]
+            assert_equal(invalid_tips[0]['status'], "invalid")
+
+        listeners[0].wait_for_cmpctblock(invalid.sha256)
+        listeners[1].sync_with_ping()
+        assert(not listeners[1].received_cmpctblock())
+        self.log.info("Block was announced before full validation")
+
+
+if __name__ == '__main__':
+    FastBlockRelayTest().main()
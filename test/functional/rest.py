@@ -8,6 +8,7 @@
 #
 
 
+from test_framework.mininode import CBlockHeader, CTransaction, deser_compact_size
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import *
 from struct import *
@@ -25,6 +26,39 @@ def deser_uint256(f):
         r += t << (i * 32)
     return r
 
+def deser_varint(f):
+    n = 0
+    while True:
+        ch = f.read(1)[0]
+        n = (n << 7) | (ch & 0x7f)
+        if ch & 0x80:
+            n += 1
+        else:
+            return n
+
+
+def deser_blocktemplate(f):
+    tmpl = {}
+    tmpl['templateid'] = deser_uint256(f)
+    tmpl['basetemplateid'] = deser_uint256(f)
+    tmpl['header'] = CBlockHeader()
+    tmpl['header'].deserialize(f)
+    tmpl['height'], tmpl['coinbasevalue'], tmpl['mintime'] = unpack(
+        b"<iqq", f.read(20))
+    tmpl['sizelimit'], tmpl['sigoplimit'] = unpack(b"<QQ", f.read(16))
+    tmpl['transactions'] = []
+    for i in range(deser_compact_size(f)):
+        ref = deser_varint(f)
+        if ref != 0:
+            tmpl['transactions'].append(ref)
+            continue
+        tx = CTransaction()
+        tx.deserialize(f)
+        tx.rehash()
+        fee, sigops = unpack(b"<qq", f.read(16))
+        tmpl['transactions'].append((tx.hash, fee, sigops))
+    return tmpl
+
 # allows simple http get calls
 
 
@@ -360,6 +394,39 @@ class RESTTest (BitcoinTestFramework):
         for tx in txs:
             assert_equal(tx in json_obj, True)
 
+        # check the binary block template contains the transactions in full
+        response = http_get_call(
+            url.hostname, url.port, '/rest/blocktemplate' + self.FORMAT_SEPARATOR + 'bin', True)
+        assert_equal(response.status, 200)
+        tmpl = deser_blocktemplate(BytesIO(response.read()))
+        assert_equal(tmpl['basetemplateid'], 0)
+        assert_equal(tmpl['header'].hashPrevBlock,
+                     int(self.nodes[0].getbestblockhash(), 16))
+        assert_equal(tmpl['height'], self.nodes[0].getblockcount() + 1)
+        assert_equal(sorted(tx[0] for tx in tmpl['transactions']), sorted(txs))
+
+        # a delta against that template only references its transactions
+        response = http_get_call(
+            url.hostname, url.port, '/rest/blocktemplate/%064x' % tmpl['templateid'] + self.FORMAT_SEPARATOR + 'bin', True)
+        assert_equal(response.status, 200)
+        delta = deser_blocktemplate(BytesIO(response.read()))
+        assert_equal(delta['templateid'], tmpl['templateid'])
+        assert_equal(delta['basetemplateid'], tmpl['templateid'])
+        assert_equal(sorted(delta['transactions']), [1, 2, 3])
+
+        # an unknown base template yields a full template
+        response = http_get_call(
+            url.hostname, url.port, '/rest/blocktemplate/' + '11' * 32 + self.FORMAT_SEPARATOR + 'bin', True)
+        assert_equal(response.status, 200)
+        tmpl = deser_blocktemplate(BytesIO(response.read()))
+        assert_equal(tmpl['basetemplateid'], 0)
+        assert_equal(len(tmpl['transactions']), 3)
+
+        # json is not supported for block templates
+        response = http_get_call(
+            url.hostname, url.port, '/rest/blocktemplate' + self.FORMAT_SEPARATOR + 'json', True)
+        assert_equal(response.status, 404)
+
         # now mine the transactions
         newblockhash = self.nodes[1].generate(1)
         self.sync_all()
@@ -100,6 +100,8 @@ BASE_SCRIPTS = [
     'net.py',
     'keypool.py',
     'p2p-mempool.py',
+    'p2p-fastblockrelay.py',
+    'p2p-blockdownload.py',
     'prioritise_transaction.py',
     'high_priority_transaction.py',
     'invalidblockrequest.py',